@@ -181,15 +181,15 @@ void CModuleManager::LoadModules()
 	RegisterModule(pThreadPoolFixModule);
 	RegisterModule(pStringTableModule);
 	RegisterModule(pPrecacheFixModule);
-	RegisterModule(pPVSModule);
+	RegisterModule2(pPVSModule);
 	RegisterModule(pSurfFixModule);
-	RegisterModule(pFileSystemModule);
+	RegisterModule2(pFileSystemModule);
 	RegisterModule(pUtilModule);
 	RegisterModule(pConCommandModule);
 	RegisterModule(pVProfModule);
 	RegisterModule(pCVarsModule);
 	RegisterModule(pBitBufModule);
-	RegisterModule(pNetworkingModule);
+	RegisterModule2(pNetworkingModule);
 	RegisterModule(pSteamWorksModule);
 	RegisterModule(pPASModule);
 	RegisterModule(pBassModule);
@@ -197,15 +197,27 @@ void CModuleManager::LoadModules()
 	RegisterModule(pVoiceChatModule);
 	RegisterModule(pPhysEnvModule);
 	RegisterModule(pNetModule);
-	RegisterModule(pEntListModule);
+	RegisterModule2(pEntListModule);
 }
 
 int g_pIDs = 0;
 void CModuleManager::RegisterModule(IModule* pModule)
 {
-	++g_pIDs;
 	CModule* module = new CModule();
 	module->SetModule(pModule);
+	AddModule(module);
+}
+
+void CModuleManager::RegisterModule2(IModule2* pModule)
+{
+	CModule* module = new CModule();
+	module->SetModule2(pModule);
+	AddModule(module);
+}
+
+void CModuleManager::AddModule(CModule* module)
+{
+	++g_pIDs;
 	module->SetID(g_pIDs);
 	Msg("holylib: Registered module %-*s (%-*i Enabled: %s Compatible: %s)\n", 
 		15,
@@ -329,6 +341,17 @@ void CModuleManager::OnEdictFreed(const edict_t* pEdict)
 	VCALL_ENABLED_MODULES(OnEdictFreed(pEdict));
 }
 
+void CModuleManager::LevelShutdown()
+{
+	for (CModule* pModule : m_pModules)
+	{
+		if (!pModule->FastIsEnabled() || !pModule->GetModule2())
+			continue;
+
+		pModule->GetModule2()->LevelShutdown();
+	}
+}
+
 CModuleManager g_pModuleManager;
 
 static void NukeModules(const CCommand &args)
@@ -7,12 +7,14 @@ class CModule : public IModuleWrapper
 public:
 	~CModule();
 	virtual void SetModule(IModule* module);
+	inline void SetModule2(IModule2* module) { SetModule(module); m_pModule2 = module; };
 	virtual void SetEnabled(bool bEnabled, bool bForced = false);
 	virtual void Shutdown();
 	virtual bool IsEnabled();
 
 public:
 	inline IModule* GetModule() { return m_pModule; };
+	inline IModule2* GetModule2() { return m_pModule2; }; // NULL if the module was registered with RegisterModule.
 	inline bool FastIsEnabled() { return m_bEnabled; };
 	inline ConVar* GetConVar() { return m_pCVar; };
 	inline ConVar* GetDebugConVar() { return m_pDebugCVar; };
@@ -24,6 +26,7 @@ protected:
 
 protected:
 	IModule* m_pModule = NULL;
+	IModule2* m_pModule2 = NULL;
 	ConVar* m_pCVar = NULL;
 	char* m_pCVarName = NULL;
 	ConVar* m_pDebugCVar = NULL;
@@ -55,6 +58,8 @@ public:
 	virtual void ServerActivate(edict_t* pEdictList, int edictCount, int clientMax);
 	virtual void OnEdictAllocated(edict_t* pEdict);
 	virtual void OnEdictFreed(const edict_t* pEdict);
+	virtual void LevelShutdown();
+	virtual void RegisterModule2(IModule2* mdl);
 
 	inline int GetStatus() { return m_pStatus; };
 	inline CreateInterfaceFn& GetAppFactory() { return m_pAppFactory; };
@@ -65,6 +70,7 @@ public:
 	inline std::vector<CModule*>& GetModules() { return m_pModules; };
 
 private:
+	void AddModule(CModule* module);
 	std::vector<CModule*> m_pModules;
 	int m_pStatus = 0;
 	CreateInterfaceFn m_pAppFactory = NULL;
@@ -7,15 +7,15 @@ extern IModule* pSourceTVLibModule;
 extern IModule* pThreadPoolFixModule;
 extern IModule* pStringTableModule;
 extern IModule* pPrecacheFixModule;
-extern IModule* pPVSModule;
+extern IModule2* pPVSModule;
 extern IModule* pSurfFixModule;
-extern IModule* pFileSystemModule;
+extern IModule2* pFileSystemModule;
 extern IModule* pUtilModule;
 extern IModule* pConCommandModule;
 extern IModule* pVProfModule;
 extern IModule* pCVarsModule;
 extern IModule* pBitBufModule;
-extern IModule* pNetworkingModule;
+extern IModule2* pNetworkingModule;
 extern IModule* pSteamWorksModule;
 extern IModule* pPASModule;
 extern IModule* pBassModule;
@@ -23,4 +23,4 @@ extern IModule* pSysTimerModule;
 extern IModule* pVoiceChatModule;
 extern IModule* pPhysEnvModule;
 extern IModule* pNetModule;
-extern IModule* pEntListModule;
\ No newline at end of file
+extern IModule2* pEntListModule;
\ No newline at end of file
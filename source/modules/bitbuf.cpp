@@ -3,6 +3,7 @@
 #include "module.h"
 #include "lua.h"
 #include "bitbuf.h"
+#include <unordered_map>
 
 class CBitBufModule : public IModule
 {
@@ -27,6 +28,109 @@ static int bf_write_TypeID = -1;
 Push_LuaClass(bf_write, bf_write_TypeID)
 Get_LuaClass(bf_write, bf_write_TypeID, "bf_write")
 
+/*
+ * Buffer pool
+ * The backing arrays of our buffers are taken from power of two size classes (64 bytes up to 64kb)
+ * and returned on __gc / Release so that creating thousands of buffers per second doesn't allocate every time.
+ * Buffers created by the engine (e.g. UserMessageBegin or HolyLib:OnSourceTVNetMessage) are never in g_pBitBufBuffers and are never freed by us.
+ */
+static ConVar bitbuf_maxpooledbuffers("holylib_bitbuf_maxpooledbuffers", "64", 0, "The max number of unused buffers that are kept per size class.");
+
+#define BITBUF_POOL_MINSHIFT 6 // 64 bytes
+#define BITBUF_POOL_MAXSHIFT 16 // 64kb which is the max net message size.
+#define BITBUF_POOL_CLASSES (BITBUF_POOL_MAXSHIFT - BITBUF_POOL_MINSHIFT + 1)
+
+struct BitBufBuffer
+{
+	unsigned char* pData = NULL; // NULL for views.
+	int iSizeClass = -1; // -1 = not pooled.
+	int iReference = -1; // Reference to the Lua string a view reads from.
+};
+static std::unordered_map<void*, BitBufBuffer> g_pBitBufBuffers; // Every bf_read / bf_write created by us.
+static std::vector<unsigned char*> g_pBitBufPool[BITBUF_POOL_CLASSES];
+static bool g_bBitBufPoolActive = false;
+
+static int GetBitBufSizeClass(int iSize)
+{
+	if (iSize > (1 << BITBUF_POOL_MAXSHIFT))
+		return -1;
+
+	int iShift = BITBUF_POOL_MINSHIFT;
+	while ((1 << iShift) < iSize)
+		++iShift;
+
+	return iShift - BITBUF_POOL_MINSHIFT;
+}
+
+static unsigned char* AllocBitBufData(void* pBf, int iSize)
+{
+	BitBufBuffer& pBuffer = g_pBitBufBuffers[pBf];
+	pBuffer.iSizeClass = GetBitBufSizeClass(iSize);
+	if (pBuffer.iSizeClass == -1)
+	{
+		pBuffer.pData = new unsigned char[iSize];
+		return pBuffer.pData;
+	}
+
+	std::vector<unsigned char*>& pFree = g_pBitBufPool[pBuffer.iSizeClass];
+	if (!pFree.empty())
+	{
+		pBuffer.pData = pFree.back();
+		pFree.pop_back();
+	} else {
+		pBuffer.pData = new unsigned char[1 << (pBuffer.iSizeClass + BITBUF_POOL_MINSHIFT)];
+	}
+
+	return pBuffer.pData;
+}
+
+static void FreeBitBufData(void* pBf) // Does nothing if the buffer isn't ours.
+{
+	auto it = g_pBitBufBuffers.find(pBf);
+	if (it == g_pBitBufBuffers.end())
+		return;
+
+	BitBufBuffer& pBuffer = it->second;
+	if (pBuffer.iReference != -1)
+		g_Lua->ReferenceFree(pBuffer.iReference);
+
+	if (pBuffer.pData)
+	{
+		if (pBuffer.iSizeClass != -1 && g_bBitBufPoolActive && (int)g_pBitBufPool[pBuffer.iSizeClass].size() < bitbuf_maxpooledbuffers.GetInt())
+			g_pBitBufPool[pBuffer.iSizeClass].push_back(pBuffer.pData);
+		else
+			delete[] pBuffer.pData;
+	}
+
+	g_pBitBufBuffers.erase(it);
+}
+
+static bf_read* CreateBitBufRead(const void* pData, int iLength)
+{
+	bf_read* pNewBf = new bf_read;
+	unsigned char* cData = AllocBitBufData(pNewBf, iLength + 1);
+	memcpy(cData, pData, iLength);
+	pNewBf->StartReading(cData, iLength);
+
+	return pNewBf;
+}
+
+static void ReleaseBitBufRead(bf_read* bf)
+{
+	bool bOurs = g_pBitBufBuffers.find(bf) != g_pBitBufBuffers.end();
+	FreeBitBufData(bf);
+	if (bOurs)
+		delete bf;
+}
+
+static void ReleaseBitBufWrite(bf_write* bf)
+{
+	bool bOurs = g_pBitBufBuffers.find(bf) != g_pBitBufBuffers.end();
+	FreeBitBufData(bf);
+	if (bOurs)
+		delete bf;
+}
+
 LUA_FUNCTION_STATIC(bf_read__tostring)
 {
 	bf_read* bf = Get_bf_read(1, false);
@@ -56,8 +160,19 @@ LUA_FUNCTION_STATIC(bf_read__gc)
 	if (bf)
 	{
 		LUA->SetUserType(1, NULL);
-		delete[] bf->GetBasePointer();
-		delete bf;
+		ReleaseBitBufRead(bf);
+	}
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC(bf_read_Release)
+{
+	bf_read* bf = Get_bf_read(1, false);
+	if (bf)
+	{
+		LUA->SetUserType(1, NULL);
+		ReleaseBitBufRead(bf);
 	}
 
 	return 0;
@@ -311,9 +426,22 @@ LUA_FUNCTION_STATIC(bf_read_ReadBytes)
 	bf_read* bf = Get_bf_read(1, true);
 
 	int numBytes = (int)LUA->CheckNumber(2);
+	if (numBytes <= 0)
+	{
+		LUA->PushString("");
+		return 1;
+	}
+
+	if ((bf->GetNumBitsRead() & 7) == 0 && numBytes <= bf->GetNumBytesLeft()) // Byte aligned, so we can push it directly from the buffer.
+	{
+		LUA->PushString((const char*)bf->GetBasePointer() + (bf->GetNumBitsRead() >> 3), numBytes);
+		bf->SeekRelative(numBytes << 3);
+		return 1;
+	}
+
 	byte* buffer = (byte*)stackalloc( numBytes );
 	bf->ReadBytes(buffer, numBytes);
-	LUA->PushString((const char*)buffer);
+	LUA->PushString((const char*)buffer, numBytes);
 
 	return 1;
 }
@@ -395,15 +523,25 @@ LUA_FUNCTION_STATIC(bf_read_ReadString)
 {
 	bf_read* bf = Get_bf_read(1, true);
 
-	int iSize = 1 << 16;
-	char* pStr = new char[iSize]; // 1 << 16 is 64kb which is the max net message size.
-	if (bf->ReadString(pStr, iSize))
+	if ((bf->GetNumBitsRead() & 7) == 0) // Byte aligned, so we can push it directly from the buffer.
+	{
+		const char* pStart = (const char*)bf->GetBasePointer() + (bf->GetNumBitsRead() >> 3);
+		const char* pEnd = (const char*)memchr(pStart, 0, bf->GetNumBytesLeft());
+		if (pEnd)
+		{
+			int iLength = pEnd - pStart;
+			LUA->PushString(pStart, iLength);
+			bf->SeekRelative((iLength + 1) << 3);
+			return 1;
+		}
+	}
+
+	static char pStr[1 << 16]; // 1 << 16 is 64kb which is the max net message size.
+	if (bf->ReadString(pStr, sizeof(pStr)))
 		LUA->PushString(pStr);
 	else
 		LUA->PushNil();
 
-	delete[] pStr;
-
 	return 1;
 }
 
@@ -515,8 +653,19 @@ LUA_FUNCTION_STATIC(bf_write__gc)
 	if (bf)
 	{
 		LUA->SetUserType(1, NULL);
-		delete[] bf->GetBasePointer();
-		delete bf;
+		ReleaseBitBufWrite(bf);
+	}
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC(bf_write_Release)
+{
+	bf_write* bf = Get_bf_write(1, false);
+	if (bf)
+	{
+		LUA->SetUserType(1, NULL);
+		ReleaseBitBufWrite(bf);
 	}
 
 	return 0;
@@ -861,13 +1010,7 @@ LUA_FUNCTION_STATIC(bitbuf_CopyReadBuffer)
 	bf_read* pBf = Get_bf_read(1, true);
 
 	int iSize = pBf->GetNumBytesRead() + pBf->GetNumBytesLeft();
-	unsigned char* pData = new unsigned char[iSize + 1];
-	memcpy(pData, pBf->GetBasePointer(), iSize);
-
-	bf_read* pNewBf = new bf_read;
-	pNewBf->StartReading(pData, iSize);
-
-	Push_bf_read(pNewBf);
+	Push_bf_read(CreateBitBufRead(pBf->GetBasePointer(), iSize));
 
 	return 1;
 }
@@ -877,11 +1020,33 @@ LUA_FUNCTION_STATIC(bitbuf_CreateReadBuffer)
 	const char* pData = LUA->CheckString(1);
 	int iLength = LUA->ObjLen(1);
 
-	unsigned char* cData = new unsigned char[iLength + 1];
-	memcpy(cData, pData, iLength);
+	Push_bf_read(CreateBitBufRead(pData, iLength));
+
+	return 1;
+}
+
+/*
+ * Reads directly from the Lua string instead of copying it.
+ * We keep a reference to the string so that it stays alive as long as the buffer.
+ */
+LUA_FUNCTION_STATIC(bitbuf_CreateReadBufferView)
+{
+	const char* pData = LUA->CheckString(1);
+	int iStrLength = LUA->ObjLen(1);
+	int iOffset = (int)LUA->CheckNumberOpt(2, 0);
+	int iLength = (int)LUA->CheckNumberOpt(3, iStrLength - iOffset);
+
+	if (iOffset < 0 || iOffset > iStrLength)
+		LUA->ThrowError("Offset is out of range!");
+
+	if (iLength < 0 || iLength > (iStrLength - iOffset))
+		LUA->ThrowError("Length is out of range!");
 
 	bf_read* pNewBf = new bf_read;
-	pNewBf->StartReading(cData, iLength);
+	pNewBf->StartReading(pData + iOffset, iLength);
+
+	LUA->Push(1);
+	g_pBitBufBuffers[pNewBf].iReference = LUA->ReferenceCreate();
 
 	Push_bf_read(pNewBf);
 
@@ -893,20 +1058,18 @@ LUA_FUNCTION_STATIC(bitbuf_CreateWriteBuffer)
 	if (LUA->IsType(1, GarrysMod::Lua::Type::Number))
 	{
 		int iSize = (int)LUA->CheckNumber(1);
-		unsigned char* cData = new unsigned char[iSize];
 
 		bf_write* pNewBf = new bf_write;
-		pNewBf->StartWriting(cData, iSize);
+		pNewBf->StartWriting(AllocBitBufData(pNewBf, iSize), iSize);
 
 		Push_bf_write(pNewBf);
 	} else {
 		const char* pData = LUA->CheckString(1);
 		int iLength = LUA->ObjLen(1);
 
-		unsigned char* cData = new unsigned char[iLength + 1];
-		memcpy(cData, pData, iLength);
-
 		bf_write* pNewBf = new bf_write;
+		unsigned char* cData = AllocBitBufData(pNewBf, iLength + 1);
+		memcpy(cData, pData, iLength);
 		pNewBf->StartWriting(cData, iLength);
 
 		Push_bf_write(pNewBf);
@@ -920,10 +1083,13 @@ void CBitBufModule::LuaInit(bool bServerInit)
 	if (bServerInit)
 		return;
 
+	g_bBitBufPoolActive = true;
+
 	bf_read_TypeID = g_Lua->CreateMetaTable("bf_read");
 		Util::AddFunc(bf_read__tostring, "__tostring");
 		Util::AddFunc(bf_read__index, "__index");
 		Util::AddFunc(bf_read__gc, "__gc");
+		Util::AddFunc(bf_read_Release, "Release");
 		Util::AddFunc(bf_read_IsValid, "IsValid");
 		Util::AddFunc(bf_read_GetNumBitsLeft, "GetNumBitsLeft");
 		Util::AddFunc(bf_read_GetNumBitsRead, "GetNumBitsRead");
@@ -977,6 +1143,7 @@ void CBitBufModule::LuaInit(bool bServerInit)
 		Util::AddFunc(bf_write__tostring, "__tostring");
 		Util::AddFunc(bf_write__index, "__index");
 		Util::AddFunc(bf_write__gc, "__gc");
+		Util::AddFunc(bf_write_Release, "Release");
 		Util::AddFunc(bf_write_IsValid, "IsValid");
 		Util::AddFunc(bf_write_GetData, "GetData");
 		Util::AddFunc(bf_write_GetNumBytesWritten, "GetNumBytesWritten");
@@ -1021,6 +1188,7 @@ void CBitBufModule::LuaInit(bool bServerInit)
 	Util::StartTable();
 		Util::AddFunc(bitbuf_CopyReadBuffer, "CopyReadBuffer");
 		Util::AddFunc(bitbuf_CreateReadBuffer, "CreateReadBuffer");
+		Util::AddFunc(bitbuf_CreateReadBufferView, "CreateReadBufferView");
 		Util::AddFunc(bitbuf_CreateWriteBuffer, "CreateWriteBuffer");
 	Util::FinishTable("bitbuf");
 }
@@ -1028,4 +1196,17 @@ void CBitBufModule::LuaInit(bool bServerInit)
 void CBitBufModule::LuaShutdown()
 {
 	Util::NukeTable("bitbuf");
+
+	// The buffers that are still alive are freed by __gc when the Lua state is closed.
+	g_bBitBufPoolActive = false;
+	for (auto& [pBf, pBuffer] : g_pBitBufBuffers)
+		pBuffer.iReference = -1; // The references die with the Lua state.
+
+	for (int i=0; i<BITBUF_POOL_CLASSES; ++i)
+	{
+		for (unsigned char* pData : g_pBitBufPool[i])
+			delete[] pData;
+
+		g_pBitBufPool[i].clear();
+	}
 }
\ No newline at end of file
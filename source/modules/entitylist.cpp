@@ -5,20 +5,24 @@
 #include "lua.h"
 #include "player.h"
 #include "unordered_set"
+#include "vprof.h"
 
-class CEntListModule : public IModule
+class CEntListModule : public IModule2
 {
 public:
 	virtual void LuaInit(bool bServerInit) OVERRIDE;
 	virtual void LuaShutdown() OVERRIDE;
 	virtual void OnEdictFreed(const edict_t* pEdict) OVERRIDE;
 	virtual void OnEdictAllocated(edict_t* pEdict) OVERRIDE;
+	virtual void LevelShutdown() OVERRIDE;
 	virtual const char* Name() { return "entitylist"; };
 	virtual int Compatibility() { return LINUX32 | LINUX64 | WINDOWS32 | WINDOWS64; };
 };
 
 CEntListModule g_pEntListModule;
-IModule* pEntListModule = &g_pEntListModule;
+IModule2* pEntListModule = &g_pEntListModule;
+
+static ConVar entitylist_clusterindex("holylib_entitylist_clusterindex", "1", 0, "If enabled, pvs.FindInPVS and pas.FindInPAS will use a cluster index to only check the entities inside the visible clusters.");
 
 EntityList g_pGlobalEntityList;
 static int EntityList_TypeID = -1;
@@ -260,6 +264,7 @@ LUA_FUNCTION_STATIC(CreateEntityList)
 }
 
 static bool bFirstInit = true;
+static bool g_bClusterIndexDirty = true;
 static std::unordered_set<edict_t*> pQueriedGlobalEdicts;
 void UpdateGlobalEntityList() // Should always be called before using the g_pGlobalEntityList. 
 {
@@ -288,8 +293,233 @@ void UpdateGlobalEntityList() // Should always be called before using the g_pGlo
 			g_pGlobalEntityList.pEdictHash[edict->m_EdictIndex] = ent;
 		}
 		pQueriedGlobalEdicts.clear();
+		g_bClusterIndexDirty = true;
+	}
+}
+
+/*
+ * Cluster index
+ * Every entity of the global entity list is put into a bucket of the BSP cluster it's origin is in.
+ * pvs.FindInPVS and pas.FindInPAS then only visit the buckets of the clusters that are set in the visible row,
+ * instead of calling CheckOriginInPVS for every entity.
+ * 
+ * The index is rebuilt lazily when it's first used in a tick.
+ * Later calls in the same tick compare every entity's origin with the one it was indexed at and rebuild it if one moved,
+ * which is a lot cheaper than looking up the cluster of every entity.
+ * The entities are returned grouped by cluster, so the order differs from the scan.
+ */
+struct EntityClusterEntry
+{
+	CBaseEntity* pEntity;
+	int iReference;
+};
+
+struct EntityClusterCache // The cluster of an origin only changes with the map, so we only need to look it up again if the entity moved.
+{
+	Vector vecOrigin;
+	int iCluster = -2; // -2 = Never looked up.
+};
+
+static std::vector<std::vector<EntityClusterEntry>> g_pClusterBuckets;
+static std::vector<int> g_pUsedClusters; // All buckets that contain entities. Only these need to be checked & cleared.
+static EntityClusterCache g_pEntityClusters[MAX_EDICTS];
+static int g_iClusterIndexTick = -1;
+
+static void ClearEntityClusterIndex(bool bResetCache)
+{
+	for (int iCluster : g_pUsedClusters)
+		g_pClusterBuckets[iCluster].clear();
+
+	g_pUsedClusters.clear();
+	g_bClusterIndexDirty = true;
+
+	if (bResetCache)
+	{
+		g_pClusterBuckets.clear();
+		for (int i = 0; i < MAX_EDICTS; ++i)
+			g_pEntityClusters[i].iCluster = -2;
+	}
+}
+
+extern CGlobalVars* gpGlobals;
+static bool HasEntityMoved()
+{
+	for (CBaseEntity* pEnt : g_pGlobalEntityList.pEntities)
+	{
+		edict_t* pEdict = pEnt->edict();
+		if (pEdict && g_pEntityClusters[pEdict->m_EdictIndex].vecOrigin != pEnt->GetAbsOrigin())
+			return true;
+	}
+
+	return false;
+}
+
+static void UpdateEntityClusterIndex()
+{
+	UpdateGlobalEntityList();
+	if (!g_bClusterIndexDirty && g_iClusterIndexTick == gpGlobals->tickcount && !HasEntityMoved())
+		return;
+
+	VPROF_BUDGET("HolyLib - UpdateEntityClusterIndex", VPROF_BUDGETGROUP_HOLYLIB);
+
+	int iClusterCount = Util::engineserver->GetClusterCount();
+	if ((int)g_pClusterBuckets.size() != iClusterCount)
+	{
+		ClearEntityClusterIndex(true);
+		g_pClusterBuckets.resize(iClusterCount);
+	} else {
+		ClearEntityClusterIndex(false);
+	}
+
+	for (CBaseEntity* pEnt : g_pGlobalEntityList.pEntities)
+	{
+		edict_t* pEdict = pEnt->edict();
+		if (!pEdict)
+			continue;
+
+		EntityClusterCache& pCache = g_pEntityClusters[pEdict->m_EdictIndex];
+		const Vector& vecOrigin = pEnt->GetAbsOrigin();
+		if (pCache.iCluster == -2 || pCache.vecOrigin != vecOrigin)
+		{
+			pCache.vecOrigin = vecOrigin;
+			pCache.iCluster = Util::engineserver->GetClusterForOrigin(vecOrigin);
+		}
+
+		if (pCache.iCluster < 0 || pCache.iCluster >= iClusterCount) // Outside the world. CheckOriginInPVS would also return false.
+			continue;
+
+		auto it = g_pGlobalEntityList.pEntReferences.find(pEnt);
+		if (it == g_pGlobalEntityList.pEntReferences.end())
+			continue;
+
+		std::vector<EntityClusterEntry>& pBucket = g_pClusterBuckets[pCache.iCluster];
+		if (pBucket.empty())
+			g_pUsedClusters.push_back(pCache.iCluster);
+
+		pBucket.push_back({pEnt, it->second});
+	}
+
+	g_iClusterIndexTick = gpGlobals->tickcount;
+	g_bClusterIndexDirty = false;
+}
+
+bool PushEntitiesInClusters(const Util::CVisRow& pVis)
+{
+	if (!entitylist_clusterindex.GetBool())
+		return false;
+
+	UpdateEntityClusterIndex();
+
+	g_Lua->PreCreateTable(MAX_EDICTS / 16, 0);
+	int idx = 0;
+	for (int iCluster : g_pUsedClusters)
+	{
+		if (!pVis.IsClusterVisible(iCluster))
+			continue;
+
+		for (EntityClusterEntry& pEntry : g_pClusterBuckets[iCluster])
+		{
+			++idx;
+			g_Lua->PushNumber(idx);
+			g_Lua->ReferencePush(pEntry.iReference);
+			g_Lua->RawSet(-3);
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Benchmarks the real pvs.FindInPVS / pas.FindInPAS query path with the entities of the map.
+ * The scan is the path they use without the cluster index. Both build the same Lua table.
+ */
+static int PushEntitiesInVisScan(const Util::CVisRow& pVis)
+{
+	g_Lua->PreCreateTable(0, MAX_EDICTS / 16);
+	int idx = 0;
+	for (auto& [pEnt, ref] : g_pGlobalEntityList.pEntReferences)
+	{
+		if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), pVis.Data(), pVis.Size()))
+		{
+			++idx;
+			g_Lua->PushNumber(idx);
+			g_Lua->ReferencePush(ref);
+			g_Lua->RawSet(-3);
+		}
+	}
+
+	return idx;
+}
+
+static void BenchmarkClusterIndexCmd(const CCommand &args)
+{
+	int iViewers = args.ArgC() > 1 ? atoi(args.Arg(1)) : 64;
+	if (iViewers <= 0)
+	{
+		Msg("Usage: holylib_entitylist_benchmarkclusters <viewers = 64>\n");
+		return;
+	}
+
+	if (!g_Lua || !gpGlobals)
+	{
+		Msg("holylib: The server needs to be running to benchmark the cluster index!\n");
+		return;
+	}
+
+	UpdateGlobalEntityList();
+	if (g_pGlobalEntityList.pEntities.empty())
+	{
+		Msg("holylib: There are no entities to benchmark with!\n");
+		return;
 	}
+
+	bool bEnabled = entitylist_clusterindex.GetBool();
+	entitylist_clusterindex.SetValue(true); // PushEntitiesInClusters checks it.
+
+	static const int pTypes[] = {DVIS_PVS, DVIS_PAS};
+	static const char* pTypeNames[] = {"FindInPVS", "FindInPAS"};
+	size_t iEntities = g_pGlobalEntityList.pEntities.size();
+	Msg("---- Cluster index benchmark (%i entities, %i viewers) ----\n", (int)iEntities, iViewers);
+	for (int iType = 0; iType < 2; ++iType)
+	{
+		double flScan = 0;
+		double flRebuild = 0;
+		double flIndex = 0;
+		int iMismatches = 0;
+		for (int iViewer = 0; iViewer < iViewers; ++iViewer)
+		{
+			Util::CVisRow pVis = Util::CM_Vis(g_pGlobalEntityList.pEntities[((size_t)iViewer * 7919) % iEntities]->GetAbsOrigin(), pTypes[iType]);
+
+			double flStart = Plat_FloatTime();
+			int iScanFound = PushEntitiesInVisScan(pVis);
+			flScan += Plat_FloatTime() - flStart;
+			g_Lua->Pop(1);
+
+			g_bClusterIndexDirty = true; // The first call of every tick.
+			flStart = Plat_FloatTime();
+			PushEntitiesInClusters(pVis);
+			flRebuild += Plat_FloatTime() - flStart;
+			g_Lua->Pop(1);
+
+			flStart = Plat_FloatTime();
+			PushEntitiesInClusters(pVis);
+			flIndex += Plat_FloatTime() - flStart;
+			if (g_Lua->ObjLen(-1) != iScanFound)
+				++iMismatches;
+			g_Lua->Pop(1);
+		}
+
+		Msg("%s scan:            %.3fms (%.2f us/call)\n", pTypeNames[iType], flScan * 1000, flScan * 1000000 / iViewers);
+		Msg("%s index (rebuild): %.3fms (%.2f us/call)\n", pTypeNames[iType], flRebuild * 1000, flRebuild * 1000000 / iViewers);
+		Msg("%s index:           %.3fms (%.2f us/call)\n", pTypeNames[iType], flIndex * 1000, flIndex * 1000000 / iViewers);
+		if (iMismatches > 0)
+			Warning("holylib: The cluster index found a different amount of entities than the scan for %i viewers!\n", iMismatches);
+	}
+	Msg("---- End of Cluster index benchmark ----\n");
+
+	entitylist_clusterindex.SetValue(bEnabled);
 }
+static ConCommand benchmarkclusters("holylib_entitylist_benchmarkclusters", BenchmarkClusterIndexCmd, "Benchmarks pvs.FindInPVS / pas.FindInPAS with and without the cluster index using the entities of the map", 0);
 
 LUA_FUNCTION_STATIC(GetGlobalEntityList)
 {
@@ -320,6 +550,7 @@ void CEntListModule::OnEdictFreed(const edict_t* edict)
 	}
 
 	pQueriedGlobalEdicts.erase((edict_t*)edict);
+	g_bClusterIndexDirty = true; // The index could contain the freed entity.
 }
 
 void CEntListModule::OnEdictAllocated(edict_t* edict)
@@ -357,4 +588,10 @@ void CEntListModule::LuaShutdown()
 		Util::RemoveField("GetGlobalEntityList");
 	g_Lua->Pop(1);
 	g_pGlobalEntityList.Clear();
+	ClearEntityClusterIndex(false);
+}
+
+void CEntListModule::LevelShutdown()
+{
+	ClearEntityClusterIndex(true);
 }
\ No newline at end of file
@@ -9,9 +9,22 @@
 #include <algorithm>
 #include <cstring>
 #include <unordered_set>
+#include <atomic>
+#include <list>
+#include <map>
+#include <chrono>
+#include <ctime>
 #include "edict.h"
+#include <networkstringtabledefs.h>
+#ifdef SYSTEM_POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
 
-class CFileSystemModule : public IModule
+class CFileSystemModule : public IModule2
 {
 public:
 	virtual void Init(CreateInterfaceFn* appfn, CreateInterfaceFn* gamefn) OVERRIDE;
@@ -20,12 +33,14 @@ public:
 	virtual void LuaInit(bool bServerInit) OVERRIDE;
 	virtual void LuaShutdown() OVERRIDE;
 	virtual void Shutdown() OVERRIDE;
+	virtual void ServerActivate(edict_t* pEdictList, int edictCount, int clientMax) OVERRIDE;
+	virtual void LevelShutdown() OVERRIDE;
 	virtual const char* Name() { return "filesystem"; };
 	virtual int Compatibility() { return LINUX32; };
 };
 
 static CFileSystemModule g_pFileSystemModule;
-IModule* pFileSystemModule = &g_pFileSystemModule;
+IModule2* pFileSystemModule = &g_pFileSystemModule;
 
 static ConVar holylib_filesystem_easydircheck("holylib_filesystem_easydircheck", "0", 0, 
 	"Checks if the folder CBaseFileSystem::IsDirectory checks has a . in the name after the last /. if so assume it's a file extension.");
@@ -50,7 +65,7 @@ static ConVar holylib_filesystem_splitfallback("holylib_filesystem_splitfallback
 static ConVar holylib_filesystem_fixgmodpath("holylib_filesystem_fixgmodpath", "1", 0, 
 	"If enabled, it will fix up weird gamemode paths like sandbox/gamemode/sandbox/gamemode which gmod likes to use.");
 static ConVar holylib_filesystem_cachefilehandle("holylib_filesystem_cachefilehandle", "0", 0, 
-	"If enabled, it will cache the file handle and return it if needed. This will probably cause issues if you open the same file multiple times.");
+	"If enabled, read-only file handles are kept open in a pool after they were closed and reused when the same file is opened again.");
 
 static ConVar holylib_filesystem_fastopenread("holylib_filesystem_fastopenread", "0", 0,
 	"If enabled, it will use a different way to iterate over the searchpaths to reduce the overhead they cause.");
@@ -60,6 +75,11 @@ static ConVar holylib_filesystem_usesearchpathcache("holylib_filesystem_usesearc
 static ConVar holylib_filesystem_precachehandle("holylib_filesystem_precachehandle", "1", 0,
 	"If enabled, it will try to predict which file it will open next and open the file to keep a handle ready to be opened.");
 
+static ConVar holylib_filesystem_warmup("holylib_filesystem_warmup", "0", 0,
+	"If enabled, it will resolve the searchpaths of all precached models, map materials and lua files in the background on ServerActivate.");
+static ConVar holylib_filesystem_warmup_readahead("holylib_filesystem_warmup_readahead", "0", 0,
+	"If enabled, the warmup will also ask the OS to read the files into the page cache.");
+
 
 // Optimization Idea: When Gmod calls GetFileTime, we could try to get the filehandle in parallel to have it ready when gmod calls it.
 // We could also cache every FULL searchpath to not have to look up a file every time.  
@@ -85,1447 +105,5901 @@ struct FilesystemJob
 	void* pData = NULL;
 };
 
+static INetworkStringTableContainer* networkStringTableContainerServer = NULL;
 static const char* nullPath = "NULL_PATH";
-extern void DeleteFileHandle(FileHandle_t handle);
-static std::unordered_map<FileHandle_t, std::string_view> m_FileStringCache;
-static std::unordered_map<std::string_view, FileHandle_t> m_FileCache;
-static std::unordered_set<FileHandle_t> m_WriteFileHandle;
 static std::unordered_set<std::string> m_PredictionCheck;
-std::unordered_map<FileHandle_t, float> pFileDeletionList;
-void AddFileHandleToCache(std::string_view strFilePath, FileHandle_t pHandle)
-{
-	char* pFilePath = new char[MAX_PATH];
-	V_strncpy(pFilePath, strFilePath.data(), MAX_PATH);
 
-	m_FileCache[pFilePath] = pHandle;
-	m_FileStringCache[pHandle] = pFilePath;
+static Symbols::CBaseFileSystem_FindSearchPathByStoreId func_CBaseFileSystem_FindSearchPathByStoreId;
+inline CSearchPath* FindSearchPathByStoreId(int iStoreID)
+{
+	if (!func_CBaseFileSystem_FindSearchPathByStoreId)
+	{
+		Warning("HolyLib: Failed to get CBaseFileSystem::FindSearchPathByStoreId!\n");
+		return NULL;
+	}
 
-	if (g_pFileSystemModule.InDebug())
-		Msg("holylib - AddFileHandleToCache: Added file %s to filehandle cache\n", pFilePath);
+	return func_CBaseFileSystem_FindSearchPathByStoreId(g_pFullFileSystem, iStoreID);
 }
 
-void RemoveFileHandleFromCache(FileHandle_t pHandle)
+std::string GetFullPath(const CSearchPath* pSearchPath, const char* strFileName) // ToDo: Possibly switch to string_view?
 {
-	auto it = m_FileStringCache.find(pHandle);
-	if (it == m_FileStringCache.end())
-		return;
+	char szLowercaseFilename[MAX_PATH];
+	V_strcpy_safe(szLowercaseFilename, strFileName);
+	V_strlower(szLowercaseFilename);
 
-	m_FileCache.erase(it->second);
-	m_FileStringCache.erase(it);
+	std::string pPath = pSearchPath->GetPathString();
+	pPath.append(szLowercaseFilename);
+	return pPath;
+}
 
-	if (g_pFileSystemModule.InDebug())
-		Msg("holylib - RemoveFileHandleFromCache: Removed file %s from filehandle cache\n", it->second.data());
+/*
+ * I/O tracing
+ * -----------
+ *
+ * Records the latency of the filesystem hooks into log-linear histograms per operation and per pathID.
+ * If holylib_filesystem_tracing is disabled, a hook only checks a bool.
+ * The histograms and cache counters are atomic since the hooks are also called by the async threads.
+ * Only the pathID lookup and the slowest paths take a lock.
+ */
+enum FileSystemTraceOp
+{
+	FSTRACE_OPENFORREAD = 0,
+	FSTRACE_FINDFILEINSEARCHPATH,
+	FSTRACE_FASTFILETIME,
+	FSTRACE_GETFILETIME,
+	FSTRACE_ISDIRECTORY,
+	FSTRACE_CLOSE,
+	FSTRACE_COUNT
+};
+static const char* pTraceOpNames[FSTRACE_COUNT] = {"OpenForRead", "FindFileInSearchPath", "FastFileTime", "GetFileTime", "IsDirectory", "Close"};
+
+enum FileSystemTraceCache
+{
+	FSCACHE_SEARCHCACHE = 0,
+	FSCACHE_HANDLEPOOL,
+	FSCACHE_NEGATIVECACHE,
+	FSCACHE_VIRTUALINDEX,
+	FSCACHE_COUNT
+};
+static const char* pTraceCacheNames[FSCACHE_COUNT] = {"searchcache", "handlepool", "negativecache", "virtualindex"};
 
-	delete it->second.data();
+static bool g_bFileSystemTracing = false;
+static void OnTracingChange(IConVar* convar, const char* pOldValue, float flOldValue)
+{
+	g_bFileSystemTracing = ((ConVar*)convar)->GetBool();
 }
 
-extern CGlobalVars* gpGlobals;
-FileHandle_t GetFileHandleFromCache(std::string_view strFilePath)
+static ConVar holylib_filesystem_tracing("holylib_filesystem_tracing", "0", 0,
+	"If enabled, it will record the latency of the filesystem functions. See filesystem.GetStats and holylib_filesystem_dumpstats", OnTracingChange);
+static ConVar holylib_filesystem_tracing_slowest("holylib_filesystem_tracing_slowest", "32", 0,
+	"The number of slowest paths that are remembered while tracing.");
+
+/*
+ * Each power of two is split into 8 linear sub buckets, so a value is at most 12.5% off.
+ * It covers everything from 1ns to ~137 seconds.
+ */
+class CTraceHistogram
 {
-	auto it = m_FileCache.find(strFilePath);
-	if (it == m_FileCache.end())
+public:
+	static constexpr int SUB_BUCKET_BITS = 3;
+	static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static constexpr int MAX_EXPONENT = 36;
+	static constexpr int BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+	void Record(uint64 iValue)
 	{
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - GetFileHandleFromCache: Failed to find %s in filehandle cache\n", strFilePath.data());
+		m_pBuckets[GetBucket(iValue)].fetch_add(1, std::memory_order_relaxed);
+		m_iCount.fetch_add(1, std::memory_order_relaxed);
+		m_iTotal.fetch_add(iValue, std::memory_order_relaxed);
 
-		return NULL;
+		uint64 iMax = m_iMax.load(std::memory_order_relaxed);
+		while (iValue > iMax && !m_iMax.compare_exchange_weak(iMax, iValue, std::memory_order_relaxed));
+
+		uint64 iMin = m_iMin.load(std::memory_order_relaxed);
+		while (iValue < iMin && !m_iMin.compare_exchange_weak(iMin, iValue, std::memory_order_relaxed));
 	}
 
-	auto it2 = pFileDeletionList.find(it->second);
-	if (it2 != pFileDeletionList.end())
+	void Reset()
 	{
-		pFileDeletionList.erase(it2);
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - GetFileHandleFromCache: Removed handle for deletion! (%p)\n", it->second);
-	} else {
-		Msg("holylib - GetFileHandleFromCache: File wasn't marked for deletion? (%p)\n", it->second); // This could mean that were actively using it.
+		for (int i = 0; i < BUCKETS; ++i)
+			m_pBuckets[i].store(0, std::memory_order_relaxed);
+
+		m_iCount.store(0, std::memory_order_relaxed);
+		m_iTotal.store(0, std::memory_order_relaxed);
+		m_iMax.store(0, std::memory_order_relaxed);
+		m_iMin.store((uint64)-1, std::memory_order_relaxed);
 	}
 
-	int iPos = g_pFullFileSystem->Tell(it->second);
-	if (iPos != 0)
+	uint64 GetPercentile(double flPercentile) const // flPercentile = 0-1
 	{
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - GetFileHandleFromCache: Pos: %u\n", g_pFullFileSystem->Tell(it->second));
-		
-		g_pFullFileSystem->Seek(it->second, 0, FILESYSTEM_SEEK_HEAD); // Why doesn't it reset?
-		
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - GetFileHandleFromCache: Rewind pos: %u\n", g_pFullFileSystem->Tell(it->second));
-		
-		int iNewPos = g_pFullFileSystem->Tell(it->second);
-		if (iNewPos != 0)
+		uint64 iCount = m_iCount.load(std::memory_order_relaxed);
+		if (iCount == 0)
+			return 0;
+
+		uint64 iTarget = std::max<uint64>((uint64)(flPercentile * iCount + 0.5), 1);
+		uint64 iSeen = 0;
+		for (int i = 0; i < BUCKETS; ++i)
 		{
-			if (g_pFileSystemModule.InDebug())
-				Msg("holylib - GetFileHandleFromCache: Failed to reset pointer!\n");
-			
-			pFileDeletionList[it->second] = gpGlobals->curtime; // Force delete. it's broken
-			return NULL;
+			iSeen += m_pBuckets[i].load(std::memory_order_relaxed);
+			if (iSeen >= iTarget)
+				return std::min(GetBucketValue(i), m_iMax.load(std::memory_order_relaxed));
 		}
-		// BUG: .bsp files seem to have funny behavior :/
-		// BUG2: We need to account for rb and wb since wb can't read and rb can't write.  
-		// How will we account for that? were gonna need to get the CFileHandle class
+
+		return m_iMax.load(std::memory_order_relaxed);
 	}
 
-	return it->second;
-}
+	inline uint64 GetCount() const { return m_iCount.load(std::memory_order_relaxed); };
+	inline uint64 GetTotal() const { return m_iTotal.load(std::memory_order_relaxed); };
+	inline uint64 GetMax() const { return m_iMax.load(std::memory_order_relaxed); };
+	inline uint64 GetMin() const { return GetCount() > 0 ? m_iMin.load(std::memory_order_relaxed) : 0; };
 
-static Symbols::CBaseFileSystem_FindSearchPathByStoreId func_CBaseFileSystem_FindSearchPathByStoreId;
-inline CSearchPath* FindSearchPathByStoreId(int iStoreID)
-{
-	if (!func_CBaseFileSystem_FindSearchPathByStoreId)
+private:
+	static inline int GetBucket(uint64 iValue)
 	{
-		Warning("HolyLib: Failed to get CBaseFileSystem::FindSearchPathByStoreId!\n");
-		return NULL;
+		if (iValue < SUB_BUCKETS)
+			return (int)iValue;
+
+		int iExponent = 63 - __builtin_clzll(iValue);
+		if (iExponent > MAX_EXPONENT)
+			return BUCKETS - 1;
+
+		int iSubBucket = (int)((iValue >> (iExponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+		return (iExponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + iSubBucket;
 	}
 
-	return func_CBaseFileSystem_FindSearchPathByStoreId(g_pFullFileSystem, iStoreID);
-}
+	static inline uint64 GetBucketValue(int iBucket) // Middle of the bucket.
+	{
+		if (iBucket < SUB_BUCKETS)
+			return iBucket;
 
-std::string GetFullPath(const CSearchPath* pSearchPath, const char* strFileName) // ToDo: Possibly switch to string_view?
-{
-	char szLowercaseFilename[MAX_PATH];
-	V_strcpy_safe(szLowercaseFilename, strFileName);
-	V_strlower(szLowercaseFilename);
+		int iShift = iBucket / SUB_BUCKETS - 1;
+		uint64 iLower = (uint64)(SUB_BUCKETS + iBucket % SUB_BUCKETS) << iShift;
+		return iLower + (((uint64)1 << iShift) >> 1);
+	}
 
-	std::string pPath = pSearchPath->GetPathString();
-	pPath.append(szLowercaseFilename);
-	return pPath;
-}
+	std::atomic<uint64> m_pBuckets[BUCKETS] = {};
+	std::atomic<uint64> m_iCount = 0;
+	std::atomic<uint64> m_iTotal = 0;
+	std::atomic<uint64> m_iMax = 0;
+	std::atomic<uint64> m_iMin = (uint64)-1;
+};
 
-static std::unordered_map<std::string_view, std::unordered_map<std::string_view, int>> m_SearchCache;
-static void AddFileToSearchCache(const char* pFileName, int path, const char* pathID) // pathID should never be deleted so we don't need to manage that memory.
+struct TracePathID
 {
-	if (!pathID)
-		pathID = nullPath;
+	CTraceHistogram pHistogram;
+	std::atomic<uint64> pCalls[FSTRACE_COUNT] = {};
+};
 
-	if (g_pFileSystemModule.InDebug())
-		Msg("holylib - AddFileToSearchCache: Added file %s to seach cache (%i, %s)\n", pFileName, path, pathID);
+struct TraceSlowEntry
+{
+	uint64 iTime;
+	FileSystemTraceOp iOp;
+	std::string strPathID;
+	std::string strFileName;
+};
 
-	char* cFileName = new char[MAX_PATH];
-	V_strncpy(cFileName, pFileName, MAX_PATH);
+static CTraceHistogram g_pTraceOps[FSTRACE_COUNT];
+static std::atomic<uint64> g_pTraceCacheHits[FSCACHE_COUNT] = {};
+static std::atomic<uint64> g_pTraceCacheMisses[FSCACHE_COUNT] = {};
+static std::unordered_map<std::string, TracePathID*> g_pTracePathIDs; // Never removed since the other threads could still use them.
+static std::vector<TraceSlowEntry> g_pTraceSlowest; // Sorted, slowest first.
+static std::atomic<uint64> g_iTraceSlowThreshold = 0; // Fast path so we only lock if the call is slow enough.
+static CThreadFastMutex g_pTraceMutex; // Guards g_pTracePathIDs & g_pTraceSlowest.
 
-	m_SearchCache[pathID][cFileName] = path;
+/*
+ * Every thread keeps its own map of the pathIDs it has seen, so a traced call only takes g_pTraceMutex
+ * the first time a thread sees a pathID or if the call is one of the slowest ones.
+ * The stats themselves are atomics shared by all threads.
+ */
+static TracePathID* GetTracePathID(const char* pPathID)
+{
+	thread_local std::unordered_map<std::string, TracePathID*> pThreadPathIDs;
+	auto it = pThreadPathIDs.find(pPathID);
+	if (it != pThreadPathIDs.end())
+		return it->second;
+
+	g_pTraceMutex.Lock();
+	TracePathID*& pStats = g_pTracePathIDs[pPathID];
+	if (!pStats)
+		pStats = new TracePathID;
+	g_pTraceMutex.Unlock();
+
+	pThreadPathIDs[pPathID] = pStats; // Entries of g_pTracePathIDs are never removed, so we can keep the pointer.
+	return pStats;
 }
 
-
-static void RemoveFileFromSearchCache(const char* pFileName, const char* pathID)
+static void RecordFileSystemTrace(FileSystemTraceOp iOp, const char* pFileName, const char* pPathID, uint64 iTime)
 {
-	if (!pathID)
-		pathID = nullPath;
-
-	if (g_pFileSystemModule.InDebug())
-		Msg("holylib - RemoveFileFromSearchCache: Removed file %s from seach cache! (%s)\n", pFileName, pathID);
+	g_pTraceOps[iOp].Record(iTime);
+	if (pPathID)
+	{
+		TracePathID* pStats = GetTracePathID(pPathID);
+		pStats->pHistogram.Record(iTime);
+		pStats->pCalls[iOp].fetch_add(1, std::memory_order_relaxed);
+	}
 
-	auto& map = m_SearchCache[pathID];
-	auto it = map.find(pFileName);
-	if (it == map.end())
+	bool bSlow = pFileName && iTime > g_iTraceSlowThreshold.load(std::memory_order_relaxed);
+	if (!bSlow)
 		return;
 
-	map.erase(it);
-	delete[] it->first.data(); // Allocated in AddFileToSearchCache
-}
+	g_pTraceMutex.Lock();
+	size_t iMaxEntries = (size_t)std::clamp(holylib_filesystem_tracing_slowest.GetInt(), 0, 1024);
+	auto it = std::find_if(g_pTraceSlowest.begin(), g_pTraceSlowest.end(), [&](const TraceSlowEntry& pEntry) {
+		return pEntry.iOp == iOp && pEntry.strFileName == pFileName;
+	});
 
-static CSearchPath* GetPathFromSearchCache(const char* pFileName, const char* pathID)
-{
-	if (!pathID)
-		pathID = nullPath;
+	if (it == g_pTraceSlowest.end() || it->iTime < iTime) // Every path is only listed once with its slowest call.
+	{
+		if (it != g_pTraceSlowest.end())
+			g_pTraceSlowest.erase(it);
 
-	auto& map = m_SearchCache[pathID];
-	auto it = map.find(pFileName);
-	if (it == map.end())
-		return NULL; // We should add a debug print to see if we make a mistake somewhere
+		TraceSlowEntry pEntry = {iTime, iOp, pPathID ? pPathID : nullPath, pFileName};
+		auto insertIt = std::upper_bound(g_pTraceSlowest.begin(), g_pTraceSlowest.end(), iTime, [](uint64 iValue, const TraceSlowEntry& pOther) {
+			return iValue > pOther.iTime;
+		});
+		g_pTraceSlowest.insert(insertIt, std::move(pEntry));
 
-	if (g_pFileSystemModule.InDebug())
-		Msg("holylib - GetPathFromSearchCache: Getting search path for file %s from cache!\n", pFileName);
+		if (g_pTraceSlowest.size() > iMaxEntries)
+			g_pTraceSlowest.resize(iMaxEntries);
 
-	return FindSearchPathByStoreId(it->second);
+		g_iTraceSlowThreshold.store(g_pTraceSlowest.size() >= iMaxEntries && !g_pTraceSlowest.empty() ? g_pTraceSlowest.back().iTime : 0, std::memory_order_relaxed);
+	}
+	g_pTraceMutex.Unlock();
 }
 
-static void NukeSearchCache() // NOTE: We actually never nuke it :D
+static inline void TraceCacheResult(FileSystemTraceCache iCache, bool bHit)
 {
-	if (g_pFileSystemModule.InDebug())
-		Msg("holylib - NukeSearchCache: Search cache got nuked\n");
+	if (!g_bFileSystemTracing)
+		return;
 
-	m_SearchCache.clear(); // Now causes a memory leak :D (Should I try to solve it? naaaaaa :^)
+	(bHit ? g_pTraceCacheHits : g_pTraceCacheMisses)[iCache].fetch_add(1, std::memory_order_relaxed);
 }
 
-static void DumpSearchcacheCmd(const CCommand &args)
+static void ResetFileSystemTrace()
 {
-	Msg("---- Search cache ----\n");
-	for (auto&[strPath, cache] : m_SearchCache)
+	for (int i = 0; i < FSTRACE_COUNT; ++i)
+		g_pTraceOps[i].Reset();
+
+	for (int i = 0; i < FSCACHE_COUNT; ++i)
 	{
-		Msg("	\"%s\":\n", strPath.data());
-		for (auto&[entry, storeID] : cache)
-		{
-			Msg("		\"%s\": %i\n", entry.data(), storeID);
-		}
+		g_pTraceCacheHits[i].store(0, std::memory_order_relaxed);
+		g_pTraceCacheMisses[i].store(0, std::memory_order_relaxed);
+	}
+
+	g_pTraceMutex.Lock();
+	for (auto& [strPathID, pStats] : g_pTracePathIDs)
+	{
+		pStats->pHistogram.Reset();
+		for (int i = 0; i < FSTRACE_COUNT; ++i)
+			pStats->pCalls[i].store(0, std::memory_order_relaxed);
 	}
-	Msg("---- End of Search cache ----\n");
+	g_pTraceSlowest.clear();
+	g_iTraceSlowThreshold.store(0, std::memory_order_relaxed);
+	g_pTraceMutex.Unlock();
 }
-static ConCommand dumpsearchcache("holylib_filesystem_dumpsearchcache", DumpSearchcacheCmd, "Dumps the searchcache", 0);
 
-static void GetPathFromIDCmd(const CCommand &args)
+class CFileSystemTrace // Records the time between construction and destruction.
 {
-	if ( args.ArgC() < 1 || V_stricmp(args.Arg(1), "") == 0 )
+public:
+	inline CFileSystemTrace(FileSystemTraceOp iOp, const char* pFileName, const char* pPathID)
 	{
-		Msg("Usage: holylib_filesystem_getpathfromid <id>\n");
-		return;
+		if (!g_bFileSystemTracing)
+			return;
+
+		m_bActive = true;
+		m_iOp = iOp;
+		m_pFileName = pFileName;
+		m_pPathID = pPathID;
+		m_pStart = std::chrono::steady_clock::now();
 	}
 
-	CSearchPath* path = FindSearchPathByStoreId(atoi(args.Arg(1)));
-	if (!path)
+	inline ~CFileSystemTrace()
 	{
-		Msg("Failed to find CSearchPath :/\n");
-		return;
+		if (m_bActive)
+			RecordFileSystemTrace(m_iOp, m_pFileName, m_pPathID, (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_pStart).count());
 	}
 
-	Msg("Id: %s\n", args.Arg(1));
-	Msg("Path %s\n", path->GetPathString()); // Does this crash? idk.
-}
-static ConCommand getpathfromid("holylib_filesystem_getpathfromid", GetPathFromIDCmd, "prints the path of the given searchpath id", 0);
+private:
+	bool m_bActive = false;
+	FileSystemTraceOp m_iOp = FSTRACE_OPENFORREAD;
+	const char* m_pFileName = NULL;
+	const char* m_pPathID = NULL;
+	std::chrono::steady_clock::time_point m_pStart;
+};
 
-static void NukeSearchcacheCmd(const CCommand &args)
+struct TraceSummary // All times are in nanoseconds.
 {
-	NukeSearchCache();
-}
-static ConCommand nukesearchcache("holylib_filesystem_nukesearchcache", NukeSearchcacheCmd, "Nukes the searchcache", 0);
+	uint64 iCount = 0;
+	uint64 iTotal = 0;
+	uint64 iMin = 0;
+	uint64 iMax = 0;
+	uint64 iMean = 0;
+	uint64 iP50 = 0;
+	uint64 iP90 = 0;
+	uint64 iP99 = 0;
+	uint64 iP999 = 0;
+};
 
-static void DumpFilecacheCmd(const CCommand &args)
+static TraceSummary SummarizeHistogram(const CTraceHistogram& pHistogram)
 {
-	Msg("---- FileHandle cache ----\n");
-	for (auto&[strPath, handle] : m_FileCache)
-	{
-		Msg("	\"%s\": %p\n", strPath.data(), handle);
-	}
-	Msg("---- End of Search cache ----\n");
+	TraceSummary pSummary;
+	pSummary.iCount = pHistogram.GetCount();
+	pSummary.iTotal = pHistogram.GetTotal();
+	pSummary.iMin = pHistogram.GetMin();
+	pSummary.iMax = pHistogram.GetMax();
+	pSummary.iMean = pSummary.iCount > 0 ? pSummary.iTotal / pSummary.iCount : 0;
+	pSummary.iP50 = pHistogram.GetPercentile(0.5);
+	pSummary.iP90 = pHistogram.GetPercentile(0.9);
+	pSummary.iP99 = pHistogram.GetPercentile(0.99);
+	pSummary.iP999 = pHistogram.GetPercentile(0.999);
+
+	return pSummary;
 }
-static ConCommand dumpfilecache("holylib_filesystem_dumpfilecache", DumpFilecacheCmd, "Dumps the filecache", 0);
 
-static void ShowPredictionErrosCmd(const CCommand &args)
+static std::vector<std::pair<std::string, TraceSummary>> GetPathIDTraceSummaries()
 {
-	Msg("---- Prediction Errors ----\n");
-	for (const std::string& strFileName : m_PredictionCheck)
-	{
-		Msg("- \"%s\"", strFileName.c_str());
-	}
-	Msg("---- End of Prediction Errors ----\n");
+	std::vector<std::pair<std::string, TraceSummary>> pSummaries;
+	g_pTraceMutex.Lock();
+	for (auto& [strPathID, pStats] : g_pTracePathIDs)
+		if (pStats->pHistogram.GetCount() > 0)
+			pSummaries.push_back({strPathID, SummarizeHistogram(pStats->pHistogram)});
+	g_pTraceMutex.Unlock();
+
+	std::sort(pSummaries.begin(), pSummaries.end(), [](const auto& a, const auto& b) {
+		return a.second.iTotal > b.second.iTotal;
+	});
+
+	return pSummaries;
 }
-static ConCommand showpredictionerrors("holylib_filesystem_showpredictionerrors", ShowPredictionErrosCmd, "Shows all prediction errors that ocurred", 0);
 
-inline void OnFileHandleOpen(FileHandle_t handle, const char* pFileMode)
+static std::vector<TraceSlowEntry> GetSlowestTraces()
 {
-	if (pFileMode[0] == 'r') // I see a potential crash, but this should never happen.
-		return;
+	g_pTraceMutex.Lock();
+	std::vector<TraceSlowEntry> pSlowest = g_pTraceSlowest;
+	g_pTraceMutex.Unlock();
 
-	m_WriteFileHandle.insert(handle);
+	return pSlowest;
 }
 
-static Detouring::Hook detour_CBaseFileSystem_FindFileInSearchPath;
-static FileHandle_t hook_CBaseFileSystem_FindFileInSearchPath(void* filesystem, CFileOpenInfo &openInfo)
+static std::string EscapeTraceString(const std::string& strValue, bool bJSON)
 {
-	if (!holylib_filesystem_searchcache.GetBool())
-		return detour_CBaseFileSystem_FindFileInSearchPath.GetTrampoline<Symbols::CBaseFileSystem_FindFileInSearchPath>()(filesystem, openInfo);
+	std::string strOut;
+	strOut.reserve(strValue.length() + 2);
+	strOut.push_back('"');
+	for (char c : strValue)
+	{
+		if (c == '"')
+			strOut.append(bJSON ? "\\\"" : "\"\"");
+		else if (bJSON && c == '\\')
+			strOut.append("\\\\");
+		else if (bJSON && (unsigned char)c < 0x20)
+			continue;
+		else
+			strOut.push_back(c);
+	}
+	strOut.push_back('"');
 
-	if (!g_pFullFileSystem)
-		g_pFullFileSystem = (IFileSystem*)filesystem;
+	return strOut;
+}
 
-	VPROF_BUDGET("HolyLib - CBaseFileSystem::FindFile", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+static void AppendTraceSummary(std::string& strOut, const char* pFormat, const std::string& strLead, const std::string& strName, const TraceSummary& pSummary) // strLead is the type for csv and the separator for json.
+{
+	char pLine[512];
+	V_snprintf(pLine, sizeof(pLine), pFormat, strLead.c_str(), strName.c_str(), (unsigned long long)pSummary.iCount, pSummary.iTotal / 1000.0, pSummary.iMin / 1000.0, pSummary.iMean / 1000.0,
+		pSummary.iP50 / 1000.0, pSummary.iP90 / 1000.0, pSummary.iP99 / 1000.0, pSummary.iP999 / 1000.0, pSummary.iMax / 1000.0);
+	strOut.append(pLine);
+}
 
-	CSearchPath* cachePath = GetPathFromSearchCache(openInfo.m_pFileName, openInfo.m_pSearchPath->GetPathIDString());
-	if (cachePath)
+static std::string BuildTraceReport(bool bJSON)
+{
+	std::string strOut;
+	char pLine[512];
+	if (bJSON)
 	{
-		VPROF_BUDGET("HolyLib - CBaseFileSystem::FindFile - Cache", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
-
-		if (holylib_filesystem_cachefilehandle.GetBool())
+		const char* pFormat = "%s{\"name\": %s, \"count\": %llu, \"total_us\": %.3f, \"min_us\": %.3f, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f}";
+		strOut.append("{\n\t\"operations\": [");
+		for (int i = 0; i < FSTRACE_COUNT; ++i)
+			AppendTraceSummary(strOut, pFormat, i == 0 ? "\n\t\t" : ",\n\t\t", EscapeTraceString(pTraceOpNames[i], true), SummarizeHistogram(g_pTraceOps[i]));
+
+		strOut.append("\n\t],\n\t\"pathIDs\": [");
+		bool bFirst = true;
+		for (auto& [strPathID, pSummary] : GetPathIDTraceSummaries())
 		{
-			FileHandle_t cacheFile = GetFileHandleFromCache(GetFullPath(cachePath, openInfo.m_pFileName));
-			if (cacheFile)
-			{
-				OnFileHandleOpen(cacheFile, openInfo.m_pOptions);
-				return cacheFile;
-			}
+			AppendTraceSummary(strOut, pFormat, bFirst ? "\n\t\t" : ",\n\t\t", EscapeTraceString(strPathID, true), pSummary);
+			bFirst = false;
 		}
 
-		const CSearchPath* origPath = openInfo.m_pSearchPath;
-		openInfo.m_pSearchPath = cachePath;
-		FileHandle_t file = detour_CBaseFileSystem_FindFileInSearchPath.GetTrampoline<Symbols::CBaseFileSystem_FindFileInSearchPath>()(filesystem, openInfo);
-		if (file)
+		strOut.append("\n\t],\n\t\"caches\": [");
+		for (int i = 0; i < FSCACHE_COUNT; ++i)
 		{
-			if (holylib_filesystem_cachefilehandle.GetBool())
-				AddFileHandleToCache(GetFullPath(openInfo.m_pSearchPath, openInfo.m_pFileName), file);
-
-			OnFileHandleOpen(file, openInfo.m_pOptions);
-			return file;
+			V_snprintf(pLine, sizeof(pLine), "%s{\"name\": \"%s\", \"hits\": %llu, \"misses\": %llu}", i == 0 ? "\n\t\t" : ",\n\t\t", pTraceCacheNames[i],
+				(unsigned long long)g_pTraceCacheHits[i].load(std::memory_order_relaxed), (unsigned long long)g_pTraceCacheMisses[i].load(std::memory_order_relaxed));
+			strOut.append(pLine);
 		}
 
-		openInfo.m_pSearchPath = origPath;
-		RemoveFileFromSearchCache(openInfo.m_pFileName, openInfo.m_pSearchPath->GetPathIDString());
-	} else {
-		if (holylib_filesystem_cachefilehandle.GetBool())
+		strOut.append("\n\t],\n\t\"slowest\": [");
+		bFirst = true;
+		for (const TraceSlowEntry& pEntry : GetSlowestTraces())
 		{
-			FileHandle_t cacheFile = GetFileHandleFromCache(GetFullPath(openInfo.m_pSearchPath, openInfo.m_pFileName));
-			if (cacheFile)
-			{
-				OnFileHandleOpen(cacheFile, openInfo.m_pOptions);
-				return cacheFile;
-			}
+			V_snprintf(pLine, sizeof(pLine), "%s{\"operation\": \"%s\", \"pathID\": %s, \"time_us\": %.3f, \"file\": ", bFirst ? "\n\t\t" : ",\n\t\t", pTraceOpNames[pEntry.iOp],
+				EscapeTraceString(pEntry.strPathID, true).c_str(), pEntry.iTime / 1000.0);
+			strOut.append(pLine);
+			strOut.append(EscapeTraceString(pEntry.strFileName, true));
+			strOut.append("}");
+			bFirst = false;
 		}
+		strOut.append("\n\t]\n}\n");
+	} else {
+		const char* pFormat = "%s,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n";
+		strOut.append("type,name,count,total_us,min_us,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+		for (int i = 0; i < FSTRACE_COUNT; ++i)
+			AppendTraceSummary(strOut, pFormat, "operation", pTraceOpNames[i], SummarizeHistogram(g_pTraceOps[i]));
 
-		if (g_pFileSystemModule.InDebug())
-			Msg("FindFileInSearchPath: Failed to find cachePath! (%s)\n", openInfo.m_pFileName);
-	}
+		for (auto& [strPathID, pSummary] : GetPathIDTraceSummaries())
+			AppendTraceSummary(strOut, pFormat, "pathID", EscapeTraceString(strPathID, false), pSummary);
 
-	FileHandle_t file = detour_CBaseFileSystem_FindFileInSearchPath.GetTrampoline<Symbols::CBaseFileSystem_FindFileInSearchPath>()(filesystem, openInfo);
+		strOut.append("\ncache,hits,misses\n");
+		for (int i = 0; i < FSCACHE_COUNT; ++i)
+		{
+			V_snprintf(pLine, sizeof(pLine), "%s,%llu,%llu\n", pTraceCacheNames[i],
+				(unsigned long long)g_pTraceCacheHits[i].load(std::memory_order_relaxed), (unsigned long long)g_pTraceCacheMisses[i].load(std::memory_order_relaxed));
+			strOut.append(pLine);
+		}
 
-	if (file)
-	{
-		AddFileToSearchCache(openInfo.m_pFileName, openInfo.m_pSearchPath->m_storeId, openInfo.m_pSearchPath->GetPathIDString());
-		if (holylib_filesystem_cachefilehandle.GetBool())
-			AddFileHandleToCache(GetFullPath(openInfo.m_pSearchPath, openInfo.m_pFileName), file);
-	
-		OnFileHandleOpen(file, openInfo.m_pOptions);
+		strOut.append("\noperation,pathID,time_us,file\n");
+		for (const TraceSlowEntry& pEntry : GetSlowestTraces())
+		{
+			V_snprintf(pLine, sizeof(pLine), "%s,%s,%.3f,", pTraceOpNames[pEntry.iOp], EscapeTraceString(pEntry.strPathID, false).c_str(), pEntry.iTime / 1000.0);
+			strOut.append(pLine);
+			strOut.append(EscapeTraceString(pEntry.strFileName, false));
+			strOut.append("\n");
+		}
 	}
 
-	return file;
+	return strOut;
 }
 
-static Detouring::Hook detour_CBaseFileSystem_FastFileTime;
-static long hook_CBaseFileSystem_FastFileTime(void* filesystem, const CSearchPath* path, const char* pFileName)
+static void DumpStatsCmd(const CCommand &args)
 {
-	if (!holylib_filesystem_searchcache.GetBool())
-		return detour_CBaseFileSystem_FastFileTime.GetTrampoline<Symbols::CBaseFileSystem_FastFileTime>()(filesystem, path, pFileName);
-
-	if (!g_pFullFileSystem)
-		g_pFullFileSystem = (IFileSystem*)filesystem;
-
-	VPROF_BUDGET("HolyLib - CBaseFileSystem::FastFileTime", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
-
-	CSearchPath* cachePath = GetPathFromSearchCache(pFileName, path->GetPathIDString());
-	if (cachePath)
+	Msg("---- Filesystem stats (%s) ----\n", g_bFileSystemTracing ? "tracing" : "tracing disabled");
+	Msg("%-22s %10s %12s %10s %10s %10s %10s\n", "operation", "count", "total ms", "mean us", "p50 us", "p99 us", "max us");
+	for (int i = 0; i < FSTRACE_COUNT; ++i)
 	{
-		VPROF_BUDGET("HolyLib - CBaseFileSystem::FastFileTime - Cache", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+		TraceSummary pSummary = SummarizeHistogram(g_pTraceOps[i]);
+		Msg("%-22s %10llu %12.3f %10.3f %10.3f %10.3f %10.3f\n", pTraceOpNames[i], (unsigned long long)pSummary.iCount, pSummary.iTotal / 1000000.0,
+			pSummary.iMean / 1000.0, pSummary.iP50 / 1000.0, pSummary.iP99 / 1000.0, pSummary.iMax / 1000.0);
+	}
 
-		long time = detour_CBaseFileSystem_FastFileTime.GetTrampoline<Symbols::CBaseFileSystem_FastFileTime>()(filesystem, cachePath, pFileName);
-		if (time != 0L)
-			return time;
+	for (int i = 0; i < FSCACHE_COUNT; ++i)
+		Msg("%s: %llu hits, %llu misses\n", pTraceCacheNames[i], (unsigned long long)g_pTraceCacheHits[i].load(std::memory_order_relaxed), (unsigned long long)g_pTraceCacheMisses[i].load(std::memory_order_relaxed));
 
-		RemoveFileFromSearchCache(pFileName, path->GetPathIDString());
-	} else {
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - FastFileTime: Failed to find cachePath! (%s)\n", pFileName);
+	if (args.ArgC() < 2)
+	{
+		Msg("Use holylib_filesystem_dumpstats <csv/json> to write the full stats into vprof/\n");
+		Msg("---- End of Filesystem stats ----\n");
+		return;
 	}
 
-	long time = detour_CBaseFileSystem_FastFileTime.GetTrampoline<Symbols::CBaseFileSystem_FastFileTime>()(filesystem, path, pFileName);
+	bool bJSON = V_stricmp(args.Arg(1), "json") == 0;
+	if (!bJSON && V_stricmp(args.Arg(1), "csv") != 0)
+	{
+		Msg("Usage: holylib_filesystem_dumpstats <csv/json>\n");
+		return;
+	}
 
-	if (time != 0L)
-		AddFileToSearchCache(pFileName, path->m_storeId, path->GetPathIDString());
+	if (!g_pFullFileSystem->IsDirectory("vprof", "MOD"))
+		g_pFullFileSystem->CreateDirHierarchy("vprof", "MOD");
 
-	return time;
-}
+	char pTime[64];
+	time_t iTime = time(NULL);
+	strftime(pTime, sizeof(pTime), "%Y-%m-%d %H-%M-%S", localtime(&iTime));
 
-static bool is_file(const char *path) {
-	const char *last_slash = strrchr(path, '/');
-	const char *last_dot = strrchr(path, '.');
+	char pFileName[MAX_PATH];
+	V_snprintf(pFileName, sizeof(pFileName), "vprof/filesystem %s.%s", pTime, bJSON ? "json" : "csv");
 
-	return last_dot != NULL && (last_slash == NULL || last_dot > last_slash);
+	std::string strReport = BuildTraceReport(bJSON);
+	FileHandle_t fh = g_pFullFileSystem->Open(pFileName, "wb", "MOD");
+	if (fh)
+	{
+		g_pFullFileSystem->Write(strReport.c_str(), strReport.length(), fh);
+		g_pFullFileSystem->Close(fh);
+		Msg("holylib: Wrote filesystem stats into %s\n", pFileName);
+	} else {
+		Warning("holylib: Failed to open %s!\n", pFileName);
+	}
+	Msg("---- End of Filesystem stats ----\n");
 }
+static ConCommand dumpstats("holylib_filesystem_dumpstats", DumpStatsCmd, "Dumps the filesystem stats. Pass csv or json to also write them into vprof/", 0);
 
-static Detouring::Hook detour_CBaseFileSystem_IsDirectory;
-static bool hook_CBaseFileSystem_IsDirectory(void* filesystem, const char* pFileName, const char* pPathID)
+static void ResetStatsCmd(const CCommand &args)
 {
-	VPROF_BUDGET("HolyLib - CBaseFileSystem::IsDirectory", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+	ResetFileSystemTrace();
+}
+static ConCommand resetstats("holylib_filesystem_resetstats", ResetStatsCmd, "Resets the filesystem stats", 0);
 
-	if (holylib_filesystem_easydircheck.GetBool() && is_file(pFileName))
-		return false;
+/*
+ * File handle pool
+ * ----------------
+ *
+ * Read-only handles are kept open after Close and reused when the same file is opened again with the same mode & flags.
+ * A handle is only ever given to one user at a time. When it's closed it's rewound and put back into the pool.
+ * Idle handles are closed after some time or when the pool exceeds its fd budget (least recently used first).
+ * Handles of files that were written, removed or renamed are never reused.
+ * OpenForRead and Close are called by async threads too, so all of the pool's state is guarded by m_pMutex.
+ */
+static ConVar holylib_filesystem_handlepool_maxfds("holylib_filesystem_handlepool_maxfds", "128", 0,
+	"The maximum number of file handles the handle pool keeps open. The least recently used idle handles are closed first.");
+static ConVar holylib_filesystem_handlepool_idletime("holylib_filesystem_handlepool_idletime", "30", 0,
+	"The number of seconds an idle handle is kept in the handle pool.");
 
-	return detour_CBaseFileSystem_IsDirectory.GetTrampoline<Symbols::CBaseFileSystem_IsDirectory>()(filesystem, pFileName, pPathID);
-}
+extern void DeleteFileHandle(FileHandle_t handle);
+struct PooledFileHandle
+{
+	FileHandle_t pHandle;
+	std::string strKey;
+	std::string strFullPath;
+	int iRefs = 0; // 0 = idle inside the pool.
+	bool bStale = false; // The file changed. Don't reuse it.
+	double flLastUsed = 0;
+	std::list<PooledFileHandle*>::iterator pLRUIt;
+};
 
-static int pBaseLength = 0;
-static char pBaseDir[MAX_PATH];
-static Detouring::Hook detour_CBaseFileSystem_FixUpPath;
-static bool hook_CBaseFileSystem_FixUpPath(IFileSystem* filesystem, const char *pFileName, char *pFixedUpFileName, int sizeFixedUpFileName)
+class CFileHandlePool
 {
-	// NOTE for future me: 64x doesn't see to have this function anymore.
-	if (!holylib_filesystem_optimizedfixpath.GetBool())
-		return detour_CBaseFileSystem_FixUpPath.GetTrampoline<Symbols::CBaseFileSystem_FixUpPath>()(filesystem, pFileName, pFixedUpFileName, sizeFixedUpFileName);
+public:
+	static bool ShouldPool(const std::string& strFullPath, const char* pOptions)
+	{
+		if (!pOptions || pOptions[0] != 'r' || strchr(pOptions, '+')) // Only read-only handles.
+			return false;
 
-	VPROF_BUDGET("HolyLib - CBaseFileSystem::FixUpPath", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+		return V_stristr(strFullPath.c_str(), ".bsp") == NULL; // The map and the files inside its pakfile share the map's fd and break when rewound.
+	}
 
-	if (!g_pFullFileSystem)
-		g_pFullFileSystem = (IFileSystem*)filesystem;
+	FileHandle_t Acquire(const std::string& strFullPath, const char* pOptions, int iFlags)
+	{
+		m_pMutex.Lock();
+		auto it = m_pIdle.find(GetKey(strFullPath, pOptions, iFlags));
+		if (it == m_pIdle.end() || it->second.empty())
+		{
+			++m_iMisses;
+			m_pMutex.Unlock();
+			return NULL;
+		}
 
-	V_strncpy( pFixedUpFileName, pFileName, sizeFixedUpFileName );
-	V_FixSlashes( pFixedUpFileName, CORRECT_PATH_SEPARATOR );
-	V_FixDoubleSlashes( pFixedUpFileName );
+		PooledFileHandle* pEntry = it->second.back();
+		it->second.pop_back();
+		m_pLRU.erase(pEntry->pLRUIt);
+		--m_iIdleHandles;
 
-	if ( !V_IsAbsolutePath( pFixedUpFileName ) )
-	{
-		V_strlower( pFixedUpFileName );
+		g_pFullFileSystem->Seek(pEntry->pHandle, 0, FILESYSTEM_SEEK_HEAD);
+		if (g_pFullFileSystem->Tell(pEntry->pHandle) != 0)
+		{
+			if (g_pFileSystemModule.InDebug())
+				Msg("holylib - HandlePool: Failed to rewind %s. Closing it\n", pEntry->strFullPath.c_str());
+
+			CloseEntry(pEntry);
+			++m_iMisses;
+			m_pMutex.Unlock();
+			return NULL;
+		}
+
+		pEntry->iRefs = 1;
+		++m_iHits;
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - HandlePool: Reused handle for %s (%p)\n", pEntry->strFullPath.c_str(), pEntry->pHandle);
+
+		FileHandle_t pHandle = pEntry->pHandle;
+		m_pMutex.Unlock();
+		return pHandle;
 	}
-	else 
+
+	void Add(const std::string& strFullPath, const char* pOptions, int iFlags, FileHandle_t pHandle)
 	{
-		/*
-		 * What changed here ?
-		 * Gmod calls GetSearchPath every time FixUpPath is called.
-		 * Now, we only call it once and then reuse the value, since the BASE_PATH shouldn't change at runtime.
-		 */
+		m_pMutex.Lock();
+		if (m_pHandles.find(pHandle) != m_pHandles.end())
+		{
+			m_pMutex.Unlock();
+			return;
+		}
 
-		if ( pBaseLength < 3 )
-			pBaseLength = filesystem->GetSearchPath( "BASE_PATH", true, pBaseDir, sizeof( pBaseDir ) );
+		PooledFileHandle* pEntry = new PooledFileHandle;
+		pEntry->pHandle = pHandle;
+		pEntry->strKey = GetKey(strFullPath, pOptions, iFlags);
+		pEntry->strFullPath = strFullPath;
+		pEntry->iRefs = 1;
+		m_pHandles[pHandle] = pEntry;
+		m_iPeakHandles = std::max(m_iPeakHandles, (unsigned int)m_pHandles.size());
 
-		if ( pBaseLength )
+		EnforceBudget();
+		m_pMutex.Unlock();
+	}
+
+	/*
+	 * Returns true if the handle belongs to the pool. The caller must not close it then.
+	 */
+	bool Release(FileHandle_t pHandle)
+	{
+		m_pMutex.Lock();
+		auto it = m_pHandles.find(pHandle);
+		if (it == m_pHandles.end())
 		{
-			if ( *pBaseDir && (pBaseLength+1 < V_strlen( pFixedUpFileName ) ) && (0 != V_strncmp( pBaseDir, pFixedUpFileName, pBaseLength ) )  )
-			{
-				V_strlower( &pFixedUpFileName[pBaseLength-1] );
-			}
+			m_pMutex.Unlock();
+			return false;
 		}
-		
-	}
 
-	return true;
-}
+		PooledFileHandle* pEntry = it->second;
+		if (pEntry->iRefs <= 0)
+		{
+			Warning("holylib - HandlePool: Handle %p was closed twice! (%s)\n", pHandle, pEntry->strFullPath.c_str());
+			m_pMutex.Unlock();
+			return true;
+		}
 
-static std::string_view nukeFileExtension(const std::string_view& fileName) {
-	size_t lastDotPos = fileName.find_last_of('.');
-	if (lastDotPos == std::string::npos) 
-		return fileName;
+		if (--pEntry->iRefs > 0)
+		{
+			m_pMutex.Unlock();
+			return true;
+		}
 
-	return fileName.substr(0, lastDotPos);
-}
+		if (pEntry->bStale || !holylib_filesystem_cachefilehandle.GetBool())
+		{
+			CloseEntry(pEntry);
+			m_pMutex.Unlock();
+			return true;
+		}
 
-static std::string_view getFileExtension(const std::string_view& fileName) {
-	size_t lastDotPos = fileName.find_last_of('.');
-	if (lastDotPos == std::string::npos || lastDotPos == fileName.length() - 1)
-		return "";
+		pEntry->flLastUsed = Plat_FloatTime();
+		m_pIdle[pEntry->strKey].push_back(pEntry);
+		m_pLRU.push_front(pEntry);
+		pEntry->pLRUIt = m_pLRU.begin();
+		++m_iIdleHandles;
 
-	return fileName.substr(lastDotPos + 1);
-}
+		EnforceBudget();
+		m_pMutex.Unlock();
+		return true;
+	}
 
-static bool shouldWeCare(const std::string_view& fileName) { // Skip models like models/airboat.mdl
-	size_t firstSlash = fileName.find_first_of('/');
-	if (firstSlash == std::string::npos)
-		return false;
+	void Invalidate(const std::string& strFullPath) // The file was changed.
+	{
+		m_pMutex.Lock();
+		std::vector<PooledFileHandle*> pIdle;
+		for (auto& [pHandle, pEntry] : m_pHandles)
+		{
+			if (V_stricmp(pEntry->strFullPath.c_str(), strFullPath.c_str()) != 0)
+				continue;
 
-	size_t lastSlash = fileName.find_last_of('/');
-	if (lastSlash == std::string::npos || firstSlash == lastSlash)
-		return false;
+			if (pEntry->iRefs > 0)
+				pEntry->bStale = true;
+			else
+				pIdle.push_back(pEntry);
+		}
 
-	return true;
-}
+		for (PooledFileHandle* pEntry : pIdle)
+			CloseIdle(pEntry);
 
-static const char* GetOverridePath(const char* pFileName, const char* pathID)
-{
-	if (!holylib_filesystem_splitgamepath.GetBool())
-		return NULL;
+		m_pMutex.Unlock();
+	}
 
-	std::string_view strFileName = pFileName;
-	std::size_t pos = strFileName.find_first_of("/");
-	if (pos == std::string::npos)
-		return NULL;
+	void Think()
+	{
+		m_pMutex.Lock();
+		double flExpire = Plat_FloatTime() - holylib_filesystem_handlepool_idletime.GetFloat();
+		while (!m_pLRU.empty() && m_pLRU.back()->flLastUsed < flExpire)
+		{
+			++m_iExpired;
+			CloseIdle(m_pLRU.back());
+		}
+		m_pMutex.Unlock();
+	}
 
-	std::string_view strStart = strFileName.substr(0, pos);
-	static const std::unordered_map<std::string_view, std::string_view> pOverridePaths = {
-        {"materials",	"CONTENT_MATERIALS"},
-        {"models",		"CONTENT_MODELS"},
-        {"sound",		"CONTENT_SOUNDS"},
-        {"maps",		"CONTENT_MAPS"},
-        {"resource",	"CONTENT_RESOURCE"},
-        {"scripts",		"CONTENT_SCRIPTS"},
-        {"cfg",			"CONTENT_CONFIGS"},
-        {"gamemodes",	"LUA_GAMEMODES"}
-    };
-
-	auto it = pOverridePaths.find(strStart);
-	if (it != pOverridePaths.end())
-		return it->second.data();
+	void Clear() // Closes every idle handle. Handles in use are closed by their owner.
+	{
+		m_pMutex.Lock();
+		while (!m_pLRU.empty())
+			CloseIdle(m_pLRU.back());
 
-	return NULL;
+		for (auto& [pHandle, pEntry] : m_pHandles)
+			pEntry->bStale = true;
+		m_pMutex.Unlock();
+	}
 
-	/*if (pathID && (V_stricmp(pathID, "lsv") == 0 || V_stricmp(pathID, "GAME") == 0) && holylib_filesystem_splitluapath.GetBool())
+	inline bool IsEmpty()
 	{
-		if (strFileName.rfind("lua/includes/") == 0)
-			return "LUA_INCLUDES";
-
-		if (strFileName.rfind("sandbox/") == 0)
-			return "LUA_GAMEMODE_SANDBOX";
+		m_pMutex.Lock();
+		bool bEmpty = m_pHandles.empty();
+		m_pMutex.Unlock();
+		return bEmpty;
+	};
 
-		if (strFileName.rfind("effects/") == 0)
-			return "LUA_EFFECTS";
+	void Dump()
+	{
+		m_pMutex.Lock();
+		Msg("---- FileHandle pool ----\n");
+		for (auto& [pHandle, pEntry] : m_pHandles)
+			Msg("	\"%s\": %p (%s)\n", pEntry->strKey.c_str(), pHandle, pEntry->iRefs > 0 ? (pEntry->bStale ? "in use, stale" : "in use") : "idle");
+
+		unsigned int iRequests = m_iHits + m_iMisses;
+		Msg("Open handles: %i (%u idle, peak %u, budget %i)\n", (int)m_pHandles.size(), m_iIdleHandles, m_iPeakHandles, holylib_filesystem_handlepool_maxfds.GetInt());
+		Msg("Hits: %u, Misses: %u (%.2f%% hit rate)\n", m_iHits, m_iMisses, iRequests > 0 ? (m_iHits * 100.0) / iRequests : 0.0);
+		Msg("Evictions: %u, Expired: %u\n", m_iEvictions, m_iExpired);
+		Msg("---- End of FileHandle pool ----\n");
+		m_pMutex.Unlock();
+	}
 
-		if (strFileName.rfind("entities/") == 0)
-			return "LUA_ENTITIES";
+private:
+	static inline std::string GetKey(const std::string& strFullPath, const char* pOptions, int iFlags)
+	{
+		std::string strKey = strFullPath;
+		strKey.push_back('|');
+		strKey.append(pOptions);
+		strKey.push_back('|');
+		strKey.append(std::to_string(iFlags));
+		return strKey;
+	}
 
-		if (strFileName.rfind("weapons/") == 0)
-			return "LUA_WEAPONS";
+	void EnforceBudget()
+	{
+		int iBudget = std::max(holylib_filesystem_handlepool_maxfds.GetInt(), 0);
+		while ((int)m_pHandles.size() > iBudget && !m_pLRU.empty())
+		{
+			++m_iEvictions;
+			CloseIdle(m_pLRU.back());
+		}
+	}
 
-		if (strFileName.rfind("lua/derma/") == 0)
-			return "LUA_DERMA";
+	void CloseIdle(PooledFileHandle* pEntry)
+	{
+		m_pLRU.erase(pEntry->pLRUIt);
+		--m_iIdleHandles;
+		Vector_RemoveElement(m_pIdle[pEntry->strKey], pEntry);
+		CloseEntry(pEntry);
+	}
 
-		if (strFileName.rfind("lua/drive/") == 0)
-			return "LUA_DRIVE";
+	void CloseEntry(PooledFileHandle* pEntry)
+	{
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - HandlePool: Closed handle for %s (%p)\n", pEntry->strFullPath.c_str(), pEntry->pHandle);
 
-		if (strFileName.rfind("lua/entities/") == 0)
-			return "LUA_LUA_ENTITIES";
+		m_pHandles.erase(pEntry->pHandle);
+		DeleteFileHandle(pEntry->pHandle);
+		delete pEntry;
+	}
 
-		if (strFileName.rfind("vgui/") == 0)
-			return "LUA_VGUI";
+	std::unordered_map<FileHandle_t, PooledFileHandle*> m_pHandles;
+	std::unordered_map<std::string, std::vector<PooledFileHandle*>> m_pIdle;
+	std::list<PooledFileHandle*> m_pLRU; // Idle handles. Front = most recently used.
+	unsigned int m_iIdleHandles = 0;
+	unsigned int m_iPeakHandles = 0;
+	unsigned int m_iHits = 0;
+	unsigned int m_iMisses = 0;
+	unsigned int m_iEvictions = 0;
+	unsigned int m_iExpired = 0;
+	CThreadFastMutex m_pMutex; // Recursive, so closing a handle while it's locked is fine.
+};
+static CFileHandlePool g_pFileHandlePool;
 
-		if (strFileName.rfind("postprocess/") == 0)
-			return "LUA_POSTPROCESS";
+static FileHandle_t GetFileHandleFromPool(const CSearchPath* pSearchPath, const CFileOpenInfo& openInfo)
+{
+	if (!holylib_filesystem_cachefilehandle.GetBool() || openInfo.m_ppszResolvedFilename) // The caller wants the resolved name, which we can't give it.
+		return NULL;
 
-		if (strFileName.rfind("matproxy/") == 0)
-			return "LUA_MATPROXY";
+	std::string strFullPath = GetFullPath(pSearchPath, openInfo.m_pFileName);
+	if (!CFileHandlePool::ShouldPool(strFullPath, openInfo.m_pOptions))
+		return NULL;
 
-		if (strFileName.rfind("autorun/") == 0)
-			return "LUA_AUTORUN";
-	}*/
+	FileHandle_t pHandle = g_pFileHandlePool.Acquire(strFullPath, openInfo.m_pOptions, openInfo.m_Flags);
+	TraceCacheResult(FSCACHE_HANDLEPOOL, pHandle != NULL);
 
-	return NULL;
+	return pHandle;
 }
 
-static std::unordered_map<std::string_view, std::string_view> g_pOverridePaths;
-void AddOveridePath(const char* pFileName, const char* pPathID)
+static void AddFileHandleToPool(const CFileOpenInfo& openInfo, FileHandle_t pHandle)
 {
-	char* cFileName = new char[MAX_PATH];
-	V_strncpy(cFileName, pFileName, MAX_PATH);
+	if (!holylib_filesystem_cachefilehandle.GetBool() || !pHandle)
+		return;
 
-	char* cPathID = new char[MAX_PATH];
-	V_strncpy(cPathID, pPathID, MAX_PATH);
+	std::string strFullPath = GetFullPath(openInfo.m_pSearchPath, openInfo.m_pFileName);
+	if (!CFileHandlePool::ShouldPool(strFullPath, openInfo.m_pOptions))
+		return;
 
-	g_pOverridePaths[cFileName] = cPathID;
+	g_pFileHandlePool.Add(strFullPath, openInfo.m_pOptions, openInfo.m_Flags, pHandle);
 }
 
 /*
- * This is the OpenForRead implementation but faster.
+ * Search cache
+ * ------------
+ *
+ * All strings are interned into an arena so every filename / pathID is only stored once.
+ * The entries are stored in one flat open-addressing table keyed by (pathID, filename).
+ * Each entry has its precomputed case-insensitive hash so a lookup normally only compares the hash.
+ * Removing an entry doesn't free its string. The arena is freed as a whole when the cache gets nuked.
  */
-static Detouring::Hook detour_CBaseFileSystem_OpenForRead;
-static FileHandle_t hook_CBaseFileSystem_OpenForRead(CBaseFileSystem* filesystem, const char *pFileNameT, const char *pOptions, unsigned flags, const char *pathID, char **ppszResolvedFilename)
+static inline unsigned int HashPathString(const char* pStr, unsigned int iHash = 2166136261u)
 {
-	VPROF_BUDGET("HolyLib - CBaseFileSystem::OpenForRead", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+	while (*pStr)
+	{
+		iHash ^= (unsigned char)V_tolower(*pStr++);
+		iHash *= 16777619u;
+	}
 
-	char pFileNameBuff[MAX_PATH];
-	const char *pFileName = pFileNameBuff;
+	return iHash;
+}
 
-	hook_CBaseFileSystem_FixUpPath(filesystem, pFileNameT, pFileNameBuff, sizeof(pFileNameBuff));
+#define SEARCHCACHE_ARENA_BLOCKSIZE (1 << 16)
+class CPathStringArena
+{
+public:
+	~CPathStringArena()
+	{
+		Clear();
+	}
 
-	bool splitPath = false;
-	const char* origPath = pathID;
-	const char* newPath = GetOverridePath(pFileName, pathID);
-	if (newPath)
+	const char* Allocate(const char* pStr, unsigned int iLength)
 	{
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - OpenForRead: Found split path! switching (%s, %s)\n", pathID, newPath);
+		unsigned int iSize = iLength + 1;
+		if (iSize > SEARCHCACHE_ARENA_BLOCKSIZE)
+		{
+			char* pBlock = new char[iSize]; // Should never happen since paths are limited to MAX_PATH.
+			m_iMemoryUsage += iSize;
+			m_pLargeBlocks.push_back(pBlock);
+			memcpy(pBlock, pStr, iSize);
+			return pBlock;
+		}
 
-		pathID = newPath;
-		splitPath = true;
+		if (m_pBlocks.empty() || (m_iUsed + iSize) > SEARCHCACHE_ARENA_BLOCKSIZE)
+		{
+			m_pBlocks.push_back(new char[SEARCHCACHE_ARENA_BLOCKSIZE]);
+			m_iMemoryUsage += SEARCHCACHE_ARENA_BLOCKSIZE;
+			m_iUsed = 0;
+		}
+
+		char* pString = m_pBlocks.back() + m_iUsed;
+		memcpy(pString, pStr, iSize);
+		m_iUsed += iSize;
+		return pString;
+	}
+
+	void Clear()
+	{
+		for (char* pBlock : m_pBlocks)
+			delete[] pBlock;
+
+		for (char* pBlock : m_pLargeBlocks)
+			delete[] pBlock;
+
+		m_pBlocks.clear();
+		m_pLargeBlocks.clear();
+		m_iUsed = 0;
+		m_iMemoryUsage = 0;
 	}
 
-	if (holylib_filesystem_forcepath.GetBool())
+	inline size_t GetMemoryUsage() { return m_iMemoryUsage; };
+
+private:
+	std::vector<char*> m_pBlocks;
+	std::vector<char*> m_pLargeBlocks;
+	unsigned int m_iUsed = 0;
+	size_t m_iMemoryUsage = 0;
+};
+
+class CSearchCacheTable
+{
+public:
+	~CSearchCacheTable()
 	{
-		newPath = NULL;
-		std::string_view strFileName = pFileName;
+		Clear();
+	}
 
-		auto it = g_pOverridePaths.find(strFileName);
-		if (it != g_pOverridePaths.end())
-			newPath = it->second.data();
+	bool Insert(const char* pFileName, int iStoreID, const char* pPathID) // Returns true if the table changed.
+	{
+		if (m_iCount + m_iCount / 2 >= m_iCapacity) // Keep the load factor below ~0.66
+			Grow();
 
-		if (newPath)
+		unsigned int iHash = GetKeyHash(pFileName, pPathID);
+		unsigned int iSlot = iHash & (m_iCapacity - 1);
+		while (m_pEntries[iSlot].pFileName)
 		{
-			FileHandle_t handle = detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
-			if (handle) {
-				if (g_pFileSystemModule.InDebug())
-					Msg("holylib - OpenForRead: Found file in forced path! (%s, %s, %s)\n", pFileNameT, pathID, newPath);
+			SearchCacheEntry& pEntry = m_pEntries[iSlot];
+			if (pEntry.iHash == iHash && IsEntry(pEntry, pFileName, pPathID))
+			{
+				if (pEntry.iStoreID == iStoreID)
+					return false;
 
-				return handle;
-			} else {
-				if (g_pFileSystemModule.InDebug())
-					Msg("holylib - OpenForRead: Failed to find file in forced path! (%s, %s, %s)\n", pFileNameT, pathID, newPath);
+				pEntry.iStoreID = iStoreID;
+				return true;
 			}
-		} else {
-			if (g_pFileSystemModule.InDebug())
-				Msg("holylib - OpenForRead: File is not in overridePaths (%s, %s)\n", pFileNameT, pathID);
+
+			iSlot = (iSlot + 1) & (m_iCapacity - 1);
 		}
+
+		SearchCacheEntry& pEntry = m_pEntries[iSlot];
+		pEntry.iHash = iHash;
+		pEntry.iStoreID = iStoreID;
+		pEntry.pFileName = Intern(pFileName);
+		pEntry.pPathID = Intern(pPathID);
+		++m_iCount;
+		return true;
 	}
 
-	/*
-	 * The Prediction
-	 * --------------
-	 * 
-	 * I predict that all files are inside the same search paths.
-	 * With this prediction I can now get the search path of the .mdl file
-	 * and search in that one to find a file. If It's not found we say it doesn't exist.
-	 * 
-	 * The prediction currently is only implemented for models 
-	 * -> .mdl .vdd .vtx .phy .ani and the other fancy formats.
-	 */
-	if (holylib_filesystem_predictpath.GetBool() || holylib_filesystem_predictexistance.GetBool())
+	bool Find(const char* pFileName, const char* pPathID, int& iStoreID)
 	{
-		std::string_view strFileName = pFileNameT;
-		std::string_view extension = getFileExtension(strFileName);
-		CSearchPath* path = NULL;
-		bool isModel = false;
-		if (extension == "vvd" || extension == "vtx" || extension == "phy" || extension == "ani")
-			isModel = true;
+		if (m_iCount == 0)
+			return false;
 
-		if (isModel)
+		unsigned int iHash = GetKeyHash(pFileName, pPathID);
+		unsigned int iSlot = iHash & (m_iCapacity - 1);
+		while (m_pEntries[iSlot].pFileName)
 		{
-			if (shouldWeCare(strFileName)) // Skip shitty files. I had enouth
+			SearchCacheEntry& pEntry = m_pEntries[iSlot];
+			if (pEntry.iHash == iHash && IsEntry(pEntry, pFileName, pPathID))
 			{
-				std::string_view mdlPath = nukeFileExtension(strFileName);
-				if (extension == "vtx")
-					mdlPath = nukeFileExtension(mdlPath); // "dx90.vtx" -> "dx90" -> ""
+				iStoreID = pEntry.iStoreID;
+				return true;
+			}
 
-				std::string finalMDLPath = (std::string)mdlPath + ".mdl";
-				path = GetPathFromSearchCache(finalMDLPath.c_str(), pathID);
-				if (!path)
-					if (g_pFileSystemModule.InDebug())
-						Msg("holylib - Prediction: failed to build a path? (%s, %s, %s)\n", finalMDLPath.c_str(), pathID, strFileName.data());
-			} else
-				if (g_pFileSystemModule.InDebug())
-					Msg("holylib - Prediction: We decided to not care about this specific file! (%s)\n", strFileName.data());
+			iSlot = (iSlot + 1) & (m_iCapacity - 1);
 		}
 
-		if (extension == "lmp") // .lmp -> map lump
-		{
-			// ToDo
-		}
+		return false;
+	}
 
-		if (extension == "vmt")
-		{
-			// ToDo. I got no plan how but I'll come up with one hopefully
-		}
+	bool Remove(const char* pFileName, const char* pPathID)
+	{
+		if (m_iCount == 0)
+			return false;
 
-		if (extension == "lua")
+		unsigned int iMask = m_iCapacity - 1;
+		unsigned int iHash = GetKeyHash(pFileName, pPathID);
+		unsigned int iSlot = iHash & iMask;
+		while (m_pEntries[iSlot].pFileName)
 		{
-			// ToDo. Time to predict lua. We actually need to do this in FastFileTime or so
+			SearchCacheEntry& pEntry = m_pEntries[iSlot];
+			if (pEntry.iHash == iHash && IsEntry(pEntry, pFileName, pPathID))
+				break;
+
+			iSlot = (iSlot + 1) & iMask;
 		}
 
-		if (path)
+		if (!m_pEntries[iSlot].pFileName)
+			return false;
+
+		// Backward shift deletion so we never need tombstones.
+		unsigned int iNext = (iSlot + 1) & iMask;
+		while (m_pEntries[iNext].pFileName)
 		{
-			CFileOpenInfo openInfo( filesystem, pFileName, NULL, pOptions, flags, ppszResolvedFilename );
-			openInfo.m_pSearchPath = path;
-			FileHandle_t file = hook_CBaseFileSystem_FindFileInSearchPath(filesystem, openInfo);
-			if (file) {
-				if (g_pFileSystemModule.InDebug())
-					Msg("holylib - Prediction: Found file in predicted path! (%s, %s)\n", pFileNameT, pathID);
+			unsigned int iHome = m_pEntries[iNext].iHash & iMask;
+			bool bCanMove = (iSlot <= iNext) ? (iHome <= iSlot || iHome > iNext) : (iHome <= iSlot && iHome > iNext);
+			if (bCanMove)
+			{
+				m_pEntries[iSlot] = m_pEntries[iNext];
+				iSlot = iNext;
+			}
 
-				if (holylib_filesystem_cachefilehandle.GetBool())
-					AddFileHandleToCache(GetFullPath(openInfo.m_pSearchPath, openInfo.m_pFileName), file);
+			iNext = (iNext + 1) & iMask;
+		}
 
-				return file;
-			} else {
-				if (g_pFileSystemModule.InDebug())
-					Msg("holylib - Prediction: Failed to predict file path! (%s, %s)\n", pFileNameT, pathID);
+		m_pEntries[iSlot] = SearchCacheEntry();
+		--m_iCount;
+		return true;
+	}
 
-				if (holylib_filesystem_predictexistance.GetBool())
-				{
-					if (g_pFileSystemModule.InDebug())
-					{
-						Msg("holylib - Prediction: predicted path failed. Let's say it doesn't exist.\n");
-						FileHandle_t file2 = detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
-						if (file2) // Verify in debug that the predictions we make are correct.
-						{
-							Msg("holylib - Prediction Error!: We predicted it to not exist, but it exists\n");
-							g_pFullFileSystem->Close(file2); // We still return NULL!
-						}
-					}
+	void Clear()
+	{
+		delete[] m_pEntries;
+		m_pEntries = NULL;
+		m_iCapacity = 0;
+		m_iCount = 0;
 
-					std::string realStrFileName = strFileName.data();
-					auto it = m_PredictionCheck.find(realStrFileName); // This could cause additional slowdown :/
-					if (it != m_PredictionCheck.end())
-						return NULL;
+		delete[] m_pInterned;
+		m_pInterned = NULL;
+		m_iInternedCapacity = 0;
+		m_iInternedCount = 0;
 
-					m_PredictionCheck.insert(realStrFileName);
+		m_pArena.Clear();
+	}
 
-					return NULL;
-				}
-			}
-		} else {
-			if (g_pFileSystemModule.InDebug())
-				Msg("holylib - Prediction: Not predicting it! (%s, %s, %s)\n", pFileNameT, pathID, extension.data());
+	template<typename Func>
+	void ForEach(Func pFunc) // pFunc(const char* pFileName, int iStoreID, const char* pPathID)
+	{
+		for (unsigned int i = 0; i < m_iCapacity; ++i)
+		{
+			SearchCacheEntry& pEntry = m_pEntries[i];
+			if (pEntry.pFileName)
+				pFunc(pEntry.pFileName, pEntry.iStoreID, pEntry.pPathID);
 		}
 	}
 
-	if (!holylib_filesystem_earlysearchcache.GetBool())
-		return detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
+	inline unsigned int Count() { return m_iCount; };
+	inline size_t GetMemoryUsage()
+	{
+		return m_pArena.GetMemoryUsage() + (sizeof(SearchCacheEntry) * m_iCapacity) + (sizeof(InternedString) * m_iInternedCapacity);
+	};
 
-	if (V_IsAbsolutePath(pFileName))
-		return detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
+private:
+	struct SearchCacheEntry
+	{
+		unsigned int iHash = 0;
+		int iStoreID = -1;
+		const char* pFileName = NULL; // NULL = empty slot.
+		const char* pPathID = NULL;
+	};
 
-	// So we now got the issue that CBaseFileSystem::CSearchPathsIterator::CSearchPathsIterator is way too slow.
-	// so we need to skip it. We do this by checking if we got the file in the search cache before we call the OpenForRead function.
-	CSearchPath* cachePath = GetPathFromSearchCache(pFileName, pathID);
-	if (cachePath)
+	struct InternedString
 	{
-		VPROF_BUDGET("HolyLib - SearchCache::OpenForRead", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+		unsigned int iHash = 0;
+		unsigned int iLength = 0;
+		const char* pString = NULL;
+	};
+
+	static inline unsigned int GetKeyHash(const char* pFileName, const char* pPathID)
+	{
+		return HashPathString(pFileName, HashPathString(pPathID) * 31u);
+	}
+
+	static inline bool IsEntry(const SearchCacheEntry& pEntry, const char* pFileName, const char* pPathID)
+	{
+		return (pEntry.pPathID == pPathID || V_stricmp(pEntry.pPathID, pPathID) == 0) && V_stricmp(pEntry.pFileName, pFileName) == 0;
+	}
 
-		if (holylib_filesystem_cachefilehandle.GetBool())
+	void Grow()
+	{
+		unsigned int iOldCapacity = m_iCapacity;
+		SearchCacheEntry* pOldEntries = m_pEntries;
+
+		m_iCapacity = iOldCapacity ? iOldCapacity * 2 : 1024;
+		m_pEntries = new SearchCacheEntry[m_iCapacity];
+		for (unsigned int i = 0; i < iOldCapacity; ++i)
 		{
-			FileHandle_t cacheFile = GetFileHandleFromCache(GetFullPath(cachePath, pFileName));
-			if (cacheFile)
-				return cacheFile;
+			SearchCacheEntry& pEntry = pOldEntries[i];
+			if (!pEntry.pFileName)
+				continue;
+
+			unsigned int iSlot = pEntry.iHash & (m_iCapacity - 1);
+			while (m_pEntries[iSlot].pFileName)
+				iSlot = (iSlot + 1) & (m_iCapacity - 1);
+
+			m_pEntries[iSlot] = pEntry;
 		}
 
-		CFileOpenInfo openInfo( filesystem, pFileName, NULL, pOptions, flags, ppszResolvedFilename );
-		openInfo.m_pSearchPath = cachePath;
-		FileHandle_t file = detour_CBaseFileSystem_FindFileInSearchPath.GetTrampoline<Symbols::CBaseFileSystem_FindFileInSearchPath>()(filesystem, openInfo);
-		if (file)
+		delete[] pOldEntries;
+	}
+
+	const char* Intern(const char* pStr)
+	{
+		if (m_iInternedCount + m_iInternedCount / 2 >= m_iInternedCapacity)
+			GrowInterned();
+
+		unsigned int iLength = V_strlen(pStr);
+		unsigned int iHash = HashPathString(pStr);
+		unsigned int iSlot = iHash & (m_iInternedCapacity - 1);
+		while (m_pInterned[iSlot].pString)
 		{
-			if (holylib_filesystem_cachefilehandle.GetBool())
-				AddFileHandleToCache(GetFullPath(openInfo.m_pSearchPath, openInfo.m_pFileName), file);
+			InternedString& pInterned = m_pInterned[iSlot];
+			if (pInterned.iHash == iHash && pInterned.iLength == iLength && V_stricmp(pInterned.pString, pStr) == 0)
+				return pInterned.pString;
 
-			return file;
+			iSlot = (iSlot + 1) & (m_iInternedCapacity - 1);
 		}
-	} else {
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - OpenForRead: Failed to find cachePath! (%s)\n", pFileName);
+
+		InternedString& pInterned = m_pInterned[iSlot];
+		pInterned.iHash = iHash;
+		pInterned.iLength = iLength;
+		pInterned.pString = m_pArena.Allocate(pStr, iLength);
+		++m_iInternedCount;
+		return pInterned.pString;
 	}
-	
-	if (splitPath && holylib_filesystem_splitfallback.GetBool())
+
+	void GrowInterned()
 	{
-		FileHandle_t file = detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
-		if (file)
-			return file;
+		unsigned int iOldCapacity = m_iInternedCapacity;
+		InternedString* pOldInterned = m_pInterned;
 
-		// ToDo: Find out why map content isn't found properly.
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - OpenForRead: Failed to find file in splitPath! Failling back to original. This is slow! (%s)\n", pFileName);
+		m_iInternedCapacity = iOldCapacity ? iOldCapacity * 2 : 1024;
+		m_pInterned = new InternedString[m_iInternedCapacity];
+		for (unsigned int i = 0; i < iOldCapacity; ++i)
+		{
+			InternedString& pInterned = pOldInterned[i];
+			if (!pInterned.pString)
+				continue;
 
-		pathID = origPath;
+			unsigned int iSlot = pInterned.iHash & (m_iInternedCapacity - 1);
+			while (m_pInterned[iSlot].pString)
+				iSlot = (iSlot + 1) & (m_iInternedCapacity - 1);
+
+			m_pInterned[iSlot] = pInterned;
+		}
+
+		delete[] pOldInterned;
 	}
 
-	return detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
+	SearchCacheEntry* m_pEntries = NULL;
+	unsigned int m_iCapacity = 0; // Always a power of 2
+	unsigned int m_iCount = 0;
+
+	InternedString* m_pInterned = NULL;
+	unsigned int m_iInternedCapacity = 0;
+	unsigned int m_iInternedCount = 0;
+
+	CPathStringArena m_pArena;
+};
+
+static CSearchCacheTable m_SearchCache;
+static bool g_bSearchCacheDirty = false; // Set when the search cache changed since it was last saved / loaded.
+static CThreadFastMutex g_pSearchCacheMutex; // The OpenForRead & co hooks can be called by async threads. Never call into the filesystem while holding it.
+static void AddFileToSearchCache(const char* pFileName, int path, const char* pathID)
+{
+	if (!pathID)
+		pathID = nullPath;
+
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - AddFileToSearchCache: Added file %s to seach cache (%i, %s)\n", pFileName, path, pathID);
+
+	g_pSearchCacheMutex.Lock();
+	if (m_SearchCache.Insert(pFileName, path, pathID))
+		g_bSearchCacheDirty = true;
+	g_pSearchCacheMutex.Unlock();
+}
+
+
+static void RemoveFileFromSearchCache(const char* pFileName, const char* pathID)
+{
+	if (!pathID)
+		pathID = nullPath;
+
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - RemoveFileFromSearchCache: Removed file %s from seach cache! (%s)\n", pFileName, pathID);
+
+	g_pSearchCacheMutex.Lock();
+	if (m_SearchCache.Remove(pFileName, pathID))
+		g_bSearchCacheDirty = true;
+	g_pSearchCacheMutex.Unlock();
+}
+
+static CSearchPath* GetPathFromSearchCache(const char* pFileName, const char* pathID)
+{
+	if (!pathID)
+		pathID = nullPath;
+
+	int iStoreID;
+	g_pSearchCacheMutex.Lock();
+	bool bFound = m_SearchCache.Find(pFileName, pathID, iStoreID);
+	g_pSearchCacheMutex.Unlock();
+	TraceCacheResult(FSCACHE_SEARCHCACHE, bFound);
+	if (!bFound)
+		return NULL; // We should add a debug print to see if we make a mistake somewhere
+
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - GetPathFromSearchCache: Getting search path for file %s from cache!\n", pFileName);
+
+	return FindSearchPathByStoreId(iStoreID);
+}
+
+static void NukeSearchCache() // NOTE: We actually never nuke it :D
+{
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - NukeSearchCache: Search cache got nuked\n");
+
+	g_pSearchCacheMutex.Lock();
+	m_SearchCache.Clear(); // Frees all strings since they all live in the arena.
+	g_bSearchCacheDirty = true;
+	g_pSearchCacheMutex.Unlock();
 }
 
 /*
- * GMOD first calls GetFileTime and then OpenForRead, so we need to make changes for lua in GetFileTime.
+ * Persistent search cache
+ * -----------------------
+ *
+ * The search cache is written into a binary file on LevelShutdown / Shutdown and loaded again on startup.
+ * StoreIDs change between restarts, so we save the path string of the searchpath and resolve it again when loading.
+ * The file contains a fingerprint of all searchpaths. If it doesn't match the current searchpaths, we don't use the file.
+ * Stale entries are removed by the hooks when the cached searchpath fails to find the file.
+ *
+ * Layout:
+ * SearchCacheFileHeader
+ * SearchCacheFileEntry[iEntries]
+ * char[iStringTableSize] (null terminated strings referenced by the entries)
  */
+static ConVar holylib_filesystem_persistentsearchcache("holylib_filesystem_persistentsearchcache", "0", 0,
+	"If enabled, the search cache will be saved on level change / shutdown and loaded again on startup.");
 
-namespace IGamemodeSystem
+#define SEARCHCACHE_FILE "holylib/searchcache.dat"
+#define SEARCHCACHE_FILE_TMP "holylib/searchcache.dat.tmp"
+#define SEARCHCACHE_MAGIC 0x43534C48 // 'HLSC'
+#define SEARCHCACHE_VERSION 1
+#define SEARCHCACHE_STOREID_SCANGAP 1024 // How many StoreIDs in a row can be missing before we assume we found all searchpaths.
+
+struct SearchCacheFileHeader
 {
-	struct UpdatedInformation
+	unsigned int iMagic;
+	unsigned int iVersion;
+	uint64 iFingerprint;
+	unsigned int iEntries;
+	unsigned int iStringTableSize;
+};
+
+struct SearchCacheFileEntry
+{
+	unsigned int iPathID; // Offsets into the string table.
+	unsigned int iFileName;
+	unsigned int iSearchPath;
+};
+
+static inline uint64 FNV1a64(const char* pStr, uint64 iHash = 0xcbf29ce484222325ull)
+{
+	while (*pStr)
 	{
-		bool exists;
-		bool menusystem;
-#ifndef WIN32
-		const char* title;
-		const char* name;
-		const char* maps;
-		const char* basename;
-		const char* category;
-#else
-		std::string title;
-		std::string name;
-		std::string maps;
-		std::string basename;
-		std::string category;
-#endif
-		uint64_t workshopid;
-	};
+		iHash ^= (unsigned char)*pStr++;
+		iHash *= 0x100000001b3ull;
+	}
+
+	return iHash;
+}
+
+static inline bool IsMapSearchPath(const char* pPath) // Map paths change every level, so they are never part of the fingerprint.
+{
+	std::string_view strPath = pPath;
+	return strPath.length() >= 4 && V_stricmp(strPath.substr(strPath.length() - 4).data(), ".bsp") == 0;
+}
+
+static inline std::string GetSearchPathKey(const char* pPathID, const char* pPath)
+{
+	std::string strKey = pPathID ? pPathID : nullPath;
+	strKey.append("|");
+	strKey.append(pPath);
+	return strKey;
 }
 
 /*
- * GMOD Likes to use paths like "sandbox/gamemode/spawnmenu/sandbox/gamemode/spawnmenu/".
- * This wastes performance, so we fix them up to be "sandbox/gamemode/spawnmenu/"
+ * Walks all searchpaths by their StoreID and builds the fingerprint and a lookup to get the StoreID from a path.
+ * There is no other way for us to iterate the searchpaths since we don't have the m_SearchPaths offset.
  */
-static std::string_view fixGamemodePath(IFileSystem* filesystem, std::string_view path)
+static uint64 BuildSearchPathLookup(std::unordered_map<std::string, int>* pLookup)
 {
-	std::string_view activeGamemode = ((const IGamemodeSystem::UpdatedInformation&)filesystem->Gamemodes()->Active()).name;
-	if (activeGamemode.empty())
-		return path;
-
-	if (path.rfind("gamemodes/") == 0)
-		return path;
+	uint64 iFingerprint = FNV1a64("");
+	int iMissing = 0;
+	for (int iStoreID = 0; iMissing < SEARCHCACHE_STOREID_SCANGAP; ++iStoreID)
+	{
+		CSearchPath* pSearchPath = FindSearchPathByStoreId(iStoreID);
+		if (!pSearchPath)
+		{
+			++iMissing;
+			continue;
+		}
 
-	std::string searchStr = "/";
-	searchStr.append(activeGamemode);
-	searchStr.append("/gamemode/"); // Final string should be /[Active Gamemode]/gamemode/
-	size_t pos = path.find(searchStr);
-	if (pos == std::string::npos)
-		return path;
+		iMissing = 0;
+		const char* pPath = pSearchPath->GetPathString();
+		if (!pPath || IsMapSearchPath(pPath))
+			continue;
 
-	if (g_pFileSystemModule.InDebug())
-		Msg("fixGamemodePath: Fixed up path. (%s -> %s)\n", path.data(), path.substr(pos + 1).data());
+		std::string strKey = GetSearchPathKey(pSearchPath->GetPathIDString(), pPath);
+		iFingerprint = FNV1a64(strKey.c_str(), iFingerprint);
+		if (pLookup)
+			(*pLookup)[strKey] = iStoreID;
+	}
 
-	return path.substr(pos + 1);
+	return iFingerprint;
 }
 
-static Detouring::Hook detour_CBaseFileSystem_GetFileTime;
-static long hook_CBaseFileSystem_GetFileTime(IFileSystem* filesystem, const char *pFileName, const char *pPathID)
+static void SaveSearchCache(bool bForce = false) // LevelShutdown can be called multiple times per map, so we only save if something changed.
 {
-	VPROF_BUDGET("HolyLib - CBaseFileSystem::GetFileTime", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
-	
-	bool bSplitPath = false;
-	const char* origPath = pPathID;
-	const char* newPath = GetOverridePath(pFileName, pPathID);
-	if (newPath)
+	if (!holylib_filesystem_persistentsearchcache.GetBool() || !func_CBaseFileSystem_FindSearchPathByStoreId)
+		return;
+
+	VPROF_BUDGET("HolyLib - SaveSearchCache", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	struct SearchCacheSnapshot
 	{
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - GetFileTime: Found split path! switching (%s, %s)\n", pPathID, newPath);
+		std::string strFileName;
+		std::string strPathID;
+		int iStoreID;
+	};
 
-		pPathID = newPath;
-		bSplitPath = true;
+	// Copy the entries so that we don't hold the lock while FindSearchPathByStoreId takes the searchpath lock of the filesystem.
+	std::vector<SearchCacheSnapshot> pSnapshot;
+	g_pSearchCacheMutex.Lock();
+	if (!g_bSearchCacheDirty && !bForce)
+	{
+		g_pSearchCacheMutex.Unlock();
+		return;
 	}
 
-	std::string_view strFileName = pFileName; // Workaround for now.
-	if (origPath && V_stricmp(origPath, "lsv") == 0 && holylib_filesystem_fixgmodpath.GetBool()) // Some weird things happen in the lsv path.  
+	pSnapshot.reserve(m_SearchCache.Count());
+	m_SearchCache.ForEach([&](const char* pFileName, int iStoreID, const char* pPathID) {
+		pSnapshot.push_back({pFileName, pPathID, iStoreID});
+	});
+	g_bSearchCacheDirty = false; // Anything added from now on will be saved the next time.
+	g_pSearchCacheMutex.Unlock();
+
+	std::vector<SearchCacheFileEntry> pEntries;
+	std::string strStringTable;
+	std::unordered_map<std::string_view, unsigned int> pStringOffsets; // Keys point into the snapshot / searchpaths which outlive this function.
+	auto AddString = [&](std::string_view strValue) -> unsigned int {
+		auto it = pStringOffsets.find(strValue);
+		if (it != pStringOffsets.end())
+			return it->second;
+
+		unsigned int iOffset = (unsigned int)strStringTable.length();
+		strStringTable.append(strValue);
+		strStringTable.push_back('\0');
+		pStringOffsets[strValue] = iOffset;
+		return iOffset;
+	};
+
+	for (const SearchCacheSnapshot& pCached : pSnapshot)
 	{
-		strFileName = fixGamemodePath(filesystem, strFileName);
+		CSearchPath* pSearchPath = FindSearchPathByStoreId(pCached.iStoreID);
+		if (!pSearchPath)
+			continue;
+
+		const char* pPath = pSearchPath->GetPathString();
+		if (!pPath || IsMapSearchPath(pPath))
+			continue;
+
+		SearchCacheFileEntry& pEntry = pEntries.emplace_back();
+		pEntry.iPathID = AddString(pCached.strPathID);
+		pEntry.iFileName = AddString(pCached.strFileName);
+		pEntry.iSearchPath = AddString(pPath);
 	}
-	pFileName = strFileName.data();
 
-	if (holylib_filesystem_forcepath.GetBool())
+	SearchCacheFileHeader pHeader;
+	pHeader.iMagic = SEARCHCACHE_MAGIC;
+	pHeader.iVersion = SEARCHCACHE_VERSION;
+	pHeader.iFingerprint = BuildSearchPathLookup(NULL);
+	pHeader.iEntries = (unsigned int)pEntries.size();
+	pHeader.iStringTableSize = (unsigned int)strStringTable.length();
+
+	g_pFullFileSystem->CreateDirHierarchy("holylib", "MOD_WRITE");
+	FileHandle_t fh = g_pFullFileSystem->Open(SEARCHCACHE_FILE_TMP, "wb", "MOD_WRITE");
+	if (!fh)
 	{
-		newPath = NULL;
+		Warning("holylib: Failed to open %s for writing!\n", SEARCHCACHE_FILE_TMP);
+		g_pSearchCacheMutex.Lock();
+		g_bSearchCacheDirty = true;
+		g_pSearchCacheMutex.Unlock();
+		return;
+	}
 
-		if (!newPath && strFileName.rfind("gamemodes/base") == 0)
-			newPath = "MOD_WRITE";
+	g_pFullFileSystem->Write(&pHeader, sizeof(pHeader), fh);
+	if (pEntries.size() > 0)
+		g_pFullFileSystem->Write(pEntries.data(), sizeof(SearchCacheFileEntry) * pEntries.size(), fh);
+	g_pFullFileSystem->Write(strStringTable.data(), strStringTable.length(), fh);
+	g_pFullFileSystem->Close(fh);
 
-		if (!newPath && strFileName.rfind("gamemodes/sandbox") == 0)
-			newPath = "MOD_WRITE";
+	// Write into a temporary file first so that a crash while saving can't leave a broken cache behind.
+	g_pFullFileSystem->RemoveFile(SEARCHCACHE_FILE, "MOD_WRITE");
+	g_pFullFileSystem->RenameFile(SEARCHCACHE_FILE_TMP, SEARCHCACHE_FILE, "MOD_WRITE");
 
-		if (!newPath && strFileName.rfind("gamemodes/terrortown") == 0)
-			newPath = "MOD_WRITE";
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - SaveSearchCache: Saved %u entries (%u bytes of strings)\n", pHeader.iEntries, pHeader.iStringTableSize);
+}
 
-		if (newPath)
-		{
-			long time = detour_CBaseFileSystem_GetFileTime.GetTrampoline<Symbols::CBaseFileSystem_GetFileTime>()(filesystem, pFileName, pPathID);
-			if (time != 0L) {
-				if (g_pFileSystemModule.InDebug())
-					Msg("holylib - GetFileTime: Found file in forced path! (%s, %s, %s)\n", pFileName, pPathID, newPath);
-				return time;
-			} else
-				if (g_pFileSystemModule.InDebug())
-					Msg("holylib - GetFileTime: Failed to find file in forced path! (%s, %s, %s)\n", pFileName, pPathID, newPath);
-		} else {
-			if (g_pFileSystemModule.InDebug())
-				Msg("holylib - GetFileTime: File is not in overridePaths (%s, %s)\n", pFileName, pPathID);
-		}
+static bool g_bSearchCacheLoaded = false;
+static void LoadSearchCache()
+{
+	if (g_bSearchCacheLoaded || !holylib_filesystem_persistentsearchcache.GetBool() || !func_CBaseFileSystem_FindSearchPathByStoreId)
+		return;
+
+	VPROF_BUDGET("HolyLib - LoadSearchCache", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	char pFullPath[MAX_PATH];
+	if (!g_pFullFileSystem->RelativePathToFullPath(SEARCHCACHE_FILE, "MOD_WRITE", pFullPath, sizeof(pFullPath)))
+		return;
+
+#ifdef SYSTEM_POSIX
+	int iFile = open(pFullPath, O_RDONLY);
+	if (iFile == -1)
+		return;
+
+	struct stat pStat;
+	if (fstat(iFile, &pStat) == -1 || pStat.st_size < (off_t)sizeof(SearchCacheFileHeader))
+	{
+		close(iFile);
+		return;
 	}
 
-	if (bSplitPath)
+	size_t iSize = (size_t)pStat.st_size;
+	void* pMapped = mmap(NULL, iSize, PROT_READ, MAP_PRIVATE, iFile, 0);
+	close(iFile);
+	if (pMapped == MAP_FAILED)
+		return;
+
+	const char* pData = (const char*)pMapped;
+#else
+	FileHandle_t fh = g_pFullFileSystem->Open(SEARCHCACHE_FILE, "rb", "MOD_WRITE");
+	if (!fh)
+		return;
+
+	size_t iSize = g_pFullFileSystem->Size(fh);
+	std::vector<char> pBuffer(iSize);
+	g_pFullFileSystem->Read(pBuffer.data(), (int)iSize, fh);
+	g_pFullFileSystem->Close(fh);
+
+	if (iSize < sizeof(SearchCacheFileHeader))
+		return;
+
+	const char* pData = pBuffer.data();
+#endif
+
+	std::unordered_map<std::string, int> pLookup;
+	const SearchCacheFileHeader* pHeader = (const SearchCacheFileHeader*)pData;
+	const SearchCacheFileEntry* pEntries = (const SearchCacheFileEntry*)(pData + sizeof(SearchCacheFileHeader));
+	const char* pStringTable = (const char*)(pEntries + pHeader->iEntries);
+	bool bValid = pHeader->iMagic == SEARCHCACHE_MAGIC && pHeader->iVersion == SEARCHCACHE_VERSION;
+	if (bValid) // Verify that the sizes match the file so that a broken file can't make us read out of bounds.
 	{
-		long pTime = detour_CBaseFileSystem_GetFileTime.GetTrampoline<Symbols::CBaseFileSystem_GetFileTime>()(filesystem, pFileName, pPathID);
-		if (pTime != 0L)
-			return pTime;
+		uint64 iExpectedSize = (uint64)sizeof(SearchCacheFileHeader) + (uint64)pHeader->iEntries * sizeof(SearchCacheFileEntry) + pHeader->iStringTableSize;
+		bValid = iExpectedSize == iSize && (pHeader->iStringTableSize == 0 || pStringTable[pHeader->iStringTableSize - 1] == '\0');
+	}
 
+	if (bValid && pHeader->iFingerprint != BuildSearchPathLookup(&pLookup))
+	{
 		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - GetFileTime: Splitpath failed! (%s, %s, %s)\n", pFileName, pPathID, origPath);
+			Msg("holylib - LoadSearchCache: Fingerprint doesn't match the current searchpaths. Not loading it yet\n");
+
+		bValid = false;
+	} else if (bValid) {
+		g_pSearchCacheMutex.Lock(); // Held over the whole loop so that entries added by other threads in the meantime still mark it dirty.
+		bool bWasDirty = g_bSearchCacheDirty;
+		int iLoaded = 0;
+		for (unsigned int i = 0; i < pHeader->iEntries; ++i)
+		{
+			const SearchCacheFileEntry& pEntry = pEntries[i];
+			if (pEntry.iPathID >= pHeader->iStringTableSize || pEntry.iFileName >= pHeader->iStringTableSize || pEntry.iSearchPath >= pHeader->iStringTableSize)
+				continue;
 
-		pPathID = origPath;
+			const char* pPathID = pStringTable + pEntry.iPathID;
+			auto it = pLookup.find(GetSearchPathKey(pPathID, pStringTable + pEntry.iSearchPath));
+			if (it == pLookup.end())
+				continue;
+
+			AddFileToSearchCache(pStringTable + pEntry.iFileName, it->second, pPathID); // The search cache interns the strings.
+			++iLoaded;
+		}
+
+		g_bSearchCacheLoaded = true;
+		g_bSearchCacheDirty = bWasDirty; // The file already contains everything we just loaded.
+		g_pSearchCacheMutex.Unlock();
+		Msg("holylib: Loaded %i search cache entries from %s\n", iLoaded, SEARCHCACHE_FILE);
 	}
 
-	return detour_CBaseFileSystem_GetFileTime.GetTrampoline<Symbols::CBaseFileSystem_GetFileTime>()(filesystem, pFileName, pPathID);
+	bool bBroken = !bValid && pHeader->iMagic != SEARCHCACHE_MAGIC;
+#ifdef SYSTEM_POSIX
+	munmap(pMapped, iSize);
+#endif
+
+	if (bBroken)
+		Warning("holylib: %s is invalid! Ignoring it.\n", SEARCHCACHE_FILE);
 }
 
-static bool gBlockRemoveAllMapPaths = false;
-static Detouring::Hook detour_CBaseFileSystem_RemoveAllMapSearchPaths;
-static void hook_CBaseFileSystem_RemoveAllMapSearchPaths(IFileSystem* filesystem)
+static void SaveSearchcacheCmd(const CCommand &args)
 {
-	if (gBlockRemoveAllMapPaths)
-		return;
+	SaveSearchCache(true);
+}
+static ConCommand savesearchcache("holylib_filesystem_savesearchcache", SaveSearchcacheCmd, "Saves the searchcache into holylib/searchcache.dat", 0);
 
-	detour_CBaseFileSystem_RemoveAllMapSearchPaths.GetTrampoline<Symbols::CBaseFileSystem_RemoveAllMapSearchPaths>()(filesystem);
+static void DumpSearchcacheCmd(const CCommand &args)
+{
+	g_pSearchCacheMutex.Lock();
+	Msg("---- Search cache ----\n");
+	m_SearchCache.ForEach([](const char* pFileName, int iStoreID, const char* pPathID) {
+		Msg("	\"%s\" - \"%s\": %i\n", pPathID, pFileName, iStoreID);
+	});
+	Msg("---- End of Search cache (%u entries, %u bytes) ----\n", m_SearchCache.Count(), (unsigned int)m_SearchCache.GetMemoryUsage());
+	g_pSearchCacheMutex.Unlock();
 }
+static ConCommand dumpsearchcache("holylib_filesystem_dumpsearchcache", DumpSearchcacheCmd, "Dumps the searchcache", 0);
 
-static std::string_view getVPKFile(const std::string_view& fileName) {
-	size_t lastThingyPos = fileName.find_last_of('/');
-	size_t lastDotPos = fileName.find_last_of('.');
+static size_t GetResidentMemory()
+{
+#ifdef SYSTEM_LINUX
+	FILE* pFile = fopen("/proc/self/statm", "r");
+	if (!pFile)
+		return 0;
 
-	return fileName.substr(lastThingyPos + 1, lastDotPos - lastThingyPos - 1);
+	long iPages = 0, iResident = 0;
+	if (fscanf(pFile, "%ld %ld", &iPages, &iResident) != 2)
+		iResident = 0;
+
+	fclose(pFile);
+	return (size_t)iResident * (size_t)sysconf(_SC_PAGESIZE);
+#else
+	return 0;
+#endif
 }
 
-static Detouring::Hook detour_CBaseFileSystem_AddSearchPath;
-static void hook_CBaseFileSystem_AddSearchPath(IFileSystem* filesystem, const char *pPath, const char *pathID, SearchPathAdd_t addType)
+/*
+ * Compares the search cache table against the nested unordered_map we used before.
+ * The old map allocated MAX_PATH bytes for every filename, so we do the same here.
+ */
+static void BenchmarkSearchcacheCmd(const CCommand &args)
 {
-	VPROF_BUDGET("HolyLib - CBaseFileSystem::AddSearchPath", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+	int iFiles = args.ArgC() > 1 ? atoi(args.Arg(1)) : 200000;
+	if (iFiles <= 0)
+	{
+		Msg("Usage: holylib_filesystem_benchmarksearchcache <files = 200000>\n");
+		return;
+	}
 
-	detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, pathID, addType);
+	static const char* pPathIDs[] = {"GAME", "CONTENT_MODELS", "CONTENT_MATERIALS", "lsv"};
+	std::vector<std::string> pFileNames;
+	pFileNames.reserve(iFiles);
+	for (int i = 0; i < iFiles; ++i)
+		pFileNames.push_back("models/holylib/benchmark/" + std::to_string(i % 512) + "/file_" + std::to_string(i) + ".mdl");
 
-	// Below is not dead code. It's code to try to solve the map contents but it currently doesn't work.
-	/*std::string_view extension = getFileExtension(pPath);
-	if (extension == "bsp") {
-		const char* pPathID = "__TEMP_MAP_PATH";
-		gBlockRemoveAllMapPaths = true;
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, pPathID, addType);
+	size_t iStartRSS = GetResidentMemory();
+	double flStart = Plat_FloatTime();
+	std::unordered_map<std::string_view, std::unordered_map<std::string_view, int>>* pOldCache = new std::unordered_map<std::string_view, std::unordered_map<std::string_view, int>>;
+	for (int i = 0; i < iFiles; ++i)
+	{
+		char* cFileName = new char[MAX_PATH];
+		V_strncpy(cFileName, pFileNames[i].c_str(), MAX_PATH);
+		(*pOldCache)[pPathIDs[i % 4]][cFileName] = i;
+	}
+	double flOldInsert = Plat_FloatTime() - flStart;
+	double flOldRSS = ((double)GetResidentMemory() - iStartRSS) / (1024.0 * 1024.0); // Only an estimate since freed memory is reused.
 
-		if (filesystem->IsDirectory("materials/", pPathID))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MATERIALS", addType);
+	flStart = Plat_FloatTime();
+	int iOldFound = 0;
+	for (int i = 0; i < iFiles; ++i)
+	{
+		auto& map = (*pOldCache)[pPathIDs[i % 4]];
+		if (map.find(pFileNames[i].c_str()) != map.end())
+			++iOldFound;
+	}
+	double flOldLookup = Plat_FloatTime() - flStart;
+
+	for (auto& [strPathID, cache] : *pOldCache)
+		for (auto& [strFileName, iStoreID] : cache)
+			delete[] strFileName.data();
+	delete pOldCache;
+
+	iStartRSS = GetResidentMemory();
+	flStart = Plat_FloatTime();
+	CSearchCacheTable* pNewCache = new CSearchCacheTable;
+	for (int i = 0; i < iFiles; ++i)
+		pNewCache->Insert(pFileNames[i].c_str(), i, pPathIDs[i % 4]);
+	double flNewInsert = Plat_FloatTime() - flStart;
+	double flNewRSS = ((double)GetResidentMemory() - iStartRSS) / (1024.0 * 1024.0);
+
+	flStart = Plat_FloatTime();
+	int iNewFound = 0;
+	int iStoreID;
+	for (int i = 0; i < iFiles; ++i)
+		if (pNewCache->Find(pFileNames[i].c_str(), pPathIDs[i % 4], iStoreID))
+			++iNewFound;
+	double flNewLookup = Plat_FloatTime() - flStart;
+	size_t iNewMemory = pNewCache->GetMemoryUsage();
+	delete pNewCache;
+
+	Msg("---- Search cache benchmark (%i files) ----\n", iFiles);
+	Msg("unordered_map: insert %.3fms, lookup %.3fms (%.2f M/s), found %i, RSS +%.2f MB\n", flOldInsert * 1000, flOldLookup * 1000, iFiles / flOldLookup / 1000000, iOldFound, flOldRSS);
+	Msg("table:         insert %.3fms, lookup %.3fms (%.2f M/s), found %i, RSS +%.2f MB (%.2f MB used)\n", flNewInsert * 1000, flNewLookup * 1000, iFiles / flNewLookup / 1000000, iNewFound, flNewRSS, iNewMemory / (1024.0 * 1024.0));
+	Msg("---- End of Search cache benchmark ----\n");
+}
+static ConCommand benchmarksearchcache("holylib_filesystem_benchmarksearchcache", BenchmarkSearchcacheCmd, "Benchmarks the searchcache table against the old unordered_map", 0);
+
+static void GetPathFromIDCmd(const CCommand &args)
+{
+	if ( args.ArgC() < 1 || V_stricmp(args.Arg(1), "") == 0 )
+	{
+		Msg("Usage: holylib_filesystem_getpathfromid <id>\n");
+		return;
+	}
+
+	CSearchPath* path = FindSearchPathByStoreId(atoi(args.Arg(1)));
+	if (!path)
+	{
+		Msg("Failed to find CSearchPath :/\n");
+		return;
+	}
+
+	Msg("Id: %s\n", args.Arg(1));
+	Msg("Path %s\n", path->GetPathString()); // Does this crash? idk.
+}
+static ConCommand getpathfromid("holylib_filesystem_getpathfromid", GetPathFromIDCmd, "prints the path of the given searchpath id", 0);
+
+static void NukeSearchcacheCmd(const CCommand &args)
+{
+	NukeSearchCache();
+}
+static ConCommand nukesearchcache("holylib_filesystem_nukesearchcache", NukeSearchcacheCmd, "Nukes the searchcache", 0);
+
+static void DumpFilecacheCmd(const CCommand &args)
+{
+	g_pFileHandlePool.Dump();
+}
+static ConCommand dumpfilecache("holylib_filesystem_dumpfilecache", DumpFilecacheCmd, "Dumps the file handle pool and its stats", 0);
+
+static void ShowPredictionErrosCmd(const CCommand &args)
+{
+	Msg("---- Prediction Errors ----\n");
+	for (const std::string& strFileName : m_PredictionCheck)
+	{
+		Msg("- \"%s\"", strFileName.c_str());
+	}
+	Msg("---- End of Prediction Errors ----\n");
+}
+static ConCommand showpredictionerrors("holylib_filesystem_showpredictionerrors", ShowPredictionErrosCmd, "Shows all prediction errors that ocurred", 0);
+
+static Detouring::Hook detour_CBaseFileSystem_FindFileInSearchPath;
+static FileHandle_t hook_CBaseFileSystem_FindFileInSearchPath(void* filesystem, CFileOpenInfo &openInfo)
+{
+	CFileSystemTrace pTrace(FSTRACE_FINDFILEINSEARCHPATH, openInfo.m_pFileName, openInfo.m_pSearchPath ? openInfo.m_pSearchPath->GetPathIDString() : NULL);
+	if (!holylib_filesystem_searchcache.GetBool())
+		return detour_CBaseFileSystem_FindFileInSearchPath.GetTrampoline<Symbols::CBaseFileSystem_FindFileInSearchPath>()(filesystem, openInfo);
+
+	if (!g_pFullFileSystem)
+		g_pFullFileSystem = (IFileSystem*)filesystem;
+
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::FindFile", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	CSearchPath* cachePath = GetPathFromSearchCache(openInfo.m_pFileName, openInfo.m_pSearchPath->GetPathIDString());
+	if (cachePath)
+	{
+		VPROF_BUDGET("HolyLib - CBaseFileSystem::FindFile - Cache", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+		FileHandle_t cacheFile = GetFileHandleFromPool(cachePath, openInfo);
+		if (cacheFile)
+			return cacheFile;
+
+		const CSearchPath* origPath = openInfo.m_pSearchPath;
+		openInfo.m_pSearchPath = cachePath;
+		FileHandle_t file = detour_CBaseFileSystem_FindFileInSearchPath.GetTrampoline<Symbols::CBaseFileSystem_FindFileInSearchPath>()(filesystem, openInfo);
+		if (file)
+		{
+			AddFileHandleToPool(openInfo, file);
+			return file;
+		}
+
+		openInfo.m_pSearchPath = origPath;
+		RemoveFileFromSearchCache(openInfo.m_pFileName, openInfo.m_pSearchPath->GetPathIDString());
+	} else {
+		FileHandle_t cacheFile = GetFileHandleFromPool(openInfo.m_pSearchPath, openInfo);
+		if (cacheFile)
+			return cacheFile;
+
+		if (g_pFileSystemModule.InDebug())
+			Msg("FindFileInSearchPath: Failed to find cachePath! (%s)\n", openInfo.m_pFileName);
+	}
+
+	FileHandle_t file = detour_CBaseFileSystem_FindFileInSearchPath.GetTrampoline<Symbols::CBaseFileSystem_FindFileInSearchPath>()(filesystem, openInfo);
+
+	if (file)
+	{
+		AddFileToSearchCache(openInfo.m_pFileName, openInfo.m_pSearchPath->m_storeId, openInfo.m_pSearchPath->GetPathIDString());
+		AddFileHandleToPool(openInfo, file);
+	}
+
+	return file;
+}
+
+static Detouring::Hook detour_CBaseFileSystem_FastFileTime;
+static long hook_CBaseFileSystem_FastFileTime(void* filesystem, const CSearchPath* path, const char* pFileName)
+{
+	CFileSystemTrace pTrace(FSTRACE_FASTFILETIME, pFileName, path->GetPathIDString());
+	if (!holylib_filesystem_searchcache.GetBool())
+		return detour_CBaseFileSystem_FastFileTime.GetTrampoline<Symbols::CBaseFileSystem_FastFileTime>()(filesystem, path, pFileName);
+
+	if (!g_pFullFileSystem)
+		g_pFullFileSystem = (IFileSystem*)filesystem;
+
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::FastFileTime", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	CSearchPath* cachePath = GetPathFromSearchCache(pFileName, path->GetPathIDString());
+	if (cachePath)
+	{
+		VPROF_BUDGET("HolyLib - CBaseFileSystem::FastFileTime - Cache", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+		long time = detour_CBaseFileSystem_FastFileTime.GetTrampoline<Symbols::CBaseFileSystem_FastFileTime>()(filesystem, cachePath, pFileName);
+		if (time != 0L)
+			return time;
+
+		RemoveFileFromSearchCache(pFileName, path->GetPathIDString());
+	} else {
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - FastFileTime: Failed to find cachePath! (%s)\n", pFileName);
+	}
+
+	long time = detour_CBaseFileSystem_FastFileTime.GetTrampoline<Symbols::CBaseFileSystem_FastFileTime>()(filesystem, path, pFileName);
+
+	if (time != 0L)
+		AddFileToSearchCache(pFileName, path->m_storeId, path->GetPathIDString());
+
+	return time;
+}
+
+static bool is_file(const char *path) {
+	const char *last_slash = strrchr(path, '/');
+	const char *last_dot = strrchr(path, '.');
+
+	return last_dot != NULL && (last_slash == NULL || last_dot > last_slash);
+}
+
+/*
+ * Virtual directory index
+ * -----------------------
+ *
+ * When a searchpath is added, we walk the directory (or parse the VPK directory tree) and store every file and folder in memory.
+ * FileExists, IsDirectory, GetFileTime and filesystem.Find are then answered from the index without touching the disk.
+ * The order of the searchpaths for a pathID is taken from GetSearchPath, so we never need to mirror the engine's order ourselves.
+ * If any searchpath of a pathID couldn't be indexed (.bsp / .gma pack files), the pathID falls back to the engine.
+ * Writes, deletes and renames done through the filesystem update the index of the searchpaths containing the file.
+ */
+static ConVar holylib_filesystem_virtualindex("holylib_filesystem_virtualindex", "0", 0,
+	"If enabled, it will build an in-memory index of all searchpaths and answer FileExists/IsDirectory/GetFileTime/Find from it.");
+
+struct VirtualFileEntry
+{
+	long iTime = 0;
+	unsigned int iSize = 0;
+	// VPK only
+	unsigned short iArchiveIndex = 0;
+	unsigned short iPreloadBytes = 0;
+	unsigned int iOffset = 0;
+};
+
+struct VirtualDirectoryEntry
+{
+	long iTime = 0;
+	std::vector<std::string> pChildren;
+};
+
+static inline std::string LowerVirtualPath(std::string_view strPath) // Keys are lowercase since CBaseFileSystem::FixUpPath lowercases every path.
+{
+	std::string strLower(strPath);
+	std::transform(strLower.begin(), strLower.end(), strLower.begin(), [](unsigned char c) { return std::tolower(c); });
+	return strLower;
+}
+
+#define VPK_SIGNATURE 0x55aa1234
+#define VPK_DIR_ARCHIVE 0x7fff // The file data is stored inside the _dir.vpk after the tree.
+class CVirtualSearchPath
+{
+public:
+	CVirtualSearchPath(const std::string& strPath) : m_strPath(strPath) {};
+
+	void Build()
+	{
+		VPROF_BUDGET("HolyLib - CVirtualSearchPath::Build", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+		m_pFiles.clear();
+		m_pDirectories.clear();
+		m_pDirectories[""]; // Root directory always exists.
+
+		std::string_view strPath = m_strPath;
+		if (strPath.length() > 0 && strPath.back() == '/')
+			m_bIndexed = BuildDirectory();
+		else if (strPath.length() > 4 && V_stricmp(strPath.substr(strPath.length() - 4).data(), ".vpk") == 0)
+			m_bIndexed = BuildVPK();
+		else
+			m_bIndexed = false; // Zip pack files like .bsp or .gma. We let the engine handle these.
+
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - VirtualIndex: Indexed %s (%s, %i files, %i directories)\n", m_strPath.c_str(), m_bIndexed ? "indexed" : "not indexable", (int)m_pFiles.size(), (int)m_pDirectories.size());
+	}
+
+	inline bool IsIndexed() { return m_bIndexed; };
+	inline bool IsPackedStore() { return m_bPackedStore; };
+	inline const std::string& GetPath() { return m_strPath; };
+	inline const std::string& GetArchiveBase() { return m_strArchiveBase; };
+
+	// Expects a lowercase name.
+	inline VirtualFileEntry* FindFile(const std::string& strFileName)
+	{
+		auto it = m_pFiles.find(strFileName);
+		return it != m_pFiles.end() ? &it->second : NULL;
+	}
+
+	inline VirtualDirectoryEntry* FindDirectory(const std::string& strDirName)
+	{
+		auto it = m_pDirectories.find(strDirName);
+		return it != m_pDirectories.end() ? &it->second : NULL;
+	}
+
+	// The names below keep their case since the children are returned by Find.
+	VirtualFileEntry& AddFile(const std::string& strFileName, long iTime, unsigned int iSize)
+	{
+		std::string strKey = LowerVirtualPath(strFileName);
+		bool bNew = m_pFiles.find(strKey) == m_pFiles.end();
+		VirtualFileEntry& pEntry = m_pFiles[strKey];
+		pEntry.iTime = iTime;
+		pEntry.iSize = iSize;
+
+		if (bNew)
+			AddToParent(strFileName, iTime);
+
+		return pEntry;
+	}
+
+	void AddDirectory(const std::string& strDirName, long iTime)
+	{
+		if (strDirName.empty())
+			return;
+
+		std::string strKey = LowerVirtualPath(strDirName);
+		if (m_pDirectories.find(strKey) != m_pDirectories.end())
+			return;
+
+		m_pDirectories[strKey].iTime = iTime;
+		AddToParent(strDirName, iTime);
+	}
+
+	void Remove(const std::string& strName)
+	{
+		std::string strKey = LowerVirtualPath(strName);
+		auto it = m_pDirectories.find(strKey);
+		if (it != m_pDirectories.end())
+		{
+			std::vector<std::string> pChildren = it->second.pChildren;
+			for (const std::string& strChild : pChildren)
+				Remove(strName + "/" + strChild);
+
+			m_pDirectories.erase(strKey);
+		} else if (m_pFiles.erase(strKey) == 0) {
+			return;
+		}
+
+		size_t iSlash = strKey.find_last_of('/');
+		auto parentIt = m_pDirectories.find(iSlash == std::string::npos ? "" : strKey.substr(0, iSlash));
+		if (parentIt == m_pDirectories.end())
+			return;
+
+		std::string strChild = strKey.substr(iSlash == std::string::npos ? 0 : iSlash + 1);
+		std::vector<std::string>& pChildren = parentIt->second.pChildren;
+		for (auto childIt = pChildren.begin(); childIt != pChildren.end(); ++childIt)
+		{
+			if (V_stricmp(childIt->c_str(), strChild.c_str()) == 0)
+			{
+				pChildren.erase(childIt);
+				break;
+			}
+		}
+	}
+
+	std::unordered_set<std::string> m_pPathIDs; // All pathIDs this searchpath was found in.
+
+private:
+	void AddToParent(const std::string& strName, long iTime)
+	{
+		size_t iSlash = strName.find_last_of('/');
+		std::string strParent = iSlash == std::string::npos ? "" : strName.substr(0, iSlash);
+		AddDirectory(strParent, iTime);
+		m_pDirectories[LowerVirtualPath(strParent)].pChildren.push_back(strName.substr(iSlash == std::string::npos ? 0 : iSlash + 1));
+	}
+
+	bool BuildDirectory()
+	{
+#ifdef SYSTEM_POSIX
+		std::vector<std::string> pPending;
+		pPending.push_back("");
+		while (!pPending.empty())
+		{
+			std::string strDir = pPending.back();
+			pPending.pop_back();
+
+			std::string strFullDir = m_strPath + strDir;
+			DIR* pDir = opendir(strFullDir.c_str());
+			if (!pDir)
+			{
+				if (strDir.empty())
+					return false; // Searchpath doesn't exist? The engine will handle it.
+
+				continue;
+			}
+
+			int iDirFD = dirfd(pDir);
+			struct dirent* pEntry;
+			while ((pEntry = readdir(pDir)) != NULL)
+			{
+				if (pEntry->d_name[0] == '.' && (pEntry->d_name[1] == '\0' || (pEntry->d_name[1] == '.' && pEntry->d_name[2] == '\0')))
+					continue;
+
+				struct stat pStat;
+				if (fstatat(iDirFD, pEntry->d_name, &pStat, 0) == -1)
+					continue;
+
+				std::string strName = strDir.empty() ? pEntry->d_name : strDir + "/" + pEntry->d_name;
+				if (S_ISDIR(pStat.st_mode))
+				{
+					AddDirectory(strName, (long)pStat.st_mtime);
+					pPending.push_back(strName);
+				} else {
+					AddFile(strName, (long)pStat.st_mtime, (unsigned int)pStat.st_size);
+				}
+			}
+
+			closedir(pDir);
+		}
+
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool BuildVPK()
+	{
+		std::string strDirFile = m_strPath;
+		if (strDirFile.length() < 8 || V_stricmp(strDirFile.substr(strDirFile.length() - 8).c_str(), "_dir.vpk") != 0)
+			strDirFile = strDirFile.substr(0, strDirFile.length() - 4) + "_dir.vpk";
+
+		m_strArchiveBase = strDirFile.substr(0, strDirFile.length() - 8); // "pak01_dir.vpk" -> "pak01" -> "pak01_000.vpk"
+
+		FILE* pFile = fopen(strDirFile.c_str(), "rb");
+		if (!pFile)
+			return false;
+
+		long iTime = 0;
+#ifdef SYSTEM_POSIX
+		struct stat pStat;
+		if (fstat(fileno(pFile), &pStat) == 0)
+			iTime = (long)pStat.st_mtime;
+#endif
+
+		unsigned int pHeader[3];
+		if (fread(pHeader, sizeof(unsigned int), 3, pFile) != 3 || pHeader[0] != VPK_SIGNATURE || (pHeader[1] != 1 && pHeader[1] != 2))
+		{
+			fclose(pFile);
+			return false;
+		}
+
+		unsigned int iHeaderSize = pHeader[1] == 2 ? 28 : 12;
+		unsigned int iTreeSize = pHeader[2];
+		std::vector<char> pTree(iTreeSize);
+		if (fseek(pFile, iHeaderSize, SEEK_SET) != 0 || fread(pTree.data(), 1, iTreeSize, pFile) != iTreeSize)
+		{
+			fclose(pFile);
+			return false;
+		}
+		fclose(pFile);
+
+		m_bPackedStore = true;
+		m_iDirDataOffset = iHeaderSize + iTreeSize;
+
+		size_t iPos = 0;
+		auto ReadString = [&]() -> const char* {
+			const char* pStr = pTree.data() + iPos;
+			while (iPos < iTreeSize && pTree[iPos] != '\0')
+				++iPos;
+
+			if (iPos >= iTreeSize)
+				return NULL;
+
+			++iPos;
+			return pStr;
+		};
+
+		#pragma pack(push, 1)
+		struct VPKEntry
+		{
+			unsigned int iCRC;
+			unsigned short iPreloadBytes;
+			unsigned short iArchiveIndex;
+			unsigned int iEntryOffset;
+			unsigned int iEntryLength;
+			unsigned short iTerminator;
+		};
+		#pragma pack(pop)
+
+		while (true)
+		{
+			const char* pExtension = ReadString();
+			if (!pExtension)
+				return false;
+
+			if (*pExtension == '\0')
+				break;
+
+			while (true)
+			{
+				const char* pPath = ReadString();
+				if (!pPath)
+					return false;
+
+				if (*pPath == '\0')
+					break;
+
+				while (true)
+				{
+					const char* pName = ReadString();
+					if (!pName)
+						return false;
+
+					if (*pName == '\0')
+						break;
+
+					if (iPos + sizeof(VPKEntry) > iTreeSize)
+						return false;
+
+					VPKEntry pVPKEntry;
+					memcpy(&pVPKEntry, pTree.data() + iPos, sizeof(VPKEntry));
+					iPos += sizeof(VPKEntry) + pVPKEntry.iPreloadBytes;
+
+					std::string strFileName;
+					if (V_strcmp(pPath, " ") != 0)
+					{
+						strFileName.append(pPath);
+						strFileName.push_back('/');
+					}
+
+					strFileName.append(pName);
+					if (V_strcmp(pExtension, " ") != 0)
+					{
+						strFileName.push_back('.');
+						strFileName.append(pExtension);
+					}
+
+					VirtualFileEntry& pEntry = AddFile(strFileName, iTime, pVPKEntry.iPreloadBytes + pVPKEntry.iEntryLength);
+					pEntry.iArchiveIndex = pVPKEntry.iArchiveIndex;
+					pEntry.iPreloadBytes = pVPKEntry.iPreloadBytes;
+					pEntry.iOffset = pVPKEntry.iArchiveIndex == VPK_DIR_ARCHIVE ? m_iDirDataOffset + pVPKEntry.iEntryOffset : pVPKEntry.iEntryOffset;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	std::string m_strPath;
+	std::string m_strArchiveBase;
+	unsigned int m_iDirDataOffset = 0;
+	bool m_bIndexed = false;
+	bool m_bPackedStore = false;
+	std::unordered_map<std::string, VirtualFileEntry> m_pFiles;
+	std::unordered_map<std::string, VirtualDirectoryEntry> m_pDirectories;
+};
+
+static std::unordered_map<std::string, CVirtualSearchPath*> g_pVirtualSearchPaths;
+static std::unordered_map<std::string, std::vector<CVirtualSearchPath*>> g_pVirtualPathIDs; // Cache. Cleared every time a searchpath is added or removed.
+static std::unordered_set<std::string> g_pUnindexablePathIDs; // Cache. pathIDs that contain a searchpath we can't index.
+static std::unordered_set<std::string> g_pVirtualIndexRequests; // pathIDs a lookup asked for that aren't built yet. VirtualIndexThink builds them.
+static unsigned int g_iVirtualIndexGeneration = 0; // Increased every time a searchpath is added or removed. A build that started before it is thrown away.
+static CThreadFastMutex g_pVirtualIndexMutex; // FileExists, IsDirectory and GetFileTime can be called by async threads. Recursive, so InvalidateVirtualPathIDs can be called while it is locked.
+// NOTE: Never call into the filesystem while g_pVirtualIndexMutex is locked! It takes its own searchpath lock, which async threads hold while calling our hooks.
+
+static inline std::string GetVirtualPathIDKey(const char* pPathID)
+{
+	return LowerVirtualPath(pPathID); // pathIDs are case insensitive in the filesystem too, so the key can be passed to it.
+}
+
+static std::vector<std::string> GetSearchPathList(const char* pPathID)
+{
+	constexpr int iSize = 1 << 16;
+	std::unique_ptr<char[]> pChar(new char[iSize]);
+	int iLength = g_pFullFileSystem->GetSearchPath(pPathID, true, pChar.get(), iSize);
+	if (iLength <= 0)
+		return {};
+
+	std::vector<std::string> pSearchPaths;
+	std::string_view strPaths(pChar.get(), std::min(iLength, iSize - 1));
+	size_t iStart = 0;
+	while (iStart < strPaths.length())
+	{
+		size_t iEnd = strPaths.find(';', iStart);
+		if (iEnd == std::string::npos)
+			iEnd = strPaths.length();
+
+		std::string_view strPath = strPaths.substr(iStart, iEnd - iStart);
+		if (!strPath.empty() && strPath.front() != '\0')
+			pSearchPaths.push_back(std::string(strPath.data(), strnlen(strPath.data(), strPath.length())));
+
+		iStart = iEnd + 1;
+	}
+
+	return pSearchPaths;
+}
+
+struct VirtualPathChange
+{
+	std::string strFullPath;
+	bool bRemoved = false;
+	bool bDirectory = false;
+	long iTime = 0;
+	unsigned int iSize = 0;
+};
+
+struct VirtualIndexBuild
+{
+	unsigned int iGeneration = 0;
+	std::unordered_map<std::string, std::vector<std::string>> pPathIDs; // pathID key -> searchpaths in order.
+	std::unordered_map<std::string, CVirtualSearchPath*> pBuilt; // Searchpaths that weren't indexed yet. Only touched by the job until it finished.
+	std::vector<VirtualPathChange> pChanges; // Changes made while building. Replayed on pBuilt before they're published.
+};
+static VirtualIndexBuild* g_pVirtualIndexBuild = NULL; // Guarded by g_pVirtualIndexMutex.
+static CJob* g_pVirtualIndexJob = NULL; // Main thread only.
+
+/*
+ * Returns the indexed searchpaths of the given pathID.
+ * Returns NULL if the pathID can't be fully answered by the index or isn't built yet, in which case it's requested so VirtualIndexThink builds it.
+ * Expects g_pVirtualIndexMutex to be locked as long as the result is used.
+ */
+static std::vector<CVirtualSearchPath*>* GetVirtualSearchPaths(const char* pPathID)
+{
+	if (!holylib_filesystem_virtualindex.GetBool() || !pPathID || !g_pFullFileSystem)
+		return NULL;
+
+	std::string strPathID = GetVirtualPathIDKey(pPathID);
+	auto it = g_pVirtualPathIDs.find(strPathID);
+	if (it != g_pVirtualPathIDs.end())
+	{
+		TraceCacheResult(FSCACHE_VIRTUALINDEX, true);
+		return &it->second;
+	}
+
+	if (g_pUnindexablePathIDs.find(strPathID) == g_pUnindexablePathIDs.end())
+		g_pVirtualIndexRequests.insert(strPathID); // Until it's built, the engine answers it.
+
+	TraceCacheResult(FSCACHE_VIRTUALINDEX, false);
+	return NULL;
+}
+
+static inline void InvalidateVirtualPathIDs()
+{
+	g_pVirtualIndexMutex.Lock();
+	for (auto& [strPathID, pPaths] : g_pVirtualPathIDs)
+		g_pVirtualIndexRequests.insert(strPathID); // Rebuild them right away instead of waiting for the next lookup.
+
+	g_pVirtualPathIDs.clear();
+	g_pUnindexablePathIDs.clear();
+	++g_iVirtualIndexGeneration;
+	g_pVirtualIndexMutex.Unlock();
+}
+
+static void UpdateVirtualSearchPath(CVirtualSearchPath* pVirtualPath, const VirtualPathChange& pChange)
+{
+	if (pVirtualPath->IsPackedStore() || !pVirtualPath->IsIndexed())
+		return;
+
+	const std::string& strPath = pVirtualPath->GetPath();
+	if (pChange.strFullPath.length() <= strPath.length() || pChange.strFullPath.compare(0, strPath.length(), strPath) != 0)
+		return;
+
+	std::string strName(pChange.strFullPath.substr(strPath.length()));
+	while (!strName.empty() && strName.back() == '/')
+		strName.pop_back();
+
+	if (pChange.bRemoved)
+		pVirtualPath->Remove(strName);
+	else if (pChange.bDirectory)
+		pVirtualPath->AddDirectory(strName, pChange.iTime);
+	else
+		pVirtualPath->AddFile(strName, pChange.iTime, pChange.iSize);
+
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - VirtualIndex: %s %s in %s\n", pChange.bRemoved ? "Removed" : "Updated", strName.c_str(), strPath.c_str());
+}
+
+static void VirtualIndexBuildJob(VirtualIndexBuild*& pBuild)
+{
+	for (auto& [strPath, pVirtualPath] : pBuild->pBuilt)
+		pVirtualPath->Build();
+}
+
+static void PublishVirtualIndexBuild()
+{
+	g_pVirtualIndexMutex.Lock();
+	VirtualIndexBuild* pBuild = g_pVirtualIndexBuild;
+	g_pVirtualIndexBuild = NULL;
+	if (pBuild->iGeneration != g_iVirtualIndexGeneration) // The searchpaths changed while building.
+	{
+		for (auto& [strPath, pVirtualPath] : pBuild->pBuilt)
+			delete pVirtualPath;
+
+		for (auto& [strPathID, pSearchPaths] : pBuild->pPathIDs)
+			g_pVirtualIndexRequests.insert(strPathID);
+	} else {
+		for (auto& [strPath, pVirtualPath] : pBuild->pBuilt)
+		{
+			for (const VirtualPathChange& pChange : pBuild->pChanges)
+				UpdateVirtualSearchPath(pVirtualPath, pChange);
+
+			g_pVirtualSearchPaths[strPath] = pVirtualPath;
+		}
+
+		for (auto& [strPathID, pSearchPaths] : pBuild->pPathIDs)
+		{
+			bool bIndexable = true;
+			std::vector<CVirtualSearchPath*> pPaths;
+			for (const std::string& strPath : pSearchPaths)
+			{
+				CVirtualSearchPath* pVirtualPath = g_pVirtualSearchPaths[strPath];
+				pVirtualPath->m_pPathIDs.insert(strPathID);
+				if (!pVirtualPath->IsIndexed())
+					bIndexable = false;
+
+				pPaths.push_back(pVirtualPath);
+			}
+
+			if (bIndexable)
+				g_pVirtualPathIDs[strPathID] = std::move(pPaths);
+			else
+				g_pUnindexablePathIDs.insert(strPathID);
+		}
+	}
+	g_pVirtualIndexMutex.Unlock();
+
+	delete pBuild;
+}
+
+static void FinishVirtualIndexBuild(bool bWait)
+{
+	if (!g_pVirtualIndexJob)
+		return;
+
+	if (bWait)
+		g_pVirtualIndexJob->WaitForFinish();
+	else if (!g_pVirtualIndexJob->IsFinished())
+		return;
+
+	g_pVirtualIndexJob->Release();
+	g_pVirtualIndexJob = NULL;
+	PublishVirtualIndexBuild();
+}
+
+/*
+ * Builds the requested pathIDs on the filesystem pool and publishes them once they're done.
+ * The searchpaths are resolved here without holding g_pVirtualIndexMutex, and building never holds it either.
+ */
+static void VirtualIndexThink()
+{
+	FinishVirtualIndexBuild(false);
+	if (g_pVirtualIndexJob || !pFileSystemPool)
+		return;
+
+	std::unordered_set<std::string> pRequests;
+	g_pVirtualIndexMutex.Lock();
+	pRequests.swap(g_pVirtualIndexRequests);
+	unsigned int iGeneration = g_iVirtualIndexGeneration;
+	g_pVirtualIndexMutex.Unlock();
+
+	if (pRequests.empty() || !holylib_filesystem_virtualindex.GetBool())
+		return;
+
+	VirtualIndexBuild* pBuild = new VirtualIndexBuild;
+	pBuild->iGeneration = iGeneration;
+	for (const std::string& strPathID : pRequests)
+		pBuild->pPathIDs[strPathID] = GetSearchPathList(strPathID.c_str());
+
+	g_pVirtualIndexMutex.Lock();
+	for (auto& [strPathID, pSearchPaths] : pBuild->pPathIDs)
+	{
+		for (const std::string& strPath : pSearchPaths)
+		{
+			if (g_pVirtualSearchPaths.find(strPath) != g_pVirtualSearchPaths.end())
+				continue;
+
+			CVirtualSearchPath*& pVirtualPath = pBuild->pBuilt[strPath];
+			if (!pVirtualPath)
+				pVirtualPath = new CVirtualSearchPath(strPath);
+		}
+	}
+	g_pVirtualIndexBuild = pBuild;
+	g_pVirtualIndexMutex.Unlock();
+
+	if (pBuild->pBuilt.empty())
+	{
+		PublishVirtualIndexBuild();
+		return;
+	}
+
+	g_pVirtualIndexJob = pFileSystemPool->QueueCall(VirtualIndexBuildJob, pBuild);
+}
+
+static std::string NormalizeSearchPath(const char* pPath) // Same format as GetSearchPathList without the trailing slash.
+{
+	char pFullPath[MAX_PATH];
+	if (V_IsAbsolutePath(pPath))
+		V_strncpy(pFullPath, pPath, sizeof(pFullPath));
+	else
+		V_MakeAbsolutePath(pFullPath, sizeof(pFullPath), pPath);
+
+	V_FixSlashes(pFullPath, '/');
+	V_FixDoubleSlashes(pFullPath);
+
+	std::string strPath = pFullPath;
+	while (!strPath.empty() && strPath.back() == '/')
+		strPath.pop_back();
+
+	return strPath;
+}
+
+/*
+ * pPath = NULL -> all searchpaths of the pathID. pPathID = NULL -> all pathIDs.
+ * bMapPaths -> only the searchpaths of maps. pPath is ignored.
+ */
+static void RemoveVirtualSearchPaths(const char* pPath, const char* pPathID, bool bMapPaths = false)
+{
+	std::string strRemovePath = (pPath && !bMapPaths) ? NormalizeSearchPath(pPath) : "";
+
+	g_pVirtualIndexMutex.Lock();
+	InvalidateVirtualPathIDs();
+
+	std::string strPathID = pPathID ? GetVirtualPathIDKey(pPathID) : "";
+	for (auto it = g_pVirtualSearchPaths.begin(); it != g_pVirtualSearchPaths.end();)
+	{
+		CVirtualSearchPath* pVirtualPath = it->second;
+		bool bMatches = true;
+		if (bMapPaths)
+		{
+			bMatches = IsMapSearchPath(pVirtualPath->GetPath().c_str());
+		} else if (pPath) {
+			std::string_view strPath = pVirtualPath->GetPath();
+			while (!strPath.empty() && strPath.back() == '/')
+				strPath.remove_suffix(1);
+
+			bMatches = strPath == strRemovePath;
+		}
+
+		if (!bMatches)
+		{
+			++it;
+			continue;
+		}
+
+		if (pPathID)
+			pVirtualPath->m_pPathIDs.erase(strPathID);
+		else
+			pVirtualPath->m_pPathIDs.clear();
+
+		if (pVirtualPath->m_pPathIDs.empty())
+		{
+			if (g_pFileSystemModule.InDebug())
+				Msg("holylib - VirtualIndex: Removed index of %s\n", pVirtualPath->GetPath().c_str());
+
+			delete pVirtualPath;
+			it = g_pVirtualSearchPaths.erase(it);
+		} else {
+			++it;
+		}
+	}
+	g_pVirtualIndexMutex.Unlock();
+}
+
+static void NukeVirtualIndex()
+{
+	g_pVirtualIndexMutex.Lock();
+	InvalidateVirtualPathIDs();
+	g_pVirtualIndexRequests.clear(); // It's rebuilt when it's used again.
+	for (auto& [strPath, pVirtualPath] : g_pVirtualSearchPaths)
+		delete pVirtualPath;
+
+	g_pVirtualSearchPaths.clear();
+	g_pVirtualIndexMutex.Unlock();
+}
+
+static bool NormalizeVirtualFileName(const char* pFileName, std::string& strOut) // Returns false if we can't handle the path.
+{
+	if (!pFileName || V_IsAbsolutePath(pFileName))
+		return false;
+
+	char pFixedFileName[MAX_PATH];
+	V_strncpy(pFixedFileName, pFileName, sizeof(pFixedFileName));
+	V_FixSlashes(pFixedFileName, '/');
+	V_FixDoubleSlashes(pFixedFileName);
+	V_strlower(pFixedFileName); // Same as CBaseFileSystem::FixUpPath
+
+	const char* pStart = pFixedFileName;
+	while (pStart[0] == '.' && pStart[1] == '/')
+		pStart += 2;
+
+	while (*pStart == '/')
+		++pStart;
+
+	if (V_strstr(pStart, "..")) // Let the engine deal with relative paths.
+		return false;
+
+	strOut = pStart;
+	while (!strOut.empty() && strOut.back() == '/')
+		strOut.pop_back();
+
+	return true;
+}
+
+/*
+ * Returns -1 if the index can't answer it.
+ */
+static int VirtualIndex_FileExists(const char* pFileName, const char* pPathID)
+{
+	std::string strFileName;
+	if (!NormalizeVirtualFileName(pFileName, strFileName))
+		return -1;
+
+	int iFound = -1;
+	g_pVirtualIndexMutex.Lock();
+	std::vector<CVirtualSearchPath*>* pPaths = GetVirtualSearchPaths(pPathID);
+	if (pPaths)
+	{
+		iFound = 0;
+		for (CVirtualSearchPath* pVirtualPath : *pPaths)
+		{
+			if (pVirtualPath->FindFile(strFileName))
+			{
+				iFound = 1;
+				break;
+			}
+		}
+	}
+	g_pVirtualIndexMutex.Unlock();
+
+	return iFound;
+}
+
+static int VirtualIndex_IsDirectory(const char* pFileName, const char* pPathID)
+{
+	std::string strFileName;
+	if (!NormalizeVirtualFileName(pFileName, strFileName))
+		return -1;
+
+	int iFound = -1;
+	g_pVirtualIndexMutex.Lock();
+	std::vector<CVirtualSearchPath*>* pPaths = GetVirtualSearchPaths(pPathID);
+	if (pPaths)
+	{
+		iFound = 0;
+		for (CVirtualSearchPath* pVirtualPath : *pPaths)
+		{
+			if (pVirtualPath->FindDirectory(strFileName))
+			{
+				iFound = 1;
+				break;
+			}
+		}
+	}
+	g_pVirtualIndexMutex.Unlock();
+
+	return iFound;
+}
+
+static bool VirtualIndex_GetFileTime(const char* pFileName, const char* pPathID, long& iTime)
+{
+	std::string strFileName;
+	if (!NormalizeVirtualFileName(pFileName, strFileName))
+		return false;
+
+	g_pVirtualIndexMutex.Lock();
+	std::vector<CVirtualSearchPath*>* pPaths = GetVirtualSearchPaths(pPathID);
+	if (!pPaths)
+	{
+		g_pVirtualIndexMutex.Unlock();
+		return false;
+	}
+
+	iTime = 0L;
+	for (CVirtualSearchPath* pVirtualPath : *pPaths)
+	{
+		VirtualFileEntry* pFile = pVirtualPath->FindFile(strFileName);
+		if (pFile)
+		{
+			iTime = pFile->iTime;
+			break;
+		}
+
+		VirtualDirectoryEntry* pDir = pVirtualPath->FindDirectory(strFileName);
+		if (pDir)
+		{
+			iTime = pDir->iTime;
+			break;
+		}
+	}
+	g_pVirtualIndexMutex.Unlock();
+
+	return true;
+}
+
+static bool MatchWildcard(const char* pPattern, const char* pStr) // Case insensitive. Supports * and ?
+{
+	const char* pStarPattern = NULL;
+	const char* pStarStr = NULL;
+	while (*pStr)
+	{
+		if (*pPattern == '*')
+		{
+			pStarPattern = ++pPattern;
+			pStarStr = pStr;
+		} else if (*pPattern == '?' || V_tolower(*pPattern) == V_tolower(*pStr)) {
+			++pPattern;
+			++pStr;
+		} else if (pStarPattern) {
+			pPattern = pStarPattern;
+			pStr = ++pStarStr;
+		} else {
+			return false;
+		}
+	}
+
+	while (*pPattern == '*')
+		++pPattern;
+
+	return *pPattern == '\0';
+}
+
+static bool VirtualIndex_Find(const char* pWildCard, const char* pPathID, std::vector<std::string>& pFiles, std::vector<std::string>& pFolders)
+{
+	std::string strWildCard;
+	if (!NormalizeVirtualFileName(pWildCard, strWildCard))
+		return false;
+
+	size_t iSlash = strWildCard.find_last_of('/');
+	std::string strDir = iSlash == std::string::npos ? "" : strWildCard.substr(0, iSlash);
+	std::string strPattern = iSlash == std::string::npos ? strWildCard : strWildCard.substr(iSlash + 1);
+	if (strDir.find_first_of("*?") != std::string::npos)
+		return false; // Wildcards in directories aren't supported by the engine either.
+
+	g_pVirtualIndexMutex.Lock();
+	std::vector<CVirtualSearchPath*>* pPaths = GetVirtualSearchPaths(pPathID);
+	if (!pPaths)
+	{
+		g_pVirtualIndexMutex.Unlock();
+		return false;
+	}
+
+	std::unordered_set<std::string> pVisited;
+	for (CVirtualSearchPath* pVirtualPath : *pPaths)
+	{
+		VirtualDirectoryEntry* pDir = pVirtualPath->FindDirectory(strDir);
+		if (!pDir)
+			continue;
+
+		std::string strPrefix = strDir.empty() ? "" : strDir + "/";
+		for (const std::string& strChild : pDir->pChildren)
+		{
+			if (!MatchWildcard(strPattern.c_str(), strChild.c_str()))
+				continue;
+
+			if (!pVisited.insert(LowerVirtualPath(strChild)).second)
+				continue;
+
+			if (pVirtualPath->FindDirectory(LowerVirtualPath(strPrefix + strChild)))
+				pFolders.push_back(strChild);
+			else
+				pFiles.push_back(strChild);
+		}
+	}
+	g_pVirtualIndexMutex.Unlock();
+
+	return true;
+}
+
+/*
+ * Updates the index of every directory searchpath that contains the given full path.
+ */
+static void VirtualIndex_OnPathChanged(const char* pFullPath, bool bRemoved)
+{
+	g_pVirtualIndexMutex.Lock();
+	bool bEmpty = g_pVirtualSearchPaths.empty() && !g_pVirtualIndexBuild;
+	g_pVirtualIndexMutex.Unlock();
+	if (bEmpty)
+		return;
+
+	char pFixedPath[MAX_PATH];
+	V_strncpy(pFixedPath, pFullPath, sizeof(pFixedPath));
+	V_FixSlashes(pFixedPath, '/');
+	V_FixDoubleSlashes(pFixedPath);
+
+	VirtualPathChange pChange;
+	pChange.strFullPath = pFixedPath;
+	pChange.bRemoved = bRemoved;
+#ifdef SYSTEM_POSIX
+	if (!bRemoved)
+	{
+		struct stat pStat;
+		if (stat(pFixedPath, &pStat) == -1)
+			return;
+
+		pChange.iTime = (long)pStat.st_mtime;
+		pChange.iSize = (unsigned int)pStat.st_size;
+		pChange.bDirectory = S_ISDIR(pStat.st_mode);
+	}
+#endif
+
+	g_pVirtualIndexMutex.Lock();
+	for (auto& [strPath, pVirtualPath] : g_pVirtualSearchPaths)
+		UpdateVirtualSearchPath(pVirtualPath, pChange);
+
+	if (g_pVirtualIndexBuild) // The job might have already passed it.
+		g_pVirtualIndexBuild->pChanges.push_back(std::move(pChange));
+	g_pVirtualIndexMutex.Unlock();
+}
+
+static void DumpVirtualIndexCmd(const CCommand &args)
+{
+	Msg("---- Virtual index ----\n");
+	g_pVirtualIndexMutex.Lock();
+	for (auto& [strPath, pVirtualPath] : g_pVirtualSearchPaths)
+	{
+		std::string strPathIDs;
+		for (const std::string& strPathID : pVirtualPath->m_pPathIDs)
+			strPathIDs.append(strPathID).append(" ");
+
+		Msg("	\"%s\": %s(%s)\n", strPath.c_str(), pVirtualPath->IsIndexed() ? "" : "not indexed ", strPathIDs.c_str());
+	}
+	g_pVirtualIndexMutex.Unlock();
+	Msg("---- End of Virtual index ----\n");
+}
+static ConCommand dumpvirtualindex("holylib_filesystem_dumpvirtualindex", DumpVirtualIndexCmd, "Dumps all searchpaths in the virtual index", 0);
+
+static void NukeVirtualIndexCmd(const CCommand &args)
+{
+	NukeVirtualIndex();
+}
+static ConCommand nukevirtualindex("holylib_filesystem_nukevirtualindex", NukeVirtualIndexCmd, "Nukes the virtual index. It will be rebuilt when it's used again", 0);
+
+/*
+ * Negative lookup cache
+ * ---------------------
+ *
+ * Gamemodes probe tons of files that don't exist (.vtx variants, .phy files, lua include fallbacks).
+ * Every miss walks all searchpaths, so we remember misses per pathID.
+ * The normalized names themselves are stored, so a lookup can never hide an existing file because of a hash collision.
+ * Adding a searchpath clears all caches, writing a file removes every name it could be found as.
+ */
+static ConVar holylib_filesystem_negativecache("holylib_filesystem_negativecache", "0", 0,
+	"If enabled, it will remember files that weren't found and skip searching them again until a searchpath is added or the file is written.");
+static ConVar holylib_filesystem_negativecache_maxentries("holylib_filesystem_negativecache_maxentries", "16384", 0,
+	"The maximum number of missing files remembered per pathID. If it's reached, the cache of the pathID is reset.");
+
+static inline std::string NormalizeNegativePath(const char* pStr) // Same as CBaseFileSystem::FixUpPath for our purpose. Lowercase and forward slashes.
+{
+	std::string strPath = pStr;
+	for (char& cChar : strPath)
+		cChar = cChar == '\\' ? '/' : (char)V_tolower(cChar);
+
+	return strPath;
+}
+
+class CNegativeLookupCache
+{
+public:
+	bool Contains(const std::string& strPath) const
+	{
+		return m_pPaths.find(strPath) != m_pPaths.end();
+	}
+
+	void Insert(const std::string& strPath, int iMaxEntries)
+	{
+		if ((int)m_pPaths.size() >= iMaxEntries)
+			Reset();
+
+		m_pPaths.insert(strPath);
+	}
+
+	bool Remove(const std::string& strPath)
+	{
+		return m_pPaths.erase(strPath) > 0;
+	}
+
+	void Reset()
+	{
+		m_pPaths.clear();
+		++m_iResets;
+	}
+
+	inline size_t Count() const { return m_pPaths.size(); };
+	inline size_t GetMemoryUsage() const // Roughly.
+	{
+		size_t iSize = m_pPaths.bucket_count() * sizeof(void*);
+		for (const std::string& strPath : m_pPaths)
+			iSize += sizeof(std::string) + sizeof(void*) * 2 + strPath.capacity();
+
+		return iSize;
+	}
+
+	unsigned int m_iLookups = 0;
+	unsigned int m_iHits = 0;
+	unsigned int m_iInserts = 0;
+	unsigned int m_iRemovals = 0;
+	unsigned int m_iResets = 0;
+
+private:
+	std::unordered_set<std::string> m_pPaths;
+};
+
+static std::unordered_map<std::string, CNegativeLookupCache> g_pNegativeCaches;
+static unsigned int g_iNegativeCacheInvalidations = 0;
+static CThreadFastMutex g_pNegativeCacheMutex; // OpenForRead and FileExists can be called by async threads.
+
+static inline CNegativeLookupCache* GetNegativeCache(const char* pPathID, bool bCreate)
+{
+	std::string strPathID = pPathID ? LowerVirtualPath(pPathID) : "";
+	if (!bCreate)
+	{
+		auto it = g_pNegativeCaches.find(strPathID);
+		return it != g_pNegativeCaches.end() ? &it->second : NULL;
+	}
+
+	return &g_pNegativeCaches[strPathID];
+}
+
+/*
+ * Returns true if the file is known to not exist in the given pathID.
+ */
+static bool NegativeCache_IsMissing(const char* pFileName, const char* pPathID)
+{
+	if (!holylib_filesystem_negativecache.GetBool() || !pFileName || V_IsAbsolutePath(pFileName))
+		return false;
+
+	std::string strFileName = NormalizeNegativePath(pFileName);
+	g_pNegativeCacheMutex.Lock();
+	CNegativeLookupCache* pCache = GetNegativeCache(pPathID, false);
+	if (!pCache)
+	{
+		g_pNegativeCacheMutex.Unlock();
+		return false;
+	}
+
+	++pCache->m_iLookups;
+	if (!pCache->Contains(strFileName))
+	{
+		g_pNegativeCacheMutex.Unlock();
+		TraceCacheResult(FSCACHE_NEGATIVECACHE, false);
+		return false;
+	}
+
+	++pCache->m_iHits;
+	g_pNegativeCacheMutex.Unlock();
+	TraceCacheResult(FSCACHE_NEGATIVECACHE, true);
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - NegativeCache: Skipped lookup of missing file %s (%s)\n", pFileName, pPathID);
+
+	return true;
+}
+
+static void NegativeCache_AddMissing(const char* pFileName, const char* pPathID)
+{
+	if (!holylib_filesystem_negativecache.GetBool() || !pFileName || V_IsAbsolutePath(pFileName))
+		return;
+
+	std::string strFileName = NormalizeNegativePath(pFileName);
+	g_pNegativeCacheMutex.Lock();
+	CNegativeLookupCache* pCache = GetNegativeCache(pPathID, true);
+	pCache->Insert(strFileName, std::max(holylib_filesystem_negativecache_maxentries.GetInt(), 1));
+	++pCache->m_iInserts;
+	g_pNegativeCacheMutex.Unlock();
+}
+
+static void NegativeCache_Invalidate()
+{
+	g_pNegativeCacheMutex.Lock();
+	if (g_pNegativeCaches.empty())
+	{
+		g_pNegativeCacheMutex.Unlock();
+		return;
+	}
+
+	++g_iNegativeCacheInvalidations;
+	g_pNegativeCaches.clear();
+	g_pNegativeCacheMutex.Unlock();
+
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - NegativeCache: Invalidated all caches\n");
+}
+
+/*
+ * A file was created at the given full path.
+ * We don't know which searchpath root it belongs to, so we remove every possible relative name.
+ * "/srv/garrysmod/data/a.txt" -> "srv/garrysmod/data/a.txt", "garrysmod/data/a.txt", "data/a.txt", "a.txt"
+ */
+static void NegativeCache_OnPathCreated(const char* pFullPath)
+{
+	g_pNegativeCacheMutex.Lock();
+	bool bEmpty = g_pNegativeCaches.empty();
+	g_pNegativeCacheMutex.Unlock();
+	if (bEmpty)
+		return;
+
+	std::string strFullPath = NormalizeNegativePath(pFullPath);
+	std::vector<std::string> pNames;
+	for (size_t iPos = 0; iPos < strFullPath.length(); ++iPos)
+		if (strFullPath[iPos] == '/' && iPos + 1 < strFullPath.length())
+			pNames.push_back(strFullPath.substr(iPos + 1));
+
+	pNames.push_back(strFullPath);
+
+	g_pNegativeCacheMutex.Lock();
+	for (auto& [strPathID, pCache] : g_pNegativeCaches)
+	{
+		for (const std::string& strName : pNames)
+		{
+			if (pCache.Remove(strName))
+				++pCache.m_iRemovals;
+		}
+	}
+	g_pNegativeCacheMutex.Unlock();
+}
+
+static void DumpNegativeCacheCmd(const CCommand &args)
+{
+	g_pNegativeCacheMutex.Lock();
+	Msg("---- Negative lookup cache ----\n");
+	Msg("Invalidations: %u\n", g_iNegativeCacheInvalidations);
+	for (auto& [strPathID, pCache] : g_pNegativeCaches)
+	{
+		double flHitRate = pCache.m_iLookups > 0 ? (pCache.m_iHits * 100.0) / pCache.m_iLookups : 0.0;
+		Msg("	\"%s\": %i entries, %u lookups, %u hits (%.2f%%), %u inserts, %u removals, %u resets, %.2f KB\n",
+			strPathID.c_str(), (int)pCache.Count(), pCache.m_iLookups, pCache.m_iHits, flHitRate,
+			pCache.m_iInserts, pCache.m_iRemovals, pCache.m_iResets, pCache.GetMemoryUsage() / 1024.0);
+	}
+	Msg("---- End of Negative lookup cache ----\n");
+	g_pNegativeCacheMutex.Unlock();
+}
+static ConCommand dumpnegativecache("holylib_filesystem_dumpnegativecache", DumpNegativeCacheCmd, "Dumps the hit stats of the negative lookup cache", 0);
+
+static void NukeNegativeCacheCmd(const CCommand &args)
+{
+	NegativeCache_Invalidate();
+}
+static ConCommand nukenegativecache("holylib_filesystem_nukenegativecache", NukeNegativeCacheCmd, "Nukes the negative lookup cache", 0);
+
+/*
+ * Mapped files
+ * ------------
+ *
+ * filesystem.MapFile maps a file read-only so Lua can read ranges of it without the engine copying the whole file through a CFileHandle.
+ * Loose files are mapped directly and VPK entries map their archive at the entry's offset.
+ * Files inside zip packs (.bsp/.gma) and VPK entries with preload bytes can't be mapped, so these are read into memory instead.
+ */
+class CMappedFileData;
+static std::unordered_set<CMappedFileData*> g_pMappedFiles; // Loose files that are currently mapped.
+static CThreadFastMutex g_pMappedFilesMutex; // OpenForWrite can be called by async threads. Also guards the data of every CMappedFileData since Detach swaps it.
+
+class CMappedFileData
+{
+public:
+	~CMappedFileData()
+	{
+		Free();
+	}
+
+	bool Map(const std::string& strFullPath, size_t iOffset, size_t iLength, bool bLoose)
+	{
+#ifdef SYSTEM_POSIX
+		int iFile = open(strFullPath.c_str(), O_RDONLY);
+		if (iFile == -1)
+			return false;
+
+		struct stat pStat;
+		if (fstat(iFile, &pStat) == -1 || (uint64)iOffset + iLength > (uint64)pStat.st_size) // Mapping past the end would SIGBUS on read.
+		{
+			close(iFile);
+			return false;
+		}
+
+		m_strFullPath = strFullPath;
+		m_iLength = iLength;
+		if (iLength == 0)
+		{
+			close(iFile);
+			m_pData = "";
+			return true;
+		}
+
+		static size_t iPageSize = (size_t)sysconf(_SC_PAGESIZE);
+		size_t iAlignedOffset = iOffset & ~(iPageSize - 1);
+		m_iMappingLength = iLength + (iOffset - iAlignedOffset);
+		m_pMapping = mmap(NULL, m_iMappingLength, PROT_READ, MAP_PRIVATE, iFile, (off_t)iAlignedOffset);
+		close(iFile);
+		if (m_pMapping == MAP_FAILED)
+		{
+			m_pMapping = NULL;
+			return false;
+		}
+
+		m_pData = (const char*)m_pMapping + (iOffset - iAlignedOffset);
+		if (bLoose)
+		{
+			g_pMappedFilesMutex.Lock();
+			g_pMappedFiles.insert(this);
+			g_pMappedFilesMutex.Unlock();
+		}
+
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool ReadIntoMemory(const char* pFileName, const char* pPathID)
+	{
+		FileHandle_t fh = g_pFullFileSystem->Open(pFileName, "rb", pPathID);
+		if (!fh)
+			return false;
+
+		m_iLength = g_pFullFileSystem->Size(fh);
+		m_pMemory = new char[m_iLength + 1];
+		m_iLength = std::max(g_pFullFileSystem->Read(m_pMemory, (int)m_iLength, fh), 0);
+		g_pFullFileSystem->Close(fh);
+
+		m_pData = m_pMemory;
+		return true;
+	}
+
+	/*
+	 * Copies the mapped data into memory.
+	 * Called before the file is opened for writing since reading a truncated mapping would crash us.
+	 * Expects g_pMappedFilesMutex to be locked.
+	 */
+	void Detach()
+	{
+		if (!m_pMapping)
+			return;
+
+		char* pMemory = new char[m_iLength];
+		memcpy(pMemory, m_pData, m_iLength);
+		Free();
+		m_pMemory = pMemory;
+		m_pData = m_pMemory;
+	}
+
+	inline const char* GetData() { return m_pData; };
+	inline size_t GetLength() { return m_iLength; };
+	inline bool IsMapped() { return m_pMapping != NULL; };
+	inline const std::string& GetFullPath() { return m_strFullPath; };
+
+	int m_iRefs = 0; // Number of MappedFile views using us.
+
+private:
+	void Free()
+	{
+		g_pMappedFilesMutex.Lock();
+#ifdef SYSTEM_POSIX
+		if (m_pMapping)
+		{
+			munmap(m_pMapping, m_iMappingLength);
+			g_pMappedFiles.erase(this);
+		}
+#endif
+
+		if (m_pMemory)
+			delete[] m_pMemory;
+
+		m_pMapping = NULL;
+		m_iMappingLength = 0;
+		m_pMemory = NULL;
+		m_pData = NULL;
+		g_pMappedFilesMutex.Unlock();
+	}
+
+	std::string m_strFullPath;
+	void* m_pMapping = NULL;
+	size_t m_iMappingLength = 0;
+	char* m_pMemory = NULL;
+	const char* m_pData = NULL;
+	size_t m_iLength = 0;
+};
+
+static std::unordered_map<std::string, CVirtualSearchPath*> g_pMappedVPKs; // Main thread only. Searchpaths parsed by MapGameFile, kept until the level ends.
+static CVirtualSearchPath* GetMappedVPK(const std::string& strPath)
+{
+	CVirtualSearchPath*& pVPK = g_pMappedVPKs[strPath];
+	if (!pVPK)
+	{
+		pVPK = new CVirtualSearchPath(strPath);
+		pVPK->Build();
+	}
+
+	return pVPK;
+}
+
+static void ClearMappedVPKs()
+{
+	for (auto& [strPath, pVPK] : g_pMappedVPKs)
+		delete pVPK;
+
+	g_pMappedVPKs.clear();
+}
+
+static inline bool IsPackFilePath(const char* pPath)
+{
+	const char* pExtension = V_GetFileExtension(pPath);
+	return pExtension && (V_stricmp(pExtension, "vpk") == 0 || V_stricmp(pExtension, "bsp") == 0 || V_stricmp(pExtension, "gma") == 0 || V_stricmp(pExtension, "zip") == 0);
+}
+
+static CMappedFileData* MapGameFile(const char* pFileName, const char* pPathID)
+{
+	VPROF_BUDGET("HolyLib - MapGameFile", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	CMappedFileData* pData = new CMappedFileData;
+#ifdef SYSTEM_POSIX
+	std::string strFileName;
+	if (NormalizeVirtualFileName(pFileName, strFileName))
+	{
+		char pFullPath[MAX_PATH] = {0};
+		if (g_pFullFileSystem->RelativePathToFullPath(pFileName, pPathID, pFullPath, sizeof(pFullPath)) && !IsPackFilePath(pFullPath))
+		{
+			struct stat pStat;
+			if (stat(pFullPath, &pStat) == 0 && S_ISREG(pStat.st_mode) && pData->Map(pFullPath, 0, (size_t)pStat.st_size, true))
+				return pData;
+		} else if (pPathID) {
+			// The engine either doesn't report VPK entries or gave us the pack file, so we check the VPKs ourself in searchpath order.
+			bool bMapped = false;
+			for (const std::string& strPath : GetSearchPathList(pPathID))
+			{
+				if (strPath.back() == '/')
+					continue;
+
+				CVirtualSearchPath* pVirtualPath = GetMappedVPK(strPath); // Not the virtual index since adding to it would turn on the file change tracking for good.
+				if (!pVirtualPath->IsPackedStore())
+				{
+					if (V_stricmp(strPath.c_str(), pFullPath) == 0) // The file is inside a zip pack.
+						break;
+
+					continue;
+				}
+
+				VirtualFileEntry* pEntry = pVirtualPath->FindFile(strFileName);
+				if (!pEntry)
+					continue;
+
+				if (pEntry->iPreloadBytes > 0)
+					break;
+
+				char pArchive[MAX_PATH];
+				if (pEntry->iArchiveIndex == VPK_DIR_ARCHIVE)
+					V_snprintf(pArchive, sizeof(pArchive), "%s_dir.vpk", pVirtualPath->GetArchiveBase().c_str());
+				else
+					V_snprintf(pArchive, sizeof(pArchive), "%s_%03d.vpk", pVirtualPath->GetArchiveBase().c_str(), pEntry->iArchiveIndex);
+
+				bMapped = pData->Map(pArchive, pEntry->iOffset, pEntry->iSize, false);
+				break;
+			}
+
+			if (bMapped)
+				return pData;
+		}
+	}
+#endif
+
+	if (pData->ReadIntoMemory(pFileName, pPathID))
+	{
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - MapGameFile: Couldn't map %s (%s). Read it into memory instead\n", pFileName, pPathID);
+
+		return pData;
+	}
+
+	delete pData;
+	return NULL;
+}
+
+static void MappedFile_OnWrite(const char* pFullPath)
+{
+	g_pMappedFilesMutex.Lock();
+	std::vector<CMappedFileData*> pDetach;
+	for (CMappedFileData* pData : g_pMappedFiles)
+		if (V_stricmp(pData->GetFullPath().c_str(), pFullPath) == 0)
+			pDetach.push_back(pData);
+
+	for (CMappedFileData* pData : pDetach) // Detach removes it from g_pMappedFiles.
+		pData->Detach();
+	g_pMappedFilesMutex.Unlock();
+}
+
+/*
+ * Called by every hook that creates or removes a file.
+ */
+static inline bool IsTrackingFileChanges()
+{
+	g_pVirtualIndexMutex.Lock();
+	bool bVirtualIndex = !g_pVirtualSearchPaths.empty() || g_pVirtualIndexBuild;
+	g_pVirtualIndexMutex.Unlock();
+
+	g_pNegativeCacheMutex.Lock();
+	bool bNegativeCache = !g_pNegativeCaches.empty();
+	g_pNegativeCacheMutex.Unlock();
+
+	return bVirtualIndex || bNegativeCache || !g_pFileHandlePool.IsEmpty();
+}
+
+static void OnPathChanged(const char* pFullPath, bool bRemoved)
+{
+	VirtualIndex_OnPathChanged(pFullPath, bRemoved);
+	g_pFileHandlePool.Invalidate(pFullPath);
+
+	if (!bRemoved)
+		NegativeCache_OnPathCreated(pFullPath);
+}
+
+static void OnFileChanged(IFileSystem* filesystem, const char* pFileName, const char* pPathID, bool bRemoved)
+{
+	if (!IsTrackingFileChanges())
+		return;
+
+	if (V_IsAbsolutePath(pFileName))
+	{
+		OnPathChanged(pFileName, bRemoved);
+		return;
+	}
+
+	char pFullPath[MAX_PATH];
+	if (filesystem->RelativePathToFullPath(pFileName, pPathID, pFullPath, sizeof(pFullPath)))
+		OnPathChanged(pFullPath, bRemoved);
+}
+
+static Detouring::Hook detour_CBaseFileSystem_IsDirectory;
+static bool hook_CBaseFileSystem_IsDirectory(void* filesystem, const char* pFileName, const char* pPathID)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::IsDirectory", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+	CFileSystemTrace pTrace(FSTRACE_ISDIRECTORY, pFileName, pPathID);
+
+	if (holylib_filesystem_easydircheck.GetBool() && is_file(pFileName))
+		return false;
+
+	int iIndexed = VirtualIndex_IsDirectory(pFileName, pPathID);
+	if (iIndexed != -1)
+		return iIndexed == 1;
+
+	return detour_CBaseFileSystem_IsDirectory.GetTrampoline<Symbols::CBaseFileSystem_IsDirectory>()(filesystem, pFileName, pPathID);
+}
+
+static Detouring::Hook detour_CBaseFileSystem_FileExists;
+static bool hook_CBaseFileSystem_FileExists(void* filesystem, const char* pFileName, const char* pPathID)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::FileExists", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	int iIndexed = VirtualIndex_FileExists(pFileName, pPathID);
+	if (iIndexed != -1)
+		return iIndexed == 1;
+
+	if (NegativeCache_IsMissing(pFileName, pPathID))
+		return false;
+
+	bool bExists = detour_CBaseFileSystem_FileExists.GetTrampoline<Symbols::CBaseFileSystem_FileExists>()(filesystem, pFileName, pPathID);
+	if (!bExists)
+		NegativeCache_AddMissing(pFileName, pPathID);
+
+	return bExists;
+}
+
+static std::unordered_map<FileHandle_t, std::string> g_pVirtualWriteHandles; // Files we need to restat on Close since their size changed.
+static Detouring::Hook detour_CBaseFileSystem_OpenForWrite;
+static FileHandle_t hook_CBaseFileSystem_OpenForWrite(IFileSystem* filesystem, const char* pFileName, const char* pOptions, const char* pPathID)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::OpenForWrite", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	g_pMappedFilesMutex.Lock();
+	bool bMappedFiles = !g_pMappedFiles.empty();
+	g_pMappedFilesMutex.Unlock();
+	if (bMappedFiles) // Needs to happen before the file is truncated.
+	{
+		char pFullPath[MAX_PATH];
+		if (V_IsAbsolutePath(pFileName))
+			MappedFile_OnWrite(pFileName);
+		else if (filesystem->RelativePathToFullPath(pFileName, pPathID, pFullPath, sizeof(pFullPath)))
+			MappedFile_OnWrite(pFullPath);
+	}
+
+	FileHandle_t pHandle = detour_CBaseFileSystem_OpenForWrite.GetTrampoline<Symbols::CBaseFileSystem_OpenForWrite>()(filesystem, pFileName, pOptions, pPathID);
+	if (pHandle && IsTrackingFileChanges())
+	{
+		char pFullPath[MAX_PATH];
+		if (V_IsAbsolutePath(pFileName))
+			V_strncpy(pFullPath, pFileName, sizeof(pFullPath));
+		else if (!filesystem->RelativePathToFullPath(pFileName, pPathID, pFullPath, sizeof(pFullPath)))
+			return pHandle;
+
+		OnPathChanged(pFullPath, false);
+		g_pVirtualWriteHandles[pHandle] = pFullPath;
+	}
+
+	return pHandle;
+}
+
+static Detouring::Hook detour_CBaseFileSystem_RemoveFile;
+static void hook_CBaseFileSystem_RemoveFile(IFileSystem* filesystem, const char* pRelativePath, const char* pPathID)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::RemoveFile", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	char pFullPath[MAX_PATH];
+	bool bFound = IsTrackingFileChanges() && filesystem->RelativePathToFullPath(pRelativePath, pPathID, pFullPath, sizeof(pFullPath));
+
+	detour_CBaseFileSystem_RemoveFile.GetTrampoline<Symbols::CBaseFileSystem_RemoveFile>()(filesystem, pRelativePath, pPathID);
+
+	if (bFound)
+		OnPathChanged(pFullPath, true);
+}
+
+static Detouring::Hook detour_CBaseFileSystem_RenameFile;
+static bool hook_CBaseFileSystem_RenameFile(IFileSystem* filesystem, const char* pOldPath, const char* pNewPath, const char* pPathID)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::RenameFile", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	char pFullPath[MAX_PATH];
+	bool bFound = IsTrackingFileChanges() && filesystem->RelativePathToFullPath(pOldPath, pPathID, pFullPath, sizeof(pFullPath));
+
+	bool bSuccess = detour_CBaseFileSystem_RenameFile.GetTrampoline<Symbols::CBaseFileSystem_RenameFile>()(filesystem, pOldPath, pNewPath, pPathID);
+	if (bSuccess && bFound)
+	{
+		OnPathChanged(pFullPath, true);
+		OnFileChanged(filesystem, pNewPath, pPathID, false);
+	}
+
+	return bSuccess;
+}
+
+static Detouring::Hook detour_CBaseFileSystem_CreateDirHierarchy;
+static void hook_CBaseFileSystem_CreateDirHierarchy(IFileSystem* filesystem, const char* pRelativePath, const char* pPathID)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::CreateDirHierarchy", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	detour_CBaseFileSystem_CreateDirHierarchy.GetTrampoline<Symbols::CBaseFileSystem_CreateDirHierarchy>()(filesystem, pRelativePath, pPathID);
+
+	if (!IsTrackingFileChanges())
+		return;
+
+	std::string strPath = pRelativePath;
+	size_t iPos = 0;
+	while ((iPos = strPath.find_first_of("/\\", iPos + 1)) != std::string::npos) // Every parent could be new.
+		OnFileChanged(filesystem, strPath.substr(0, iPos).c_str(), pPathID, false);
+
+	OnFileChanged(filesystem, pRelativePath, pPathID, false);
+}
+
+static int pBaseLength = 0;
+static char pBaseDir[MAX_PATH];
+static Detouring::Hook detour_CBaseFileSystem_FixUpPath;
+static bool hook_CBaseFileSystem_FixUpPath(IFileSystem* filesystem, const char *pFileName, char *pFixedUpFileName, int sizeFixedUpFileName)
+{
+	// NOTE for future me: 64x doesn't see to have this function anymore.
+	if (!holylib_filesystem_optimizedfixpath.GetBool())
+		return detour_CBaseFileSystem_FixUpPath.GetTrampoline<Symbols::CBaseFileSystem_FixUpPath>()(filesystem, pFileName, pFixedUpFileName, sizeFixedUpFileName);
+
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::FixUpPath", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	if (!g_pFullFileSystem)
+		g_pFullFileSystem = (IFileSystem*)filesystem;
+
+	V_strncpy( pFixedUpFileName, pFileName, sizeFixedUpFileName );
+	V_FixSlashes( pFixedUpFileName, CORRECT_PATH_SEPARATOR );
+	V_FixDoubleSlashes( pFixedUpFileName );
+
+	if ( !V_IsAbsolutePath( pFixedUpFileName ) )
+	{
+		V_strlower( pFixedUpFileName );
+	}
+	else 
+	{
+		/*
+		 * What changed here ?
+		 * Gmod calls GetSearchPath every time FixUpPath is called.
+		 * Now, we only call it once and then reuse the value, since the BASE_PATH shouldn't change at runtime.
+		 */
+
+		if ( pBaseLength < 3 )
+			pBaseLength = filesystem->GetSearchPath( "BASE_PATH", true, pBaseDir, sizeof( pBaseDir ) );
+
+		if ( pBaseLength )
+		{
+			if ( *pBaseDir && (pBaseLength+1 < V_strlen( pFixedUpFileName ) ) && (0 != V_strncmp( pBaseDir, pFixedUpFileName, pBaseLength ) )  )
+			{
+				V_strlower( &pFixedUpFileName[pBaseLength-1] );
+			}
+		}
+		
+	}
+
+	return true;
+}
+
+static std::string_view nukeFileExtension(const std::string_view& fileName) {
+	size_t lastDotPos = fileName.find_last_of('.');
+	if (lastDotPos == std::string::npos) 
+		return fileName;
+
+	return fileName.substr(0, lastDotPos);
+}
+
+static std::string_view getFileExtension(const std::string_view& fileName) {
+	size_t lastDotPos = fileName.find_last_of('.');
+	if (lastDotPos == std::string::npos || lastDotPos == fileName.length() - 1)
+		return "";
+
+	return fileName.substr(lastDotPos + 1);
+}
+
+static bool shouldWeCare(const std::string_view& fileName) { // Skip models like models/airboat.mdl
+	size_t firstSlash = fileName.find_first_of('/');
+	if (firstSlash == std::string::npos)
+		return false;
+
+	size_t lastSlash = fileName.find_last_of('/');
+	if (lastSlash == std::string::npos || firstSlash == lastSlash)
+		return false;
+
+	return true;
+}
+
+/*
+ * Path router
+ * -----------
+ *
+ * Decides in which pathID a file is searched in first.
+ * Before, every open split the path and did multiple map lookups. Now all routes are compiled into a trie that is walked once per path.
+ * OpenForRead is also called by the async threads, so a changed route builds a new router which is then swapped in.
+ * Every route has the hooks it's used by, since the forced files were only ever used in OpenForRead and the forced gamemodes only in GetFileTime.
+ */
+enum RouteType
+{
+	ROUTE_PREFIX = 1, // "materials/" -> every file inside materials/
+	ROUTE_EXACT = 2, // "cfg/server.cfg"
+	ROUTE_EXTENSION = 3, // "vmt" -> every .vmt file
+};
+
+enum RouteHook
+{
+	ROUTEHOOK_OPENFORREAD = 1 << 0,
+	ROUTEHOOK_GETFILETIME = 1 << 1,
+	ROUTEHOOK_ALL = ROUTEHOOK_OPENFORREAD | ROUTEHOOK_GETFILETIME,
+};
+
+struct RouteRule
+{
+	std::string strMatch;
+	RouteType iType = ROUTE_PREFIX;
+	bool bForce = false; // Forced routes are used by holylib_filesystem_forcepath, all others by holylib_filesystem_splitgamepath.
+	const char* pPathID = NULL; // Interned.
+	const char* pSourcePathID = NULL; // Interned. NULL = any pathID.
+	int iHooks = ROUTEHOOK_ALL;
+};
+
+struct RouteResult
+{
+	const char* pSplitPath = NULL;
+	const char* pForcePath = NULL;
+};
+
+static inline unsigned char NormalizeRouteChar(unsigned char c)
+{
+	if (c == '\\')
+		return '/';
+
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+class CPathRouter
+{
+public:
+	CPathRouter(const std::vector<RouteRule>& pRules) : m_pRules(pRules)
+	{
+		struct BuildNode
+		{
+			std::map<unsigned char, unsigned int> pChildren;
+			std::vector<unsigned int> pRules;
+		};
+
+		std::vector<BuildNode> pBuild(2); // 0 = path root, 1 = extension root
+		for (unsigned int i = 0; i < m_pRules.size(); ++i)
+		{
+			const RouteRule& pRule = m_pRules[i];
+			unsigned int iNode = pRule.iType == ROUTE_EXTENSION ? 1 : 0;
+			for (unsigned char c : pRule.strMatch)
+			{
+				c = NormalizeRouteChar(c);
+				auto it = pBuild[iNode].pChildren.find(c);
+				if (it == pBuild[iNode].pChildren.end())
+				{
+					unsigned int iChild = (unsigned int)pBuild.size();
+					pBuild[iNode].pChildren[c] = iChild;
+					pBuild.emplace_back();
+					iNode = iChild;
+				} else {
+					iNode = it->second;
+				}
+			}
+
+			pBuild[iNode].pRules.push_back(i);
+		}
+
+		m_pNodes.resize(pBuild.size());
+		for (unsigned int i = 0; i < pBuild.size(); ++i)
+		{
+			BuildNode& pBuildNode = pBuild[i];
+			RouteNode& pNode = m_pNodes[i];
+			pNode.iFirstEdge = (unsigned int)m_pEdges.size();
+			pNode.iEdges = (unsigned int)pBuildNode.pChildren.size();
+			for (auto& [c, iChild] : pBuildNode.pChildren)
+				m_pEdges.push_back({c, iChild});
+
+			// Routes for a specific pathID come first so they win over the generic ones.
+			std::stable_sort(pBuildNode.pRules.begin(), pBuildNode.pRules.end(), [this](unsigned int a, unsigned int b) {
+				return m_pRules[a].pSourcePathID && !m_pRules[b].pSourcePathID;
+			});
+
+			pNode.iFirstRule = (unsigned int)m_pNodeRules.size();
+			pNode.iRules = (unsigned int)pBuildNode.pRules.size();
+			m_pNodeRules.insert(m_pNodeRules.end(), pBuildNode.pRules.begin(), pBuildNode.pRules.end());
+		}
+	}
+
+	void Route(const char* pFileName, const char* pPathID, int iHook, RouteResult& pResult) const
+	{
+		unsigned int iNode = 0;
+		bool bExtensions = m_pNodes[1].iEdges > 0;
+		const char* pExtension = NULL;
+		const char* pStr = pFileName;
+		for (;; ++pStr)
+		{
+			unsigned char c = NormalizeRouteChar((unsigned char)*pStr);
+			if (iNode != INVALID_NODE)
+			{
+				if (m_pNodes[iNode].iRules > 0)
+					ApplyRules(m_pNodes[iNode], pPathID, iHook, c == '\0' ? 0 : ROUTE_PREFIX, pResult);
+
+				iNode = c == '\0' ? INVALID_NODE : FindChild(iNode, c);
+			} else if (!bExtensions) {
+				break; // Nothing left that could match.
+			}
+
+			if (c == '\0')
+				break;
+
+			if (c == '.')
+				pExtension = pStr + 1;
+			else if (c == '/')
+				pExtension = NULL;
+		}
+
+		if (pExtension && bExtensions && (!pResult.pSplitPath || !pResult.pForcePath))
+		{
+			iNode = 1;
+			for (const char* pExt = pExtension; *pExt && iNode != INVALID_NODE; ++pExt)
+				iNode = FindChild(iNode, NormalizeRouteChar((unsigned char)*pExt));
+
+			if (iNode != INVALID_NODE)
+				ApplyRules(m_pNodes[iNode], pPathID, iHook, ROUTE_EXTENSION, pResult);
+		}
+	}
+
+	inline const std::vector<RouteRule>& GetRules() const { return m_pRules; };
+	inline size_t GetNodeCount() const { return m_pNodes.size(); };
+
+private:
+	static constexpr unsigned int INVALID_NODE = (unsigned int)-1;
+
+	struct RouteNode
+	{
+		unsigned int iFirstEdge = 0;
+		unsigned int iEdges = 0;
+		unsigned int iFirstRule = 0;
+		unsigned int iRules = 0;
+	};
+
+	struct RouteEdge
+	{
+		unsigned char c;
+		unsigned int iNode;
+	};
+
+	inline unsigned int FindChild(unsigned int iNode, unsigned char c) const
+	{
+		const RouteNode& pNode = m_pNodes[iNode];
+		const RouteEdge* pEdges = m_pEdges.data() + pNode.iFirstEdge;
+		for (unsigned int i = 0; i < pNode.iEdges; ++i) // Most nodes have one or two children.
+			if (pEdges[i].c == c)
+				return pEdges[i].iNode;
+
+		return INVALID_NODE;
+	}
+
+	/*
+	 * iType 0 means we reached the end of the path, so prefix and exact routes both match.
+	 * Exact routes and deeper prefixes override the previous match, extensions are only used if nothing else matched.
+	 */
+	inline void ApplyRules(const RouteNode& pNode, const char* pPathID, int iHook, int iType, RouteResult& pResult) const
+	{
+		bool bSplitFound = false, bForceFound = false;
+		for (unsigned int i = 0; i < pNode.iRules; ++i)
+		{
+			const RouteRule& pRule = m_pRules[m_pNodeRules[pNode.iFirstRule + i]];
+			if (iType == 0 ? pRule.iType == ROUTE_EXTENSION : pRule.iType != iType)
+				continue;
+
+			if (!(pRule.iHooks & iHook))
+				continue;
+
+			if (pRule.pSourcePathID && (!pPathID || V_stricmp(pRule.pSourcePathID, pPathID) != 0))
+				continue;
+
+			bool& bFound = pRule.bForce ? bForceFound : bSplitFound;
+			const char*& pTarget = pRule.bForce ? pResult.pForcePath : pResult.pSplitPath;
+			if (bFound || (iType == ROUTE_EXTENSION && pTarget))
+				continue;
+
+			pTarget = pRule.pPathID;
+			bFound = true;
+		}
+	}
+
+	std::vector<RouteRule> m_pRules;
+	std::vector<RouteNode> m_pNodes;
+	std::vector<RouteEdge> m_pEdges;
+	std::vector<unsigned int> m_pNodeRules;
+};
+
+static CPathRouter* g_pPathRouter = NULL; // Only replaced by the main thread, so it can read it without the lock.
+static CThreadSpinRWLock g_pPathRouterLock; // Async threads hold it for reading while they're inside Route.
+static std::vector<RouteRule> g_pRouteRules;
+static std::unordered_set<std::string> g_pRoutePathIDs; // Never cleared since Route returns these.
+
+static const char* InternRoutePathID(const char* pPathID)
+{
+	if (!pPathID)
+		return NULL;
+
+	return g_pRoutePathIDs.insert(pPathID).first->c_str();
+}
+
+static void SwapPathRouter(CPathRouter* pRouter)
+{
+	g_pPathRouterLock.LockForWrite(); // Waits for every thread that's still inside Route.
+	CPathRouter* pOldRouter = g_pPathRouter;
+	g_pPathRouter = pRouter;
+	g_pPathRouterLock.UnlockWrite();
+
+	if (pOldRouter)
+		delete pOldRouter;
+}
+
+static void RebuildPathRouter()
+{
+	SwapPathRouter(new CPathRouter(g_pRouteRules)); // Built before locking so Route isn't blocked by it.
+}
+
+static void NormalizeRouteMatch(std::string& strMatch, RouteType iType)
+{
+	for (char& c : strMatch)
+		c = (char)NormalizeRouteChar((unsigned char)c);
+
+	if (iType == ROUTE_EXTENSION && !strMatch.empty() && strMatch.front() == '.')
+		strMatch.erase(0, 1);
+}
+
+static void AddRoute(const char* pMatch, const char* pPathID, RouteType iType, bool bForce, const char* pSourcePathID = NULL, int iHooks = ROUTEHOOK_ALL, bool bRebuild = true)
+{
+	RouteRule pRule;
+	pRule.strMatch = pMatch;
+	pRule.iType = iType;
+	pRule.bForce = bForce;
+	pRule.iHooks = iHooks;
+	pRule.pPathID = InternRoutePathID(pPathID);
+	pRule.pSourcePathID = InternRoutePathID(pSourcePathID);
+	NormalizeRouteMatch(pRule.strMatch, iType);
+
+	bool bReplaced = false;
+	for (RouteRule& pOther : g_pRouteRules)
+	{
+		if (pOther.iType == iType && pOther.bForce == bForce && pOther.pSourcePathID == pRule.pSourcePathID && pOther.strMatch == pRule.strMatch)
+		{
+			pOther.pPathID = pRule.pPathID;
+			pOther.iHooks = pRule.iHooks;
+			bReplaced = true;
+			break;
+		}
+	}
+
+	if (!bReplaced)
+		g_pRouteRules.push_back(pRule);
+
+	if (bRebuild)
+		RebuildPathRouter();
+}
+
+static bool RemoveRoute(const char* pMatch, RouteType iType, const char* pSourcePathID)
+{
+	std::string strMatch = pMatch;
+	NormalizeRouteMatch(strMatch, iType);
+	const char* pInternedSource = InternRoutePathID(pSourcePathID);
+
+	size_t iOldSize = g_pRouteRules.size();
+	g_pRouteRules.erase(std::remove_if(g_pRouteRules.begin(), g_pRouteRules.end(), [&](const RouteRule& pRule) {
+		return pRule.iType == iType && pRule.pSourcePathID == pInternedSource && pRule.strMatch == strMatch;
+	}), g_pRouteRules.end());
+
+	if (g_pRouteRules.size() == iOldSize)
+		return false;
+
+	RebuildPathRouter();
+	return true;
+}
+
+static void ResetRoutes()
+{
+	g_pRouteRules.clear();
+
+	// Content paths used by holylib_filesystem_splitgamepath
+	AddRoute("materials/", "CONTENT_MATERIALS", ROUTE_PREFIX, false, NULL, ROUTEHOOK_ALL, false);
+	AddRoute("models/", "CONTENT_MODELS", ROUTE_PREFIX, false, NULL, ROUTEHOOK_ALL, false);
+	AddRoute("sound/", "CONTENT_SOUNDS", ROUTE_PREFIX, false, NULL, ROUTEHOOK_ALL, false);
+	AddRoute("maps/", "CONTENT_MAPS", ROUTE_PREFIX, false, NULL, ROUTEHOOK_ALL, false);
+	AddRoute("resource/", "CONTENT_RESOURCE", ROUTE_PREFIX, false, NULL, ROUTEHOOK_ALL, false);
+	AddRoute("scripts/", "CONTENT_SCRIPTS", ROUTE_PREFIX, false, NULL, ROUTEHOOK_ALL, false);
+	AddRoute("cfg/", "CONTENT_CONFIGS", ROUTE_PREFIX, false, NULL, ROUTEHOOK_ALL, false);
+	AddRoute("gamemodes/", "LUA_GAMEMODES", ROUTE_PREFIX, false, NULL, ROUTEHOOK_ALL, false);
+
+	// We use MOD_WRITE because it doesn't have additional junk search paths.
+	// The forced files are only used by OpenForRead and the forced gamemodes only by GetFileTime, like it always was.
+	static const char* pForcedFiles[] = {
+		"cfg/server.cfg", "cfg/banned_ip.cfg", "cfg/banned_user.cfg", "cfg/skill2.cfg", "cfg/game.cfg",
+		"cfg/trusted_keys_base.txt", "cfg/pure_server_minimal.txt", "cfg/skill_manifest.cfg", "cfg/skill.cfg", "cfg/mapcycle.txt",
+		"stale.txt", "garrysmod.ver", "scripts/actbusy.txt", "modelsounds.cache", "lua/send.txt",
+		"resource/serverevents.res", "resource/gameevents.res", "resource/modevents.res", "resource/hltvevents.res",
+	};
+	for (const char* pFile : pForcedFiles)
+		AddRoute(pFile, "MOD_WRITE", ROUTE_EXACT, true, NULL, ROUTEHOOK_OPENFORREAD, false);
+
+	AddRoute("gamemodes/base", "MOD_WRITE", ROUTE_PREFIX, true, NULL, ROUTEHOOK_GETFILETIME, false);
+	AddRoute("gamemodes/sandbox", "MOD_WRITE", ROUTE_PREFIX, true, NULL, ROUTEHOOK_GETFILETIME, false);
+	AddRoute("gamemodes/terrortown", "MOD_WRITE", ROUTE_PREFIX, true, NULL, ROUTEHOOK_GETFILETIME, false);
+
+	RebuildPathRouter();
+}
+
+static RouteResult RoutePath(const char* pFileName, const char* pPathID, int iHook)
+{
+	RouteResult pResult;
+	bool bSplit = holylib_filesystem_splitgamepath.GetBool();
+	bool bForce = holylib_filesystem_forcepath.GetBool();
+	if (!bSplit && !bForce)
+		return pResult;
+
+	g_pPathRouterLock.LockForRead();
+	if (g_pPathRouter)
+		g_pPathRouter->Route(pFileName, pPathID, iHook, pResult);
+	g_pPathRouterLock.UnlockRead();
+
+	if (!bSplit)
+		pResult.pSplitPath = NULL;
+
+	if (!bForce)
+		pResult.pForcePath = NULL;
+
+	return pResult;
+}
+
+static const char* GetOverridePath(const char* pFileName, const char* pathID)
+{
+	return RoutePath(pFileName, pathID, ROUTEHOOK_OPENFORREAD).pSplitPath;
+}
+
+static const char* pRouteTypeNames[] = {"", "prefix", "exact", "extension"};
+static const char* pRouteHookNames[] = {"", "openforread", "getfiletime", "all"};
+static void DumpRoutesCmd(const CCommand &args)
+{
+	const CPathRouter* pRouter = g_pPathRouter;
+	if (!pRouter)
+		return;
+
+	Msg("---- Path routes (%i routes, %i nodes) ----\n", (int)pRouter->GetRules().size(), (int)pRouter->GetNodeCount());
+	for (const RouteRule& pRule : pRouter->GetRules())
+		Msg("%-9s %-6s \"%s\" -> %s (from: %s, hooks: %s)\n", pRouteTypeNames[pRule.iType], pRule.bForce ? "force" : "split", pRule.strMatch.c_str(), pRule.pPathID, pRule.pSourcePathID ? pRule.pSourcePathID : "any", pRouteHookNames[pRule.iHooks & ROUTEHOOK_ALL]);
+	Msg("---- End of Path routes ----\n");
+}
+static ConCommand dumproutes("holylib_filesystem_dumproutes", DumpRoutesCmd, "Dumps all path routes", 0);
+
+static void BenchmarkRouterCmd(const CCommand &args)
+{
+	int iFiles = args.ArgC() > 1 ? atoi(args.Arg(1)) : 1000000;
+	if (iFiles <= 0)
+	{
+		Msg("Usage: holylib_filesystem_benchmarkrouter <files = 1000000>\n");
+		return;
+	}
+
+	static const char* pFormats[] = {"models/holylib/benchmark/%i.mdl", "materials/holylib/%i/benchmark.vmt", "sound/holylib/%i.wav", "lua/autorun/holylib_%i.lua", "cfg/server.cfg", "gamemodes/base/gamemode/%i.lua", "data/holylib/%i.txt"};
+	std::vector<std::string> pFileNames;
+	pFileNames.reserve(iFiles);
+	char pFileName[MAX_PATH];
+	for (int i = 0; i < iFiles; ++i)
+	{
+		V_snprintf(pFileName, sizeof(pFileName), pFormats[i % (sizeof(pFormats) / sizeof(const char*))], i);
+		pFileNames.push_back(pFileName);
+	}
+
+	// The old implementation: split at the first slash, look up the content path and then the forced files.
+	static const std::unordered_map<std::string_view, std::string_view> pOldOverridePaths = {
+		{"materials", "CONTENT_MATERIALS"}, {"models", "CONTENT_MODELS"}, {"sound", "CONTENT_SOUNDS"}, {"maps", "CONTENT_MAPS"},
+		{"resource", "CONTENT_RESOURCE"}, {"scripts", "CONTENT_SCRIPTS"}, {"cfg", "CONTENT_CONFIGS"}, {"gamemodes", "LUA_GAMEMODES"}
+	};
+	std::unordered_map<std::string_view, std::string_view> pOldForcedPaths;
+	for (const RouteRule& pRule : g_pRouteRules)
+		if (pRule.iType == ROUTE_EXACT && (pRule.iHooks & ROUTEHOOK_OPENFORREAD))
+			pOldForcedPaths[pRule.strMatch] = pRule.pPathID;
+
+	double flStart = Plat_FloatTime();
+	int iOldRouted = 0;
+	for (const std::string& strFileName : pFileNames)
+	{
+		std::string_view strView = strFileName;
+		size_t iPos = strView.find_first_of("/");
+		if (iPos != std::string::npos && pOldOverridePaths.find(strView.substr(0, iPos)) != pOldOverridePaths.end())
+			++iOldRouted;
+
+		if (pOldForcedPaths.find(strView) != pOldForcedPaths.end())
+			++iOldRouted;
+	}
+	double flOld = Plat_FloatTime() - flStart;
+
+	const CPathRouter* pRouter = g_pPathRouter;
+	if (!pRouter)
+		return;
+
+	flStart = Plat_FloatTime();
+	int iNewRouted = 0;
+	for (const std::string& strFileName : pFileNames)
+	{
+		RouteResult pResult;
+		pRouter->Route(strFileName.c_str(), "GAME", ROUTEHOOK_OPENFORREAD, pResult);
+		iNewRouted += (pResult.pSplitPath ? 1 : 0) + (pResult.pForcePath ? 1 : 0);
+	}
+	double flNew = Plat_FloatTime() - flStart;
+
+	Msg("---- Path router benchmark (%i files) ----\n", iFiles);
+	Msg("old:    %.3fms (%.1f ns/path), routed %i\n", flOld * 1000, flOld * 1000000000 / iFiles, iOldRouted);
+	Msg("router: %.3fms (%.1f ns/path), routed %i\n", flNew * 1000, flNew * 1000000000 / iFiles, iNewRouted);
+	Msg("---- End of Path router benchmark ----\n");
+}
+static ConCommand benchmarkrouter("holylib_filesystem_benchmarkrouter", BenchmarkRouterCmd, "Benchmarks the path router against the old override path lookup", 0);
+
+/*
+ * This is the OpenForRead implementation but faster.
+ */
+static Detouring::Hook detour_CBaseFileSystem_OpenForRead;
+static FileHandle_t hook_CBaseFileSystem_OpenForRead(CBaseFileSystem* filesystem, const char *pFileNameT, const char *pOptions, unsigned flags, const char *pathID, char **ppszResolvedFilename)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::OpenForRead", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+	CFileSystemTrace pTrace(FSTRACE_OPENFORREAD, pFileNameT, pathID);
+
+	char pFileNameBuff[MAX_PATH];
+	const char *pFileName = pFileNameBuff;
+
+	hook_CBaseFileSystem_FixUpPath(filesystem, pFileNameT, pFileNameBuff, sizeof(pFileNameBuff));
+
+	bool splitPath = false;
+	const char* origPath = pathID;
+	RouteResult pRoute = RoutePath(pFileName, pathID, ROUTEHOOK_OPENFORREAD); // Also checks holylib_filesystem_splitgamepath and holylib_filesystem_forcepath
+	if (pRoute.pSplitPath)
+	{
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - OpenForRead: Found split path! switching (%s, %s)\n", pathID, pRoute.pSplitPath);
+
+		pathID = pRoute.pSplitPath;
+		splitPath = true;
+	}
+
+	if (pRoute.pForcePath)
+	{
+		FileHandle_t handle = detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
+		if (handle) {
+			if (g_pFileSystemModule.InDebug())
+				Msg("holylib - OpenForRead: Found file in forced path! (%s, %s, %s)\n", pFileNameT, pathID, pRoute.pForcePath);
+
+			return handle;
+		} else {
+			if (g_pFileSystemModule.InDebug())
+				Msg("holylib - OpenForRead: Failed to find file in forced path! (%s, %s, %s)\n", pFileNameT, pathID, pRoute.pForcePath);
+		}
+	} else if (holylib_filesystem_forcepath.GetBool()) {
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - OpenForRead: File is not in overridePaths (%s, %s)\n", pFileNameT, pathID);
+	}
+
+	/*
+	 * The Prediction
+	 * --------------
+	 * 
+	 * I predict that all files are inside the same search paths.
+	 * With this prediction I can now get the search path of the .mdl file
+	 * and search in that one to find a file. If It's not found we say it doesn't exist.
+	 * 
+	 * The prediction currently is only implemented for models 
+	 * -> .mdl .vdd .vtx .phy .ani and the other fancy formats.
+	 */
+	if (holylib_filesystem_predictpath.GetBool() || holylib_filesystem_predictexistance.GetBool())
+	{
+		std::string_view strFileName = pFileNameT;
+		std::string_view extension = getFileExtension(strFileName);
+		CSearchPath* path = NULL;
+		bool isModel = false;
+		if (extension == "vvd" || extension == "vtx" || extension == "phy" || extension == "ani")
+			isModel = true;
+
+		if (isModel)
+		{
+			if (shouldWeCare(strFileName)) // Skip shitty files. I had enouth
+			{
+				std::string_view mdlPath = nukeFileExtension(strFileName);
+				if (extension == "vtx")
+					mdlPath = nukeFileExtension(mdlPath); // "dx90.vtx" -> "dx90" -> ""
+
+				std::string finalMDLPath = (std::string)mdlPath + ".mdl";
+				path = GetPathFromSearchCache(finalMDLPath.c_str(), pathID);
+				if (!path)
+					if (g_pFileSystemModule.InDebug())
+						Msg("holylib - Prediction: failed to build a path? (%s, %s, %s)\n", finalMDLPath.c_str(), pathID, strFileName.data());
+			} else
+				if (g_pFileSystemModule.InDebug())
+					Msg("holylib - Prediction: We decided to not care about this specific file! (%s)\n", strFileName.data());
+		}
+
+		if (extension == "lmp") // .lmp -> map lump
+		{
+			// ToDo
+		}
+
+		if (extension == "vmt")
+		{
+			// ToDo. I got no plan how but I'll come up with one hopefully
+		}
+
+		if (extension == "lua")
+		{
+			// ToDo. Time to predict lua. We actually need to do this in FastFileTime or so
+		}
+
+		if (path)
+		{
+			CFileOpenInfo openInfo( filesystem, pFileName, NULL, pOptions, flags, ppszResolvedFilename );
+			openInfo.m_pSearchPath = path;
+			FileHandle_t file = hook_CBaseFileSystem_FindFileInSearchPath(filesystem, openInfo);
+			if (file) {
+				if (g_pFileSystemModule.InDebug())
+					Msg("holylib - Prediction: Found file in predicted path! (%s, %s)\n", pFileNameT, pathID);
+
+				return file; // hook_CBaseFileSystem_FindFileInSearchPath already added it to the handle pool.
+			} else {
+				if (g_pFileSystemModule.InDebug())
+					Msg("holylib - Prediction: Failed to predict file path! (%s, %s)\n", pFileNameT, pathID);
+
+				if (holylib_filesystem_predictexistance.GetBool())
+				{
+					if (g_pFileSystemModule.InDebug())
+					{
+						Msg("holylib - Prediction: predicted path failed. Let's say it doesn't exist.\n");
+						FileHandle_t file2 = detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
+						if (file2) // Verify in debug that the predictions we make are correct.
+						{
+							Msg("holylib - Prediction Error!: We predicted it to not exist, but it exists\n");
+							g_pFullFileSystem->Close(file2); // We still return NULL!
+						}
+					}
+
+					std::string realStrFileName = strFileName.data();
+					auto it = m_PredictionCheck.find(realStrFileName); // This could cause additional slowdown :/
+					if (it != m_PredictionCheck.end())
+						return NULL;
+
+					m_PredictionCheck.insert(realStrFileName);
+
+					return NULL;
+				}
+			}
+		} else {
+			if (g_pFileSystemModule.InDebug())
+				Msg("holylib - Prediction: Not predicting it! (%s, %s, %s)\n", pFileNameT, pathID, extension.data());
+		}
+	}
+
+	const char* pNegativePathID = pathID; // The split pathID. We may fall back to origPath below, but the miss has to be stored under the same pathID we look it up with.
+	if (NegativeCache_IsMissing(pFileName, pNegativePathID))
+		return NULL;
+
+	if (!holylib_filesystem_earlysearchcache.GetBool())
+		return detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
+
+	if (V_IsAbsolutePath(pFileName))
+		return detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
+
+	// So we now got the issue that CBaseFileSystem::CSearchPathsIterator::CSearchPathsIterator is way too slow.
+	// so we need to skip it. We do this by checking if we got the file in the search cache before we call the OpenForRead function.
+	CSearchPath* cachePath = GetPathFromSearchCache(pFileName, pathID);
+	if (cachePath)
+	{
+		VPROF_BUDGET("HolyLib - SearchCache::OpenForRead", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+		CFileOpenInfo openInfo( filesystem, pFileName, NULL, pOptions, flags, ppszResolvedFilename );
+		openInfo.m_pSearchPath = cachePath;
+		FileHandle_t cacheFile = GetFileHandleFromPool(cachePath, openInfo);
+		if (cacheFile)
+			return cacheFile;
+
+		FileHandle_t file = detour_CBaseFileSystem_FindFileInSearchPath.GetTrampoline<Symbols::CBaseFileSystem_FindFileInSearchPath>()(filesystem, openInfo);
+		if (file)
+		{
+			AddFileHandleToPool(openInfo, file);
+
+			return file;
+		}
+	} else {
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - OpenForRead: Failed to find cachePath! (%s)\n", pFileName);
+	}
+	
+	if (splitPath && holylib_filesystem_splitfallback.GetBool())
+	{
+		FileHandle_t file = detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
+		if (file)
+			return file;
+
+		// ToDo: Find out why map content isn't found properly.
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - OpenForRead: Failed to find file in splitPath! Failling back to original. This is slow! (%s)\n", pFileName);
+
+		pathID = origPath;
+	}
+
+	FileHandle_t file = detour_CBaseFileSystem_OpenForRead.GetTrampoline<Symbols::CBaseFileSystem_OpenForRead>()(filesystem, pFileNameT, pOptions, flags, pathID, ppszResolvedFilename);
+	if (!file)
+		NegativeCache_AddMissing(pFileName, pNegativePathID);
+
+	return file;
+}
+
+/*
+ * GMOD first calls GetFileTime and then OpenForRead, so we need to make changes for lua in GetFileTime.
+ */
+
+namespace IGamemodeSystem
+{
+	struct UpdatedInformation
+	{
+		bool exists;
+		bool menusystem;
+#ifndef WIN32
+		const char* title;
+		const char* name;
+		const char* maps;
+		const char* basename;
+		const char* category;
+#else
+		std::string title;
+		std::string name;
+		std::string maps;
+		std::string basename;
+		std::string category;
+#endif
+		uint64_t workshopid;
+	};
+}
+
+/*
+ * GMOD Likes to use paths like "sandbox/gamemode/spawnmenu/sandbox/gamemode/spawnmenu/".
+ * This wastes performance, so we fix them up to be "sandbox/gamemode/spawnmenu/"
+ */
+static std::string_view fixGamemodePath(IFileSystem* filesystem, std::string_view path)
+{
+	std::string_view activeGamemode = ((const IGamemodeSystem::UpdatedInformation&)filesystem->Gamemodes()->Active()).name;
+	if (activeGamemode.empty())
+		return path;
+
+	if (path.rfind("gamemodes/") == 0)
+		return path;
+
+	std::string searchStr = "/";
+	searchStr.append(activeGamemode);
+	searchStr.append("/gamemode/"); // Final string should be /[Active Gamemode]/gamemode/
+	size_t pos = path.find(searchStr);
+	if (pos == std::string::npos)
+		return path;
+
+	if (g_pFileSystemModule.InDebug())
+		Msg("fixGamemodePath: Fixed up path. (%s -> %s)\n", path.data(), path.substr(pos + 1).data());
+
+	return path.substr(pos + 1);
+}
+
+static Detouring::Hook detour_CBaseFileSystem_GetFileTime;
+static inline long GetFileTime(IFileSystem* filesystem, const char *pFileName, const char *pPathID)
+{
+	long iTime;
+	if (VirtualIndex_GetFileTime(pFileName, pPathID, iTime))
+		return iTime;
+
+	return detour_CBaseFileSystem_GetFileTime.GetTrampoline<Symbols::CBaseFileSystem_GetFileTime>()(filesystem, pFileName, pPathID);
+}
+
+static long hook_CBaseFileSystem_GetFileTime(IFileSystem* filesystem, const char *pFileName, const char *pPathID)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::GetFileTime", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+	CFileSystemTrace pTrace(FSTRACE_GETFILETIME, pFileName, pPathID);
+
+	bool bSplitPath = false;
+	const char* origPath = pPathID;
+	RouteResult pRoute = RoutePath(pFileName, pPathID, ROUTEHOOK_GETFILETIME);
+	if (pRoute.pSplitPath)
+	{
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - GetFileTime: Found split path! switching (%s, %s)\n", pPathID, pRoute.pSplitPath);
+
+		pPathID = pRoute.pSplitPath;
+		bSplitPath = true;
+	}
+
+	std::string_view strFileName = pFileName; // Workaround for now.
+	if (origPath && V_stricmp(origPath, "lsv") == 0 && holylib_filesystem_fixgmodpath.GetBool()) // Some weird things happen in the lsv path.  
+	{
+		strFileName = fixGamemodePath(filesystem, strFileName);
+		if (strFileName.data() != pFileName)
+			pRoute.pForcePath = RoutePath(strFileName.data(), origPath, ROUTEHOOK_GETFILETIME).pForcePath;
+	}
+	pFileName = strFileName.data();
+
+	if (pRoute.pForcePath)
+	{
+		long time = GetFileTime(filesystem, pFileName, pPathID);
+		if (time != 0L) {
+			if (g_pFileSystemModule.InDebug())
+				Msg("holylib - GetFileTime: Found file in forced path! (%s, %s, %s)\n", pFileName, pPathID, pRoute.pForcePath);
+			return time;
+		} else
+			if (g_pFileSystemModule.InDebug())
+				Msg("holylib - GetFileTime: Failed to find file in forced path! (%s, %s, %s)\n", pFileName, pPathID, pRoute.pForcePath);
+	} else if (holylib_filesystem_forcepath.GetBool()) {
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - GetFileTime: File is not in overridePaths (%s, %s)\n", pFileName, pPathID);
+	}
+
+	if (bSplitPath)
+	{
+		long pTime = GetFileTime(filesystem, pFileName, pPathID);
+		if (pTime != 0L)
+			return pTime;
+
+		if (g_pFileSystemModule.InDebug())
+			Msg("holylib - GetFileTime: Splitpath failed! (%s, %s, %s)\n", pFileName, pPathID, origPath);
+
+		pPathID = origPath;
+	}
+
+	return GetFileTime(filesystem, pFileName, pPathID);
+}
+
+static bool gBlockRemoveAllMapPaths = false;
+static Detouring::Hook detour_CBaseFileSystem_RemoveAllMapSearchPaths;
+static void hook_CBaseFileSystem_RemoveAllMapSearchPaths(IFileSystem* filesystem)
+{
+	if (gBlockRemoveAllMapPaths)
+		return;
+
+	detour_CBaseFileSystem_RemoveAllMapSearchPaths.GetTrampoline<Symbols::CBaseFileSystem_RemoveAllMapSearchPaths>()(filesystem);
+	RemoveVirtualSearchPaths(NULL, NULL, true);
+}
+
+static std::string_view getVPKFile(const std::string_view& fileName) {
+	size_t lastThingyPos = fileName.find_last_of('/');
+	size_t lastDotPos = fileName.find_last_of('.');
+
+	return fileName.substr(lastThingyPos + 1, lastDotPos - lastThingyPos - 1);
+}
+
+static Detouring::Hook detour_CBaseFileSystem_AddSearchPath;
+static void hook_CBaseFileSystem_AddSearchPath(IFileSystem* filesystem, const char *pPath, const char *pathID, SearchPathAdd_t addType)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::AddSearchPath", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, pathID, addType);
+	NegativeCache_Invalidate();
+
+	// Below is not dead code. It's code to try to solve the map contents but it currently doesn't work.
+	/*std::string_view extension = getFileExtension(pPath);
+	if (extension == "bsp") {
+		const char* pPathID = "__TEMP_MAP_PATH";
+		gBlockRemoveAllMapPaths = true;
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, pPathID, addType);
+
+		if (filesystem->IsDirectory("materials/", pPathID))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MATERIALS", addType);
+
+		if (filesystem->IsDirectory("models/", pPathID))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MODELS", addType);
+	
+		if (filesystem->IsDirectory("sound/", pPathID))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_SOUNDS", addType);
+	
+		if (filesystem->IsDirectory("maps/", pPathID))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MAPS", addType);
+	
+		if (filesystem->IsDirectory("resource/", pPathID))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_RESOURCE", addType);
+
+		if (filesystem->IsDirectory("scripts/", pPathID))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_SCRIPTS", addType);
+
+		if (filesystem->IsDirectory("cfg/", pPathID))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_CONFIGS", addType);
+		
+		gBlockRemoveAllMapPaths = false;
+		filesystem->RemoveSearchPath(pPath, pPathID);
+	}*/
+
+	std::string strPath = pPath;
+	if (V_stricmp(pathID, "GAME") == 0)
+	{
+		if (filesystem->IsDirectory((strPath + "/materials").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MATERIALS", addType);
+
+		if (filesystem->IsDirectory((strPath + "/models").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MODELS", addType);
+	
+		if (filesystem->IsDirectory((strPath + "/sound").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_SOUNDS", addType);
+	
+		if (filesystem->IsDirectory((strPath + "/maps").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MAPS", addType);
+	
+		if (filesystem->IsDirectory((strPath + "/resource").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_RESOURCE", addType);
+
+		if (filesystem->IsDirectory((strPath + "/scripts").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_SCRIPTS", addType);
+
+		if (filesystem->IsDirectory((strPath + "/cfg").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_CONFIGS", addType);
+
+		if (filesystem->IsDirectory((strPath + "/gamemodes").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_GAMEMODES", addType);
+
+		if (filesystem->IsDirectory((strPath + "/lua/includes").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_INCLUDES", addType);
+	}
+	
+	if(V_stricmp(pathID, "lsv") == 0 || V_stricmp(pathID, "GAME") == 0)
+	{
+		if (filesystem->IsDirectory((strPath + "/sandbox").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_GAMEMODE_SANDBOX", addType);
+
+		if (filesystem->IsDirectory((strPath + "/effects").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_EFFECTS", addType);
+	
+		if (filesystem->IsDirectory((strPath + "/entities").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_ENTITIES", addType);
+
+		if (filesystem->IsDirectory((strPath + "/weapons").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_WEAPONS", addType);
+
+		if (filesystem->IsDirectory((strPath + "/lua/derma").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_DERMA", addType);
+
+		if (filesystem->IsDirectory((strPath + "/lua/drive").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_DRIVE", addType);
+
+		if (filesystem->IsDirectory((strPath + "/lua/entities").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_LUA_ENTITIES", addType);
+
+		if (filesystem->IsDirectory((strPath + "/vgui").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_VGUI", addType);
+
+		if (filesystem->IsDirectory((strPath + "/postprocess").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_POSTPROCESS", addType);
+
+		if (filesystem->IsDirectory((strPath + "/matproxy").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_MATPROXY", addType);
+
+		if (filesystem->IsDirectory((strPath + "/autorun").c_str()))
+			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_AUTORUN", addType);
+	}
+
+	InvalidateVirtualPathIDs(); // After all the pathIDs above were added.
+
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - Added Searchpath: %s %s %i\n", pPath, pathID, (int)addType);
+}
+
+static Detouring::Hook detour_CBaseFileSystem_AddVPKFile;
+static void hook_CBaseFileSystem_AddVPKFile(IFileSystem* filesystem, const char *pPath, const char *pathID, SearchPathAdd_t addType)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::AddVPKFile", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, pathID, addType);
+	NegativeCache_Invalidate();
+
+	if (V_stricmp(pathID, "GAME") == 0)
+	{
+		std::string_view vpkPath = getVPKFile(pPath);
+		detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, vpkPath.data(), addType);
+
+		if (filesystem->IsDirectory("materials/"), vpkPath.data())
+			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_MATERIALS", addType);
+
+		if (filesystem->IsDirectory("models/"), vpkPath.data())
+			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_MODELS", addType);
+	
+		if (filesystem->IsDirectory("sound/"), vpkPath.data())
+			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_SOUNDS", addType);
+	
+		if (filesystem->IsDirectory("maps/"), vpkPath.data())
+			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_MAPS", addType);
+	
+		if (filesystem->IsDirectory("resource/"), vpkPath.data())
+			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_RESOURCE", addType);
+
+		if (filesystem->IsDirectory("scripts/"), vpkPath.data())
+			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_SCRIPTS", addType);
+
+		if (filesystem->IsDirectory("cfg/"), vpkPath.data())
+			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_CONFIGS", addType);
+
+		if (filesystem->IsDirectory("gamemodes/"), vpkPath.data())
+			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "LUA_GAMEMODES", addType);
+
+		if (filesystem->IsDirectory("lua/includes/"), vpkPath.data())
+			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "LUA_INCLUDES", addType);
+	
+		filesystem->RemoveSearchPath(pPath, vpkPath.data());
+	}
+
+	InvalidateVirtualPathIDs(); // After all the pathIDs above were added.
+
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - Added vpk: %s %s %i\n", pPath, pathID, (int)addType);
+}
+
+static Detouring::Hook detour_CBaseFileSystem_RemoveSearchPath;
+static bool hook_CBaseFileSystem_RemoveSearchPath(IFileSystem* filesystem, const char *pPath, const char *pathID)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::RemoveSearchPath", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	bool bRemoved = detour_CBaseFileSystem_RemoveSearchPath.GetTrampoline<Symbols::CBaseFileSystem_RemoveSearchPath>()(filesystem, pPath, pathID);
+	if (bRemoved)
+		RemoveVirtualSearchPaths(pPath, pathID);
+
+	return bRemoved;
+}
+
+static Detouring::Hook detour_CBaseFileSystem_RemoveSearchPaths;
+static void hook_CBaseFileSystem_RemoveSearchPaths(IFileSystem* filesystem, const char *pathID)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::RemoveSearchPaths", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	detour_CBaseFileSystem_RemoveSearchPaths.GetTrampoline<Symbols::CBaseFileSystem_RemoveSearchPaths>()(filesystem, pathID);
+	RemoveVirtualSearchPaths(NULL, pathID);
+}
+
+static Detouring::Hook detour_CBaseFileSystem_RemoveAllSearchPaths;
+static void hook_CBaseFileSystem_RemoveAllSearchPaths(IFileSystem* filesystem)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::RemoveAllSearchPaths", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	detour_CBaseFileSystem_RemoveAllSearchPaths.GetTrampoline<Symbols::CBaseFileSystem_RemoveAllSearchPaths>()(filesystem);
+	NukeVirtualIndex();
+}
+
+static Detouring::Hook detour_CBaseFileSystem_Close;
+void DeleteFileHandle(FileHandle_t handle) // NOTE for myself: This is declared extern! so no static!!!
+{
+	detour_CBaseFileSystem_Close.GetTrampoline<Symbols::CBaseFileSystem_Close>()(g_pFullFileSystem, handle);
+}
+
+static void hook_CBaseFileSystem_Close(IFileSystem* filesystem, FileHandle_t file)
+{
+	VPROF_BUDGET("HolyLib - CBaseFileSystem::Close", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+	CFileSystemTrace pTrace(FSTRACE_CLOSE, NULL, NULL);
+
+	auto writeIt = g_pVirtualWriteHandles.find(file);
+	if (writeIt != g_pVirtualWriteHandles.end())
+	{
+		detour_CBaseFileSystem_Close.GetTrampoline<Symbols::CBaseFileSystem_Close>()(filesystem, file);
+		OnPathChanged(writeIt->second.c_str(), false); // Update the size & time.
+		g_pVirtualWriteHandles.erase(writeIt);
+		return;
+	}
+
+	if (g_pFileHandlePool.Release(file))
+		return;
+
+	detour_CBaseFileSystem_Close.GetTrampoline<Symbols::CBaseFileSystem_Close>()(filesystem, file);
+}
+
+extern void FileAsyncReadThink();
+extern void WarmupThink();
+void CFileSystemModule::Think(bool bSimulating)
+{
+	FileAsyncReadThink();
+	WarmupThink();
+	VirtualIndexThink();
+
+	g_pFileHandlePool.Think();
+}
+
+std::vector<std::string> splitString(std::string str, std::string_view delimiter)
+{
+	std::vector<std::string> v;
+	if (!str.empty()) {
+		int start = 0;
+		while (true)
+		{
+			size_t idx = str.find(delimiter, start);
+			if (idx == std::string::npos)
+				break;
+
+			int length = idx - start;
+			v.push_back(str.substr(start, length));
+			start += (length + delimiter.size());
+		}
+
+		v.push_back(str.substr(start));
+	}
+
+	return v;
+}
+
+void CFileSystemModule::Init(CreateInterfaceFn* appfn, CreateInterfaceFn* gamefn)
+{
+	networkStringTableContainerServer = (INetworkStringTableContainer*)appfn[0](INTERFACENAME_NETWORKSTRINGTABLESERVER, NULL);
+	Detour::CheckValue("get interface", "INetworkStringTableContainer", networkStringTableContainerServer != NULL);
+
+	/*
+	 * Why do we do this below?
+	 * Because if our Detours weren't added by the GhostInj, they were added after SearchPaths were created.
+	 * This will cause the splitgamepath stuff to fail since we didn't add our custom paths.
+	 * So now we get all GAME paths, remove them and reaplly them so that our detour can handle them.
+	 */
+	if (!g_pModuleManager.IsUsingGhostInj())
+	{
+		// Humongus size because you can have a huge amount of searchpaths.
+		constexpr int iSize = 1 << 16;
+		char* pChar = new char[iSize];
+		int iLength = g_pFullFileSystem->GetSearchPath("GAME", true, pChar, iSize);
+		if (iSize <= iLength)
+			Warning("holylib: Not enouth space for search paths! please report this.\n");
+
+		std::string pStr = pChar;
+		pStr = pStr.substr(0, iLength);
+		std::vector<std::string> pSearchPaths = splitString(pStr, ";");
+		g_pFullFileSystem->RemoveSearchPaths("GAME"); // Yes. Were gonna reapply them. Should we also do it for lsv?
+		for (std::string pSearchPath : pSearchPaths)
+		{
+			g_pFullFileSystem->AddSearchPath(pSearchPath.c_str(), "GAME", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+			
+			if (g_pFileSystemModule.InDebug())
+				Msg("Recreate Path: %s\n", pSearchPath.c_str());
+		}
+
+		delete[] pChar;
+	}
+
+
+	ResetRoutes();
+
+	if ( pBaseLength < 3 )
+		pBaseLength = g_pFullFileSystem->GetSearchPath( "BASE_PATH", true, pBaseDir, sizeof( pBaseDir ) );
+
+	std::string workshopDir = pBaseDir;
+	workshopDir.append("garrysmod/workshop");
+
+	if (!DETOUR_ISVALID(detour_CBaseFileSystem_AddSearchPath))
+	{
+		Msg("holylib: CBaseFileSystem::AddSearchPath detour is invalid?\n");
+		return;
+	}
+
+	// NOTE: Check the thing below again and redo it. I don't like how it looks :<
+	if (g_pFullFileSystem->IsDirectory("materials/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_MATERIALS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("models/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_MODELS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	
+	if (g_pFullFileSystem->IsDirectory("sound/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_SOUNDS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	
+	if (g_pFullFileSystem->IsDirectory("maps/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_MAPS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	
+	if (g_pFullFileSystem->IsDirectory("resource/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_RESOURCE", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("scripts/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_SCRIPTS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("cfg/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_CONFIGS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("gamemodes/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_GAMEMODES", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("lua/includes/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_INCLUDES", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	
+	if (g_pFullFileSystem->IsDirectory("sandbox/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_GAMEMODE_SANDBOX", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("effects/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_EFFECTS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	
+	if (g_pFullFileSystem->IsDirectory("entities/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_ENTITIES", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("weapons/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_WEAPONS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("lua/derma/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_DERMA", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("lua/drive/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_DRIVE", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("lua/entities/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_LUA_ENTITIES", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("vgui/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_VGUI", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("postprocess/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_POSTPROCESS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("matproxy/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_MATPROXY", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+
+	if (g_pFullFileSystem->IsDirectory("autorun/", "workshop"))
+		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_AUTORUN", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	
+	if (g_pFileSystemModule.InDebug())
+		Msg("Updated workshop path. (%s)\n", workshopDir.c_str());
+
+	LoadSearchCache();
+}
+
+extern bool StartWarmup(int iCallback);
+extern void AbortWarmup();
+void CFileSystemModule::ServerActivate(edict_t* pEdictList, int edictCount, int clientMax)
+{
+	LoadSearchCache(); // Last chance. All searchpaths should exist by now.
+
+	if (holylib_filesystem_warmup.GetBool())
+		StartWarmup(-1);
+}
+
+void CFileSystemModule::LevelShutdown()
+{
+	AbortWarmup(); // The searchpaths will change, so the results would be useless.
+	SaveSearchCache();
+	ClearMappedVPKs();
+	g_pFileHandlePool.Clear();
+}
+
+inline const char* CPathIDInfo::GetPathIDString() const
+{
+	return m_pDebugPathID; // This should remove the requirement for g_pPathIDTable.
+}
+
+inline const char* CSearchPath::GetPathIDString() const
+{
+	return m_pPathIDInfo->GetPathIDString(); // When can we nuke it :>
+}
+
+static Symbols::CBaseFileSystem_CSearchPath_GetDebugString func_CBaseFileSystem_CSearchPath_GetDebugString;
+inline const char* CSearchPath::GetPathString() const
+{
+	return func_CBaseFileSystem_CSearchPath_GetDebugString((void*)this); // Look into this to possibly remove the GetDebugString function.
+}
+
+inline const char* CBaseFileSystem::CPathIDInfo::GetPathIDString() const
+{
+	return m_pDebugPathID; // This should remove the requirement for g_pPathIDTable.
+}
+
+inline const char* CBaseFileSystem::CSearchPath::GetPathIDString() const // Remove this duplicate later :<
+{
+	return m_pPathIDInfo->GetPathIDString(); // When can we nuke it :>
+}
+
+inline const char* CBaseFileSystem::CSearchPath::GetPathString() const
+{
+	return func_CBaseFileSystem_CSearchPath_GetDebugString((void*)this); // Look into this to possibly remove the GetDebugString function.
+}
+
+void CFileSystemModule::InitDetour(bool bPreServer)
+{
+	if (!bPreServer)
+		return;
+
+	pFileSystemPool = V_CreateThreadPool();
+	Util::StartThreadPool(pFileSystemPool, holylib_filesystem_threads.GetInt());
+
+	// ToDo: Redo EVERY Hook so that we'll abuse the vtable instead of symbols.  
+	// Use the ClassProxy or so which should also allow me to port this to windows.  
+	SourceSDK::ModuleLoader dedicated_loader("dedicated");
+	Detour::Create(
+		&detour_CBaseFileSystem_FindFileInSearchPath, "CBaseFileSystem::FindFileInSearchPath",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_FindFileInSearchPathSym,
+		(void*)hook_CBaseFileSystem_FindFileInSearchPath, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_IsDirectory, "CBaseFileSystem::IsDirectory",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_IsDirectorySym,
+		(void*)hook_CBaseFileSystem_IsDirectory, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_FastFileTime, "CBaseFileSystem::FastFileTime",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_FastFileTimeSym,
+		(void*)hook_CBaseFileSystem_FastFileTime, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_FixUpPath, "CBaseFileSystem::FixUpPath",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_FixUpPathSym,
+		(void*)hook_CBaseFileSystem_FixUpPath, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_OpenForRead, "CBaseFileSystem::OpenForRead",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_OpenForReadSym,
+		(void*)hook_CBaseFileSystem_OpenForRead, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_GetFileTime, "CBaseFileSystem::GetFileTime",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_GetFileTimeSym,
+		(void*)hook_CBaseFileSystem_GetFileTime, m_pID
+	);
 
-		if (filesystem->IsDirectory("models/", pPathID))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MODELS", addType);
-	
-		if (filesystem->IsDirectory("sound/", pPathID))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_SOUNDS", addType);
-	
-		if (filesystem->IsDirectory("maps/", pPathID))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MAPS", addType);
-	
-		if (filesystem->IsDirectory("resource/", pPathID))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_RESOURCE", addType);
+	Detour::Create(
+		&detour_CBaseFileSystem_AddSearchPath, "CBaseFileSystem::AddSearchPath",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_AddSearchPathSym,
+		(void*)hook_CBaseFileSystem_AddSearchPath, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_AddVPKFile, "CBaseFileSystem::AddVPKFile",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_AddVPKFileSym,
+		(void*)hook_CBaseFileSystem_AddVPKFile, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_RemoveAllMapSearchPaths, "CBaseFileSystem::RemoveAllMapSearchPaths",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_RemoveAllMapSearchPathsSym,
+		(void*)hook_CBaseFileSystem_RemoveAllMapSearchPaths, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_Close, "CBaseFileSystem::Close",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_CloseSym,
+		(void*)hook_CBaseFileSystem_Close, m_pID
+	);
+
+	// ToDo: Find symbols for this function :/
+	// NOTE: It's probably easier to recreate the filesystem class since the function isn't often used in the engine and there aren't any good ways to find it :/ (Maybe some function declared before or after it can be found and then I'll can search neat that?)
+	Detour::Create(
+		&detour_CBaseFileSystem_FileExists, "CBaseFileSystem::FileExists",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_FileExistsSym,
+		(void*)hook_CBaseFileSystem_FileExists, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_RemoveSearchPath, "CBaseFileSystem::RemoveSearchPath",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_RemoveSearchPathSym,
+		(void*)hook_CBaseFileSystem_RemoveSearchPath, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_RemoveSearchPaths, "CBaseFileSystem::RemoveSearchPaths",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_RemoveSearchPathsSym,
+		(void*)hook_CBaseFileSystem_RemoveSearchPaths, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_RemoveAllSearchPaths, "CBaseFileSystem::RemoveAllSearchPaths",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_RemoveAllSearchPathsSym,
+		(void*)hook_CBaseFileSystem_RemoveAllSearchPaths, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_OpenForWrite, "CBaseFileSystem::OpenForWrite",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_OpenForWriteSym,
+		(void*)hook_CBaseFileSystem_OpenForWrite, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_RemoveFile, "CBaseFileSystem::RemoveFile",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_RemoveFileSym,
+		(void*)hook_CBaseFileSystem_RemoveFile, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_RenameFile, "CBaseFileSystem::RenameFile",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_RenameFileSym,
+		(void*)hook_CBaseFileSystem_RenameFile, m_pID
+	);
+
+	Detour::Create(
+		&detour_CBaseFileSystem_CreateDirHierarchy, "CBaseFileSystem::CreateDirHierarchy",
+		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_CreateDirHierarchySym,
+		(void*)hook_CBaseFileSystem_CreateDirHierarchy, m_pID
+	);
+
+	func_CBaseFileSystem_FindSearchPathByStoreId = (Symbols::CBaseFileSystem_FindSearchPathByStoreId)Detour::GetFunction(dedicated_loader.GetModule(), Symbols::CBaseFileSystem_FindSearchPathByStoreIdSym);
+	Detour::CheckFunction((void*)func_CBaseFileSystem_FindSearchPathByStoreId, "CBaseFileSystem::FindSearchPathByStoreId");
+
+	func_CBaseFileSystem_CSearchPath_GetDebugString = (Symbols::CBaseFileSystem_CSearchPath_GetDebugString)Detour::GetFunction(dedicated_loader.GetModule(), Symbols::CBaseFileSystem_CSearchPath_GetDebugStringSym);
+	Detour::CheckFunction((void*)func_CBaseFileSystem_CSearchPath_GetDebugString, "CBaseFileSystem::CSearchPath::GetDebugString");
+}
+
+/*
+ *
+ *	LUA API
+ *
+ */
+
+/*
+ * Async reads
+ * -----------
+ *
+ * The engine reads the file on its own threads and calls AsyncCallback from there.
+ * The engine allocates the read buffer through AsyncAlloc, which hands out pooled buffers, so the data is read directly into memory we own and never copied again before Lua gets it.
+ * Completed reads are pushed onto a lock-free MPSC stack which the main thread drains in FileAsyncReadThink.
+ */
+static ConVar holylib_filesystem_asyncbudget("holylib_filesystem_asyncbudget", "0", 0,
+	"The maximum number of filesystem.AsyncRead callbacks called per frame. 0 = no limit");
+static ConVar holylib_filesystem_asyncbufferpool("holylib_filesystem_asyncbufferpool", "32", 0,
+	"The maximum size in MB of read buffers kept in the pool for filesystem.AsyncRead");
+
+#define ASYNCBUFFER_MINSHIFT 12 // 4KB
+#define ASYNCBUFFER_MAXSHIFT 24 // 16MB. Anything bigger isn't pooled.
+#define ASYNCBUFFER_CLASSES (ASYNCBUFFER_MAXSHIFT - ASYNCBUFFER_MINSHIFT + 1)
+struct AsyncBufferHeader
+{
+	AsyncBufferHeader* pNext;
+	unsigned int iSize;
+	int iClass; // -1 = not pooled
+	char pPadding[4]; // Keep the data 16 byte aligned.
+};
+
+class CAsyncBufferPool
+{
+public:
+	void* Alloc(unsigned int iBytes)
+	{
+		int iClass = GetClass(iBytes + 1); // +1 for the null terminator.
+		AsyncBufferHeader* pHeader = NULL;
+		if (iClass != -1)
+		{
+			m_pMutex.Lock();
+			pHeader = m_pFree[iClass];
+			if (pHeader)
+			{
+				m_pFree[iClass] = pHeader->pNext;
+				m_iPooledBytes -= pHeader->iSize;
+			}
+			m_pMutex.Unlock();
+		}
+
+		if (!pHeader)
+		{
+			unsigned int iSize = iClass != -1 ? (1u << (iClass + ASYNCBUFFER_MINSHIFT)) : iBytes + 1;
+			pHeader = (AsyncBufferHeader*)malloc(sizeof(AsyncBufferHeader) + iSize);
+			if (!pHeader)
+				return NULL;
+
+			pHeader->iSize = iSize;
+			pHeader->iClass = iClass;
+		}
+
+		pHeader->pNext = NULL;
+		return pHeader + 1;
+	}
+
+	void Free(void* pData)
+	{
+		if (!pData)
+			return;
+
+		AsyncBufferHeader* pHeader = (AsyncBufferHeader*)pData - 1;
+		if (pHeader->iClass != -1)
+		{
+			m_pMutex.Lock();
+			if (m_iPooledBytes + pHeader->iSize <= (size_t)holylib_filesystem_asyncbufferpool.GetInt() * 1024 * 1024)
+			{
+				pHeader->pNext = m_pFree[pHeader->iClass];
+				m_pFree[pHeader->iClass] = pHeader;
+				m_iPooledBytes += pHeader->iSize;
+				pHeader = NULL;
+			}
+			m_pMutex.Unlock();
+		}
+
+		if (pHeader)
+			free(pHeader);
+	}
+
+	void Clear()
+	{
+		m_pMutex.Lock();
+		for (int i = 0; i < ASYNCBUFFER_CLASSES; ++i)
+		{
+			AsyncBufferHeader* pHeader = m_pFree[i];
+			while (pHeader)
+			{
+				AsyncBufferHeader* pNext = pHeader->pNext;
+				free(pHeader);
+				pHeader = pNext;
+			}
+			m_pFree[i] = NULL;
+		}
+		m_iPooledBytes = 0;
+		m_pMutex.Unlock();
+	}
+
+	size_t m_iPooledBytes = 0;
+
+private:
+	static inline int GetClass(unsigned int iBytes)
+	{
+		for (int i = 0; i < ASYNCBUFFER_CLASSES; ++i)
+			if (iBytes <= (1u << (i + ASYNCBUFFER_MINSHIFT)))
+				return i;
+
+		return -1;
+	}
+
+	CThreadFastMutex m_pMutex;
+	AsyncBufferHeader* m_pFree[ASYNCBUFFER_CLASSES] = {};
+};
+static CAsyncBufferPool g_pAsyncBufferPool;
+
+static void* AsyncAlloc(const char* pszFilename, unsigned nBytes)
+{
+	return g_pAsyncBufferPool.Alloc(nBytes);
+}
+
+static unsigned int g_iAsyncLuaGeneration = 0; // Incremented on LuaShutdown so that we don't call references of a dead Lua state.
+struct IAsyncCallback // Shared by all files of one call. Main thread only.
+{
+	int iReference = -1;
+	int iFiles = 0;
+};
+
+struct IAsyncFile
+{
+	~IAsyncFile()
+	{
+		if (pContent)
+			g_pAsyncBufferPool.Free(pContent);
+	}
+
+	FileAsyncRequest_t req;
+	std::string fileName; // The request only points to these.
+	std::string gamePath;
+	IAsyncCallback* pCallback = NULL;
+	std::atomic<bool> bCalled = false; // Set by AsyncCallback. The engine already handed it to the callback.
+	int nBytesRead = 0;
+	int status = FSASYNC_OK;
+	char* pContent = NULL;
+	unsigned int iLuaGeneration = 0;
+	IAsyncFile* pNext = NULL;
+};
+
+static std::atomic<IAsyncFile*> g_pAsyncCompleted(NULL); // Lock-free MPSC stack. Pushed by the filesystem threads, popped by the main thread.
+static std::vector<IAsyncFile*> g_pAsyncPending; // Completed reads that exceeded the per-frame budget. Main thread only.
+static void AsyncCallback(const FileAsyncRequest_t &request, int nBytesRead, FSAsyncStatus_t err)
+{
+	IAsyncFile* async = (IAsyncFile*)request.pContext;
+	if (!async)
+	{
+		Msg("[Luathreaded] file.AsyncRead Invalid request? (%s, %s)\n", request.pszFilename, request.pszPathID);
+		return;
+	}
+
+	async->nBytesRead = nBytesRead;
+	async->status = err;
+	async->pContent = (char*)request.pData; // Allocated by AsyncAlloc, we own it now.
+	if (async->pContent)
+		async->pContent[nBytesRead] = '\0';
+
+	async->bCalled.store(true, std::memory_order_relaxed);
+
+	IAsyncFile* pHead = g_pAsyncCompleted.load(std::memory_order_relaxed);
+	do {
+		async->pNext = pHead;
+	} while (!g_pAsyncCompleted.compare_exchange_weak(pHead, async, std::memory_order_release, std::memory_order_relaxed));
+}
+
+static IAsyncFile* CreateAsyncRead(const char* fileName, const char* gamePath, IAsyncCallback* pCallback, bool sync)
+{
+	IAsyncFile* file = new IAsyncFile;
+	file->fileName = fileName;
+	file->gamePath = gamePath;
+	file->pCallback = pCallback;
+	file->iLuaGeneration = g_iAsyncLuaGeneration;
+	++pCallback->iFiles;
+
+	FileAsyncRequest_t& request = file->req;
+	request.pszFilename = file->fileName.c_str();
+	request.pszPathID = file->gamePath.c_str();
+	request.pfnCallback = AsyncCallback;
+	request.pfnAlloc = AsyncAlloc;
+	request.pContext = file;
+	request.flags = sync ? FSASYNC_FLAGS_SYNC : 0;
+
+	return file;
+}
+
+static void FreeAsyncRead(IAsyncFile* file)
+{
+	IAsyncCallback* pCallback = file->pCallback;
+	if (--pCallback->iFiles <= 0)
+	{
+		if (file->iLuaGeneration == g_iAsyncLuaGeneration && g_Lua)
+			g_Lua->ReferenceFree(pCallback->iReference);
+
+		delete pCallback;
+	}
+
+	delete file;
+}
+
+/*
+ * If the engine didn't accept the requests, it never calls AsyncCallback for them, so we free them ourself.
+ * Requests it already ran synchronously are in g_pAsyncCompleted and freed by FileAsyncReadThink.
+ */
+static void FreeRejectedAsyncReads(const std::vector<IAsyncFile*>& pFiles)
+{
+	for (IAsyncFile* file : pFiles)
+		if (!file->bCalled.load(std::memory_order_relaxed))
+			FreeAsyncRead(file);
+}
+
+LUA_FUNCTION_STATIC(filesystem_AsyncRead)
+{
+	const char* fileName = LUA->CheckString(1);
+	const char* gamePath = LUA->CheckString(2);
+	LUA->CheckType(3, GarrysMod::Lua::Type::Function);
+	bool sync = LUA->GetBool(4);
+
+	IAsyncCallback* pCallback = new IAsyncCallback;
+	LUA->Push(3);
+	pCallback->iReference = LUA->ReferenceCreate();
+
+	IAsyncFile* file = CreateAsyncRead(fileName, gamePath, pCallback, sync);
+	FSAsyncStatus_t iStatus = g_pFullFileSystem->AsyncReadMultiple(&file->req, 1);
+	if (iStatus != FSASYNC_OK)
+		FreeRejectedAsyncReads({file});
+
+	LUA->PushNumber(iStatus);
+	return 1;
+}
+
+LUA_FUNCTION_STATIC(filesystem_AsyncReadMultiple)
+{
+	LUA->CheckType(1, GarrysMod::Lua::Type::Table);
+	const char* gamePath = LUA->CheckString(2);
+	LUA->CheckType(3, GarrysMod::Lua::Type::Function);
+	bool sync = LUA->GetBool(4);
+
+	std::vector<std::string> pFileNames;
+	int iLength = LUA->ObjLen(1);
+	pFileNames.reserve(iLength);
+	for (int i = 1; i <= iLength; ++i)
+	{
+		LUA->PushNumber(i);
+		LUA->GetTable(1);
+		const char* fileName = LUA->GetString(-1);
+		if (fileName)
+			pFileNames.push_back(fileName);
+		LUA->Pop(1);
+	}
+
+	if (pFileNames.empty())
+	{
+		LUA->PushNumber(FSASYNC_OK);
+		return 1;
+	}
+
+	IAsyncCallback* pCallback = new IAsyncCallback; // One reference for all files.
+	LUA->Push(3);
+	pCallback->iReference = LUA->ReferenceCreate();
+
+	std::vector<IAsyncFile*> pFiles;
+	pFiles.reserve(pFileNames.size());
+	for (const std::string& strFileName : pFileNames)
+		pFiles.push_back(CreateAsyncRead(strFileName.c_str(), gamePath, pCallback, sync));
+
+	// The engine copies the requests, so they only need to be contiguous for this call.
+	std::vector<FileAsyncRequest_t> pRequests;
+	pRequests.reserve(pFiles.size());
+	for (IAsyncFile* file : pFiles)
+		pRequests.push_back(file->req);
+
+	FSAsyncStatus_t iStatus = g_pFullFileSystem->AsyncReadMultiple(pRequests.data(), pRequests.size());
+	if (iStatus != FSASYNC_OK)
+		FreeRejectedAsyncReads(pFiles);
+
+	LUA->PushNumber(iStatus);
+	return 1;
+}
+
+void FileAsyncReadThink()
+{
+	IAsyncFile* pCompleted = g_pAsyncCompleted.exchange(NULL, std::memory_order_acquire);
+	if (pCompleted)
+	{
+		size_t iStart = g_pAsyncPending.size();
+		for (IAsyncFile* file = pCompleted; file; file = file->pNext)
+			g_pAsyncPending.push_back(file);
+
+		std::reverse(g_pAsyncPending.begin() + iStart, g_pAsyncPending.end()); // The stack is LIFO, but callbacks should be called in the order they completed.
+	}
+
+	if (g_pAsyncPending.empty())
+		return;
+
+	size_t iBudget = holylib_filesystem_asyncbudget.GetInt() > 0 ? holylib_filesystem_asyncbudget.GetInt() : g_pAsyncPending.size();
+	size_t iCount = std::min(iBudget, g_pAsyncPending.size());
+	for (size_t i = 0; i < iCount; ++i)
+	{
+		IAsyncFile* file = g_pAsyncPending[i];
+		if (file->iLuaGeneration == g_iAsyncLuaGeneration && g_Lua)
+		{
+			g_Lua->ReferencePush(file->pCallback->iReference);
+			g_Lua->PushString(file->fileName.c_str());
+			g_Lua->PushString(file->gamePath.c_str());
+			g_Lua->PushNumber(file->status);
+			if (file->pContent && file->nBytesRead > 0)
+				g_Lua->PushString(file->pContent, file->nBytesRead);
+			else
+				g_Lua->PushString("");
+			g_Lua->CallFunctionProtected(4, 0, true);
+		}
+
+		FreeAsyncRead(file);
+	}
+
+	g_pAsyncPending.erase(g_pAsyncPending.begin(), g_pAsyncPending.begin() + iCount);
+}
+
+static void AsyncReadShutdown() // The references belong to the Lua state that's shutting down.
+{
+	++g_iAsyncLuaGeneration;
+	FileAsyncReadThink(); // Frees everything since the generation doesn't match anymore.
+}
+
+/*
+ * Warmup
+ * ------
+ *
+ * On ServerActivate (or when requested) we collect the files the server will most likely open soon:
+ * the precached models, the static props & materials of the map and every lua file inside the lsv searchpaths.
+ * The filesystem threads then resolve in which searchpath every file is, which also warms the OS stat/dentry cache,
+ * and optionally tell the OS to read the files into the page cache.
+ * The results are added to the searchcache on the main thread. The searchcache is still locked since async OpenForRead calls use it too.
+ */
+#define WARMUP_FILESPERJOB 256
+enum WarmupRootType
+{
+	WARMUPROOT_DIRECTORY,
+	WARMUPROOT_VPK,
+	WARMUPROOT_MAP, // The pakfile of the current map
+	WARMUPROOT_UNKNOWN, // Pack files we can't read like .gma. Files can't be resolved past it.
+};
+
+struct WarmupRoot
+{
+	std::string strPath;
+	WarmupRootType iType = WARMUPROOT_UNKNOWN;
+	CVirtualSearchPath* pVPK = NULL;
+};
+
+struct WarmupPathID
+{
+	std::string strPathID;
+	std::vector<WarmupRoot*> pRoots;
+};
+
+struct WarmupFile
+{
+	std::string strFileName;
+	WarmupPathID* pPathID = NULL;
+	WarmupRoot* pResolved = NULL;
+};
+
+struct WarmupJob;
+struct WarmupState
+{
+	~WarmupState()
+	{
+		for (auto& [strPath, pRoot] : pRoots)
+		{
+			if (pRoot->pVPK)
+				delete pRoot->pVPK;
+
+			delete pRoot;
+		}
+
+		for (auto& [strPathID, pPathID] : pPathIDs)
+			delete pPathID;
+	}
+
+	std::atomic<int> iPendingJobs{0};
+	std::atomic<bool> bAbort{false};
+	int iStage = 0;
+	bool bReadAhead = false;
+	int iCallback = -1;
+	unsigned int iLuaGeneration = 0;
+	double flStartTime = 0;
+
+	std::unordered_map<std::string, WarmupRoot*> pRoots;
+	std::unordered_map<std::string, WarmupPathID*> pPathIDs;
+
+	// Stage 1 results. Every job writes into its own entry.
+	std::string strMapFile;
+	std::vector<std::string> pMapFiles; // Static props & materials
+	std::unordered_set<std::string> pMapPakFiles;
+	std::vector<std::vector<std::string>> pLuaFiles;
+
+	// Stage 2
+	std::vector<WarmupFile> pFiles;
+	std::vector<WarmupJob*> pJobs;
+};
+
+struct WarmupJob
+{
+	WarmupState* pState;
+	int iType;
+	size_t iStart = 0;
+	size_t iEnd = 0;
+	WarmupRoot* pRoot = NULL;
+	std::vector<std::string>* pOutput = NULL;
+};
+
+enum
+{
+	WARMUPJOB_MAP,
+	WARMUPJOB_VPK,
+	WARMUPJOB_LUA,
+	WARMUPJOB_RESOLVE,
+};
+
+static WarmupState* g_pWarmup = NULL;
+
+static inline void WarmupReadAhead(const char* pFileName, off_t iOffset = 0, off_t iLength = 0)
+{
+#ifdef SYSTEM_POSIX
+	int iFD = open(pFileName, O_RDONLY);
+	if (iFD == -1)
+		return;
+
+	posix_fadvise(iFD, iOffset, iLength, POSIX_FADV_WILLNEED);
+	close(iFD);
+#endif
+}
+
+/*
+ * Reads the static props, the materials and the pakfile entries of the map.
+ */
+#define BSP_LUMP_GAME_LUMP 35
+#define BSP_LUMP_PAKFILE 40
+#define BSP_LUMP_TEXDATA_STRING_DATA 43
+#define BSP_HEADER_LUMPS 64
+static void WarmupReadMap(WarmupState* pState)
+{
+	struct BSPLump
+	{
+		int iFileOffset;
+		int iFileLength;
+		int iVersion;
+		char pFourCC[4];
+	};
 
-		if (filesystem->IsDirectory("scripts/", pPathID))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_SCRIPTS", addType);
+	struct BSPHeader
+	{
+		int iIdent;
+		int iVersion;
+		BSPLump pLumps[BSP_HEADER_LUMPS];
+		int iMapRevision;
+	};
 
-		if (filesystem->IsDirectory("cfg/", pPathID))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_CONFIGS", addType);
-		
-		gBlockRemoveAllMapPaths = false;
-		filesystem->RemoveSearchPath(pPath, pPathID);
-	}*/
+	FILE* pFile = fopen(pState->strMapFile.c_str(), "rb");
+	if (!pFile)
+		return;
 
-	std::string strPath = pPath;
-	if (V_stricmp(pathID, "GAME") == 0)
+	BSPHeader pHeader;
+	if (fread(&pHeader, sizeof(pHeader), 1, pFile) != 1 || pHeader.iIdent != (('P'<<24)+('S'<<16)+('B'<<8)+'V'))
 	{
-		if (filesystem->IsDirectory((strPath + "/materials").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MATERIALS", addType);
+		fclose(pFile);
+		return;
+	}
 
-		if (filesystem->IsDirectory((strPath + "/models").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MODELS", addType);
-	
-		if (filesystem->IsDirectory((strPath + "/sound").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_SOUNDS", addType);
-	
-		if (filesystem->IsDirectory((strPath + "/maps").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_MAPS", addType);
-	
-		if (filesystem->IsDirectory((strPath + "/resource").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_RESOURCE", addType);
+	auto ReadLump = [&](int iLump, std::vector<char>& pData) -> bool {
+		const BSPLump& pLump = pHeader.pLumps[iLump];
+		if (pLump.iFileLength <= 0 || pLump.iFileOffset <= 0)
+			return false;
 
-		if (filesystem->IsDirectory((strPath + "/scripts").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_SCRIPTS", addType);
+		pData.resize(pLump.iFileLength);
+		return fseek(pFile, pLump.iFileOffset, SEEK_SET) == 0 && fread(pData.data(), 1, pData.size(), pFile) == pData.size();
+	};
 
-		if (filesystem->IsDirectory((strPath + "/cfg").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "CONTENT_CONFIGS", addType);
+	std::vector<char> pData;
+	if (ReadLump(BSP_LUMP_TEXDATA_STRING_DATA, pData))
+	{
+		size_t iStart = 0;
+		for (size_t i = 0; i < pData.size(); ++i)
+		{
+			if (pData[i] != '\0')
+				continue;
 
-		if (filesystem->IsDirectory((strPath + "/gamemodes").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_GAMEMODES", addType);
+			if (i > iStart)
+			{
+				std::string strMaterial = "materials/" + LowerVirtualPath(std::string_view(pData.data() + iStart, i - iStart));
+				V_FixSlashes(strMaterial.data(), '/');
+				pState->pMapFiles.push_back(strMaterial + ".vmt");
+				pState->pMapFiles.push_back(strMaterial + ".vtf");
+			}
 
-		if (filesystem->IsDirectory((strPath + "/lua/includes").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_INCLUDES", addType);
+			iStart = i + 1;
+		}
 	}
-	
-	if(V_stricmp(pathID, "lsv") == 0 || V_stricmp(pathID, "GAME") == 0)
+
+	if (ReadLump(BSP_LUMP_GAME_LUMP, pData) && pData.size() >= sizeof(int))
 	{
-		if (filesystem->IsDirectory((strPath + "/sandbox").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_GAMEMODE_SANDBOX", addType);
+		#pragma pack(push, 1)
+		struct GameLump
+		{
+			int iID;
+			unsigned short iFlags;
+			unsigned short iVersion;
+			int iFileOffset;
+			int iFileLength;
+		};
+		#pragma pack(pop)
+
+		int iCount;
+		memcpy(&iCount, pData.data(), sizeof(int));
+		for (int i = 0; i < iCount && sizeof(int) + (i + 1) * sizeof(GameLump) <= pData.size(); ++i)
+		{
+			GameLump pGameLump;
+			memcpy(&pGameLump, pData.data() + sizeof(int) + i * sizeof(GameLump), sizeof(GameLump));
+			if (pGameLump.iID != (('s'<<24)+('p'<<16)+('r'<<8)+'p') || (pGameLump.iFlags & 1)) // Compressed lumps aren't supported.
+				continue;
 
-		if (filesystem->IsDirectory((strPath + "/effects").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_EFFECTS", addType);
-	
-		if (filesystem->IsDirectory((strPath + "/entities").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_ENTITIES", addType);
+			int iDictEntries = 0;
+			if (fseek(pFile, pGameLump.iFileOffset, SEEK_SET) != 0 || fread(&iDictEntries, sizeof(int), 1, pFile) != 1 || iDictEntries < 0 || iDictEntries > 0xFFFF)
+				break;
 
-		if (filesystem->IsDirectory((strPath + "/weapons").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_WEAPONS", addType);
+			char pName[128];
+			for (int j = 0; j < iDictEntries; ++j)
+			{
+				if (fread(pName, sizeof(pName), 1, pFile) != 1)
+					break;
 
-		if (filesystem->IsDirectory((strPath + "/lua/derma").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_DERMA", addType);
+				pName[sizeof(pName) - 1] = '\0';
+				pState->pMapFiles.push_back(pName);
+			}
+			break;
+		}
+	}
 
-		if (filesystem->IsDirectory((strPath + "/lua/drive").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_DRIVE", addType);
+	const BSPLump& pPakLump = pHeader.pLumps[BSP_LUMP_PAKFILE];
+	if (pPakLump.iFileOffset > 0 && pPakLump.iFileLength >= 22) // The pakfile is a zip. We only need the names from the central directory.
+	{
+		size_t iTailSize = std::min<size_t>(pPakLump.iFileLength, 22 + 0xFFFF); // The end of central directory record + max comment length.
+		pData.resize(iTailSize);
+		if (fseek(pFile, pPakLump.iFileOffset + pPakLump.iFileLength - iTailSize, SEEK_SET) == 0 && fread(pData.data(), 1, iTailSize, pFile) == iTailSize)
+		{
+			for (size_t i = iTailSize - 22 + 1; i-- > 0;)
+			{
+				unsigned int iSignature;
+				memcpy(&iSignature, pData.data() + i, sizeof(iSignature));
+				if (iSignature != 0x06054b50)
+					continue;
+
+				unsigned short iEntries;
+				unsigned int iDirSize, iDirOffset;
+				memcpy(&iEntries, pData.data() + i + 10, sizeof(iEntries));
+				memcpy(&iDirSize, pData.data() + i + 12, sizeof(iDirSize));
+				memcpy(&iDirOffset, pData.data() + i + 16, sizeof(iDirOffset));
+				if ((size_t)iDirOffset + iDirSize > (size_t)pPakLump.iFileLength)
+					break;
+
+				std::vector<char> pDir(iDirSize);
+				if (fseek(pFile, pPakLump.iFileOffset + iDirOffset, SEEK_SET) != 0 || fread(pDir.data(), 1, iDirSize, pFile) != iDirSize)
+					break;
+
+				size_t iPos = 0;
+				for (unsigned short j = 0; j < iEntries && iPos + 46 <= pDir.size(); ++j)
+				{
+					unsigned short iNameLength, iExtraLength, iCommentLength;
+					memcpy(&iSignature, pDir.data() + iPos, sizeof(iSignature));
+					memcpy(&iNameLength, pDir.data() + iPos + 28, sizeof(iNameLength));
+					memcpy(&iExtraLength, pDir.data() + iPos + 30, sizeof(iExtraLength));
+					memcpy(&iCommentLength, pDir.data() + iPos + 32, sizeof(iCommentLength));
+					if (iSignature != 0x02014b50 || iPos + 46 + iNameLength > pDir.size())
+						break;
+
+					pState->pMapPakFiles.insert(LowerVirtualPath(std::string_view(pDir.data() + iPos + 46, iNameLength)));
+					iPos += 46 + iNameLength + iExtraLength + iCommentLength;
+				}
+				break;
+			}
+		}
+	}
 
-		if (filesystem->IsDirectory((strPath + "/lua/entities").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_LUA_ENTITIES", addType);
+	fclose(pFile);
+}
 
-		if (filesystem->IsDirectory((strPath + "/vgui").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_VGUI", addType);
+static void WarmupCollectLua(const std::string& strRoot, std::vector<std::string>& pOutput, std::atomic<bool>& bAbort)
+{
+#ifdef SYSTEM_POSIX
+	std::vector<std::string> pPending;
+	pPending.push_back("");
+	while (!pPending.empty() && !bAbort)
+	{
+		std::string strDir = pPending.back();
+		pPending.pop_back();
 
-		if (filesystem->IsDirectory((strPath + "/postprocess").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_POSTPROCESS", addType);
+		DIR* pDir = opendir((strRoot + strDir).c_str());
+		if (!pDir)
+			continue;
 
-		if (filesystem->IsDirectory((strPath + "/matproxy").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_MATPROXY", addType);
+		struct dirent* pEntry;
+		while ((pEntry = readdir(pDir)) != NULL)
+		{
+			if (pEntry->d_name[0] == '.')
+				continue;
 
-		if (filesystem->IsDirectory((strPath + "/autorun").c_str()))
-			detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(filesystem, pPath, "LUA_AUTORUN", addType);
-	}
+			std::string strName = strDir.empty() ? pEntry->d_name : strDir + "/" + pEntry->d_name;
+			bool bDirectory = pEntry->d_type == DT_DIR;
+			if (pEntry->d_type == DT_UNKNOWN || pEntry->d_type == DT_LNK)
+			{
+				struct stat pStat;
+				bDirectory = stat((strRoot + strName).c_str(), &pStat) == 0 && S_ISDIR(pStat.st_mode);
+			}
 
-	if (g_pFileSystemModule.InDebug())
-		Msg("holylib - Added Searchpath: %s %s %i\n", pPath, pathID, (int)addType);
+			if (bDirectory)
+				pPending.push_back(strName);
+			else if (strName.length() > 4 && V_stricmp(strName.c_str() + strName.length() - 4, ".lua") == 0)
+				pOutput.push_back(strName);
+		}
+
+		closedir(pDir);
+	}
+#endif
 }
 
-static Detouring::Hook detour_CBaseFileSystem_AddVPKFile;
-static void hook_CBaseFileSystem_AddVPKFile(IFileSystem* filesystem, const char *pPath, const char *pathID, SearchPathAdd_t addType)
+static void WarmupResolve(WarmupState* pState, size_t iStart, size_t iEnd)
 {
-	VPROF_BUDGET("HolyLib - CBaseFileSystem::AddVPKFile", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+	for (size_t i = iStart; i < iEnd && !pState->bAbort; ++i)
+	{
+		WarmupFile& pFile = pState->pFiles[i];
+		std::string strLower = LowerVirtualPath(pFile.strFileName);
+		for (WarmupRoot* pRoot : pFile.pPathID->pRoots)
+		{
+			if (pRoot->iType == WARMUPROOT_UNKNOWN)
+				break; // We don't know what's inside, so we can't know if a later searchpath would be used.
 
-	detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, pathID, addType);
+			if (pRoot->iType == WARMUPROOT_MAP)
+			{
+				if (pState->pMapPakFiles.find(strLower) != pState->pMapPakFiles.end())
+					break; // Found in the map. We don't cache those since they change with every map.
 
-	if (V_stricmp(pathID, "GAME") == 0)
-	{
-		std::string_view vpkPath = getVPKFile(pPath);
-		detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, vpkPath.data(), addType);
+				continue;
+			}
 
-		if (filesystem->IsDirectory("materials/"), vpkPath.data())
-			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_MATERIALS", addType);
+			if (pRoot->iType == WARMUPROOT_VPK)
+			{
+				VirtualFileEntry* pEntry = pRoot->pVPK->FindFile(strLower);
+				if (!pEntry)
+					continue;
 
-		if (filesystem->IsDirectory("models/"), vpkPath.data())
-			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_MODELS", addType);
-	
-		if (filesystem->IsDirectory("sound/"), vpkPath.data())
-			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_SOUNDS", addType);
-	
-		if (filesystem->IsDirectory("maps/"), vpkPath.data())
-			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_MAPS", addType);
-	
-		if (filesystem->IsDirectory("resource/"), vpkPath.data())
-			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_RESOURCE", addType);
+				pFile.pResolved = pRoot;
+				if (pState->bReadAhead && pEntry->iSize > pEntry->iPreloadBytes)
+				{
+					char pArchive[MAX_PATH];
+					if (pEntry->iArchiveIndex == VPK_DIR_ARCHIVE)
+						V_snprintf(pArchive, sizeof(pArchive), "%s_dir.vpk", pRoot->pVPK->GetArchiveBase().c_str());
+					else
+						V_snprintf(pArchive, sizeof(pArchive), "%s_%03d.vpk", pRoot->pVPK->GetArchiveBase().c_str(), pEntry->iArchiveIndex);
 
-		if (filesystem->IsDirectory("scripts/"), vpkPath.data())
-			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_SCRIPTS", addType);
+					WarmupReadAhead(pArchive, pEntry->iOffset, pEntry->iSize - pEntry->iPreloadBytes);
+				}
+				break;
+			}
 
-		if (filesystem->IsDirectory("cfg/"), vpkPath.data())
-			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "CONTENT_CONFIGS", addType);
+			std::string strFullPath = pRoot->strPath + pFile.strFileName;
+#ifdef SYSTEM_POSIX
+			struct stat pStat;
+			if (stat(strFullPath.c_str(), &pStat) != 0 || S_ISDIR(pStat.st_mode))
+				continue;
+#endif
 
-		if (filesystem->IsDirectory("gamemodes/"), vpkPath.data())
-			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "LUA_GAMEMODES", addType);
+			pFile.pResolved = pRoot;
+			if (pState->bReadAhead)
+				WarmupReadAhead(strFullPath.c_str());
 
-		if (filesystem->IsDirectory("lua/includes/"), vpkPath.data())
-			detour_CBaseFileSystem_AddVPKFile.GetTrampoline<Symbols::CBaseFileSystem_AddVPKFile>()(filesystem, pPath, "LUA_INCLUDES", addType);
-	
-		filesystem->RemoveSearchPath(pPath, vpkPath.data());
+			break;
+		}
 	}
+}
 
-	if (g_pFileSystemModule.InDebug())
-		Msg("holylib - Added vpk: %s %s %i\n", pPath, pathID, (int)addType);
+static void WarmupJobFunc(WarmupJob*& pJob)
+{
+	WarmupState* pState = pJob->pState;
+	if (!pState->bAbort)
+	{
+		switch (pJob->iType)
+		{
+			case WARMUPJOB_MAP:
+				WarmupReadMap(pState);
+				break;
+			case WARMUPJOB_VPK:
+				pJob->pRoot->pVPK->Build();
+				break;
+			case WARMUPJOB_LUA:
+				WarmupCollectLua(pJob->pRoot->strPath, *pJob->pOutput, pState->bAbort);
+				break;
+			case WARMUPJOB_RESOLVE:
+				WarmupResolve(pState, pJob->iStart, pJob->iEnd);
+				break;
+		}
+	}
+
+	pState->iPendingJobs.fetch_sub(1, std::memory_order_release);
 }
 
-#define FILE_HANDLE_DELETION_DELAY 5 // 5 sec
-static Detouring::Hook detour_CBaseFileSystem_Close;
-void DeleteFileHandle(FileHandle_t handle) // NOTE for myself: This is declared extern! so no static!!!
+static void QueueWarmupJob(WarmupState* pState, int iType, WarmupRoot* pRoot = NULL, size_t iStart = 0, size_t iEnd = 0, std::vector<std::string>* pOutput = NULL)
 {
-	detour_CBaseFileSystem_Close.GetTrampoline<Symbols::CBaseFileSystem_Close>()(g_pFullFileSystem, handle);
+	WarmupJob* pJob = new WarmupJob;
+	pJob->pState = pState;
+	pJob->iType = iType;
+	pJob->pRoot = pRoot;
+	pJob->iStart = iStart;
+	pJob->iEnd = iEnd;
+	pJob->pOutput = pOutput;
+	pState->pJobs.push_back(pJob);
+
+	pState->iPendingJobs.fetch_add(1, std::memory_order_relaxed);
+	pFileSystemPool->QueueCall(WarmupJobFunc, pJob);
 }
 
-static void hook_CBaseFileSystem_Close(IFileSystem* filesystem, FileHandle_t file)
+static WarmupPathID* GetWarmupPathID(WarmupState* pState, const char* pPathID)
 {
-	VPROF_BUDGET("HolyLib - CBaseFileSystem::Close", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+	std::string strKey = LowerVirtualPath(pPathID);
+	auto it = pState->pPathIDs.find(strKey);
+	if (it != pState->pPathIDs.end())
+		return it->second;
+
+	WarmupPathID* pWarmupPathID = new WarmupPathID;
+	pWarmupPathID->strPathID = pPathID;
+	pState->pPathIDs[strKey] = pWarmupPathID;
 
-	if (holylib_filesystem_cachefilehandle.GetBool())
+	for (const std::string& strPath : GetSearchPathList(pPathID))
 	{
-		auto it2 = m_WriteFileHandle.find(file);
-		if (it2 != m_WriteFileHandle.end())
+		WarmupRoot*& pRoot = pState->pRoots[strPath];
+		if (!pRoot)
 		{
-			m_WriteFileHandle.erase(it2);
-			detour_CBaseFileSystem_Close.GetTrampoline<Symbols::CBaseFileSystem_Close>()(filesystem, file);
-			return;
+			pRoot = new WarmupRoot;
+			pRoot->strPath = strPath;
+			if (!strPath.empty() && strPath.back() == '/')
+			{
+				pRoot->iType = WARMUPROOT_DIRECTORY;
+			} else if (strPath.length() > 4 && V_stricmp(strPath.c_str() + strPath.length() - 4, ".vpk") == 0) {
+				pRoot->iType = WARMUPROOT_VPK;
+				pRoot->pVPK = new CVirtualSearchPath(strPath);
+				QueueWarmupJob(pState, WARMUPJOB_VPK, pRoot);
+			} else if (!pState->strMapFile.empty() && V_stricmp(strPath.c_str(), pState->strMapFile.c_str()) == 0) {
+				pRoot->iType = WARMUPROOT_MAP;
+			}
 		}
 
-		auto it = pFileDeletionList.find(file);
-		if (it == pFileDeletionList.end()) // File is being used again.
-			pFileDeletionList[file] = gpGlobals->curtime + FILE_HANDLE_DELETION_DELAY;
-		else
-			it->second = FILE_HANDLE_DELETION_DELAY;
+		pWarmupPathID->pRoots.push_back(pRoot);
+	}
 
-		if (g_pFileSystemModule.InDebug())
-			Msg("holylib - CBaseFileSystem::Close: Marked handle for deletion! (%p)\n", file);
+	return pWarmupPathID;
+}
+
+static void AddWarmupFile(WarmupState* pState, std::unordered_set<std::string>& pSeen, std::string strFileName, const char* pPathID)
+{
+	V_FixSlashes(strFileName.data(), '/');
+	const char* pOverridePath = GetOverridePath(strFileName.c_str(), pPathID);
+	if (pOverridePath)
+		pPathID = pOverridePath;
 
+	if (!pSeen.insert(LowerVirtualPath(pPathID) + "|" + LowerVirtualPath(strFileName)).second)
 		return;
-	}
 
-	detour_CBaseFileSystem_Close.GetTrampoline<Symbols::CBaseFileSystem_Close>()(filesystem, file);
+	WarmupFile pFile;
+	pFile.strFileName = std::move(strFileName);
+	pFile.pPathID = GetWarmupPathID(pState, pPathID);
+	pState->pFiles.push_back(std::move(pFile));
 }
 
-extern void FileAsyncReadThink();
-void CFileSystemModule::Think(bool bSimulating)
+static void AddWarmupModel(WarmupState* pState, std::unordered_set<std::string>& pSeen, const char* pModel)
 {
-	FileAsyncReadThink();
+	std::string_view strModel = pModel;
+	if (strModel.length() < 4 || V_stricmp(strModel.data() + strModel.length() - 4, ".mdl") != 0)
+		return; // Brush models like *1 or sprites.
+
+	std::string strBase(strModel.substr(0, strModel.length() - 4));
+	AddWarmupFile(pState, pSeen, strBase + ".mdl", "GAME");
+	AddWarmupFile(pState, pSeen, strBase + ".vvd", "GAME");
+	AddWarmupFile(pState, pSeen, strBase + ".dx90.vtx", "GAME");
+	AddWarmupFile(pState, pSeen, strBase + ".phy", "GAME");
+}
 
-	if (!holylib_filesystem_cachefilehandle.GetBool())
-		return;
+bool StartWarmup(int iCallback) // NOTE: Declared extern!
+{
+	if (g_pWarmup || !pFileSystemPool)
+		return false;
 
-	std::vector<FileHandle_t> pDeletionList;
-	for (auto& [file, time] : pFileDeletionList)
+	VPROF_BUDGET("HolyLib - StartWarmup", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
+
+	WarmupState* pState = new WarmupState;
+	pState->bReadAhead = holylib_filesystem_warmup_readahead.GetBool();
+	pState->iCallback = iCallback;
+	pState->iLuaGeneration = g_iAsyncLuaGeneration;
+	pState->flStartTime = Plat_FloatTime();
+	pState->iStage = 1;
+	g_pWarmup = pState;
+
+	const char* pMapName = gpGlobals ? STRING(gpGlobals->mapname) : NULL;
+	if (pMapName && pMapName[0] != '\0')
 	{
-		if (gpGlobals->curtime > time)
+		char pMapFile[MAX_PATH];
+		V_snprintf(pMapFile, sizeof(pMapFile), "maps/%s.bsp", pMapName);
+		char pFullPath[MAX_PATH];
+		if (g_pFullFileSystem->RelativePathToFullPath(pMapFile, "GAME", pFullPath, sizeof(pFullPath)))
 		{
-			pDeletionList.push_back(file);
-			if (g_pFileSystemModule.InDebug())
-				Msg("holylib - FileThread: Preparing filehandle for deletion! (%p, %f)\n", file, time);
+			V_FixSlashes(pFullPath, '/');
+			pState->strMapFile = pFullPath;
+			QueueWarmupJob(pState, WARMUPJOB_MAP);
 		}
 	}
 
-	if (pDeletionList.size() > 0)
+	GetWarmupPathID(pState, "GAME");
+	WarmupPathID* pLuaPathID = GetWarmupPathID(pState, "lsv");
+	pState->pLuaFiles.resize(pLuaPathID->pRoots.size());
+	for (size_t i = 0; i < pLuaPathID->pRoots.size(); ++i)
 	{
-		for (FileHandle_t handle : pDeletionList)
-		{
-			auto it = pFileDeletionList.find(handle);
-			if (it == pFileDeletionList.end()) // File is being used again.
-				continue;
+		WarmupRoot* pRoot = pLuaPathID->pRoots[i];
+		if (pRoot->iType == WARMUPROOT_DIRECTORY)
+			QueueWarmupJob(pState, WARMUPJOB_LUA, pRoot, 0, 0, &pState->pLuaFiles[i]);
+	}
 
-			pFileDeletionList.erase(it);
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - Warmup: Started (%i jobs)\n", pState->iPendingJobs.load());
 
-			RemoveFileHandleFromCache(handle); // Remove & Free the memory of the string.
-		}
+	return true;
+}
 
-		for (FileHandle_t handle : pDeletionList) // We delete them outside the mutex to not block the main thread.
-		{
-			if (g_pFileSystemModule.InDebug())
-				Msg("holylib - FileThread: Deleted handle! (%p)\n", handle);
+void AbortWarmup() // NOTE: Declared extern! Waits for all jobs since they still use the state.
+{
+	if (!g_pWarmup)
+		return;
 
-			CFileHandle* fh = (CFileHandle*)handle;
-			if (!fh->m_pFile)
-			{
-				Msg("holylib - filesystem think: Tried to delete an already deleted handle!\n");
-				continue;
-			}
+	g_pWarmup->bAbort = true;
+	while (g_pWarmup->iPendingJobs.load(std::memory_order_acquire) > 0)
+		ThreadSleep(1);
 
-			DeleteFileHandle(handle); // BUG! We somehow delete the same handle twice :/
-		}
-		pDeletionList.clear();
-	}
+	if (g_pWarmup->iCallback != -1 && g_pWarmup->iLuaGeneration == g_iAsyncLuaGeneration && g_Lua)
+		g_Lua->ReferenceFree(g_pWarmup->iCallback);
+
+	for (WarmupJob* pJob : g_pWarmup->pJobs)
+		delete pJob;
+
+	delete g_pWarmup;
+	g_pWarmup = NULL;
 }
 
-std::vector<std::string> splitString(std::string str, std::string_view delimiter)
+void WarmupThink() // NOTE: Declared extern!
 {
-	std::vector<std::string> v;
-	if (!str.empty()) {
-		int start = 0;
-		while (true)
-		{
-			size_t idx = str.find(delimiter, start);
-			if (idx == std::string::npos)
-				break;
+	if (!g_pWarmup || g_pWarmup->iPendingJobs.load(std::memory_order_acquire) > 0)
+		return;
 
-			int length = idx - start;
-			v.push_back(str.substr(start, length));
-			start += (length + delimiter.size());
-		}
+	VPROF_BUDGET("HolyLib - WarmupThink", VPROF_BUDGETGROUP_OTHER_FILESYSTEM);
 
-		v.push_back(str.substr(start));
-	}
+	WarmupState* pState = g_pWarmup;
+	for (WarmupJob* pJob : pState->pJobs)
+		delete pJob;
 
-	return v;
-}
+	pState->pJobs.clear();
 
-void CFileSystemModule::Init(CreateInterfaceFn* appfn, CreateInterfaceFn* gamefn)
-{
-	/*
-	 * Why do we do this below?
-	 * Because if our Detours weren't added by the GhostInj, they were added after SearchPaths were created.
-	 * This will cause the splitgamepath stuff to fail since we didn't add our custom paths.
-	 * So now we get all GAME paths, remove them and reaplly them so that our detour can handle them.
-	 */
-	if (!g_pModuleManager.IsUsingGhostInj())
+	if (pState->iStage == 1) // Everything was collected. Now resolve it.
 	{
-		// Humongus size because you can have a huge amount of searchpaths.
-		constexpr int iSize = 1 << 16;
-		char* pChar = new char[iSize];
-		int iLength = g_pFullFileSystem->GetSearchPath("GAME", true, pChar, iSize);
-		if (iSize <= iLength)
-			Warning("holylib: Not enouth space for search paths! please report this.\n");
+		std::unordered_set<std::string> pSeen;
+		if (networkStringTableContainerServer)
+		{
+			INetworkStringTable* pTable = networkStringTableContainerServer->FindTable("modelprecache");
+			if (pTable)
+				for (int i = 0; i < pTable->GetNumStrings(); ++i)
+					AddWarmupModel(pState, pSeen, pTable->GetString(i));
+		}
 
-		std::string pStr = pChar;
-		pStr = pStr.substr(0, iLength);
-		std::vector<std::string> pSearchPaths = splitString(pStr, ";");
-		g_pFullFileSystem->RemoveSearchPaths("GAME"); // Yes. Were gonna reapply them. Should we also do it for lsv?
-		for (std::string pSearchPath : pSearchPaths)
+		for (const std::string& strFile : pState->pMapFiles)
 		{
-			g_pFullFileSystem->AddSearchPath(pSearchPath.c_str(), "GAME", SearchPathAdd_t::PATH_ADD_TO_TAIL);
-			
-			if (g_pFileSystemModule.InDebug())
-				Msg("Recreate Path: %s\n", pSearchPath.c_str());
+			if (strFile.rfind("materials/", 0) == 0)
+				AddWarmupFile(pState, pSeen, strFile, "GAME");
+			else
+				AddWarmupModel(pState, pSeen, strFile.c_str());
 		}
 
-		delete[] pChar;
+		for (const std::vector<std::string>& pFiles : pState->pLuaFiles)
+			for (const std::string& strFile : pFiles)
+				AddWarmupFile(pState, pSeen, strFile, "lsv");
+
+		pState->iStage = 2;
+		if (pState->iPendingJobs.load() > 0)
+			return; // Split paths like CONTENT_MODELS can contain vpks that weren't indexed yet. They need to finish before we resolve.
+	}
+
+	if (pState->iStage == 2)
+	{
+		pState->iStage = 3;
+		for (size_t i = 0; i < pState->pFiles.size(); i += WARMUP_FILESPERJOB)
+			QueueWarmupJob(pState, WARMUPJOB_RESOLVE, NULL, i, std::min(i + WARMUP_FILESPERJOB, pState->pFiles.size()));
+
+		if (pState->iPendingJobs.load() > 0)
+			return;
 	}
 
+	std::unordered_map<std::string, int> pLookup;
+	BuildSearchPathLookup(&pLookup);
+	std::unordered_map<std::string, int> pLowerLookup; // Our keys come from GetSearchPath, so the case of the pathID can differ.
+	for (auto& [strKey, iStoreID] : pLookup)
+		pLowerLookup[LowerVirtualPath(strKey)] = iStoreID;
 
-	// We use MOD_WRITE because it doesn't have additional junk search paths.
-	AddOveridePath("cfg/server.cfg", "MOD_WRITE");
-	AddOveridePath("cfg/banned_ip.cfg", "MOD_WRITE");
-	AddOveridePath("cfg/banned_user.cfg", "MOD_WRITE");
-	AddOveridePath("cfg/skill2.cfg", "MOD_WRITE");
-	AddOveridePath("cfg/game.cfg", "MOD_WRITE");
-	AddOveridePath("cfg/trusted_keys_base.txt", "MOD_WRITE");
-	AddOveridePath("cfg/pure_server_minimal.txt", "MOD_WRITE");
-	AddOveridePath("cfg/skill_manifest.cfg", "MOD_WRITE");
-	AddOveridePath("cfg/skill.cfg", "MOD_WRITE");
-	AddOveridePath("cfg/mapcycle.txt", "MOD_WRITE");
-
-	AddOveridePath("stale.txt", "MOD_WRITE");
-	AddOveridePath("garrysmod.ver", "MOD_WRITE");
-	AddOveridePath("scripts/actbusy.txt", "MOD_WRITE");
-	AddOveridePath("modelsounds.cache", "MOD_WRITE");
-	AddOveridePath("lua/send.txt", "MOD_WRITE");
-
-	AddOveridePath("resource/serverevents.res", "MOD_WRITE");
-	AddOveridePath("resource/gameevents.res", "MOD_WRITE");
-	AddOveridePath("resource/modevents.res", "MOD_WRITE");
-	AddOveridePath("resource/hltvevents.res", "MOD_WRITE");
+	int iResolved = 0;
+	for (WarmupFile& pFile : pState->pFiles)
+	{
+		if (!pFile.pResolved)
+			continue;
 
-	if ( pBaseLength < 3 )
-		pBaseLength = g_pFullFileSystem->GetSearchPath( "BASE_PATH", true, pBaseDir, sizeof( pBaseDir ) );
+		auto it = pLowerLookup.find(LowerVirtualPath(GetSearchPathKey(pFile.pPathID->strPathID.c_str(), pFile.pResolved->strPath.c_str())));
+		if (it == pLowerLookup.end())
+			continue;
 
-	std::string workshopDir = pBaseDir;
-	workshopDir.append("garrysmod/workshop");
+		AddFileToSearchCache(pFile.strFileName.c_str(), it->second, pFile.pPathID->strPathID.c_str());
+		++iResolved;
+	}
 
-	if (!DETOUR_ISVALID(detour_CBaseFileSystem_AddSearchPath))
+	double flTime = Plat_FloatTime() - pState->flStartTime;
+	if (g_pFileSystemModule.InDebug())
+		Msg("holylib - Warmup: Resolved %i of %i files in %.3f seconds\n", iResolved, (int)pState->pFiles.size(), flTime);
+
+	if (pState->iCallback != -1 && pState->iLuaGeneration == g_iAsyncLuaGeneration && g_Lua)
 	{
-		Msg("holylib: CBaseFileSystem::AddSearchPath detour is invalid?\n");
-		return;
+		g_Lua->ReferencePush(pState->iCallback);
+		g_Lua->PushNumber(iResolved);
+		g_Lua->PushNumber(pState->pFiles.size());
+		g_Lua->PushNumber(flTime);
+		g_Lua->CallFunctionProtected(3, 0, true);
+		g_Lua->ReferenceFree(pState->iCallback);
 	}
 
-	// NOTE: Check the thing below again and redo it. I don't like how it looks :<
-	if (g_pFullFileSystem->IsDirectory("materials/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_MATERIALS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	delete pState;
+	g_pWarmup = NULL;
+}
 
-	if (g_pFullFileSystem->IsDirectory("models/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_MODELS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
-	
-	if (g_pFullFileSystem->IsDirectory("sound/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_SOUNDS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
-	
-	if (g_pFullFileSystem->IsDirectory("maps/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_MAPS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
-	
-	if (g_pFullFileSystem->IsDirectory("resource/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_RESOURCE", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+static void WarmupCmd(const CCommand &args)
+{
+	if (!StartWarmup(-1))
+		Msg("holylib - Warmup: A warmup is already running!\n");
+}
+static ConCommand warmup("holylib_filesystem_warmup_run", WarmupCmd, "Starts the filesystem warmup", 0);
 
-	if (g_pFullFileSystem->IsDirectory("scripts/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_SCRIPTS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+LUA_FUNCTION_STATIC(filesystem_Warmup)
+{
+	int iCallback = -1;
+	if (LUA->IsType(1, GarrysMod::Lua::Type::Function))
+	{
+		LUA->Push(1);
+		iCallback = LUA->ReferenceCreate();
+	}
 
-	if (g_pFullFileSystem->IsDirectory("cfg/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "CONTENT_CONFIGS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	bool bStarted = StartWarmup(iCallback);
+	if (!bStarted && iCallback != -1)
+		LUA->ReferenceFree(iCallback);
 
-	if (g_pFullFileSystem->IsDirectory("gamemodes/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_GAMEMODES", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	LUA->PushBool(bStarted);
+	return 1;
+}
 
-	if (g_pFullFileSystem->IsDirectory("lua/includes/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_INCLUDES", SearchPathAdd_t::PATH_ADD_TO_TAIL);
-	
-	if (g_pFullFileSystem->IsDirectory("sandbox/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_GAMEMODE_SANDBOX", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+struct MappedFile // A view into a CMappedFileData. Slices share the data.
+{
+	CMappedFileData* pData = NULL;
+	size_t iOffset = 0;
+	size_t iLength = 0;
+};
 
-	if (g_pFullFileSystem->IsDirectory("effects/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_EFFECTS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
-	
-	if (g_pFullFileSystem->IsDirectory("entities/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_ENTITIES", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+static int MappedFile_TypeID = -1;
+Push_LuaClass(MappedFile, MappedFile_TypeID)
+Get_LuaClass(MappedFile, MappedFile_TypeID, "MappedFile")
 
-	if (g_pFullFileSystem->IsDirectory("weapons/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_WEAPONS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+static MappedFile* CreateMappedFile(CMappedFileData* pData, size_t iOffset, size_t iLength)
+{
+	MappedFile* pFile = new MappedFile;
+	pFile->pData = pData;
+	pFile->iOffset = iOffset;
+	pFile->iLength = iLength;
+	++pData->m_iRefs;
 
-	if (g_pFullFileSystem->IsDirectory("lua/derma/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_DERMA", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	return pFile;
+}
 
-	if (g_pFullFileSystem->IsDirectory("lua/drive/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_DRIVE", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+static void ReleaseMappedFile(MappedFile* pFile)
+{
+	if (--pFile->pData->m_iRefs <= 0)
+		delete pFile->pData;
 
-	if (g_pFullFileSystem->IsDirectory("lua/entities/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_LUA_ENTITIES", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	delete pFile;
+}
 
-	if (g_pFullFileSystem->IsDirectory("vgui/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_VGUI", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+static inline size_t ClampMappedOffset(double flValue, size_t iMax)
+{
+	if (flValue <= 0)
+		return 0;
 
-	if (g_pFullFileSystem->IsDirectory("postprocess/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_POSTPROCESS", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+	return flValue >= (double)iMax ? iMax : (size_t)flValue;
+}
 
-	if (g_pFullFileSystem->IsDirectory("matproxy/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_MATPROXY", SearchPathAdd_t::PATH_ADD_TO_TAIL);
+LUA_FUNCTION_STATIC(MappedFile__tostring)
+{
+	MappedFile* pFile = Get_MappedFile(1, false);
+	if (!pFile)
+	{
+		LUA->PushString("MappedFile [NULL]");
+	} else {
+		char szBuf[128] = {};
+		V_snprintf(szBuf, sizeof(szBuf), "MappedFile [%llu bytes]", (unsigned long long)pFile->iLength);
+		LUA->PushString(szBuf);
+	}
 
-	if (g_pFullFileSystem->IsDirectory("autorun/", "workshop"))
-		detour_CBaseFileSystem_AddSearchPath.GetTrampoline<Symbols::CBaseFileSystem_AddSearchPath>()(g_pFullFileSystem, workshopDir.c_str(), "LUA_AUTORUN", SearchPathAdd_t::PATH_ADD_TO_TAIL);
-	
-	if (g_pFileSystemModule.InDebug())
-		Msg("Updated workshop path. (%s)\n", workshopDir.c_str());
+	return 1;
 }
 
-inline const char* CPathIDInfo::GetPathIDString() const
+LUA_FUNCTION_STATIC(MappedFile__index)
 {
-	return m_pDebugPathID; // This should remove the requirement for g_pPathIDTable.
+	if (!LUA->FindOnObjectsMetaTable(1, 2))
+		LUA->PushNil();
+
+	return 1;
 }
 
-inline const char* CSearchPath::GetPathIDString() const
+LUA_FUNCTION_STATIC(MappedFile__gc)
 {
-	return m_pPathIDInfo->GetPathIDString(); // When can we nuke it :>
+	MappedFile* pFile = Get_MappedFile(1, false);
+	if (pFile)
+	{
+		LUA->SetUserType(1, NULL);
+		ReleaseMappedFile(pFile);
+	}
+
+	return 0;
 }
 
-static Symbols::CBaseFileSystem_CSearchPath_GetDebugString func_CBaseFileSystem_CSearchPath_GetDebugString;
-inline const char* CSearchPath::GetPathString() const
+LUA_FUNCTION_STATIC(MappedFile_IsValid)
 {
-	return func_CBaseFileSystem_CSearchPath_GetDebugString((void*)this); // Look into this to possibly remove the GetDebugString function.
+	MappedFile* pFile = Get_MappedFile(1, false);
+
+	LUA->PushBool(pFile != nullptr);
+	return 1;
 }
 
-inline const char* CBaseFileSystem::CPathIDInfo::GetPathIDString() const
+LUA_FUNCTION_STATIC(MappedFile_Close)
 {
-	return m_pDebugPathID; // This should remove the requirement for g_pPathIDTable.
+	MappedFile* pFile = Get_MappedFile(1, true);
+	LUA->SetUserType(1, NULL);
+	ReleaseMappedFile(pFile);
+
+	return 0;
 }
 
-inline const char* CBaseFileSystem::CSearchPath::GetPathIDString() const // Remove this duplicate later :<
+LUA_FUNCTION_STATIC(MappedFile_Size)
 {
-	return m_pPathIDInfo->GetPathIDString(); // When can we nuke it :>
+	MappedFile* pFile = Get_MappedFile(1, true);
+
+	LUA->PushNumber((double)pFile->iLength);
+	return 1;
 }
 
-inline const char* CBaseFileSystem::CSearchPath::GetPathString() const
+LUA_FUNCTION_STATIC(MappedFile_IsMapped)
 {
-	return func_CBaseFileSystem_CSearchPath_GetDebugString((void*)this); // Look into this to possibly remove the GetDebugString function.
+	MappedFile* pFile = Get_MappedFile(1, true);
+
+	g_pMappedFilesMutex.Lock();
+	LUA->PushBool(pFile->pData->IsMapped());
+	g_pMappedFilesMutex.Unlock();
+	return 1;
 }
 
-void CFileSystemModule::InitDetour(bool bPreServer)
+LUA_FUNCTION_STATIC(MappedFile_Read)
 {
-	if (!bPreServer)
-		return;
+	MappedFile* pFile = Get_MappedFile(1, true);
+	size_t iOffset = ClampMappedOffset(LUA->CheckNumberOpt(2, 0), pFile->iLength);
+	size_t iLength = ClampMappedOffset(LUA->CheckNumberOpt(3, (double)pFile->iLength), pFile->iLength - iOffset);
 
-	pFileSystemPool = V_CreateThreadPool();
-	Util::StartThreadPool(pFileSystemPool, holylib_filesystem_threads.GetInt());
+	g_pMappedFilesMutex.Lock(); // An async OpenForWrite could detach it while we copy.
+	LUA->PushString(pFile->pData->GetData() + pFile->iOffset + iOffset, (unsigned int)iLength);
+	g_pMappedFilesMutex.Unlock();
+	return 1;
+}
 
-	// ToDo: Redo EVERY Hook so that we'll abuse the vtable instead of symbols.  
-	// Use the ClassProxy or so which should also allow me to port this to windows.  
-	SourceSDK::ModuleLoader dedicated_loader("dedicated");
-	Detour::Create(
-		&detour_CBaseFileSystem_FindFileInSearchPath, "CBaseFileSystem::FindFileInSearchPath",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_FindFileInSearchPathSym,
-		(void*)hook_CBaseFileSystem_FindFileInSearchPath, m_pID
-	);
+LUA_FUNCTION_STATIC(MappedFile_Sub) // Same as string.sub
+{
+	MappedFile* pFile = Get_MappedFile(1, true);
+	double iLength = (double)pFile->iLength;
+	double iStart = LUA->CheckNumberOpt(2, 1);
+	double iEnd = LUA->CheckNumberOpt(3, -1);
+	if (iStart < 0)
+		iStart = std::max(iLength + iStart + 1, 1.0);
+	else if (iStart == 0)
+		iStart = 1;
+
+	if (iEnd < 0)
+		iEnd = iLength + iEnd + 1;
+	else if (iEnd > iLength)
+		iEnd = iLength;
+
+	if (iStart > iEnd)
+	{
+		LUA->PushString("");
+		return 1;
+	}
 
-	Detour::Create(
-		&detour_CBaseFileSystem_IsDirectory, "CBaseFileSystem::IsDirectory",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_IsDirectorySym,
-		(void*)hook_CBaseFileSystem_IsDirectory, m_pID
-	);
+	g_pMappedFilesMutex.Lock();
+	LUA->PushString(pFile->pData->GetData() + pFile->iOffset + (size_t)iStart - 1, (unsigned int)(iEnd - iStart + 1));
+	g_pMappedFilesMutex.Unlock();
+	return 1;
+}
 
-	Detour::Create(
-		&detour_CBaseFileSystem_FastFileTime, "CBaseFileSystem::FastFileTime",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_FastFileTimeSym,
-		(void*)hook_CBaseFileSystem_FastFileTime, m_pID
-	);
+LUA_FUNCTION_STATIC(MappedFile_Slice)
+{
+	MappedFile* pFile = Get_MappedFile(1, true);
+	size_t iOffset = ClampMappedOffset(LUA->CheckNumber(2), pFile->iLength);
+	size_t iLength = ClampMappedOffset(LUA->CheckNumberOpt(3, (double)pFile->iLength), pFile->iLength - iOffset);
 
-	Detour::Create(
-		&detour_CBaseFileSystem_FixUpPath, "CBaseFileSystem::FixUpPath",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_FixUpPathSym,
-		(void*)hook_CBaseFileSystem_FixUpPath, m_pID
-	);
+	Push_MappedFile(CreateMappedFile(pFile->pData, pFile->iOffset + iOffset, iLength));
+	return 1;
+}
 
-	Detour::Create(
-		&detour_CBaseFileSystem_OpenForRead, "CBaseFileSystem::OpenForRead",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_OpenForReadSym,
-		(void*)hook_CBaseFileSystem_OpenForRead, m_pID
-	);
+LUA_FUNCTION_STATIC(filesystem_MapFile)
+{
+	const char* pFileName = LUA->CheckString(1);
+	const char* pGamePath = LUA->CheckStringOpt(2, "GAME");
 
-	Detour::Create(
-		&detour_CBaseFileSystem_GetFileTime, "CBaseFileSystem::GetFileTime",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_GetFileTimeSym,
-		(void*)hook_CBaseFileSystem_GetFileTime, m_pID
-	);
+	CMappedFileData* pData = MapGameFile(pFileName, pGamePath);
+	if (pData)
+		Push_MappedFile(CreateMappedFile(pData, 0, pData->GetLength()));
+	else
+		LUA->PushNil();
 
-	Detour::Create(
-		&detour_CBaseFileSystem_AddSearchPath, "CBaseFileSystem::AddSearchPath",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_AddSearchPathSym,
-		(void*)hook_CBaseFileSystem_AddSearchPath, m_pID
-	);
+	return 1;
+}
 
-	Detour::Create(
-		&detour_CBaseFileSystem_AddVPKFile, "CBaseFileSystem::AddVPKFile",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_AddVPKFileSym,
-		(void*)hook_CBaseFileSystem_AddVPKFile, m_pID
-	);
+LUA_FUNCTION_STATIC(filesystem_AddRoute)
+{
+	const char* pMatch = LUA->CheckString(1);
+	const char* pPathID = LUA->CheckString(2);
+	int iType = (int)LUA->CheckNumberOpt(3, ROUTE_PREFIX);
+	bool bForce = LUA->GetBool(4);
+	const char* pSourcePathID = LUA->CheckStringOpt(5, NULL);
+	int iHooks = (int)LUA->CheckNumberOpt(6, ROUTEHOOK_ALL);
+	if (iType < ROUTE_PREFIX || iType > ROUTE_EXTENSION)
+		LUA->ArgError(3, "Invalid route type!");
 
-	Detour::Create(
-		&detour_CBaseFileSystem_RemoveAllMapSearchPaths, "CBaseFileSystem::RemoveAllMapSearchPaths",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_RemoveAllMapSearchPathsSym,
-		(void*)hook_CBaseFileSystem_RemoveAllMapSearchPaths, m_pID
-	);
+	if (iHooks <= 0 || (iHooks & ~ROUTEHOOK_ALL))
+		LUA->ArgError(6, "Invalid route hooks!");
 
-	Detour::Create(
-		&detour_CBaseFileSystem_Close, "CBaseFileSystem::Close",
-		dedicated_loader.GetModule(), Symbols::CBaseFileSystem_CloseSym,
-		(void*)hook_CBaseFileSystem_Close, m_pID
-	);
+	AddRoute(pMatch, pPathID, (RouteType)iType, bForce, pSourcePathID, iHooks);
 
-	// ToDo: Find symbols for this function :/
-	// NOTE: It's probably easier to recreate the filesystem class since the function isn't often used in the engine and there aren't any good ways to find it :/ (Maybe some function declared before or after it can be found and then I'll can search neat that?)
-	func_CBaseFileSystem_FindSearchPathByStoreId = (Symbols::CBaseFileSystem_FindSearchPathByStoreId)Detour::GetFunction(dedicated_loader.GetModule(), Symbols::CBaseFileSystem_FindSearchPathByStoreIdSym);
-	Detour::CheckFunction((void*)func_CBaseFileSystem_FindSearchPathByStoreId, "CBaseFileSystem::FindSearchPathByStoreId");
+	return 0;
+}
 
-	func_CBaseFileSystem_CSearchPath_GetDebugString = (Symbols::CBaseFileSystem_CSearchPath_GetDebugString)Detour::GetFunction(dedicated_loader.GetModule(), Symbols::CBaseFileSystem_CSearchPath_GetDebugStringSym);
-	Detour::CheckFunction((void*)func_CBaseFileSystem_CSearchPath_GetDebugString, "CBaseFileSystem::CSearchPath::GetDebugString");
+LUA_FUNCTION_STATIC(filesystem_RemoveRoute)
+{
+	const char* pMatch = LUA->CheckString(1);
+	int iType = (int)LUA->CheckNumberOpt(2, ROUTE_PREFIX);
+	const char* pSourcePathID = LUA->CheckStringOpt(3, NULL);
+
+	LUA->PushBool(RemoveRoute(pMatch, (RouteType)iType, pSourcePathID));
+	return 1;
 }
 
-/*
- *
- *	LUA API
- *
- */
+LUA_FUNCTION_STATIC(filesystem_ResetRoutes)
+{
+	ResetRoutes();
 
-struct IAsyncFile
+	return 0;
+}
+
+LUA_FUNCTION_STATIC(filesystem_GetRoute)
 {
-	~IAsyncFile()
-	{
-		if ( content )
-			delete[] content;
-	}
+	const char* pFileName = LUA->CheckString(1);
+	const char* pPathID = LUA->CheckStringOpt(2, "GAME");
+	int iHook = (int)LUA->CheckNumberOpt(3, ROUTEHOOK_OPENFORREAD);
 
-	FileAsyncRequest_t* req;
-	int callback;
-	int nBytesRead;
-	int status;
-	const char* content = NULL;
-};
+	RouteResult pRoute = RoutePath(pFileName, pPathID, iHook);
+	if (pRoute.pSplitPath)
+		LUA->PushString(pRoute.pSplitPath);
+	else
+		LUA->PushNil();
+
+	if (pRoute.pForcePath)
+		LUA->PushString(pRoute.pForcePath);
+	else
+		LUA->PushNil();
+
+	return 2;
+}
 
-std::vector<IAsyncFile*> asyncCallback;
-void AsyncCallback(const FileAsyncRequest_t &request, int nBytesRead, FSAsyncStatus_t err)
+static void PushTraceSummary(GarrysMod::Lua::ILuaInterface* LUA, const TraceSummary& pSummary) // Times are in microseconds.
 {
-	IAsyncFile* async = (IAsyncFile*)request.pContext;
-	if (async)
-	{
-		async->nBytesRead = nBytesRead;
-		async->status = err;
-		char* content = new char[nBytesRead + 1];
-		std::memcpy(static_cast<void*>(content), request.pData, nBytesRead);
-		content[nBytesRead] = '\0';
-		async->content = content;
-		asyncCallback.push_back(async);
-	} else {
-		Msg("[Luathreaded] file.AsyncRead Invalid request? (%s, %s)\n", request.pszFilename, request.pszPathID);
-	}
+	LUA->CreateTable();
+		Util::SetStatsField(LUA, "count", (double)pSummary.iCount);
+		Util::SetStatsField(LUA, "total", pSummary.iTotal / 1000.0);
+		Util::SetStatsField(LUA, "min", pSummary.iMin / 1000.0);
+		Util::SetStatsField(LUA, "mean", pSummary.iMean / 1000.0);
+		Util::SetStatsField(LUA, "p50", pSummary.iP50 / 1000.0);
+		Util::SetStatsField(LUA, "p90", pSummary.iP90 / 1000.0);
+		Util::SetStatsField(LUA, "p99", pSummary.iP99 / 1000.0);
+		Util::SetStatsField(LUA, "p999", pSummary.iP999 / 1000.0);
+		Util::SetStatsField(LUA, "max", pSummary.iMax / 1000.0);
 }
 
-LUA_FUNCTION_STATIC(filesystem_AsyncRead)
+LUA_FUNCTION_STATIC(filesystem_GetStats)
 {
-	const char* fileName = LUA->CheckString(1);
-	const char* gamePath = LUA->CheckString(2);
-	LUA->CheckType(3, GarrysMod::Lua::Type::Function);
-	LUA->Push(3);
-	int reference = LUA->ReferenceCreate();
-	LUA->Pop();
-	bool sync = LUA->GetBool(4);
+	LUA->CreateTable();
+	LUA->PushBool(g_bFileSystemTracing);
+	LUA->SetField(-2, "enabled");
+
+	LUA->CreateTable();
+	for (int i = 0; i < FSTRACE_COUNT; ++i)
+	{
+		PushTraceSummary(LUA, SummarizeHistogram(g_pTraceOps[i]));
+		LUA->SetField(-2, pTraceOpNames[i]);
+	}
+	LUA->SetField(-2, "operations");
 
-	FileAsyncRequest_t* request = new FileAsyncRequest_t;
-	request->pszFilename = fileName;
-	request->pszPathID = gamePath;
-	request->pfnCallback = AsyncCallback;
-	request->flags = sync ? FSASYNC_FLAGS_SYNC : 0;
+	LUA->CreateTable();
+	for (auto& [strPathID, pSummary] : GetPathIDTraceSummaries())
+	{
+		PushTraceSummary(LUA, pSummary);
 
-	IAsyncFile* file = new IAsyncFile;
-	file->callback = reference;
-	file->req = request;
+		LUA->CreateTable();
+		g_pTraceMutex.Lock();
+		TracePathID* pStats = g_pTracePathIDs[strPathID];
+		for (int i = 0; i < FSTRACE_COUNT; ++i)
+			Util::SetStatsField(LUA, pTraceOpNames[i], (double)pStats->pCalls[i].load(std::memory_order_relaxed));
+		g_pTraceMutex.Unlock();
+		LUA->SetField(-2, "calls");
 
-	request->pContext = file;
+		LUA->SetField(-2, strPathID.c_str());
+	}
+	LUA->SetField(-2, "pathIDs");
+
+	LUA->CreateTable();
+	for (int i = 0; i < FSCACHE_COUNT; ++i)
+	{
+		LUA->CreateTable();
+			Util::SetStatsField(LUA, "hits", (double)g_pTraceCacheHits[i].load(std::memory_order_relaxed));
+			Util::SetStatsField(LUA, "misses", (double)g_pTraceCacheMisses[i].load(std::memory_order_relaxed));
+		LUA->SetField(-2, pTraceCacheNames[i]);
+	}
+	LUA->SetField(-2, "caches");
 
-	LUA->PushNumber(g_pFullFileSystem->AsyncReadMultiple(request, 1));
+	LUA->CreateTable();
+	int iIndex = 0;
+	for (const TraceSlowEntry& pEntry : GetSlowestTraces())
+	{
+		LUA->PushNumber(++iIndex);
+		LUA->CreateTable();
+			Util::SetStatsField(LUA, "time", pEntry.iTime / 1000.0);
+			LUA->PushString(pTraceOpNames[pEntry.iOp]);
+			LUA->SetField(-2, "operation");
+			LUA->PushString(pEntry.strPathID.c_str());
+			LUA->SetField(-2, "pathID");
+			LUA->PushString(pEntry.strFileName.c_str());
+			LUA->SetField(-2, "file");
+		LUA->SetTable(-3);
+	}
+	LUA->SetField(-2, "slowest");
 
 	return 1;
 }
 
-void FileAsyncReadThink()
+LUA_FUNCTION_STATIC(filesystem_ResetStats)
 {
-	std::vector<IAsyncFile*> files;
-	for(IAsyncFile* file : asyncCallback) {
-		g_Lua->ReferencePush(file->callback);
-		g_Lua->PushString(file->req->pszFilename);
-		g_Lua->PushString(file->req->pszPathID);
-		g_Lua->PushNumber(file->status);
-		g_Lua->PushString(file->content);
-		g_Lua->CallFunctionProtected(4, 0, true);
-		g_Lua->ReferenceFree(file->callback);
-		files.push_back(file);
-	}
+	ResetFileSystemTrace();
 
-	asyncCallback.clear();
+	return 0;
 }
 
 LUA_FUNCTION_STATIC(filesystem_CreateDir)
@@ -1586,19 +6060,22 @@ LUA_FUNCTION_STATIC(filesystem_Find)
 	const char* path = LUA->CheckString(2);
 	const char* sorting = LUA->CheckStringOpt(3, "");
 
-	FileFindHandle_t findHandle;
-	const char *pFilename = g_pFullFileSystem->FindFirstEx(filepath, path, &findHandle);
-	while (pFilename)
+	if (!VirtualIndex_Find(filepath, path, files, folders))
 	{
-		if (g_pFullFileSystem->IsDirectory(((std::string)filepath + pFilename).c_str(), path)) {
-			folders.push_back(pFilename);
-		} else {
-			files.push_back(pFilename);
-		}
+		FileFindHandle_t findHandle;
+		const char *pFilename = g_pFullFileSystem->FindFirstEx(filepath, path, &findHandle);
+		while (pFilename)
+		{
+			if (g_pFullFileSystem->IsDirectory(((std::string)filepath + pFilename).c_str(), path)) {
+				folders.push_back(pFilename);
+			} else {
+				files.push_back(pFilename);
+			}
 
-		pFilename = g_pFullFileSystem->FindNext(findHandle);
+			pFilename = g_pFullFileSystem->FindNext(findHandle);
+		}
+		g_pFullFileSystem->FindClose(findHandle);
 	}
-	g_pFullFileSystem->FindClose(findHandle);
 
 	LUA->CreateTable();
 	if (files.size() > 0) {
@@ -1800,8 +6277,11 @@ void CFileSystemModule::LuaInit(bool bServerInit)
 	if (bServerInit)
 		return;
 
+	LoadSearchCache(); // Workshop addons are mounted at this point, so the fingerprint should match now.
+
 	Util::StartTable();
 		Util::AddFunc(filesystem_AsyncRead, "AsyncRead");
+		Util::AddFunc(filesystem_AsyncReadMultiple, "AsyncReadMultiple");
 		Util::AddFunc(filesystem_CreateDir, "CreateDir");
 		Util::AddFunc(filesystem_Delete, "Delete");
 		Util::AddFunc(filesystem_Exists, "Exists");
@@ -1821,20 +6301,61 @@ void CFileSystemModule::LuaInit(bool bServerInit)
 		Util::AddFunc(filesystem_FullPathToRelativePath, "FullPathToRelativePath");
 		Util::AddFunc(filesystem_TimeCreated, "TimeCreated");
 		Util::AddFunc(filesystem_TimeAccessed, "TimeAccessed");
+		Util::AddFunc(filesystem_Warmup, "Warmup");
+		Util::AddFunc(filesystem_MapFile, "MapFile");
+		Util::AddFunc(filesystem_AddRoute, "AddRoute");
+		Util::AddFunc(filesystem_RemoveRoute, "RemoveRoute");
+		Util::AddFunc(filesystem_ResetRoutes, "ResetRoutes");
+		Util::AddFunc(filesystem_GetRoute, "GetRoute");
+		Util::AddFunc(filesystem_GetStats, "GetStats");
+		Util::AddFunc(filesystem_ResetStats, "ResetStats");
+
+		Util::AddValue(ROUTE_PREFIX, "ROUTE_PREFIX");
+		Util::AddValue(ROUTE_EXACT, "ROUTE_EXACT");
+		Util::AddValue(ROUTE_EXTENSION, "ROUTE_EXTENSION");
+		Util::AddValue(ROUTEHOOK_OPENFORREAD, "ROUTEHOOK_OPENFORREAD");
+		Util::AddValue(ROUTEHOOK_GETFILETIME, "ROUTEHOOK_GETFILETIME");
+		Util::AddValue(ROUTEHOOK_ALL, "ROUTEHOOK_ALL");
 	Util::FinishTable("filesystem");
+
+	MappedFile_TypeID = g_Lua->CreateMetaTable("MappedFile");
+		Util::AddFunc(MappedFile__tostring, "__tostring");
+		Util::AddFunc(MappedFile__index, "__index");
+		Util::AddFunc(MappedFile__gc, "__gc");
+		Util::AddFunc(MappedFile_Size, "__len");
+		Util::AddFunc(MappedFile_IsValid, "IsValid");
+		Util::AddFunc(MappedFile_Close, "Close");
+		Util::AddFunc(MappedFile_Size, "Size");
+		Util::AddFunc(MappedFile_IsMapped, "IsMapped");
+		Util::AddFunc(MappedFile_Read, "Read");
+		Util::AddFunc(MappedFile_Sub, "Sub");
+		Util::AddFunc(MappedFile_Slice, "Slice");
+	g_Lua->Pop(1);
 }
 
 void CFileSystemModule::LuaShutdown()
 {
+	AbortWarmup();
+	AsyncReadShutdown();
 	Util::NukeTable("filesystem");
 }
 
 void CFileSystemModule::Shutdown()
 {
+	AbortWarmup();
+	SaveSearchCache();
+	FinishVirtualIndexBuild(true);
+	NukeVirtualIndex();
+	ClearMappedVPKs();
+	NegativeCache_Invalidate();
+
 	pFileSystemPool->ExecuteAll();
 	V_DestroyThreadPool(pFileSystemPool);
 	pFileSystemPool = NULL;
 
+	g_pAsyncBufferPool.Clear();
+	g_pFileHandlePool.Clear();
+	SwapPathRouter(NULL);
 	m_PredictionCheck.clear();
 	// ToDo: Also clear there other shit.
 }
\ No newline at end of file
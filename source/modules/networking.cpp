@@ -10,25 +10,33 @@
 #include "server_class.h"
 #include "dt.h"
 #include "edict.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <atomic>
 
-class CNetworkingModule : public IModule
+class CNetworkingModule : public IModule2
 {
 public:
+	virtual void LuaInit(bool bServerInit) OVERRIDE;
+	virtual void LuaShutdown() OVERRIDE;
 	virtual void InitDetour(bool bPreServer) OVERRIDE;
+	virtual void Think(bool bSimulating) OVERRIDE;
+	virtual void LevelShutdown() OVERRIDE;
 	virtual void Shutdown() OVERRIDE;
 	virtual const char* Name() { return "networking"; };
 	virtual int Compatibility() { return LINUX32 | LINUX64; };
 };
 
 /*
- * This module can't be disabled at runtime!
+ * This module replaces the entire CChangeFrameList class which is used & stored in the engine.
  * 
- * This is because of it replacing the entire CChangeFrameList class which is used & stored in the engine.
- * We would have to add a check to the Copy function to then slowly switch to the original until it's not used anymore.
+ * To disable it at runtime (holylib_networking_changeframes or unloading the module),
+ * every list that is still stored in a PackedEntity is replaced by one allocated by the engine. See MigrateChangeFrameLists.
  */
 
 CNetworkingModule g_pNetworkingModule;
-IModule* pNetworkingModule = &g_pNetworkingModule;
+IModule2* pNetworkingModule = &g_pNetworkingModule;
 
 abstract_class IChangeFrameList
 {
@@ -51,6 +59,14 @@ see https://github.com/rafradek/sigsegv-mvm/tree/master?tab=License-1-ov-file fo
 */
 
 // This is originally from here: https://github.com/rafradek/sigsegv-mvm/blob/910b92456c7578a3eb5dff2a7e7bf4bc906677f7/src/mod/perf/sendprop_optimize.cpp#L35-L144
+// HolyLib: Added a ring of the props that changed in the last SetChangeTick calls, so that most queries don't need to scan every prop.
+#define CHANGEFRAME_RING_SIZE 8 // The number of SetChangeTick calls whose props are kept as bitsets.
+#define CHANGEFRAME_MAX_WORDS 128 // MAX_DATATABLE_PROPS / 32. Lists with more props always use the linear scan.
+static void RecordChangeFrameEvent(int& iRecordID, int& iRecordSession, int iType, int nProps, int iTick, const int* pProps, int nPropsInEvent);
+static std::atomic<bool> g_bRecordChangeFrames(false); // Read by every PackEntities thread while the command changes it.
+class CChangeFrameList;
+static void FreeChangeFrameList(CChangeFrameList* pList);
+
 class CChangeFrameList : public IChangeFrameList
 {
 public:
@@ -60,13 +76,26 @@ public:
 		m_ChangeTicks.SetSize(nProperties);
 		for (int i=0; i < nProperties; ++i)
 			m_ChangeTicks[i] = iCurTick;
+
+		m_nWords = (nProperties + 31) >> 5;
+		m_RingBits.assign(m_nWords * CHANGEFRAME_RING_SIZE, 0);
+		m_nRingCount = 0;
+		m_iRingHead = 0;
+		m_iRingValidAfter = iCurTick; // Every prop changed in iCurTick, so the ring only knows what changed after it.
+		m_LastChangeTickNum = iCurTick;
+		m_LastSameTickNum = iCurTick + 1; // Init changed every prop, which isn't inside m_LastChangeTicks.
+		m_LastChangeTicks.clear(); // Lists are reused, so we keep the capacity.
+		m_CopyCounter = 0;
+
+		if (g_bRecordChangeFrames)
+			RecordChangeFrameEvent(m_iRecordID, m_iRecordSession, 0, nProperties, iCurTick, NULL, 0);
 	}
 public:
 	virtual void Release()
 	{
 		--m_CopyCounter;
 		if (m_CopyCounter < 0)
-			delete this;
+			FreeChangeFrameList(this);
 	}
 
 	virtual IChangeFrameList* Copy()
@@ -84,6 +113,9 @@ public:
 	virtual void SetChangeTick(const int *pPropIndices, int nPropIndices, const int iTick)
 	{
 		VPROF_BUDGET("CChangeFrameList::SetChangeTick", VPROF_BUDGETGROUP_OTHER_NETWORKING);
+		if (g_bRecordChangeFrames)
+			RecordChangeFrameEvent(m_iRecordID, m_iRecordSession, 1, m_ChangeTicks.Count(), iTick, pPropIndices, nPropIndices);
+
 		bool same = (int)m_LastChangeTicks.size() == nPropIndices;
 		m_LastChangeTicks.resize(nPropIndices);
 		for (int i=0; i < nPropIndices; ++i)
@@ -98,39 +130,81 @@ public:
 		if (!same)
 			m_LastSameTickNum = iTick;
 
-		m_LastChangeTickNum = iTick;
-		if (m_LastChangeTicks.capacity() > m_LastChangeTicks.size() * 8)
-			m_LastChangeTicks.shrink_to_fit();
+		m_LastChangeTickNum = iTick; // The capacity of m_LastChangeTicks is never bigger than the prop count, so we don't shrink it.
+
+		if (nPropIndices > 0)
+			AddToRing(pPropIndices, nPropIndices, iTick);
 	}
 
 	virtual int GetPropsChangedAfterTick(int iTick, int *iOutProps, int nMaxOutProps)
 	{
 		// Should we remove vprof here? It could slow this entire thing down since it's called so often
 		// VPROF_BUDGET("CChangeFrameList::GetPropsChangedAfterTick", VPROF_BUDGETGROUP_OTHER_NETWORKING);
-		int nOutProps = 0;
+		if (g_bRecordChangeFrames)
+			RecordChangeFrameEvent(m_iRecordID, m_iRecordSession, 2, m_ChangeTicks.Count(), iTick, NULL, 0);
+
 		if (iTick + 1 >= m_LastSameTickNum)
 		{
 			if (iTick >= m_LastChangeTickNum)
 				return 0;
 
-			nOutProps = m_LastChangeTicks.size();
+			int nOutProps = m_LastChangeTicks.size();
 			for (int i=0; i < nOutProps; ++i)
 				iOutProps[i] = m_LastChangeTicks[i];
 
 			return nOutProps;
-		} else {
-			int c = m_ChangeTicks.Count();
-			for (int i=0; i < c; ++i)
+		}
+
+		if (iTick >= m_iRingValidAfter && m_nWords <= CHANGEFRAME_MAX_WORDS)
+			return GetPropsChangedAfterTick_Ring(iTick, iOutProps, nMaxOutProps);
+
+		return GetPropsChangedAfterTick_Linear(iTick, iOutProps, nMaxOutProps);
+	}
+
+	int GetPropsChangedAfterTick_Ring(int iTick, int *iOutProps, int nMaxOutProps)
+	{
+		uint32 pChanged[CHANGEFRAME_MAX_WORDS];
+		memset(pChanged, 0, m_nWords * sizeof(uint32));
+		for (int iEntry = 0; iEntry < m_nRingCount; ++iEntry)
+		{
+			int iSlot = (m_iRingHead - iEntry + CHANGEFRAME_RING_SIZE) % CHANGEFRAME_RING_SIZE; // Newest first
+			if (m_RingTicks[iSlot] <= iTick)
+				break; // Everything after this is even older.
+
+			const uint32* pBits = &m_RingBits[iSlot * m_nWords];
+			for (int i = 0; i < m_nWords; ++i)
+				pChanged[i] |= pBits[i];
+		}
+
+		int nOutProps = 0;
+		for (int i = 0; i < m_nWords; ++i)
+		{
+			for (uint32 iWord = pChanged[i]; iWord != 0; iWord &= iWord - 1)
 			{
-				if (m_ChangeTicks[i] > iTick)
-				{
-					iOutProps[nOutProps] = i;
-					++nOutProps;
-				}
+				if (nOutProps >= nMaxOutProps)
+					return nOutProps;
+
+				iOutProps[nOutProps++] = (i << 5) + FindLowestSetBit(iWord);
 			}
+		}
 
-			return nOutProps;
+		return nOutProps;
+	}
+
+	int GetPropsChangedAfterTick_Linear(int iTick, int *iOutProps, int nMaxOutProps)
+	{
+		int nOutProps = 0;
+		int c = m_ChangeTicks.Count();
+		for (int i=0; i < c; ++i)
+		{
+			if (m_ChangeTicks[i] > iTick)
+			{
+				iOutProps[nOutProps] = i;
+				++nOutProps;
+			}
 		}
+
+		return nOutProps;
 	}
 
 protected:
@@ -139,81 +213,838 @@ protected:
 	}
 
 private:
+	static inline int FindLowestSetBit(uint32 iWord)
+	{
+#if defined(_MSC_VER)
+		unsigned long iBit;
+		_BitScanForward(&iBit, iWord);
+		return (int)iBit;
+#else
+		return __builtin_ctz(iWord);
+#endif
+	}
+
+	void AddToRing(const int *pPropIndices, int nPropIndices, const int iTick)
+	{
+		if (m_nWords > CHANGEFRAME_MAX_WORDS)
+			return;
+
+		if (m_nRingCount > 0 && m_RingTicks[m_iRingHead] > iTick) // The tick went backwards. The ring has to be ordered, so we start over.
+		{
+			m_iRingValidAfter = MAX(m_iRingValidAfter, m_RingTicks[m_iRingHead]);
+			m_nRingCount = 0;
+		}
+
+		uint32* pBits;
+		if (m_nRingCount > 0 && m_RingTicks[m_iRingHead] == iTick) // Multiple changes in the same tick.
+		{
+			pBits = &m_RingBits[m_iRingHead * m_nWords];
+		} else {
+			m_iRingHead = (m_iRingHead + 1) % CHANGEFRAME_RING_SIZE;
+			if (m_nRingCount == CHANGEFRAME_RING_SIZE)
+				m_iRingValidAfter = MAX(m_iRingValidAfter, m_RingTicks[m_iRingHead]); // We lose this tick, so the ring can't answer for anything before it anymore.
+			else
+				++m_nRingCount;
+
+			m_RingTicks[m_iRingHead] = iTick;
+			pBits = &m_RingBits[m_iRingHead * m_nWords];
+			memset(pBits, 0, m_nWords * sizeof(uint32));
+		}
+
+		for (int i = 0; i < nPropIndices; ++i)
+			pBits[pPropIndices[i] >> 5] |= 1u << (pPropIndices[i] & 31);
+	}
+
 	CUtlVector<int>		m_ChangeTicks;
 
 	int m_CopyCounter = 0;
 	int m_LastChangeTickNum = 0;
 	int m_LastSameTickNum = 0;
 	std::vector<int> m_LastChangeTicks;
+
+	int m_nWords = 0;
+	int m_nRingCount = 0;
+	int m_iRingHead = 0;
+	int m_iRingValidAfter = 0;
+	int m_RingTicks[CHANGEFRAME_RING_SIZE] = {};
+	std::vector<uint32> m_RingBits; // CHANGEFRAME_RING_SIZE bitsets of m_nWords each.
+
+	int m_iRecordID = 0; // Used by holylib_networking_recordchangeframes
+	int m_iRecordSession = 0;
+
+	friend void FreeChangeFrameList(CChangeFrameList* pList);
+	friend void ClearChangeFramePool();
+};
+
+/*
+ * Change frame list pool
+ * Every new PackedEntity allocates a change list, so instead of freeing them we keep them per prop count and reuse them.
+ * A reused list already has the right size, so Init doesn't need to allocate anything.
+ */
+static ConVar networking_maxpooledchangeframes("holylib_networking_maxpooledchangeframes", "8192", 0, "The max number of unused change lists that are kept for reuse.");
+
+struct ChangeFramePoolClass
+{
+	std::vector<CChangeFrameList*> pFree;
+	int iLive = 0;
+	uint64 iHits = 0;
+	uint64 iMisses = 0;
+};
+static std::unordered_map<int, ChangeFramePoolClass> g_pChangeFramePool; // Indexed by the prop count.
+static int g_iPooledChangeFrames = 0;
+static void* g_pChangeFrameListVTable = NULL; // Used to know if a list stored in the engine is one of ours.
+static CThreadFastMutex g_pChangeFramePoolMutex; // PackEntities can run in parallel.
+
+static CChangeFrameList* AllocChangeFrameList(int nProperties)
+{
+	g_pChangeFramePoolMutex.Lock();
+	ChangeFramePoolClass& pClass = g_pChangeFramePool[nProperties];
+	++pClass.iLive;
+	if (!pClass.pFree.empty())
+	{
+		CChangeFrameList* pList = pClass.pFree.back();
+		pClass.pFree.pop_back();
+		--g_iPooledChangeFrames;
+		++pClass.iHits;
+		g_pChangeFramePoolMutex.Unlock();
+		return pList;
+	}
+
+	++pClass.iMisses;
+	g_pChangeFramePoolMutex.Unlock();
+
+	CChangeFrameList* pList = new CChangeFrameList;
+	g_pChangeFrameListVTable = *(void**)pList;
+	return pList;
+}
+
+void FreeChangeFrameList(CChangeFrameList* pList)
+{
+	g_pChangeFramePoolMutex.Lock();
+	ChangeFramePoolClass& pClass = g_pChangeFramePool[pList->GetNumProps()];
+	--pClass.iLive;
+	if (g_iPooledChangeFrames < networking_maxpooledchangeframes.GetInt())
+	{
+		pClass.pFree.push_back(pList);
+		++g_iPooledChangeFrames;
+		g_pChangeFramePoolMutex.Unlock();
+		return;
+	}
+	g_pChangeFramePoolMutex.Unlock();
+
+	delete pList;
+}
+
+void ClearChangeFramePool() // Only frees the unused lists. The engine still holds the others.
+{
+	g_pChangeFramePoolMutex.Lock();
+	for (auto& [nProps, pClass] : g_pChangeFramePool)
+	{
+		for (CChangeFrameList* pList : pClass.pFree)
+			delete pList;
+
+		pClass.pFree.clear();
+	}
+	g_iPooledChangeFrames = 0;
+	g_pChangeFramePoolMutex.Unlock();
+}
+
+static void ChangeFramePoolStatsCmd(const CCommand &args)
+{
+	g_pChangeFramePoolMutex.Lock();
+	std::vector<int> pSizes;
+	for (auto& [nProps, pClass] : g_pChangeFramePool)
+		pSizes.push_back(nProps);
+
+	std::sort(pSizes.begin(), pSizes.end());
+
+	int iLive = 0;
+	uint64 iHits = 0, iMisses = 0;
+	Msg("---- Change frame pool ----\n");
+	Msg("%-8s %-8s %-8s %-12s %-12s\n", "props", "live", "free", "hits", "misses");
+	for (int nProps : pSizes)
+	{
+		ChangeFramePoolClass& pClass = g_pChangeFramePool[nProps];
+		Msg("%-8i %-8i %-8i %-12llu %-12llu\n", nProps, pClass.iLive, (int)pClass.pFree.size(), (unsigned long long)pClass.iHits, (unsigned long long)pClass.iMisses);
+		iLive += pClass.iLive;
+		iHits += pClass.iHits;
+		iMisses += pClass.iMisses;
+	}
+	Msg("Total: %i live, %i free, %llu hits, %llu misses\n", iLive, g_iPooledChangeFrames, (unsigned long long)iHits, (unsigned long long)iMisses);
+	Msg("---- End of Change frame pool ----\n");
+	g_pChangeFramePoolMutex.Unlock();
+}
+static ConCommand changeframepoolstats("holylib_networking_changeframepoolstats", ChangeFramePoolStatsCmd, "Shows the stats of the change list pool", 0);
+
+/*
+ * Change frame recording
+ * Records the calls to our CChangeFrameList so that holylib_networking_benchmarkchangeframes can replay them
+ * against the linear scan and the ring, and verify that both return the same props.
+ */
+struct ChangeFrameEvent
+{
+	int iRecordID;
+	int iType; // 0 = Init, 1 = SetChangeTick, 2 = GetPropsChangedAfterTick
+	int nProps;
+	int iTick;
+	int iPropsOffset;
+	int nPropsInEvent;
 };
+static std::vector<ChangeFrameEvent> g_pChangeFrameEvents;
+static std::vector<int> g_pChangeFrameEventProps;
+static int g_iNextChangeFrameRecordID = 1;
+static int g_iChangeFrameRecordSession = 0; // IDs from older recordings are ignored.
+static int g_iRecordChangeFramesUntil = -1;
+static CThreadFastMutex g_pChangeFrameRecordMutex; // PackEntities can run in parallel.
+#define CHANGEFRAME_MAX_RECORDED_EVENTS 4000000
+
+extern CGlobalVars *gpGlobals;
+static void RecordChangeFrameEvent(int& iRecordID, int& iRecordSession, int iType, int nProps, int iTick, const int* pProps, int nPropsInEvent)
+{
+	g_pChangeFrameRecordMutex.Lock();
+	if (!g_bRecordChangeFrames) // Another thread could have stopped the recording.
+	{
+		g_pChangeFrameRecordMutex.Unlock();
+		return;
+	}
+
+	if (gpGlobals->tickcount > g_iRecordChangeFramesUntil || g_pChangeFrameEvents.size() >= CHANGEFRAME_MAX_RECORDED_EVENTS)
+	{
+		g_bRecordChangeFrames = false;
+		Msg("holylib: Finished recording %i change frame events\n", (int)g_pChangeFrameEvents.size());
+		g_pChangeFrameRecordMutex.Unlock();
+		return;
+	}
+
+	if (iRecordSession != g_iChangeFrameRecordSession || iType == 0)
+	{
+		bool bExisting = iType != 0;
+		iRecordID = g_iNextChangeFrameRecordID++;
+		iRecordSession = g_iChangeFrameRecordSession;
+		if (bExisting) // The list existed before we started recording, so the replay starts with a fresh list.
+			g_pChangeFrameEvents.push_back({iRecordID, 0, nProps, iTick, 0, 0});
+	}
+
+	g_pChangeFrameEvents.push_back({iRecordID, iType, nProps, iTick, (int)g_pChangeFrameEventProps.size(), nPropsInEvent});
+	g_pChangeFrameEventProps.insert(g_pChangeFrameEventProps.end(), pProps, pProps + nPropsInEvent);
+	g_pChangeFrameRecordMutex.Unlock();
+}
+
+static void RecordChangeFramesCmd(const CCommand &args)
+{
+	int iTicks = args.ArgC() > 1 ? Q_atoi(args.Arg(1)) : 660;
+
+	g_pChangeFrameRecordMutex.Lock();
+	g_pChangeFrameEvents.clear();
+	g_pChangeFrameEventProps.clear();
+	g_iNextChangeFrameRecordID = 1;
+	++g_iChangeFrameRecordSession;
+	g_iRecordChangeFramesUntil = gpGlobals->tickcount + iTicks;
+	g_bRecordChangeFrames = true;
+	g_pChangeFrameRecordMutex.Unlock();
+
+	Msg("holylib: Recording change frames for %i ticks\n", iTicks);
+}
+static ConCommand recordchangeframes("holylib_networking_recordchangeframes", RecordChangeFramesCmd, "Records the change frame calls for the given number of ticks (default 660) for holylib_networking_benchmarkchangeframes", 0);
+
+static void BenchmarkChangeFramesCmd(const CCommand &args)
+{
+	if (g_bRecordChangeFrames)
+	{
+		Msg("holylib: Still recording change frames!\n");
+		return;
+	}
+
+	if (g_pChangeFrameEvents.empty())
+	{
+		Msg("holylib: Nothing recorded. Use holylib_networking_recordchangeframes first!\n");
+		return;
+	}
+
+	int iIterations = MAX(args.ArgC() > 1 ? Q_atoi(args.Arg(1)) : 10, 1);
+	std::vector<int> pOutLinear(CHANGEFRAME_MAX_WORDS * 32);
+	std::vector<int> pOutRing(CHANGEFRAME_MAX_WORDS * 32);
+	double flSet = 0, flLinear = 0, flNew = 0;
+	int nQueries = 0, nMismatches = 0;
+	for (int iIteration = 0; iIteration < iIterations; ++iIteration)
+	{
+		std::unordered_map<int, CChangeFrameList*> pLists;
+		for (const ChangeFrameEvent& pEvent : g_pChangeFrameEvents)
+		{
+			CChangeFrameList*& pList = pLists[pEvent.iRecordID];
+			if (pEvent.iType == 0)
+			{
+				if (pList)
+					pList->Release();
+
+				pList = AllocChangeFrameList(pEvent.nProps);
+				pList->Init(pEvent.nProps, pEvent.iTick);
+				continue;
+			}
+
+			if (!pList)
+				continue;
+
+			if (pEvent.iType == 1)
+			{
+				double flStart = Plat_FloatTime();
+				pList->SetChangeTick(&g_pChangeFrameEventProps[pEvent.iPropsOffset], pEvent.nPropsInEvent, pEvent.iTick);
+				flSet += Plat_FloatTime() - flStart;
+				continue;
+			}
+
+			double flStart = Plat_FloatTime();
+			int nLinear = pList->GetPropsChangedAfterTick_Linear(pEvent.iTick, pOutLinear.data(), pOutLinear.size());
+			flLinear += Plat_FloatTime() - flStart;
+
+			flStart = Plat_FloatTime();
+			int nNew = pList->GetPropsChangedAfterTick(pEvent.iTick, pOutRing.data(), pOutRing.size());
+			flNew += Plat_FloatTime() - flStart;
+
+			++nQueries;
+			if (nLinear != nNew || memcmp(pOutLinear.data(), pOutRing.data(), nNew * sizeof(int)) != 0)
+				++nMismatches;
+		}
+
+		for (auto& [_, pList] : pLists)
+			if (pList)
+				pList->Release();
+	}
+
+	Msg("---- Change frame benchmark (%i events, %i iterations) ----\n", (int)g_pChangeFrameEvents.size(), iIterations);
+	Msg("SetChangeTick:            %.3fms\n", flSet * 1000);
+	Msg("GetPropsChangedAfterTick: %.3fms linear / %.3fms ring (%i queries)\n", flLinear * 1000, flNew * 1000, nQueries);
+	if (nMismatches > 0)
+		Warning("holylib: %i queries returned different props!\n", nMismatches);
+	Msg("---- End of Change frame benchmark ----\n");
+}
+static ConCommand benchmarkchangeframes("holylib_networking_benchmarkchangeframes", BenchmarkChangeFramesCmd, "Replays the recorded change frame calls and compares the linear scan with the ring [iterations=10]", 0);
+
+/*
+ * Unpacked data cache
+ * The engine uncompresses compressed packed entities (HLTV / Replay) into a fixed cache of 128 entries
+ * which it scans linearly and which thrashes on servers with many entities.
+ * This replaces it with a LRU cache sized by holylib_networking_unpackedcachesize.
+ *
+ * The engine keeps using the returned entry after the call, so an entry returned in this frame is pinned and never evicted until the next Think.
+ * Since every use moves it to the front, the pinned entries are always the front of the list.
+ * If the tail is pinned too, every entry is in use and we let the engine's cache handle it.
+ * For the same reason the cache is only resized in Think.
+ */
+static ConVar networking_unpackedcachesize("holylib_networking_unpackedcachesize", "512", 0, "The number of uncompressed packed entities that are cached. Each entry uses MAX_PACKEDENTITY_DATA (16 KB). 0 = use the engine's cache.", true, 0, true, 2048);
+
+struct UnpackedCacheEntry
+{
+	UnpackedDataCache_t pData;
+	int iPrev = -1;
+	int iNext = -1;
+	unsigned int iPinnedFrame = 0;
+};
+static std::vector<UnpackedCacheEntry> g_pUnpackedCache;
+static std::unordered_map<PackedEntity*, int> g_pUnpackedCacheEntries;
+static int g_iUnpackedCacheHead = -1; // Most recently used
+static int g_iUnpackedCacheTail = -1; // Least recently used
+static int g_iUnpackedCacheCounter = 0;
+static unsigned int g_iUnpackedCacheFrame = 1; // Increased every Think. Entries with the same frame are pinned.
+static uint64 g_iUnpackedCacheHits = 0;
+static uint64 g_iUnpackedCacheMisses = 0;
+static CThreadFastMutex g_pUnpackedCacheMutex;
+
+static void ResetUnpackedCache(int iSize) // Expects g_pUnpackedCacheMutex to be locked.
+{
+	std::vector<UnpackedCacheEntry>(iSize).swap(g_pUnpackedCache);
+	g_pUnpackedCacheEntries.clear();
+	for (int i=0; i<iSize; ++i)
+	{
+		UnpackedCacheEntry& pEntry = g_pUnpackedCache[i];
+		pEntry.pData.pEntity = NULL;
+		pEntry.pData.counter = 0;
+		pEntry.pData.bits = -1;
+		pEntry.iPrev = i - 1;
+		pEntry.iNext = (i + 1) < iSize ? (i + 1) : -1;
+	}
+
+	g_iUnpackedCacheHead = iSize > 0 ? 0 : -1;
+	g_iUnpackedCacheTail = iSize - 1;
+	g_iUnpackedCacheCounter = 0;
+}
+
+static void UnlinkUnpackedCacheEntry(int iIndex)
+{
+	UnpackedCacheEntry& pEntry = g_pUnpackedCache[iIndex];
+	if (pEntry.iPrev != -1)
+		g_pUnpackedCache[pEntry.iPrev].iNext = pEntry.iNext;
+	else
+		g_iUnpackedCacheHead = pEntry.iNext;
+
+	if (pEntry.iNext != -1)
+		g_pUnpackedCache[pEntry.iNext].iPrev = pEntry.iPrev;
+	else
+		g_iUnpackedCacheTail = pEntry.iPrev;
+
+	pEntry.iPrev = -1;
+	pEntry.iNext = -1;
+}
+
+static void PushUnpackedCacheEntryFront(int iIndex)
+{
+	UnlinkUnpackedCacheEntry(iIndex);
+	UnpackedCacheEntry& pEntry = g_pUnpackedCache[iIndex];
+	pEntry.iNext = g_iUnpackedCacheHead;
+	if (g_iUnpackedCacheHead != -1)
+		g_pUnpackedCache[g_iUnpackedCacheHead].iPrev = iIndex;
+
+	g_iUnpackedCacheHead = iIndex;
+	if (g_iUnpackedCacheTail == -1)
+		g_iUnpackedCacheTail = iIndex;
+}
+
+static void PushUnpackedCacheEntryBack(int iIndex)
+{
+	UnlinkUnpackedCacheEntry(iIndex);
+	UnpackedCacheEntry& pEntry = g_pUnpackedCache[iIndex];
+	pEntry.iPrev = g_iUnpackedCacheTail;
+	if (g_iUnpackedCacheTail != -1)
+		g_pUnpackedCache[g_iUnpackedCacheTail].iNext = iIndex;
+
+	g_iUnpackedCacheTail = iIndex;
+	if (g_iUnpackedCacheHead == -1)
+		g_iUnpackedCacheHead = iIndex;
+}
+
+/*
+ * Same contract as CFrameSnapshotManager::GetCachedUncompressedEntity.
+ * If bits is -1, the caller has to fill the entry. The entry is pinned until the next Think.
+ * Returns NULL if the cache is disabled or every entry is pinned, in which case the engine's cache should be used.
+ */
+static UnpackedDataCache_t* GetUnpackedCacheEntry(PackedEntity* pPackedEntity)
+{
+	g_pUnpackedCacheMutex.Lock();
+	if (g_pUnpackedCache.empty())
+	{
+		g_pUnpackedCacheMutex.Unlock();
+		return NULL;
+	}
+
+	auto it = g_pUnpackedCacheEntries.find(pPackedEntity);
+	if (it != g_pUnpackedCacheEntries.end())
+	{
+		++g_iUnpackedCacheCounter;
+		++g_iUnpackedCacheHits;
+		PushUnpackedCacheEntryFront(it->second);
+		UnpackedCacheEntry& pEntry = g_pUnpackedCache[it->second];
+		pEntry.iPinnedFrame = g_iUnpackedCacheFrame;
+		pEntry.pData.counter = g_iUnpackedCacheCounter;
+		g_pUnpackedCacheMutex.Unlock();
+		return &pEntry.pData;
+	}
+
+	int iIndex = g_iUnpackedCacheTail;
+	UnpackedCacheEntry& pEntry = g_pUnpackedCache[iIndex];
+	if (pEntry.iPinnedFrame == g_iUnpackedCacheFrame) // The tail is the least recently used one, so all are pinned.
+	{
+		g_pUnpackedCacheMutex.Unlock();
+		return NULL;
+	}
+
+	++g_iUnpackedCacheCounter;
+	++g_iUnpackedCacheMisses;
+	UnpackedDataCache_t* pData = &pEntry.pData;
+	if (pData->pEntity)
+		g_pUnpackedCacheEntries.erase(pData->pEntity);
+
+	pEntry.iPinnedFrame = g_iUnpackedCacheFrame;
+	pData->pEntity = pPackedEntity;
+	pData->counter = g_iUnpackedCacheCounter;
+	pData->bits = -1; // Tells the caller to fill it.
+	g_pUnpackedCacheEntries[pPackedEntity] = iIndex;
+	PushUnpackedCacheEntryFront(iIndex);
+	g_pUnpackedCacheMutex.Unlock();
+
+	return pData;
+}
+
+static void RemoveUnpackedCacheEntry(PackedEntity* pPackedEntity)
+{
+	g_pUnpackedCacheMutex.Lock();
+	auto it = g_pUnpackedCacheEntries.find(pPackedEntity);
+	if (it != g_pUnpackedCacheEntries.end())
+	{
+		UnpackedCacheEntry& pEntry = g_pUnpackedCache[it->second];
+		pEntry.pData.pEntity = NULL;
+		pEntry.pData.counter = 0;
+		pEntry.pData.bits = -1;
+		pEntry.iPinnedFrame = 0; // Its PackedEntity is freed, so nobody uses it anymore.
+		PushUnpackedCacheEntryBack(it->second); // Reuse it first.
+		g_pUnpackedCacheEntries.erase(it);
+	}
+	g_pUnpackedCacheMutex.Unlock();
+}
 
 // -------------------------------------------------------------------------------------------------
 
+static void OnChangeFramesChange(IConVar* convar, const char* pOldValue, float flOldValue);
+static ConVar networking_changeframes("holylib_networking_changeframes", "1", 0, "If disabled, the engine's change lists are used again. The lists that are currently used are converted when it's changed.", OnChangeFramesChange);
+
 static Detouring::Hook detour_AllocChangeFrameList;
+static Symbols::AllocChangeFrameList func_AllocChangeFrameList = NULL;
 static IChangeFrameList* hook_AllocChangeFrameList(int nProperties, int iCurTick)
 {
 	VPROF_BUDGET("AllocChangeFrameList", VPROF_BUDGETGROUP_OTHER_NETWORKING);
-	CChangeFrameList* pRet = new CChangeFrameList;
+	if (!networking_changeframes.GetBool())
+		return detour_AllocChangeFrameList.GetTrampoline<Symbols::AllocChangeFrameList>()(nProperties, iCurTick);
+
+	CChangeFrameList* pRet = AllocChangeFrameList(nProperties);
 	pRet->Init(nProperties, iCurTick);
 
 	return pRet;
 }
 
-CFrameSnapshotManager* framesnapshotmanager = NULL;
-void CNetworkingModule::InitDetour(bool bPreServer)
+static IChangeFrameList* EngineAllocChangeFrameList(int nProperties, int iCurTick)
 {
-	if (bPreServer)
-		return;
+	if (detour_AllocChangeFrameList.IsEnabled())
+		return detour_AllocChangeFrameList.GetTrampoline<Symbols::AllocChangeFrameList>()(nProperties, iCurTick);
 
-	SourceSDK::FactoryLoader engine_loader("engine");
-	Detour::Create(
-		&detour_AllocChangeFrameList, "AllocChangeFrameList",
-		engine_loader.GetModule(), Symbols::AllocChangeFrameListSym,
-		(void*)hook_AllocChangeFrameList, m_pID
-	);
+	// The detour is already removed when the module shuts down, so we can call the original directly.
+	return func_AllocChangeFrameList ? func_AllocChangeFrameList(nProperties, iCurTick) : NULL;
+}
 
-	framesnapshotmanager = Detour::ResolveSymbol<CFrameSnapshotManager>(engine_loader, Symbols::g_FrameSnapshotManagerSym);
-	Detour::CheckValue("get class", "framesnapshotmanager", framesnapshotmanager != NULL);
+static inline bool IsHolyLibChangeFrameList(IChangeFrameList* pList)
+{
+	return g_pChangeFrameListVTable && *(void**)pList == g_pChangeFrameListVTable;
 }
 
-extern CGlobalVars *gpGlobals;
-void CNetworkingModule::Shutdown()
+static int GetLiveChangeFrameLists()
+{
+	int iLive = 0;
+	g_pChangeFramePoolMutex.Lock();
+	for (auto& [nProps, pClass] : g_pChangeFramePool)
+		iLive += pClass.iLive;
+	g_pChangeFramePoolMutex.Unlock();
+
+	return iLive;
+}
+
+/*
+ * Replaces the change list of the given PackedEntity with one of the other kind.
+ * The new list marks every prop as changed in the current tick, so the next delta just contains more props than needed.
+ */
+static bool MigrateChangeFrameList(PackedEntity* pPackedEntity, bool bToHolyLib)
+{
+	IChangeFrameList* pList = pPackedEntity->m_pChangeFrameList;
+	if (!pList || IsHolyLibChangeFrameList(pList) == bToHolyLib)
+		return false;
+
+	int nProps = pList->GetNumProps(); // We can't use m_pServerClass since it's overwritten when the PackedEntity was freed.
+	IChangeFrameList* pNewList;
+	if (bToHolyLib)
+	{
+		CChangeFrameList* pHolyLibList = AllocChangeFrameList(nProps);
+		pHolyLibList->Init(nProps, gpGlobals->tickcount);
+		pNewList = pHolyLibList;
+	} else {
+		pNewList = EngineAllocChangeFrameList(nProps, gpGlobals->tickcount);
+	}
+
+	if (!pNewList)
+		return false;
+
+	pPackedEntity->m_pChangeFrameList = pNewList;
+	pList->Release();
+	return true;
+}
+
+CFrameSnapshotManager* framesnapshotmanager = NULL;
+static void MigrateChangeFrameLists(bool bToHolyLib)
 {
-	if (!framesnapshotmanager) // If we failed, we failed
+	if (!framesnapshotmanager)
 	{
-		Msg("holylib: Failed to find framesnapshotmanager. Unable to fully unload!\n");
+		Warning("holylib: Failed to find framesnapshotmanager. Unable to convert the change lists!\n");
 		return;
 	}
 
+	VPROF_BUDGET("MigrateChangeFrameLists", VPROF_BUDGETGROUP_OTHER_NETWORKING);
+
 	/*
-	 * The code below to unload also belongs to sigsegv
+	 * A PackedEntity is either referenced by a snapshot or it's the most recently sent one of an entity (m_pPackedData).
+	 * m_pPackedData can point to a PackedEntity that was already freed. Its destructor clears m_pChangeFrameList,
+	 * so we only read that member and never m_pServerClass, which is overwritten by the memory pool.
+	 * 
+	 * The code to unload originally belongs to sigsegv
 	 * Source: https://github.com/rafradek/sigsegv-mvm/blob/e6a6cee305023f36e5b914872500ef8319317d71/src/mod/perf/sendprop_optimize.cpp#L1981-L2002
 	 */
-	/*for (CFrameSnapshot* pSnapshot : framesnapshotmanager->m_FrameSnapshots)
+	int iMigrated = 0;
+	std::unordered_set<PackedEntity*> pVisited;
+	framesnapshotmanager->m_FrameSnapshotsWriteMutex.Lock();
+	FOR_EACH_LL(framesnapshotmanager->m_FrameSnapshots, iSnapshot)
 	{
+		CFrameSnapshot* pSnapshot = framesnapshotmanager->m_FrameSnapshots[iSnapshot];
 		for (int i=0; i<pSnapshot->m_nNumEntities; ++i)
 		{
-			CFrameSnapshotEntry* pSnapshotEntry = pSnapshot->m_pEntities + i;
-			if (!pSnapshotEntry)
+			PackedEntity* pPackedEntity = reinterpret_cast<PackedEntity*>(pSnapshot->m_pEntities[i].m_pPackedData);
+			if (!pPackedEntity || !pVisited.insert(pPackedEntity).second)
 				continue;
 
-			PackedEntity* pPackedEntity = reinterpret_cast<PackedEntity*>(pSnapshotEntry->m_pPackedData);
-			if (!pPackedEntity || !pPackedEntity->m_pChangeFrameList)
+			if (MigrateChangeFrameList(pPackedEntity, bToHolyLib))
+				++iMigrated;
+		}
+	}
+	framesnapshotmanager->m_FrameSnapshotsWriteMutex.Unlock();
+
+	for (int i=0; i<MAX_EDICTS; ++i)
+	{
+		PackedEntity* pPackedEntity = reinterpret_cast<PackedEntity*>(framesnapshotmanager->m_pPackedData[i]);
+		if (!pPackedEntity || !pVisited.insert(pPackedEntity).second)
+			continue;
+
+		if (MigrateChangeFrameList(pPackedEntity, bToHolyLib))
+			++iMigrated;
+	}
+
+	if (g_pNetworkingModule.InDebug())
+		Msg("holylib: Converted %i change lists to %s ones\n", iMigrated, bToHolyLib ? "HolyLib" : "engine");
+}
+
+static void OnChangeFramesChange(IConVar* convar, const char* pOldValue, float flOldValue)
+{
+	bool bEnabled = ((ConVar*)convar)->GetBool();
+	if (bEnabled == (flOldValue != 0) || !detour_AllocChangeFrameList.IsEnabled())
+		return;
+
+	MigrateChangeFrameLists(bEnabled);
+	if (!bEnabled)
+		Msg("holylib: Switched to the engine's change lists (%i HolyLib lists are still alive)\n", GetLiveChangeFrameLists());
+	else
+		Msg("holylib: Switched to HolyLib's change lists\n");
+}
+
+static Detouring::Hook detour_CFrameSnapshotManager_RemoveEntityReference;
+static void hook_CFrameSnapshotManager_RemoveEntityReference(CFrameSnapshotManager* pManager, PackedEntityHandle_t handle)
+{
+	PackedEntity* pPackedEntity = reinterpret_cast<PackedEntity*>(handle);
+	if (pPackedEntity && pPackedEntity->m_ReferenceCount <= 1) // It's freed now, so it can't stay in our cache.
+		RemoveUnpackedCacheEntry(pPackedEntity);
+
+	detour_CFrameSnapshotManager_RemoveEntityReference.GetTrampoline<Symbols::CFrameSnapshotManager_RemoveEntityReference>()(pManager, handle);
+}
+
+static Detouring::Hook detour_CFrameSnapshotManager_GetCachedUncompressedEntity;
+static UnpackedDataCache_t* hook_CFrameSnapshotManager_GetCachedUncompressedEntity(CFrameSnapshotManager* pManager, PackedEntity* pPackedEntity)
+{
+	VPROF_BUDGET("CFrameSnapshotManager::GetCachedUncompressedEntity", VPROF_BUDGETGROUP_OTHER_NETWORKING);
+
+	UnpackedDataCache_t* pData = GetUnpackedCacheEntry(pPackedEntity);
+	if (pData)
+		return pData;
+
+	pData = (UnpackedDataCache_t*)detour_CFrameSnapshotManager_GetCachedUncompressedEntity.GetTrampoline<Symbols::CFrameSnapshotManager_GetCachedUncompressedEntity>()(pManager, pPackedEntity);
+
+	g_pUnpackedCacheMutex.Lock();
+	if (pData->bits == -1)
+		++g_iUnpackedCacheMisses;
+	else
+		++g_iUnpackedCacheHits;
+	g_pUnpackedCacheMutex.Unlock();
+
+	return pData;
+}
+
+struct SnapshotClassStats
+{
+	int iCount = 0;
+	uint64 iBytes = 0;
+	int iMaxBytes = 0;
+};
+
+/*
+ * Only the PackedEntities referenced by snapshots are sorted into classes
+ * since m_pServerClass of an entry in m_pPackedData can be overwritten by the memory pool.
+ */
+LUA_FUNCTION_STATIC(networking_GetSnapshotStats)
+{
+	if (!framesnapshotmanager)
+		LUA->ThrowError("Failed to find framesnapshotmanager!");
+
+	int iSnapshots = 0;
+	int iSnapshotEntities = 0;
+	uint64 iPackedBytes = 0;
+	std::unordered_set<PackedEntity*> pVisited;
+	std::unordered_map<ServerClass*, SnapshotClassStats> pClasses;
+	framesnapshotmanager->m_FrameSnapshotsWriteMutex.Lock();
+	FOR_EACH_LL(framesnapshotmanager->m_FrameSnapshots, iSnapshot)
+	{
+		CFrameSnapshot* pSnapshot = framesnapshotmanager->m_FrameSnapshots[iSnapshot];
+		++iSnapshots;
+		iSnapshotEntities += pSnapshot->m_nNumEntities;
+		for (int i=0; i<pSnapshot->m_nNumEntities; ++i)
+		{
+			CFrameSnapshotEntry& pEntry = pSnapshot->m_pEntities[i];
+			PackedEntity* pPackedEntity = reinterpret_cast<PackedEntity*>(pEntry.m_pPackedData);
+			if (!pPackedEntity || !pEntry.m_pClass || !pVisited.insert(pPackedEntity).second)
 				continue;
 
-			pPackedEntity->m_pChangeFrameList->Release();
-			pPackedEntity->m_pChangeFrameList = detour_AllocChangeFrameList.GetTrampoline<Symbols::AllocChangeFrameList>()(pPackedEntity->m_pServerClass->m_pTable->m_pPrecalc->m_Props.Count(), gpGlobals->tickcount);
+			int iBytes = pPackedEntity->GetNumBytes();
+			SnapshotClassStats& pStats = pClasses[pEntry.m_pClass];
+			++pStats.iCount;
+			pStats.iBytes += iBytes;
+			pStats.iMaxBytes = MAX(pStats.iMaxBytes, iBytes);
+			iPackedBytes += iBytes;
 		}
 	}
+	framesnapshotmanager->m_FrameSnapshotsWriteMutex.Unlock();
 
-	// ToDo: Fix this crash. pPackedEntity will be invalid and it crashes when trying to access it's member.
+	int iLastSent = 0;
 	for (int i=0; i<MAX_EDICTS; ++i)
 	{
 		PackedEntity* pPackedEntity = reinterpret_cast<PackedEntity*>(framesnapshotmanager->m_pPackedData[i]);
-		if (!pPackedEntity || !pPackedEntity->m_pChangeFrameList)
-			continue;
+		if (pPackedEntity && pPackedEntity->GetData()) // A freed PackedEntity has no data anymore.
+			++iLastSent;
+	}
 
-		pPackedEntity->m_pChangeFrameList->Release();
-		pPackedEntity->m_pChangeFrameList = detour_AllocChangeFrameList.GetTrampoline<Symbols::AllocChangeFrameList>()(pPackedEntity->m_pServerClass->m_pTable->m_pPrecalc->m_Props.Count(), gpGlobals->tickcount);
-	}*/
-}
\ No newline at end of file
+	LUA->CreateTable();
+		Util::SetStatsField(LUA, "snapshots", (double)iSnapshots);
+		Util::SetStatsField(LUA, "snapshotEntities", (double)iSnapshotEntities);
+		Util::SetStatsField(LUA, "packedEntities", (double)pVisited.size());
+		Util::SetStatsField(LUA, "packedBytes", (double)iPackedBytes);
+		Util::SetStatsField(LUA, "lastSentEntities", (double)iLastSent);
+
+		LUA->CreateTable();
+			Util::SetStatsField(LUA, "count", (double)framesnapshotmanager->m_PackedEntitiesPool.Count());
+			Util::SetStatsField(LUA, "peak", (double)framesnapshotmanager->m_PackedEntitiesPool.PeakCount());
+			Util::SetStatsField(LUA, "blockSize", (double)framesnapshotmanager->m_PackedEntitiesPool.BlockSize());
+		LUA->SetField(-2, "pool");
+
+		LUA->CreateTable();
+		for (auto& [pClass, pStats] : pClasses)
+		{
+			LUA->CreateTable();
+				Util::SetStatsField(LUA, "count", (double)pStats.iCount);
+				Util::SetStatsField(LUA, "bytes", (double)pStats.iBytes);
+				Util::SetStatsField(LUA, "averageBytes", (double)pStats.iBytes / pStats.iCount);
+				Util::SetStatsField(LUA, "maxBytes", (double)pStats.iMaxBytes);
+			LUA->SetField(-2, pClass->m_pNetworkName);
+		}
+		LUA->SetField(-2, "classes");
+
+		g_pUnpackedCacheMutex.Lock();
+		LUA->CreateTable();
+			Util::SetStatsField(LUA, "size", (double)(g_pUnpackedCache.empty() ? framesnapshotmanager->m_PackedEntityCache.Count() : (int)g_pUnpackedCache.size()));
+			Util::SetStatsField(LUA, "used", (double)g_pUnpackedCacheEntries.size());
+			Util::SetStatsField(LUA, "hits", (double)g_iUnpackedCacheHits);
+			Util::SetStatsField(LUA, "misses", (double)g_iUnpackedCacheMisses);
+			LUA->PushBool(!g_pUnpackedCache.empty());
+			LUA->SetField(-2, "holylib");
+		LUA->SetField(-2, "unpackedCache");
+		g_pUnpackedCacheMutex.Unlock();
+
+		g_pChangeFramePoolMutex.Lock();
+		int iLive = 0;
+		uint64 iHits = 0, iMisses = 0;
+		for (auto& [nProps, pClass] : g_pChangeFramePool)
+		{
+			iLive += pClass.iLive;
+			iHits += pClass.iHits;
+			iMisses += pClass.iMisses;
+		}
+
+		LUA->CreateTable();
+			Util::SetStatsField(LUA, "live", (double)iLive);
+			Util::SetStatsField(LUA, "free", (double)g_iPooledChangeFrames);
+			Util::SetStatsField(LUA, "hits", (double)iHits);
+			Util::SetStatsField(LUA, "misses", (double)iMisses);
+		LUA->SetField(-2, "changeFrames");
+		g_pChangeFramePoolMutex.Unlock();
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC(networking_ResetSnapshotStats)
+{
+	g_pUnpackedCacheMutex.Lock();
+	g_iUnpackedCacheHits = 0;
+	g_iUnpackedCacheMisses = 0;
+	g_pUnpackedCacheMutex.Unlock();
+
+	return 0;
+}
+
+void CNetworkingModule::LuaInit(bool bServerInit)
+{
+	if (bServerInit)
+		return;
+
+	Util::StartTable();
+		Util::AddFunc(networking_GetSnapshotStats, "GetSnapshotStats");
+		Util::AddFunc(networking_ResetSnapshotStats, "ResetSnapshotStats");
+	Util::FinishTable("networking");
+}
+
+void CNetworkingModule::LuaShutdown()
+{
+	Util::NukeTable("networking");
+}
+
+void CNetworkingModule::Think(bool bSimulating)
+{
+	int iSize = networking_unpackedcachesize.GetInt();
+	if (!detour_CFrameSnapshotManager_RemoveEntityReference.IsEnabled()) // Without it we wouldn't know when an entry becomes invalid.
+		iSize = 0;
+
+	g_pUnpackedCacheMutex.Lock();
+	++g_iUnpackedCacheFrame; // Nothing uses the entries between frames, so we can unpin them.
+	if ((int)g_pUnpackedCache.size() != iSize)
+		ResetUnpackedCache(iSize);
+	g_pUnpackedCacheMutex.Unlock();
+}
+
+void CNetworkingModule::LevelShutdown()
+{
+	g_pUnpackedCacheMutex.Lock();
+	ResetUnpackedCache(0); // All PackedEntities are freed on a level change.
+	g_pUnpackedCacheMutex.Unlock();
+}
+
+void CNetworkingModule::InitDetour(bool bPreServer)
+{
+	if (bPreServer)
+		return;
+
+	SourceSDK::FactoryLoader engine_loader("engine");
+	Detour::Create(
+		&detour_AllocChangeFrameList, "AllocChangeFrameList",
+		engine_loader.GetModule(), Symbols::AllocChangeFrameListSym,
+		(void*)hook_AllocChangeFrameList, m_pID
+	);
+
+	Detour::Create(
+		&detour_CFrameSnapshotManager_GetCachedUncompressedEntity, "CFrameSnapshotManager::GetCachedUncompressedEntity",
+		engine_loader.GetModule(), Symbols::CFrameSnapshotManager_GetCachedUncompressedEntitySym,
+		(void*)hook_CFrameSnapshotManager_GetCachedUncompressedEntity, m_pID
+	);
+
+	Detour::Create(
+		&detour_CFrameSnapshotManager_RemoveEntityReference, "CFrameSnapshotManager::RemoveEntityReference",
+		engine_loader.GetModule(), Symbols::CFrameSnapshotManager_RemoveEntityReferenceSym,
+		(void*)hook_CFrameSnapshotManager_RemoveEntityReference, m_pID
+	);
+
+	func_AllocChangeFrameList = (Symbols::AllocChangeFrameList)Detour::GetFunction(engine_loader.GetModule(), Symbols::AllocChangeFrameListSym);
+	Detour::CheckFunction((void*)func_AllocChangeFrameList, "AllocChangeFrameList");
+
+	framesnapshotmanager = Detour::ResolveSymbol<CFrameSnapshotManager>(engine_loader, Symbols::g_FrameSnapshotManagerSym);
+	Detour::CheckValue("get class", "framesnapshotmanager", framesnapshotmanager != NULL);
+}
+
+void CNetworkingModule::Shutdown()
+{
+	MigrateChangeFrameLists(false);
+	ClearChangeFramePool();
+
+	g_pUnpackedCacheMutex.Lock();
+	ResetUnpackedCache(0);
+	g_pUnpackedCacheMutex.Unlock();
+
+	int iLive = GetLiveChangeFrameLists();
+	if (iLive > 0)
+		Warning("holylib: %i change lists are still used by the engine. Unloading HolyLib now will crash!\n", iLive);
+}
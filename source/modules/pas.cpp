@@ -18,9 +18,9 @@ public:
 CPASModule g_pPASModule;
 IModule* pPASModule = &g_pPASModule;
 
-inline bool TestPAS(const Vector& hearPos)
+inline bool TestPAS(const Util::CVisRow& pVis, const Vector& hearPos)
 {
-	return Util::engineserver->CheckOriginInPVS(hearPos, Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster));
+	return Util::engineserver->CheckOriginInPVS(hearPos, pVis.Data(), pVis.Size());
 }
 
 LUA_FUNCTION_STATIC(pas_TestPAS)
@@ -36,26 +36,26 @@ LUA_FUNCTION_STATIC(pas_TestPAS)
 		orig = (Vector*)&ent->GetAbsOrigin(); // ToDo: This currently breaks the compile.
 	}
 
-	Util::CM_Vis(*orig, DVIS_PAS);
+	Util::CVisRow pVis = Util::CM_Vis(*orig, DVIS_PAS);
 
 	LUA->CheckType(2, GarrysMod::Lua::Type::Vector);
 	if (LUA->IsType(2, GarrysMod::Lua::Type::Vector))
 	{
-		LUA->PushBool(TestPAS(*Get_Vector(2)));
+		LUA->PushBool(TestPAS(pVis, *Get_Vector(2)));
 	} else if (Is_EntityList(2)) {
 		LUA->CreateTable();
 		EntityList* entList = Get_EntityList(2, true);
 		for (auto& [ent, ref]: entList->pEntReferences)
 		{
 			LUA->ReferencePush(ref);
-			LUA->PushBool(TestPAS(ent->GetAbsOrigin()));
+			LUA->PushBool(TestPAS(pVis, ent->GetAbsOrigin()));
 			LUA->RawSet(-3);
 		}
 	} else {
 		LUA->CheckType(2, GarrysMod::Lua::Type::Entity);
 		CBaseEntity* ent = Util::Get_Entity(2, false);
 
-		LUA->PushBool(TestPAS(ent->GetAbsOrigin()));
+		LUA->PushBool(TestPAS(pVis, ent->GetAbsOrigin()));
 	}
 
 	return 1;
@@ -67,9 +67,9 @@ LUA_FUNCTION_STATIC(pas_CheckBoxInPAS)
 	Vector* maxs = Get_Vector(2, true);
 	Vector* orig = Get_Vector(3, true);
 
-	Util::CM_Vis(*orig, DVIS_PAS);
+	Util::CVisRow pVis = Util::CM_Vis(*orig, DVIS_PAS);
 
-	LUA->PushBool(Util::engineserver->CheckBoxInPVS(*mins, *maxs, Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster)));
+	LUA->PushBool(Util::engineserver->CheckBoxInPVS(*mins, *maxs, pVis.Data(), pVis.Size()));
 	return 1;
 }
 
@@ -86,7 +86,10 @@ LUA_FUNCTION_STATIC(pas_FindInPAS)
 		orig = (Vector*)&ent->GetAbsOrigin(); // ToDo: This currently breaks the compile.
 	}
 
-	Util::CM_Vis(*orig, DVIS_PAS);
+	Util::CVisRow pVis = Util::CM_Vis(*orig, DVIS_PAS);
+
+	if (Util::pEntityList->IsEnabled() && PushEntitiesInClusters(pVis))
+		return 1;
 
 	LUA->CreateTable();
 	int idx = 0;
@@ -95,7 +98,7 @@ LUA_FUNCTION_STATIC(pas_FindInPAS)
 		UpdateGlobalEntityList();
 		for (auto& [pEnt, ref] : g_pGlobalEntityList.pEntReferences)
 		{
-			if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster)))
+			if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), pVis.Data(), pVis.Size()))
 			{
 				++idx;
 				LUA->PushNumber(idx);
@@ -111,7 +114,7 @@ LUA_FUNCTION_STATIC(pas_FindInPAS)
 	CBaseEntity* pEnt = Util::entitylist->FirstEnt();
 	while (pEnt != NULL)
 	{
-		if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster)))
+		if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), pVis.Data(), pVis.Size()))
 		{
 			++idx;
 			LUA->PushNumber(idx);
@@ -130,7 +133,7 @@ LUA_FUNCTION_STATIC(pas_FindInPAS)
 		if (!pEnt)
 			continue;
 
-		if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster)))
+		if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), pVis.Data(), pVis.Size()))
 		{
 			++idx;
 			LUA->PushNumber(idx);
@@ -8,20 +8,25 @@
 #include "iserver.h"
 #include "sourcesdk/baseclient.h"
 #include "vprof.h"
+#include <atomic>
+#include <algorithm>
 
-class CPVSModule : public IModule
+class CPVSModule : public IModule2
 {
 public:
 	virtual void Init(CreateInterfaceFn* appfn, CreateInterfaceFn* gamefn) OVERRIDE;
 	virtual void LuaInit(bool bServerInit) OVERRIDE;
 	virtual void LuaShutdown() OVERRIDE;
 	virtual void InitDetour(bool bPreServer) OVERRIDE;
+	virtual void Shutdown() OVERRIDE;
+	virtual void OnEdictFreed(const edict_t* pEdict) OVERRIDE;
+	virtual void LevelShutdown() OVERRIDE;
 	virtual const char* Name() { return "pvs"; };
 	virtual int Compatibility() { return LINUX32; };
 };
 
 static CPVSModule g_pPVSModule;
-IModule* pPVSModule = &g_pPVSModule;
+IModule2* pPVSModule = &g_pPVSModule;
 
 static ConVar pvs_postchecktransmit("holylib_pvs_postchecktransmit", "0", 0, "If enabled, it will add the HolyLib:PostCheckTransmit hook.");
 
@@ -42,12 +47,1035 @@ static void hook_CGMOD_Player_SetupVisibility(void* ent, unsigned char* pvs, int
 }
 #endif
 
-#ifdef HOLYLIB_MANUALNETWORKING
-static std::unordered_map<edict_t*, int> pOriginalFlags;
-#endif
-static std::vector<edict_t*> g_pAddEntityToPVS;
-static std::unordered_map<edict_t*, int> g_pOverrideStateFlag;
+/*
+ * The pvs thread pool is used by pvs.TestPVSBatch and holylib_pvs_paralleltransmit.
+ * It's only created when it's first needed.
+ */
+static IThreadPool* pPVSPool = NULL;
+static void OnPVSThreadsChange(IConVar* convar, const char* pOldValue, float flOldValue)
+{
+	if (!pPVSPool)
+		return;
+
+	pPVSPool->ExecuteAll();
+	pPVSPool->Stop();
+	Util::StartThreadPool(pPVSPool, ((ConVar*)convar)->GetInt());
+}
+
+static ConVar pvs_threads("holylib_pvs_threads", "0", 0, "The number of threads pvs.TestPVSBatch and holylib_pvs_paralleltransmit can use. 0 = Only the main thread", OnPVSThreadsChange);
+static ConVar pvs_paralleltransmit("holylib_pvs_paralleltransmit", "0", 0, "If enabled, HolyLib's per client transmit work is computed for all clients at once on the pvs thread pool. The CheckTransmit hooks won't be called.");
+
+static inline IThreadPool* GetPVSPool()
+{
+	if (!pPVSPool)
+	{
+		pPVSPool = V_CreateThreadPool();
+		Util::StartThreadPool(pPVSPool, pvs_threads.GetInt());
+	}
+
+	return pPVSPool;
+}
+
+/*
+ * Transmit rules
+ * Rules are registered from Lua and are applied natively after the engine decided what to transmit to a client.
+ * This way we don't need to call into Lua for every client.
+ * The "always" rules are applied first, so the "never" / "only" rules win if an entity is affected by both.
+ */
+enum TransmitRuleType
+{
+	TRANSMITRULE_ALWAYS_TEAM = 1, // Always transmit the entities to the players of a team.
+	TRANSMITRULE_NEVER_CLASS_DISTANCE = 2, // Never transmit entities of a class beyond a distance.
+	TRANSMITRULE_ONLY_LIST = 3, // Only transmit the entities to the players inside an EntityList.
+};
+
+struct TransmitRule
+{
+	int iID = 0;
+	int iType = 0;
+	std::vector<int> pEdicts; // TRANSMITRULE_ALWAYS_TEAM / TRANSMITRULE_ONLY_LIST
+	int iTeam = 0; // TRANSMITRULE_ALWAYS_TEAM
+	std::string strClassName; // TRANSMITRULE_NEVER_CLASS_DISTANCE
+	float flDistanceSqr = 0; // TRANSMITRULE_NEVER_CLASS_DISTANCE
+	EntityList* pPlayers = NULL; // TRANSMITRULE_ONLY_LIST
+	int iPlayersReference = -1; // Keeps the EntityList from being garbage collected.
+};
+
+static IPlayerInfoManager* playerinfomanager = NULL;
+static std::vector<TransmitRule*> g_pTransmitRules;
+static int g_iNextTransmitRuleID = 1;
+static bool g_bClassRulesDirty = true;
+static int g_iClassRulesTick = -1;
+struct ClassRuleEdict
+{
+	int iEdict;
+	float flDistanceSqr;
+	Vector vecOrigin; // Copied once per tick so that we don't need to touch the entity for every client.
+};
+static std::vector<ClassRuleEdict> g_pClassRuleEdicts; // Rebuilt once per tick.
+
+static void UpdateClassRuleEdicts(const unsigned short *pEdictIndices, int nEdicts)
+{
+	if (!g_bClassRulesDirty && g_iClassRulesTick == gpGlobals->tickcount)
+		return;
+
+	g_iClassRulesTick = gpGlobals->tickcount;
+	g_bClassRulesDirty = false;
+	g_pClassRuleEdicts.clear();
+
+	std::unordered_map<std::string_view, float> pClassDistances;
+	for (TransmitRule* pRule : g_pTransmitRules)
+	{
+		if (pRule->iType != TRANSMITRULE_NEVER_CLASS_DISTANCE)
+			continue;
+
+		auto it = pClassDistances.find(pRule->strClassName);
+		if (it == pClassDistances.end() || it->second > pRule->flDistanceSqr)
+			pClassDistances[pRule->strClassName] = pRule->flDistanceSqr;
+	}
+
+	if (pClassDistances.empty())
+		return;
+
+	edict_t *pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	for (int i=0; i<nEdicts; ++i)
+	{
+		edict_t *pEdict = &pBaseEdict[pEdictIndices[i]];
+		if (pEdict->IsFree())
+			continue;
+
+		auto it = pClassDistances.find(pEdict->GetClassName());
+		if (it != pClassDistances.end())
+			g_pClassRuleEdicts.push_back({pEdictIndices[i], it->second, vec3_origin});
+	}
+}
+
+static void UpdateClassRuleOrigins()
+{
+	edict_t *pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	for (ClassRuleEdict& pClassEdict : g_pClassRuleEdicts)
+	{
+		CBaseEntity* pEnt = Util::servergameents->EdictToBaseEntity(&pBaseEdict[pClassEdict.iEdict]);
+		if (pEnt)
+			pClassEdict.vecOrigin = pEnt->GetAbsOrigin();
+	}
+}
+
+/*
+ * Transmit groups
+ * A group owns a set of entities and a set of players.
+ * An entity that is inside any group is only transmitted to the players of the groups it belongs to.
+ * Moving a player between groups only flips a bit, the masks are applied word wide in the CheckTransmit detour.
+ */
+struct TransmitGroup
+{
+	CBitVec<MAX_EDICTS> pEntities;
+	CBitVec<ABSOLUTE_PLAYER_LIMIT + 1> pPlayers; // Indexed by the player's edict index.
+};
+static std::unordered_map<std::string, TransmitGroup*> g_pTransmitGroups;
+static CBitVec<MAX_EDICTS> g_pGroupedEntities; // All entities that are in at least one group.
+static bool g_bTransmitGroupsDirty = false;
+
+static void UpdateGroupedEntities()
+{
+	if (!g_bTransmitGroupsDirty)
+		return;
+
+	g_bTransmitGroupsDirty = false;
+	g_pGroupedEntities.ClearAll();
+	uint32* pGrouped = g_pGroupedEntities.Base();
+	for (auto& [strName, pGroup] : g_pTransmitGroups)
+	{
+		const uint32* pEntities = pGroup->pEntities.Base();
+		for (int i = 0; i < g_pGroupedEntities.GetNumDWords(); ++i)
+			pGrouped[i] |= pEntities[i];
+	}
+}
+
+/*
+ * Transmit LOD
+ * LOD entities always stay in the transmit set. Removing them would make them dormant on the client and resending them costs more than it saves.
+ * Instead we hold back their changes: If an entity is further away from every client than the LOD's distance,
+ * FL_EDICT_CHANGED is cleared before the entities are packed, so the engine reuses the last packed entity and sends no delta for it.
+ * The held back changes are given back every Nth tick, limited by holylib_pvs_lodbudget which keeps the updates with the highest priority.
+ * The priority is based on the distance, the speed and for how long the changes were held back.
+ * Entities are packed once for all clients, which is why an entity is only held back if no client is near it.
+ */
+static ConVar pvs_lodbudget("holylib_pvs_lodbudget", "0", 0, "The max number of bytes (estimated) of held back LOD entity updates that are sent per tick. 0 = No limit");
+
+#define TRANSMITLOD_BYTESPERPROP 4 // Rough size of a changed prop inside a delta.
+#define TRANSMITLOD_FULLPROPS (MAX_CHANGE_OFFSETS + 1) // The engine stops tracking the offsets after MAX_CHANGE_OFFSETS.
+#define TRANSMITLOD_CHANGEFLAGS (FL_EDICT_CHANGED | FL_FULL_EDICT_CHANGED)
+
+struct TransmitLOD
+{
+	float flDistanceSqr = 0;
+	int iInterval = 1;
+};
+static std::unordered_map<std::string, TransmitLOD> g_pClassTransmitLODs;
+static std::unordered_map<int, TransmitLOD> g_pEntityTransmitLODs; // Indexed by the edict index. These override the class LODs.
+static bool g_bTransmitLODsDirty = false;
+static int g_iTransmitLODsTick = -1;
+static int g_iTransmitLODsAppliedTick = -1;
+
+struct LODEdict
+{
+	int iEdict;
+	float flDistanceSqr;
+	int iInterval;
+	Vector vecOrigin;
+	float flSpeed;
+};
+static std::vector<LODEdict> g_pLODEdicts; // Rebuilt once per tick.
+
+struct LODHistory
+{
+	int iTick = -1;
+	Vector vecOrigin;
+	float flSpeed = 0;
+};
+static LODHistory g_pLODHistory[MAX_EDICTS]; // Used to get the speed without touching the entity's physics.
+
+static CBitVec<MAX_EDICTS> g_pLODHeldSet; // Entities which have changes we held back.
+static int g_pLODHeldTick[MAX_EDICTS]; // The tick we started to hold back the changes.
+
+struct LODCandidate
+{
+	float flPriority;
+	int iEdict;
+	int iBytes;
+};
+static std::vector<LODCandidate> g_pLODCandidates; // Scratch space for ApplyTransmitLODs.
+static std::vector<Vector> g_pLODClientOrigins; // Scratch space for ApplyTransmitLODs.
+
+static inline bool HasTransmitLODs()
+{
+	return !g_pClassTransmitLODs.empty() || !g_pEntityTransmitLODs.empty();
+}
+
+static void UpdateLODEdicts(const unsigned short *pEdictIndices, int nEdicts)
+{
+	if (!g_bTransmitLODsDirty && g_iTransmitLODsTick == gpGlobals->tickcount)
+		return;
+
+	g_iTransmitLODsTick = gpGlobals->tickcount;
+	g_bTransmitLODsDirty = false;
+	g_pLODEdicts.clear();
+	if (!HasTransmitLODs())
+		return;
+
+	edict_t *pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	for (int i=0; i<nEdicts; ++i)
+	{
+		int iEdict = pEdictIndices[i];
+		edict_t *pEdict = &pBaseEdict[iEdict];
+		if (pEdict->IsFree())
+			continue;
+
+		const TransmitLOD* pLOD = NULL;
+		auto it = g_pEntityTransmitLODs.find(iEdict);
+		if (it != g_pEntityTransmitLODs.end())
+		{
+			pLOD = &it->second;
+		} else if (!g_pClassTransmitLODs.empty()) {
+			auto it2 = g_pClassTransmitLODs.find(pEdict->GetClassName());
+			if (it2 != g_pClassTransmitLODs.end())
+				pLOD = &it2->second;
+		}
+
+		if (!pLOD)
+			continue;
+
+		CBaseEntity* pEnt = Util::servergameents->EdictToBaseEntity(pEdict);
+		if (!pEnt)
+			continue;
+
+		const Vector& vecOrigin = pEnt->GetAbsOrigin();
+		LODHistory& pHistory = g_pLODHistory[iEdict];
+		if (pHistory.iTick != gpGlobals->tickcount)
+		{
+			if (pHistory.iTick != -1 && pHistory.iTick < gpGlobals->tickcount)
+				pHistory.flSpeed = vecOrigin.DistTo(pHistory.vecOrigin) / ((gpGlobals->tickcount - pHistory.iTick) * gpGlobals->interval_per_tick);
+
+			pHistory.iTick = gpGlobals->tickcount;
+			pHistory.vecOrigin = vecOrigin;
+		}
+
+		g_pLODEdicts.push_back({iEdict, pLOD->flDistanceSqr, pLOD->iInterval, vecOrigin, pHistory.flSpeed});
+	}
+}
+
+static inline void HoldLODEdict(edict_t* pEdict, int iEdict)
+{
+	if (!g_pLODHeldSet.IsBitSet(iEdict))
+	{
+		g_pLODHeldSet.Set(iEdict);
+		g_pLODHeldTick[iEdict] = gpGlobals->tickcount;
+	}
+
+	pEdict->m_fStateFlags &= ~TRANSMITLOD_CHANGEFLAGS;
+}
+
+/*
+ * Gives the held back changes to the engine.
+ * The change offsets of the held back ticks are gone, so the engine has to compare the full entity.
+ */
+static inline void ReleaseLODEdict(edict_t* pEdict, int iEdict)
+{
+	if (!g_pLODHeldSet.IsBitSet(iEdict))
+		return;
+
+	g_pLODHeldSet.Clear(iEdict);
+	if (!pEdict->IsFree())
+		pEdict->m_fStateFlags |= TRANSMITLOD_CHANGEFLAGS;
+}
+
+static void ReleaseAllLODEdicts()
+{
+	edict_t* pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	uint32* pHeld = g_pLODHeldSet.Base();
+	for (int i = 0; i < g_pLODHeldSet.GetNumDWords(); ++i)
+	{
+		if (pHeld[i] == 0)
+			continue;
+
+		for (int iBit = 0; iBit < 32; ++iBit)
+			if (pHeld[i] & (1u << iBit))
+				ReleaseLODEdict(&pBaseEdict[(i << 5) + iBit], (i << 5) + iBit);
+	}
+}
+
+static inline int EstimateLODUpdateBytes(edict_t* pEdict, bool bHeld)
+{
+	if (bHeld || (pEdict->m_fStateFlags & FL_FULL_EDICT_CHANGED))
+		return TRANSMITLOD_FULLPROPS * TRANSMITLOD_BYTESPERPROP;
+
+	IChangeInfoAccessor* pAccessor = Util::engineserver->GetChangeAccessor(pEdict);
+	CSharedEdictChangeInfo* pSharedInfo = Util::engineserver->GetSharedEdictChangeInfo();
+	if (!pAccessor || !pSharedInfo || pAccessor->GetChangeInfoSerialNumber() != pSharedInfo->m_iSerialNumber)
+		return TRANSMITLOD_FULLPROPS * TRANSMITLOD_BYTESPERPROP;
+
+	return MAX(pSharedInfo->m_ChangeInfos[pAccessor->GetChangeInfo()].m_nChangeOffsets, 1) * TRANSMITLOD_BYTESPERPROP;
+}
+
+/*
+ * Per client transmit state
+ * HolyLib's own per client work is split into three steps:
+ * - Prepare (main thread): Copies everything that is needed from the entities. Only this step may touch entities / call the engine.
+ * - Compute (any thread): Builds the set of entities to remove for one client. It only reads the prepared data, the rules
+ *   and the EntityLists of the rules, which aren't modified while the main thread is waiting for the jobs.
+ * - Commit (main thread, inside the client's CheckTransmit call): Applies the result to the client's transmit bits.
+ * Normally everything is done inside the client's CheckTransmit call.
+ * With holylib_pvs_paralleltransmit the first CheckTransmit call of a tick prepares & computes all clients at once on the pvs thread pool.
+ */
+struct ClientTransmitState
+{
+	int iTick = -1; // The tick in which the state was computed.
+	int iClientEdict = 0;
+	int iTeam = -1;
+	Vector vecOrigin;
+	bool bRemove = false; // Skips the commit if nothing is removed.
+	CBitVec<MAX_EDICTS> pRemove;
+	CBitVec<MAX_EDICTS> pGroupAllowed; // Scratch space for the transmit groups, so that every job has its own.
+};
+static ClientTransmitState g_pClientTransmitStates[ABSOLUTE_PLAYER_LIMIT + 1]; // Indexed by the client's edict index.
+static int g_iPreparedTransmitTick = -1;
+
+static inline bool HasClientTransmitWork()
+{
+	return !g_pTransmitRules.empty() || !g_pTransmitGroups.empty() || HasTransmitLODs();
+}
+
+static void PrepareTransmitTick(const unsigned short *pEdictIndices, int nEdicts)
+{
+	UpdateGroupedEntities();
+	if (g_iPreparedTransmitTick == gpGlobals->tickcount && !g_bClassRulesDirty && !g_bTransmitLODsDirty)
+		return;
+
+	g_iPreparedTransmitTick = gpGlobals->tickcount;
+	UpdateClassRuleEdicts(pEdictIndices, nEdicts);
+	UpdateClassRuleOrigins();
+	UpdateLODEdicts(pEdictIndices, nEdicts);
+}
+
+static ClientTransmitState* PrepareClientTransmitState(edict_t* pClientEdict)
+{
+	int iClientEdict = pClientEdict->m_EdictIndex;
+	if (iClientEdict <= 0 || iClientEdict > ABSOLUTE_PLAYER_LIMIT)
+		return NULL;
+
+	ClientTransmitState& pState = g_pClientTransmitStates[iClientEdict];
+	pState.iClientEdict = iClientEdict;
+	IPlayerInfo* pPlayerInfo = playerinfomanager ? playerinfomanager->GetPlayerInfo(pClientEdict) : NULL;
+	pState.iTeam = pPlayerInfo ? pPlayerInfo->GetTeamIndex() : -1;
+	CBaseEntity* pClientEnt = Util::servergameents->EdictToBaseEntity(pClientEdict);
+	pState.vecOrigin = pClientEnt ? pClientEnt->GetAbsOrigin() : vec3_origin;
+
+	return &pState;
+}
+
+static void ComputeClientTransmitState(ClientTransmitState* pState)
+{
+	if (pState->bRemove)
+		pState->pRemove.ClearAll();
+
+	pState->bRemove = false;
+	for (TransmitRule* pRule : g_pTransmitRules)
+	{
+		if (pRule->iType != TRANSMITRULE_ONLY_LIST)
+			continue;
+
+		if (pRule->pPlayers && pRule->pPlayers->pEdictHash.find(pState->iClientEdict) != pRule->pPlayers->pEdictHash.end())
+			continue;
+
+		for (int iEdict : pRule->pEdicts)
+			pState->pRemove.Set(iEdict);
+
+		pState->bRemove = pState->bRemove || !pRule->pEdicts.empty();
+	}
+
+	for (ClassRuleEdict& pClassEdict : g_pClassRuleEdicts)
+	{
+		if (pClassEdict.vecOrigin.DistToSqr(pState->vecOrigin) > pClassEdict.flDistanceSqr)
+		{
+			pState->pRemove.Set(pClassEdict.iEdict);
+			pState->bRemove = true;
+		}
+	}
+
+	if (!g_pTransmitGroups.empty())
+	{
+		pState->pGroupAllowed.ClearAll();
+		uint32* pAllowed = pState->pGroupAllowed.Base();
+		for (auto& [strName, pGroup] : g_pTransmitGroups)
+		{
+			if (!pGroup->pPlayers.IsBitSet(pState->iClientEdict))
+				continue;
+
+			const uint32* pEntities = pGroup->pEntities.Base();
+			for (int i = 0; i < pState->pGroupAllowed.GetNumDWords(); ++i)
+				pAllowed[i] |= pEntities[i];
+		}
+
+		pAllowed[pState->iClientEdict >> 5] |= 1u << (pState->iClientEdict & 31); // Never remove the client's own entity.
+
+		uint32* pRemove = pState->pRemove.Base();
+		const uint32* pGrouped = g_pGroupedEntities.Base();
+		uint32 iAnyRemoved = 0;
+		for (int i = 0; i < pState->pRemove.GetNumDWords(); ++i)
+		{
+			uint32 iRemove = pGrouped[i] & ~pAllowed[i];
+			pRemove[i] |= iRemove;
+			iAnyRemoved |= iRemove;
+		}
+
+		pState->bRemove = pState->bRemove || iAnyRemoved != 0;
+	}
+
+	pState->iTick = gpGlobals->tickcount;
+}
+
+static void CommitClientTransmitState(CCheckTransmitInfo *pInfo, ClientTransmitState* pState)
+{
+	edict_t *pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	for (TransmitRule* pRule : g_pTransmitRules)
+	{
+		if (pRule->iType != TRANSMITRULE_ALWAYS_TEAM || pRule->iTeam != pState->iTeam)
+			continue;
+
+		for (int iEdict : pRule->pEdicts)
+		{
+			CBaseEntity* pEnt = Util::servergameents->EdictToBaseEntity(&pBaseEdict[iEdict]);
+			if (pEnt)
+				pEnt->SetTransmit(pInfo, true);
+		}
+	}
+
+	if (!pState->bRemove)
+		return;
+
+	uint32* pTransmit = pInfo->m_pTransmitEdict->Base();
+	uint32* pTransmitAlways = pInfo->m_pTransmitAlways ? pInfo->m_pTransmitAlways->Base() : NULL;
+	const uint32* pRemove = pState->pRemove.Base();
+	for (int i = 0; i < pState->pRemove.GetNumDWords(); ++i)
+	{
+		pTransmit[i] &= ~pRemove[i];
+		if (pTransmitAlways)
+			pTransmitAlways[i] &= ~pRemove[i];
+	}
+}
+
+static void ClientTransmitJobFunc(ClientTransmitState* pState)
+{
+	ComputeClientTransmitState(pState);
+}
+
+static void CollectClientTransmitStates(std::vector<ClientTransmitState*>& pStates)
+{
+	for (CBaseClient* pClient : Util::GetClients())
+	{
+		if (!pClient->IsActive())
+			continue;
+
+		edict_t* pClientEdict = Util::engineserver->PEntityOfEntIndex(pClient->GetPlayerSlot() + 1);
+		ClientTransmitState* pState = pClientEdict ? PrepareClientTransmitState(pClientEdict) : NULL;
+		if (pState)
+			pStates.push_back(pState);
+	}
+}
+
+static void ComputeClientTransmitStates(const std::vector<ClientTransmitState*>& pStates, bool bParallel)
+{
+	if (!bParallel || pStates.size() <= 1)
+	{
+		for (ClientTransmitState* pState : pStates)
+			ComputeClientTransmitState(pState);
+
+		return;
+	}
+
+	IThreadPool* pPool = GetPVSPool();
+	std::vector<CJob*> pJobs;
+	pJobs.reserve(pStates.size() - 1);
+	for (size_t i = 1; i < pStates.size(); ++i)
+		pJobs.push_back(pPool->QueueCall(ClientTransmitJobFunc, pStates[i]));
+
+	ComputeClientTransmitState(pStates[0]);
+	for (CJob* pJob : pJobs)
+		pJob->WaitForFinishAndRelease();
+}
+
+static void ComputeAllClientTransmitStates()
+{
+	VPROF_BUDGET("HolyLib - ComputeAllClientTransmitStates", VPROF_BUDGETGROUP_OTHER_NETWORKING);
+
+	std::vector<ClientTransmitState*> pStates;
+	CollectClientTransmitStates(pStates);
+	ComputeClientTransmitStates(pStates, pvs_threads.GetInt() > 0);
+}
+
+/*
+ * Compares computing the transmit states of all clients on the main thread and on the pvs thread pool
+ * using the rules, groups and prepared data of the last tick.
+ */
+static void BenchmarkParallelTransmitCmd(const CCommand &args)
+{
+	int iIterations = args.ArgC() > 1 ? atoi(args.Arg(1)) : 1000;
+	if (iIterations <= 0)
+	{
+		Msg("Usage: holylib_pvs_benchmarkparalleltransmit <iterations = 1000>\n");
+		return;
+	}
+
+	if (pvs_threads.GetInt() <= 0)
+	{
+		Msg("holylib_pvs_threads is 0, so there is nothing to compare against.\n");
+		return;
+	}
+
+	if (g_iPreparedTransmitTick == -1 || !HasClientTransmitWork())
+	{
+		Msg("There is no transmit work yet. Add transmit rules / groups / LODs and let the server run a tick with clients.\n");
+		return;
+	}
+
+	std::vector<ClientTransmitState*> pStates;
+	CollectClientTransmitStates(pStates);
+	if (pStates.empty())
+	{
+		Msg("There are no active clients.\n");
+		return;
+	}
+
+	double flStart = Plat_FloatTime();
+	for (int i = 0; i < iIterations; ++i)
+		ComputeClientTransmitStates(pStates, false);
+	double flSerial = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for (int i = 0; i < iIterations; ++i)
+		ComputeClientTransmitStates(pStates, true);
+	double flParallel = Plat_FloatTime() - flStart;
+
+	Msg("---- Parallel transmit benchmark (%i clients, %i threads, %i iterations) ----\n", (int)pStates.size(), pvs_threads.GetInt(), iIterations);
+	Msg("main thread: %.3fms (%.2f us/tick)\n", flSerial * 1000, flSerial * 1000000 / iIterations);
+	Msg("parallel:    %.3fms (%.2f us/tick)\n", flParallel * 1000, flParallel * 1000000 / iIterations);
+	Msg("---- End of Parallel transmit benchmark ----\n");
+}
+static ConCommand benchmarkparalleltransmit("holylib_pvs_benchmarkparalleltransmit", BenchmarkParallelTransmitCmd, "Compares computing the transmit states of all clients on the main thread and on the pvs threads [iterations=1000]", 0);
+
+static void ApplyClientTransmitState(CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts)
+{
+	if (!HasClientTransmitWork())
+		return;
+
+	VPROF_BUDGET("HolyLib - ApplyClientTransmitState", VPROF_BUDGETGROUP_OTHER_NETWORKING);
+
+	int iClientEdict = pInfo->m_pClientEnt->m_EdictIndex;
+	if (iClientEdict <= 0 || iClientEdict > ABSOLUTE_PLAYER_LIMIT)
+		return;
+
+	ClientTransmitState* pState = &g_pClientTransmitStates[iClientEdict];
+	if (pvs_paralleltransmit.GetBool())
+	{
+		if (g_iPreparedTransmitTick != gpGlobals->tickcount || g_bClassRulesDirty || g_bTransmitGroupsDirty || g_bTransmitLODsDirty)
+		{
+			PrepareTransmitTick(pEdictIndices, nEdicts);
+			ComputeAllClientTransmitStates();
+		}
+
+		if (pState->iTick != gpGlobals->tickcount) // The client wasn't active yet when we computed everything.
+		{
+			PrepareClientTransmitState(pInfo->m_pClientEnt);
+			ComputeClientTransmitState(pState);
+		}
+	} else {
+		PrepareTransmitTick(pEdictIndices, nEdicts);
+		PrepareClientTransmitState(pInfo->m_pClientEnt);
+		ComputeClientTransmitState(pState);
+	}
+
+	CommitClientTransmitState(pInfo, pState);
+}
+
+/*
+ * Decides which LOD entities are held back this tick. Called once per tick after a CheckTransmit call,
+ * since the entities are packed after every client's CheckTransmit call.
+ * It's called after RestoreOverrideStateFlags so that our flags aren't overwritten.
+ */
+static void ApplyTransmitLODs()
+{
+	if (g_iTransmitLODsAppliedTick == gpGlobals->tickcount || g_pLODEdicts.empty())
+		return;
+
+	VPROF_BUDGET("HolyLib - ApplyTransmitLODs", VPROF_BUDGETGROUP_OTHER_NETWORKING);
+
+	g_iTransmitLODsAppliedTick = gpGlobals->tickcount;
+	g_pLODClientOrigins.clear();
+	for (CBaseClient* pClient : Util::GetClients())
+	{
+		if (!pClient->IsActive())
+			continue;
+
+		CBaseEntity* pClientEnt = Util::servergameents->EdictToBaseEntity(Util::engineserver->PEntityOfEntIndex(pClient->GetPlayerSlot() + 1));
+		if (pClientEnt)
+			g_pLODClientOrigins.push_back(pClientEnt->GetAbsOrigin());
+	}
+
+	int iBudget = pvs_lodbudget.GetInt();
+	edict_t* pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	g_pLODCandidates.clear();
+	for (const LODEdict& pLODEdict : g_pLODEdicts)
+	{
+		edict_t* pEdict = &pBaseEdict[pLODEdict.iEdict];
+		bool bHeld = g_pLODHeldSet.IsBitSet(pLODEdict.iEdict);
+		if (!bHeld && !(pEdict->m_fStateFlags & TRANSMITLOD_CHANGEFLAGS))
+			continue; // Nothing changed, so there is nothing to send.
+
+		float flNearestSqr = FLT_MAX;
+		for (const Vector& vecOrigin : g_pLODClientOrigins)
+			flNearestSqr = MIN(flNearestSqr, pLODEdict.vecOrigin.DistToSqr(vecOrigin));
+
+		if (flNearestSqr <= pLODEdict.flDistanceSqr)
+		{
+			ReleaseLODEdict(pEdict, pLODEdict.iEdict); // A client is close to it.
+			continue;
+		}
+
+		if (((gpGlobals->tickcount + pLODEdict.iEdict) % pLODEdict.iInterval) != 0) // Offset by the edict so that not all entities are sent in the same tick.
+		{
+			HoldLODEdict(pEdict, pLODEdict.iEdict);
+			continue;
+		}
+
+		if (iBudget <= 0)
+		{
+			ReleaseLODEdict(pEdict, pLODEdict.iEdict);
+			continue;
+		}
+
+		float flHeldIntervals = bHeld ? (float)(gpGlobals->tickcount - g_pLODHeldTick[pLODEdict.iEdict]) / pLODEdict.iInterval : 0.0f;
+		float flPriority = (1.0f + pLODEdict.flSpeed * 0.01f) * (1.0f + flHeldIntervals) / sqrtf(flNearestSqr);
+		g_pLODCandidates.push_back({flPriority, pLODEdict.iEdict, EstimateLODUpdateBytes(pEdict, bHeld)});
+	}
+
+	if (g_pLODCandidates.empty())
+		return;
+
+	std::sort(g_pLODCandidates.begin(), g_pLODCandidates.end(), [](const LODCandidate& a, const LODCandidate& b) {
+		return a.flPriority > b.flPriority;
+	});
+
+	int iBytes = 0;
+	for (const LODCandidate& pCandidate : g_pLODCandidates)
+	{
+		edict_t* pEdict = &pBaseEdict[pCandidate.iEdict];
+		if (iBytes == 0 || iBytes + pCandidate.iBytes <= iBudget) // Always send one, else an update bigger than the budget would never be sent.
+		{
+			ReleaseLODEdict(pEdict, pCandidate.iEdict);
+			iBytes += pCandidate.iBytes;
+		} else {
+			HoldLODEdict(pEdict, pCandidate.iEdict);
+		}
+	}
+}
+
+/*
+ * Per snapshot state
+ * pvs.AddEntityToPVS and pvs.OverrideStateFlags are only valid for the next CheckTransmit call.
+ * Everything is stored in flat arrays indexed by the edict index, plus a list of the touched edicts,
+ * so applying & restoring is O(changed) and doesn't allocate anything per snapshot.
+ */
+static CBitVec<MAX_EDICTS> g_pAddEntityToPVSSet;
+static std::vector<int> g_pAddEntityToPVS;
+static CBitVec<MAX_EDICTS> g_pOverrideStateFlagSet;
+static std::vector<int> g_pOverrideStateFlagEdicts;
+static int g_pOverrideStateFlags[MAX_EDICTS];
+static int g_pOriginalStateFlags[MAX_EDICTS];
+
+static inline void AddEdictToPVS(int iEdict)
+{
+	if (g_pAddEntityToPVSSet.IsBitSet(iEdict))
+		return;
+
+	g_pAddEntityToPVSSet.Set(iEdict);
+	g_pAddEntityToPVS.push_back(iEdict);
+}
+
+static inline void SetEdictOverrideStateFlags(int iEdict, int iFlags)
+{
+	if (!g_pOverrideStateFlagSet.IsBitSet(iEdict))
+	{
+		g_pOverrideStateFlagSet.Set(iEdict);
+		g_pOverrideStateFlagEdicts.push_back(iEdict);
+	}
+
+	g_pOverrideStateFlags[iEdict] = iFlags;
+}
+
+static void TransmitAddedEntities(CCheckTransmitInfo *pInfo, edict_t* pBaseEdict)
+{
+	for (int iEdict : g_pAddEntityToPVS)
+	{
+		CBaseEntity* pEnt = Util::servergameents->EdictToBaseEntity(&pBaseEdict[iEdict]);
+		if (pEnt)
+			pEnt->SetTransmit(pInfo, true);
+	}
+}
+
+static void ApplyOverrideStateFlags(edict_t* pBaseEdict)
+{
+	for (int iEdict : g_pOverrideStateFlagEdicts)
+	{
+		edict_t* pEdict = &pBaseEdict[iEdict];
+		g_pOriginalStateFlags[iEdict] = pEdict->m_fStateFlags;
+		if (g_pPVSModule.InDebug())
+			Msg("Overriding ent(%i) flags for snapshot (%i -> %i)\n", iEdict, pEdict->m_fStateFlags, g_pOverrideStateFlags[iEdict]);
+
+		pEdict->m_fStateFlags = g_pOverrideStateFlags[iEdict];
+	}
+}
+
+static void RestoreOverrideStateFlags(edict_t* pBaseEdict)
+{
+	for (int iEdict : g_pOverrideStateFlagEdicts)
+		pBaseEdict[iEdict].m_fStateFlags = g_pOriginalStateFlags[iEdict];
+}
+
+static void ClearSnapshotState() // Only clears the bits that were set.
+{
+	for (int iEdict : g_pAddEntityToPVS)
+		g_pAddEntityToPVSSet.Clear(iEdict);
+
+	for (int iEdict : g_pOverrideStateFlagEdicts)
+		g_pOverrideStateFlagSet.Clear(iEdict);
+
+	g_pAddEntityToPVS.clear();
+	g_pOverrideStateFlagEdicts.clear();
+}
+
+static void BenchmarkTransmitStateCmd(const CCommand &args)
+{
+	int iEntities = args.ArgC() > 1 ? atoi(args.Arg(1)) : 2048;
+	int iSnapshots = args.ArgC() > 2 ? atoi(args.Arg(2)) : 10000;
+	if (iEntities <= 0 || iEntities > MAX_EDICTS || iSnapshots <= 0)
+	{
+		Msg("Usage: holylib_pvs_benchmarktransmitstate <entities = 2048 (max %i)> <snapshots = 10000>\n", MAX_EDICTS);
+		return;
+	}
+
+	if (!g_pAddEntityToPVS.empty() || !g_pOverrideStateFlagEdicts.empty())
+	{
+		Msg("holylib: There is pending transmit state for the next snapshot, try again later.\n");
+		return;
+	}
+
+	// Synthetic edicts & transmit info so that we don't touch any real entity.
+	std::vector<edict_t> pEdicts(iEntities);
+	for (int i = 0; i < iEntities; ++i)
+	{
+		pEdicts[i].m_EdictIndex = i;
+		pEdicts[i].m_fStateFlags = FL_EDICT_PVSCHECK;
+	}
+
+	CBitVec<MAX_EDICTS> pTransmitEdict;
+	CCheckTransmitInfo pInfo;
+	pInfo.m_pTransmitEdict = &pTransmitEdict;
+
+	// Every snapshot overrides the flags of a quarter of all entities and adds another quarter (with duplicates) to the PVS.
+	int iChanged = MAX(iEntities / 4, 1);
+	double flStart = Plat_FloatTime();
+	{
+		std::vector<edict_t*> pAddEntityToPVS;
+		std::unordered_map<edict_t*, int> pOverrideStateFlag;
+		std::unordered_map<edict_t*, int> pOriginalFlags;
+		for (int iSnapshot = 0; iSnapshot < iSnapshots; ++iSnapshot)
+		{
+			for (int i = 0; i < iChanged; ++i)
+			{
+				pOverrideStateFlag[&pEdicts[(iSnapshot + i * 4) % iEntities]] = FL_EDICT_ALWAYS;
+				pAddEntityToPVS.push_back(&pEdicts[(iSnapshot + i * 2) % iEntities]);
+			}
+
+			for (edict_t* ent : pAddEntityToPVS)
+				pInfo.m_pTransmitEdict->Set(ent->m_EdictIndex);
+
+			for (auto&[ent, flag] : pOverrideStateFlag)
+			{
+				pOriginalFlags[ent] = ent->m_fStateFlags;
+				ent->m_fStateFlags = flag;
+			}
+
+			for (auto&[ent, flag] : pOriginalFlags)
+				ent->m_fStateFlags = flag;
+
+			pOriginalFlags.clear();
+			pAddEntityToPVS.clear();
+			pOverrideStateFlag.clear();
+		}
+	}
+	double flOld = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for (int iSnapshot = 0; iSnapshot < iSnapshots; ++iSnapshot)
+	{
+		for (int i = 0; i < iChanged; ++i)
+		{
+			SetEdictOverrideStateFlags((iSnapshot + i * 4) % iEntities, FL_EDICT_ALWAYS);
+			AddEdictToPVS((iSnapshot + i * 2) % iEntities);
+		}
+
+		for (int iEdict : g_pAddEntityToPVS)
+			pInfo.m_pTransmitEdict->Set(iEdict);
+
+		ApplyOverrideStateFlags(pEdicts.data());
+		RestoreOverrideStateFlags(pEdicts.data());
+		ClearSnapshotState();
+	}
+	double flNew = Plat_FloatTime() - flStart;
+
+	Msg("---- Transmit state benchmark (%i entities, %i changed per snapshot, %i snapshots) ----\n", iEntities, iChanged, iSnapshots);
+	Msg("unordered_map: %.3fms (%.2f us/snapshot)\n", flOld * 1000, flOld * 1000000 / iSnapshots);
+	Msg("flat arrays:   %.3fms (%.2f us/snapshot)\n", flNew * 1000, flNew * 1000000 / iSnapshots);
+	Msg("---- End of Transmit state benchmark ----\n");
+}
+static ConCommand benchmarktransmitstate("holylib_pvs_benchmarktransmitstate", BenchmarkTransmitStateCmd, "Benchmarks the per snapshot state of the CheckTransmit detour with synthetic data", 0);
+
 static CCheckTransmitInfo* g_pCurrentTransmitInfo = NULL;
+
+/*
+ * TransmitView
+ * A view on the live transmit bits of the client that is passed to HolyLib:PostCheckTransmit.
+ * There is only one TransmitView which is reused for every call, so the hook doesn't create any tables.
+ */
+struct TransmitView
+{
+	CCheckTransmitInfo* pInfo = NULL; // Only set while the HolyLib:PostCheckTransmit hook is running.
+};
+
+static int TransmitView_TypeID = -1;
+static TransmitView g_pTransmitView;
+static int g_iTransmitViewReference = -1;
+static int g_iTransmitViewNextReference = -1;
+Push_LuaClass(TransmitView, TransmitView_TypeID)
+Get_LuaClass(TransmitView, TransmitView_TypeID, "TransmitView")
+
+static CBitVec<MAX_EDICTS>* GetTransmitViewBits(GarrysMod::Lua::ILuaInterface* LUA, int iStackPos)
+{
+	TransmitView* pView = Get_TransmitView(iStackPos, true);
+	if (!pView->pInfo)
+		LUA->ThrowError("pvs: Tried to use a TransmitView outside of HolyLib:PostCheckTransmit!");
+
+	return pView->pInfo->m_pTransmitEdict;
+}
+
+static int CountTransmitBits(const CBitVec<MAX_EDICTS>* pBits)
+{
+	int iCount = 0;
+	const uint32* pWords = pBits->Base();
+	for (int i = 0; i < pBits->GetNumDWords(); ++i)
+	{
+		for (uint32 iWord = pWords[i]; iWord != 0; iWord &= iWord - 1)
+			++iCount;
+	}
+
+	return iCount;
+}
+
+LUA_FUNCTION_STATIC(TransmitView__tostring)
+{
+	TransmitView* pView = Get_TransmitView(1, false);
+	if (!pView || !pView->pInfo)
+	{
+		LUA->PushString("TransmitView [NULL]");
+		return 1;
+	}
+
+	char szBuf[64] = {};
+	V_snprintf(szBuf, sizeof(szBuf), "TransmitView [%i]", CountTransmitBits(pView->pInfo->m_pTransmitEdict));
+	LUA->PushString(szBuf);
+	return 1;
+}
+
+LUA_FUNCTION_STATIC(TransmitView__index)
+{
+	if (!LUA->FindOnObjectsMetaTable(1, 2))
+		LUA->PushNil();
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC(TransmitView_IsTransmitting)
+{
+	CBitVec<MAX_EDICTS>* pBits = GetTransmitViewBits(LUA, 1);
+	CBaseEntity* pEnt = Util::Get_Entity(2, true);
+	edict_t* pEdict = pEnt->edict();
+
+	LUA->PushBool(pEdict && pBits->IsBitSet(pEdict->m_EdictIndex));
+	return 1;
+}
+
+LUA_FUNCTION_STATIC(TransmitView_Count)
+{
+	LUA->PushNumber(CountTransmitBits(GetTransmitViewBits(LUA, 1)));
+	return 1;
+}
+
+LUA_FUNCTION_STATIC(TransmitView_Next) // Stateless iterator. The control variable is the edict index.
+{
+	CBitVec<MAX_EDICTS>* pBits = GetTransmitViewBits(LUA, 1);
+	int iEdict = LUA->IsType(2, GarrysMod::Lua::Type::Number) ? (int)LUA->GetNumber(2) : -1;
+
+	edict_t* pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	while ((iEdict = pBits->FindNextSetBit(iEdict + 1)) != -1)
+	{
+		CBaseEntity* pEnt = Util::servergameents->EdictToBaseEntity(&pBaseEdict[iEdict]);
+		if (!pEnt)
+			continue;
+
+		LUA->PushNumber(iEdict);
+		Util::Push_Entity(pEnt);
+		return 2;
+	}
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC(TransmitView_Iterator)
+{
+	GetTransmitViewBits(LUA, 1);
+
+	LUA->ReferencePush(g_iTransmitViewNextReference);
+	LUA->Push(1);
+	LUA->PushNumber(-1);
+	return 3;
+}
+
+LUA_FUNCTION_STATIC(TransmitView_ToEntityList)
+{
+	CBitVec<MAX_EDICTS>* pBits = GetTransmitViewBits(LUA, 1);
+	EntityList* pList = Get_EntityList(2, true);
+
+	// Entities that stay in the list keep their reference, so we only touch what changed.
+	CBitVec<MAX_EDICTS> pInList;
+	auto itEnd = std::remove_if(pList->pEntities.begin(), pList->pEntities.end(), [&](CBaseEntity* pEnt) {
+		edict_t* pEdict = pEnt->edict();
+		if (pEdict && pBits->IsBitSet(pEdict->m_EdictIndex))
+		{
+			pInList.Set(pEdict->m_EdictIndex);
+			return false;
+		}
+
+		if (pEdict)
+			pList->pEdictHash.erase(pEdict->m_EdictIndex);
+
+		auto it = pList->pEntReferences.find(pEnt);
+		if (it != pList->pEntReferences.end())
+		{
+			LUA->ReferenceFree(it->second);
+			pList->pEntReferences.erase(it);
+		}
+
+		return true;
+	});
+	pList->pEntities.erase(itEnd, pList->pEntities.end());
+
+	edict_t* pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	int iEdict = -1;
+	while ((iEdict = pBits->FindNextSetBit(iEdict + 1)) != -1)
+	{
+		if (pInList.IsBitSet(iEdict))
+			continue;
+
+		CBaseEntity* pEnt = Util::servergameents->EdictToBaseEntity(&pBaseEdict[iEdict]);
+		if (!pEnt)
+			continue;
+
+		Util::Push_Entity(pEnt);
+		pList->pEntReferences[pEnt] = LUA->ReferenceCreate();
+		pList->pEntities.push_back(pEnt);
+		pList->pEdictHash[iEdict] = pEnt;
+	}
+
+	return 0;
+}
+
+/*
+ * Pushes the arguments of the HolyLib:PostCheckTransmit hook after the player.
+ * 2 = A table with all transmitted entities.
+ * 3 = The TransmitView.
+ */
+static int PushPostCheckTransmitArgs(CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts)
+{
+	int iMode = pvs_postchecktransmit.GetInt();
+	if (iMode >= 3 && g_iTransmitViewReference != -1)
+	{
+		g_pTransmitView.pInfo = pInfo;
+		g_Lua->ReferencePush(g_iTransmitViewReference);
+		return 1;
+	}
+
+	if (iMode < 2)
+		return 0;
+
+	g_Lua->CreateTable();
+	int idx = 0;
+	edict_t *pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	for (int i=0; i<nEdicts; ++i)
+	{
+		int iEdict = pEdictIndices[i];
+		if (!pInfo->m_pTransmitEdict->Get(iEdict))
+			continue;
+
+		++idx;
+		g_Lua->PushNumber(idx);
+		Util::Push_Entity(Util::servergameents->EdictToBaseEntity(&pBaseEdict[iEdict]));
+		g_Lua->RawSet(-3);
+	}
+
+	return 1;
+}
+
 static Detouring::Hook detour_CServerGameEnts_CheckTransmit;
 #ifndef HOLYLIB_MANUALNETWORKING
 static void hook_CServerGameEnts_CheckTransmit(void* gameents, CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts)
@@ -55,7 +1083,7 @@ static void hook_CServerGameEnts_CheckTransmit(void* gameents, CCheckTransmitInf
 	VPROF_BUDGET("HolyLib - CServerGameEnts::CheckTransmit", VPROF_BUDGETGROUP_OTHER_NETWORKING);
 	g_pCurrentTransmitInfo = pInfo;
 
-	if(Lua::PushHook("HolyLib:PreCheckTransmit"))
+	if(!pvs_paralleltransmit.GetBool() && Lua::PushHook("HolyLib:PreCheckTransmit"))
 	{
 		Util::Push_Entity(Util::servergameents->EdictToBaseEntity(pInfo->m_pClientEnt));
 		if (g_Lua->CallFunctionProtected(2, 1, true))
@@ -65,8 +1093,7 @@ static void hook_CServerGameEnts_CheckTransmit(void* gameents, CCheckTransmitInf
 
 			if (bCancel)
 			{
-				g_pAddEntityToPVS.clear();
-				g_pOverrideStateFlag.clear();
+				ClearSnapshotState();
 
 				g_pCurrentTransmitInfo = NULL;
 				return;
@@ -74,60 +1101,28 @@ static void hook_CServerGameEnts_CheckTransmit(void* gameents, CCheckTransmitInf
 		}
 	}
 
-	for (edict_t* ent : g_pAddEntityToPVS)
-	{
-		Util::servergameents->EdictToBaseEntity(ent)->SetTransmit(pInfo, true);
-	}
-	
-	static std::unordered_map<edict_t*, int> pOriginalFlags;
-	for (auto&[ent, flag] : g_pOverrideStateFlag)
-	{
-		pOriginalFlags[ent] = ent->m_fStateFlags;
-		if (g_pPVSModule.InDebug())
-			Msg("Overriding ent(%i) flags for snapshot (%i -> %i)\n", ent->m_EdictIndex, ent->m_fStateFlags, flag);
-		ent->m_fStateFlags = flag;
-	}
+	edict_t *pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	TransmitAddedEntities(pInfo, pBaseEdict);
+	ApplyOverrideStateFlags(pBaseEdict);
 
 	detour_CServerGameEnts_CheckTransmit.GetTrampoline<Symbols::CServerGameEnts_CheckTransmit>()(gameents, pInfo, pEdictIndices, nEdicts);
 
-	if (pvs_postchecktransmit.GetBool())
+	ApplyClientTransmitState(pInfo, pEdictIndices, nEdicts);
+
+	if (pvs_postchecktransmit.GetBool() && !pvs_paralleltransmit.GetBool())
 	{
 		if(Lua::PushHook("HolyLib:PostCheckTransmit"))
 		{
 			Util::Push_Entity(Util::servergameents->EdictToBaseEntity(pInfo->m_pClientEnt));
-			int pushed = 2;
-			if (pvs_postchecktransmit.GetInt() >= 2)
-			{
-				++pushed;
-				g_Lua->CreateTable();
-				int idx = 0;
-				edict_t *pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
-				for (int i=0; i<nEdicts; ++i)
-				{
-					int iEdict = pEdictIndices[i];
-					edict_t *pEdict = &pBaseEdict[iEdict];
-
-					if (!pInfo->m_pTransmitEdict->Get(i))
-						continue;
-
-					++idx;
-					g_Lua->PushNumber(idx);
-					Util::Push_Entity(Util::servergameents->EdictToBaseEntity(pEdict));
-					g_Lua->RawSet(-3);
-				}
-			}
-
+			int pushed = 2 + PushPostCheckTransmitArgs(pInfo, pEdictIndices, nEdicts);
 			g_Lua->CallFunctionProtected(pushed, 0, true);
+			g_pTransmitView.pInfo = NULL;
 		}
 	}
 
-	for (auto&[ent, flag] : pOriginalFlags)
-	{
-		ent->m_fStateFlags = flag;
-	}
-	pOriginalFlags.clear();
-	g_pAddEntityToPVS.clear();
-	g_pOverrideStateFlag.clear();
+	RestoreOverrideStateFlags(pBaseEdict);
+	ClearSnapshotState();
+	ApplyTransmitLODs();
 
 	g_pCurrentTransmitInfo = NULL;
 }
@@ -148,7 +1143,7 @@ void PreCheckTransmit(void* gameents, CCheckTransmitInfo *pInfo, const unsigned
 {
 	VPROF_BUDGET("HolyLib - CServerGameEnts::(Pre)CheckTransmit", VPROF_BUDGETGROUP_OTHER_NETWORKING);
 
-	if (pvs_postchecktransmit.GetBool())
+	if (pvs_postchecktransmit.GetBool() && !pvs_paralleltransmit.GetBool())
 	{
 		if(Lua::PushHook("HolyLib:PreCheckTransmit"))
 		{
@@ -161,8 +1156,7 @@ void PreCheckTransmit(void* gameents, CCheckTransmitInfo *pInfo, const unsigned
 
 				if (bCancel)
 				{
-					g_pAddEntityToPVS.clear();
-					g_pOverrideStateFlag.clear();
+					ClearSnapshotState();
 
 					g_pCurrentTransmitInfo = NULL;
 					return;
@@ -172,64 +1166,33 @@ void PreCheckTransmit(void* gameents, CCheckTransmitInfo *pInfo, const unsigned
 		}
 	}
 
-	for (edict_t* ent : g_pAddEntityToPVS)
-	{
-		Util::servergameents->EdictToBaseEntity(ent)->SetTransmit(pInfo, true);
-	}
-	
-	static std::unordered_map<edict_t*, int> pOriginalFlags;
-	for (auto&[ent, flag] : g_pOverrideStateFlag)
-	{
-		pOriginalFlags[ent] = ent->m_fStateFlags;
-		Msg("Overriding ent(%i) flags for snapshot (%i -> %i)\n", ent->m_EdictIndex, ent->m_fStateFlags, flag);
-		ent->m_fStateFlags = flag;
-	}
+	edict_t *pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
+	TransmitAddedEntities(pInfo, pBaseEdict);
+	ApplyOverrideStateFlags(pBaseEdict);
 }
 
 void PostCheckTransmit(void* gameents, CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts)
 {
 	VPROF_BUDGET("HolyLib - CServerGameEnts::(Post)CheckTransmit", VPROF_BUDGETGROUP_OTHER_NETWORKING);
 
-	if (pvs_postchecktransmit.GetBool())
+	ApplyClientTransmitState(pInfo, pEdictIndices, nEdicts);
+
+	if (pvs_postchecktransmit.GetBool() && !pvs_paralleltransmit.GetBool())
 	{
 		g_pCurrentTransmitInfo = pInfo;
 		if(Lua::PushHook("HolyLib:PostCheckTransmit"))
-		{
-			Util::Push_Entity(Util::servergameents->EdictToBaseEntity(pInfo->m_pClientEnt));
-			int pushed = 2;
-			if (pvs_postchecktransmit.GetInt() >= 2)
-			{
-				++pushed;
-				g_Lua->CreateTable();
-				int idx = 0;
-				edict_t *pBaseEdict = Util::engineserver->PEntityOfEntIndex(0);
-				for (int i=0; i<nEdicts; ++i)
-				{
-					int iEdict = pEdictIndices[i];
-					edict_t *pEdict = &pBaseEdict[iEdict];
-
-					if (!pInfo->m_pTransmitEdict->Get(i))
-						continue;
-
-					++idx;
-					g_Lua->PushNumber(idx);
-					Util::Push_Entity(Util::servergameents->EdictToBaseEntity(pEdict));
-					g_Lua->RawSet(-3);
-				}
-			}
-
+		{
+			Util::Push_Entity(Util::servergameents->EdictToBaseEntity(pInfo->m_pClientEnt));
+			int pushed = 2 + PushPostCheckTransmitArgs(pInfo, pEdictIndices, nEdicts);
 			g_Lua->CallFunctionProtected(pushed, 0, true);
+			g_pTransmitView.pInfo = NULL;
 		}
 		g_pCurrentTransmitInfo = NULL;
 	}
 
-	for (auto&[ent, flag] : pOriginalFlags)
-	{
-		ent->m_fStateFlags = flag;
-	}
-	pOriginalFlags.clear();
-	g_pAddEntityToPVS.clear();
-	g_pOverrideStateFlag.clear();
+	RestoreOverrideStateFlags(Util::engineserver->PEntityOfEntIndex(0));
+	ClearSnapshotState();
+	ApplyTransmitLODs();
 }
 #endif
 
@@ -283,6 +1246,8 @@ LUA_FUNCTION_STATIC(pvs_GetClusterForOrigin)
 	return 1;
 }
 
+#define PVS_MAX_AREAS 256 // MAX_MAP_AREAS
+
 LUA_FUNCTION_STATIC(pvs_CheckAreasConnected)
 {
 	int area1 = LUA->CheckNumber(1);
@@ -302,6 +1267,88 @@ LUA_FUNCTION_STATIC(pvs_GetArea)
 	return 1;
 }
 
+static void GetAreaEntities(GarrysMod::Lua::ILuaInterface* LUA, int iStackPos, std::vector<CBaseEntity*>& pEntities)
+{
+	if (Is_EntityList(iStackPos))
+	{
+		pEntities = Get_EntityList(iStackPos, true)->pEntities;
+		return;
+	}
+
+	LUA->CheckType(iStackPos, GarrysMod::Lua::Type::Table);
+	int iLength = LUA->ObjLen(iStackPos);
+	pEntities.reserve(iLength);
+	for (int i = 1; i <= iLength; ++i)
+	{
+		LUA->PushNumber(i);
+		LUA->GetTable(iStackPos);
+		pEntities.push_back(Util::Get_Entity(-1, true));
+		LUA->Pop(1);
+	}
+}
+
+LUA_FUNCTION_STATIC(pvs_GetAreas)
+{
+	VPROF_BUDGET("pvs.GetAreas", VPROF_BUDGETGROUP_HOLYLIB);
+
+	std::vector<CBaseEntity*> pEntities;
+	GetAreaEntities(LUA, 1, pEntities);
+
+	LUA->PreCreateTable(pEntities.size(), 0);
+	int idx = 0;
+	for (CBaseEntity* pEnt : pEntities)
+	{
+		LUA->PushNumber(++idx);
+		LUA->PushNumber(Util::engineserver->GetArea(pEnt->GetAbsOrigin()));
+		LUA->RawSet(-3);
+	}
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC(pvs_FilterConnectedAreas)
+{
+	VPROF_BUDGET("pvs.FilterConnectedAreas", VPROF_BUDGETGROUP_HOLYLIB);
+
+	int iArea;
+	if (LUA->IsType(1, GarrysMod::Lua::Type::Vector))
+		iArea = Util::engineserver->GetArea(*Get_Vector(1));
+	else
+		iArea = LUA->CheckNumber(1);
+
+	std::vector<CBaseEntity*> pEntities;
+	GetAreaEntities(LUA, 2, pEntities);
+
+	signed char pConnected[PVS_MAX_AREAS]; // -1 = Unknown. Most entities share a few areas, so we only check each area once.
+	memset(pConnected, -1, sizeof(pConnected));
+
+	LUA->PreCreateTable(pEntities.size() / 4, 0);
+	int idx = 0;
+	for (CBaseEntity* pEnt : pEntities)
+	{
+		int iEntArea = Util::engineserver->GetArea(pEnt->GetAbsOrigin());
+		bool bConnected;
+		if (iEntArea >= 0 && iEntArea < PVS_MAX_AREAS)
+		{
+			if (pConnected[iEntArea] == -1)
+				pConnected[iEntArea] = Util::engineserver->CheckAreasConnected(iArea, iEntArea) ? 1 : 0;
+
+			bConnected = pConnected[iEntArea] == 1;
+		} else {
+			bConnected = Util::engineserver->CheckAreasConnected(iArea, iEntArea);
+		}
+
+		if (!bConnected)
+			continue;
+
+		LUA->PushNumber(++idx);
+		Util::Push_Entity(pEnt);
+		LUA->RawSet(-3);
+	}
+
+	return 1;
+}
+
 LUA_FUNCTION_STATIC(pvs_GetPVSForCluster)
 {
 	int cluster = LUA->CheckNumber(1);
@@ -329,7 +1376,7 @@ static void AddEntityToPVS(CBaseEntity* ent)
 {
 	edict_t* edict = ent->edict();
 	if (edict)
-		g_pAddEntityToPVS.push_back(edict);
+		AddEdictToPVS(edict->m_EdictIndex);
 	else
 		g_Lua->ThrowError("Failed to get edict?");
 }
@@ -393,7 +1440,7 @@ static void SetOverrideStateFlags(CBaseEntity* ent, int flags, bool force)
 			newFlags |= FL_EDICT_FULLCHECK;
 	}
 
-	g_pOverrideStateFlag[edict] = newFlags;
+	SetEdictOverrideStateFlags(edict->m_EdictIndex, newFlags);
 }
 
 LUA_FUNCTION_STATIC(pvs_OverrideStateFlags)
@@ -748,7 +1795,10 @@ LUA_FUNCTION_STATIC(pvs_FindInPVS) // Copy from pas.FindInPAS
 		orig = (Vector*)&ent->GetAbsOrigin(); // ToDo: This currently breaks the compile.
 	}
 
-	Util::CM_Vis(*orig, DVIS_PVS);
+	Util::CVisRow pVis = Util::CM_Vis(*orig, DVIS_PVS);
+
+	if (Util::pEntityList->IsEnabled() && PushEntitiesInClusters(pVis))
+		return 1;
 
 	LUA->PreCreateTable(0, MAX_EDICTS / 16); // Should we reduce this later? (Currently: 512)
 	int idx = 0;
@@ -757,7 +1807,7 @@ LUA_FUNCTION_STATIC(pvs_FindInPVS) // Copy from pas.FindInPAS
 		UpdateGlobalEntityList();
 		for (auto& [pEnt, ref] : g_pGlobalEntityList.pEntReferences)
 		{
-			if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster)))
+			if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), pVis.Data(), pVis.Size()))
 			{
 				++idx;
 				LUA->PushNumber(idx);
@@ -772,7 +1822,7 @@ LUA_FUNCTION_STATIC(pvs_FindInPVS) // Copy from pas.FindInPAS
 	CBaseEntity* pEnt = Util::entitylist->FirstEnt();
 	while (pEnt != NULL)
 	{
-		if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster)))
+		if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), pVis.Data(), pVis.Size()))
 		{
 			++idx;
 			LUA->PushNumber(idx);
@@ -791,7 +1841,7 @@ LUA_FUNCTION_STATIC(pvs_FindInPVS) // Copy from pas.FindInPAS
 		if (!pEnt)
 			continue;
 
-		if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster)))
+		if (Util::engineserver->CheckOriginInPVS(pEnt->GetAbsOrigin(), pVis.Data(), pVis.Size()))
 		{
 			++idx;
 			LUA->PushNumber(idx);
@@ -804,9 +1854,9 @@ LUA_FUNCTION_STATIC(pvs_FindInPVS) // Copy from pas.FindInPAS
 	return 1;
 }
 
-inline bool TestPVS(const Vector& hearPos)
+inline bool TestPVS(const Util::CVisRow& pVis, const Vector& hearPos)
 {
-	return Util::engineserver->CheckOriginInPVS(hearPos, Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster));
+	return Util::engineserver->CheckOriginInPVS(hearPos, pVis.Data(), pVis.Size());
 }
 
 LUA_FUNCTION_STATIC(pvs_TestPVS)
@@ -822,34 +1872,506 @@ LUA_FUNCTION_STATIC(pvs_TestPVS)
 		orig = (Vector*)&ent->GetAbsOrigin(); // ToDo: This currently breaks the compile.
 	}
 
-	Util::CM_Vis(*orig, DVIS_PVS);
+	Util::CVisRow pVis = Util::CM_Vis(*orig, DVIS_PVS);
 
 	LUA->CheckType(2, GarrysMod::Lua::Type::Vector);
 	if (LUA->IsType(2, GarrysMod::Lua::Type::Vector))
 	{
-		LUA->PushBool(TestPVS(*Get_Vector(2)));
+		LUA->PushBool(TestPVS(pVis, *Get_Vector(2)));
 	} else if (Is_EntityList(2)) {
 		EntityList* entList = Get_EntityList(2, true);
 		LUA->PreCreateTable(0, entList->pEntities.size());
 		for (auto& [ent, ref] : entList->pEntReferences)
 		{
 			LUA->ReferencePush(ref);
-			LUA->PushBool(TestPVS(ent->GetAbsOrigin()));
+			LUA->PushBool(TestPVS(pVis, ent->GetAbsOrigin()));
 			LUA->RawSet(-3);
 		}
 	} else {
 		LUA->CheckType(2, GarrysMod::Lua::Type::Entity);
 		CBaseEntity* ent = Util::Get_Entity(2, false);
 
-		LUA->PushBool(TestPVS(ent->GetAbsOrigin()));
+		LUA->PushBool(TestPVS(pVis, ent->GetAbsOrigin()));
+	}
+
+	return 1;
+}
+
+/*
+ * Batch visibility
+ * pvs.TestPVSBatch resolves the cluster of every viewer and target once.
+ * After that every pair is only a bit test against the viewer's cached PVS row, and the results are packed 32 targets at a time.
+ * Viewers inside the same cluster have the same row, so it's only computed once and then copied.
+ */
+#define PVS_BATCH_MINPAIRS_PER_JOB 65536 // Below this it's not worth to wake up the threads.
+struct PVSBatchJob
+{
+	const std::vector<int>* pViewerClusters;
+	const std::vector<int>* pTargetClusters;
+	byte* pOutput;
+	int iRowBytes;
+	int iStart;
+	int iEnd;
+};
+
+static void TestPVSBatchRows(const PVSBatchJob* pJob)
+{
+	const std::vector<int>& pTargetClusters = *pJob->pTargetClusters;
+	int iTargets = (int)pTargetClusters.size();
+	std::unordered_map<int, int> pDoneClusters; // cluster -> first viewer with that cluster
+	for (int iViewer = pJob->iStart; iViewer < pJob->iEnd; ++iViewer)
+	{
+		int iCluster = (*pJob->pViewerClusters)[iViewer];
+		byte* pOutputRow = pJob->pOutput + (size_t)iViewer * pJob->iRowBytes;
+		auto it = pDoneClusters.find(iCluster);
+		if (it != pDoneClusters.end())
+		{
+			memcpy(pOutputRow, pJob->pOutput + (size_t)it->second * pJob->iRowBytes, pJob->iRowBytes);
+			continue;
+		}
+		pDoneClusters[iCluster] = iViewer;
+
+		if (iCluster < 0) // The output is already zeroed.
+			continue;
+
+		Util::CVisRow pVis = Util::GetVisRow(iCluster, DVIS_PVS);
+		const byte* pRow = pVis.Data();
+		for (int iTarget = 0; iTarget < iTargets; iTarget += 32)
+		{
+			int iCount = MIN(32, iTargets - iTarget);
+			unsigned int iWord = 0;
+			for (int i = 0; i < iCount; ++i)
+			{
+				int iTargetCluster = pTargetClusters[iTarget + i];
+				if (iTargetCluster >= 0)
+					iWord |= (unsigned int)((pRow[iTargetCluster >> 3] >> (iTargetCluster & 7)) & 1) << i;
+			}
+
+			byte* pOutputWord = pOutputRow + (iTarget >> 3);
+			for (int iByte = 0; iByte < (iCount + 7) >> 3; ++iByte)
+				pOutputWord[iByte] = (byte)(iWord >> (iByte * 8));
+		}
+	}
+}
+
+static void PVSBatchJobFunc(PVSBatchJob* pJob)
+{
+	TestPVSBatchRows(pJob);
+}
+
+static void GetBatchClusters(GarrysMod::Lua::ILuaInterface* LUA, int iStackPos, std::vector<int>& pClusters)
+{
+	int iClusterCount = Util::engineserver->GetClusterCount();
+	auto AddCluster = [&](const Vector& vecOrigin) {
+		int iCluster = Util::engineserver->GetClusterForOrigin(vecOrigin);
+		pClusters.push_back(iCluster < iClusterCount ? iCluster : -1);
+	};
+
+	if (Is_EntityList(iStackPos))
+	{
+		EntityList* entList = Get_EntityList(iStackPos, true);
+		pClusters.reserve(entList->pEntities.size());
+		for (CBaseEntity* ent : entList->pEntities)
+			AddCluster(ent->GetAbsOrigin());
+
+		return;
+	}
+
+	LUA->CheckType(iStackPos, GarrysMod::Lua::Type::Table);
+	int iLength = LUA->ObjLen(iStackPos);
+	pClusters.reserve(iLength);
+	for (int i = 1; i <= iLength; ++i)
+	{
+		LUA->PushNumber(i);
+		LUA->GetTable(iStackPos);
+		if (LUA->IsType(-1, GarrysMod::Lua::Type::Vector))
+			AddCluster(*Get_Vector(-1));
+		else
+			AddCluster(Util::Get_Entity(-1, true)->GetAbsOrigin());
+
+		LUA->Pop(1);
+	}
+}
+
+LUA_FUNCTION_STATIC(pvs_TestPVSBatch)
+{
+	VPROF_BUDGET("pvs.TestPVSBatch", VPROF_BUDGETGROUP_HOLYLIB);
+
+	std::vector<int> pViewerClusters;
+	std::vector<int> pTargetClusters;
+	GetBatchClusters(LUA, 1, pViewerClusters);
+	GetBatchClusters(LUA, 2, pTargetClusters);
+
+	int iViewers = (int)pViewerClusters.size();
+	int iRowBytes = ((int)pTargetClusters.size() + 7) >> 3;
+	std::string strOutput((size_t)iViewers * iRowBytes, '\0');
+	byte* pOutput = (byte*)strOutput.data();
+
+	PVSBatchJob pMainJob = {&pViewerClusters, &pTargetClusters, pOutput, iRowBytes, 0, iViewers};
+	int iJobs = 1;
+	if (pvs_threads.GetInt() > 0 && pTargetClusters.size() > 0)
+		iJobs = MIN(pvs_threads.GetInt() + 1, (int)(((size_t)iViewers * pTargetClusters.size()) / PVS_BATCH_MINPAIRS_PER_JOB));
+
+	if (iJobs <= 1)
+	{
+		TestPVSBatchRows(&pMainJob);
+	} else {
+		IThreadPool* pPool = GetPVSPool();
+
+		// Every job gets a range of viewers. The main thread does the first one itself.
+		std::vector<PVSBatchJob> pJobs(iJobs, pMainJob);
+		std::vector<CJob*> pQueued;
+		pQueued.reserve(iJobs - 1);
+		int iPerJob = (iViewers + iJobs - 1) / iJobs;
+		for (int i = 0; i < iJobs; ++i)
+		{
+			pJobs[i].iStart = MIN(i * iPerJob, iViewers);
+			pJobs[i].iEnd = MIN((i + 1) * iPerJob, iViewers);
+			if (i > 0)
+				pQueued.push_back(pPool->QueueCall(PVSBatchJobFunc, &pJobs[i]));
+		}
+
+		TestPVSBatchRows(&pJobs[0]);
+		for (CJob* pJob : pQueued)
+			pJob->WaitForFinishAndRelease();
+	}
+
+	LUA->PushString(strOutput.data(), (unsigned int)strOutput.size());
+	LUA->PushNumber(iRowBytes);
+	return 2;
+}
+
+static void GetRuleEdicts(GarrysMod::Lua::ILuaInterface* LUA, int iStackPos, std::vector<int>& pEdicts)
+{
+	auto AddEdict = [&](CBaseEntity* pEnt) {
+		edict_t* pEdict = pEnt->edict();
+		if (!pEdict)
+			LUA->ThrowError("Failed to get edict?");
+
+		pEdicts.push_back(pEdict->m_EdictIndex);
+	};
+
+	if (LUA->IsType(iStackPos, GarrysMod::Lua::Type::Table))
+	{
+		LUA->Push(iStackPos);
+		LUA->PushNil();
+		while (LUA->Next(-2))
+		{
+			AddEdict(Util::Get_Entity(-1, true));
+			LUA->Pop(1);
+		}
+		LUA->Pop(1);
+	} else if (Is_EntityList(iStackPos)) {
+		EntityList* entList = Get_EntityList(iStackPos, true);
+		for (CBaseEntity* pEnt : entList->pEntities)
+			AddEdict(pEnt);
+	} else {
+		AddEdict(Util::Get_Entity(iStackPos, true));
+	}
+
+	// A table can contain an entity multiple times, but OnEdictFreed expects every edict only once.
+	std::sort(pEdicts.begin(), pEdicts.end());
+	pEdicts.erase(std::unique(pEdicts.begin(), pEdicts.end()), pEdicts.end());
+}
+
+static void FreeTransmitRule(TransmitRule* pRule)
+{
+	if (pRule->iPlayersReference != -1 && g_Lua)
+		g_Lua->ReferenceFree(pRule->iPlayersReference);
+
+	delete pRule;
+}
+
+LUA_FUNCTION_STATIC(pvs_AddTransmitRule)
+{
+	int iType = LUA->CheckNumber(1);
+	int iTeam = 0;
+	const char* pClassName = NULL;
+	float flDistance = 0;
+	EntityList* pPlayers = NULL;
+	std::vector<int> pEdicts;
+	switch (iType)
+	{
+		case TRANSMITRULE_ALWAYS_TEAM:
+			iTeam = LUA->CheckNumber(3);
+			GetRuleEdicts(LUA, 2, pEdicts);
+			break;
+		case TRANSMITRULE_NEVER_CLASS_DISTANCE:
+			pClassName = LUA->CheckString(2);
+			flDistance = LUA->CheckNumber(3);
+			break;
+		case TRANSMITRULE_ONLY_LIST:
+			pPlayers = Get_EntityList(3, true);
+			GetRuleEdicts(LUA, 2, pEdicts);
+			break;
+		default:
+			LUA->ThrowError("pvs: Invalid transmit rule type!");
+			return 0;
+	}
+
+	// All arguments were checked above, so nothing below can error and leak the rule.
+	TransmitRule* pRule = new TransmitRule;
+	pRule->iType = iType;
+	pRule->iTeam = iTeam;
+	pRule->pEdicts = std::move(pEdicts);
+	if (pClassName)
+		pRule->strClassName = pClassName;
+
+	pRule->flDistanceSqr = flDistance * flDistance;
+	pRule->pPlayers = pPlayers;
+	if (pPlayers)
+	{
+		LUA->Push(3);
+		pRule->iPlayersReference = LUA->ReferenceCreate();
+	}
+
+	pRule->iID = g_iNextTransmitRuleID++;
+	g_pTransmitRules.push_back(pRule);
+	g_bClassRulesDirty = true;
+
+	LUA->PushNumber(pRule->iID);
+	return 1;
+}
+
+LUA_FUNCTION_STATIC(pvs_RemoveTransmitRule)
+{
+	int iID = LUA->CheckNumber(1);
+	for (auto it = g_pTransmitRules.begin(); it != g_pTransmitRules.end(); ++it)
+	{
+		if ((*it)->iID != iID)
+			continue;
+
+		FreeTransmitRule(*it);
+		g_pTransmitRules.erase(it);
+		g_bClassRulesDirty = true;
+		LUA->PushBool(true);
+		return 1;
+	}
+
+	LUA->PushBool(false);
+	return 1;
+}
+
+static void ClearTransmitRules()
+{
+	for (TransmitRule* pRule : g_pTransmitRules)
+		FreeTransmitRule(pRule);
+
+	g_pTransmitRules.clear();
+	g_bClassRulesDirty = true;
+}
+
+LUA_FUNCTION_STATIC(pvs_ClearTransmitRules)
+{
+	ClearTransmitRules();
+	return 0;
+}
+
+static TransmitGroup* GetTransmitGroup(const char* pName, bool bCreate)
+{
+	auto it = g_pTransmitGroups.find(pName);
+	if (it != g_pTransmitGroups.end())
+		return it->second;
+
+	if (!bCreate)
+		return NULL;
+
+	TransmitGroup* pGroup = new TransmitGroup;
+	g_pTransmitGroups[pName] = pGroup;
+	return pGroup;
+}
+
+// All arguments are checked before the group is created or changed, so an error can't leave it half updated.
+static void SetTransmitGroupEntities(GarrysMod::Lua::ILuaInterface* LUA, bool bAdd)
+{
+	const char* pName = LUA->CheckString(1);
+	std::vector<int> pEdicts;
+	GetRuleEdicts(LUA, 2, pEdicts);
+
+	TransmitGroup* pGroup = GetTransmitGroup(pName, bAdd);
+	if (!pGroup)
+		return;
+
+	for (int iEdict : pEdicts)
+		pGroup->pEntities.Set(iEdict, bAdd);
+
+	g_bTransmitGroupsDirty = true;
+}
+
+static void SetTransmitGroupPlayers(GarrysMod::Lua::ILuaInterface* LUA, bool bAdd)
+{
+	const char* pName = LUA->CheckString(1);
+	std::vector<int> pEdicts;
+	GetRuleEdicts(LUA, 2, pEdicts);
+	for (int iEdict : pEdicts)
+	{
+		if (iEdict <= 0 || iEdict > ABSOLUTE_PLAYER_LIMIT)
+			LUA->ThrowError("pvs: Tried to add a non player to a transmit group's players!");
+	}
+
+	TransmitGroup* pGroup = GetTransmitGroup(pName, bAdd);
+	if (!pGroup)
+		return;
+
+	for (int iEdict : pEdicts)
+		pGroup->pPlayers.Set(iEdict, bAdd);
+
+	g_bTransmitGroupsDirty = true;
+}
+
+LUA_FUNCTION_STATIC(pvs_AddTransmitGroupEntities)
+{
+	SetTransmitGroupEntities(LUA, true);
+	return 0;
+}
+
+LUA_FUNCTION_STATIC(pvs_RemoveTransmitGroupEntities)
+{
+	SetTransmitGroupEntities(LUA, false);
+	return 0;
+}
+
+LUA_FUNCTION_STATIC(pvs_AddTransmitGroupPlayers)
+{
+	SetTransmitGroupPlayers(LUA, true);
+	return 0;
+}
+
+LUA_FUNCTION_STATIC(pvs_RemoveTransmitGroupPlayers)
+{
+	SetTransmitGroupPlayers(LUA, false);
+	return 0;
+}
+
+LUA_FUNCTION_STATIC(pvs_RemoveTransmitGroup)
+{
+	auto it = g_pTransmitGroups.find(LUA->CheckString(1));
+	if (it == g_pTransmitGroups.end())
+	{
+		LUA->PushBool(false);
+		return 1;
+	}
+
+	delete it->second;
+	g_pTransmitGroups.erase(it);
+	g_bTransmitGroupsDirty = true;
+
+	LUA->PushBool(true);
+	return 1;
+}
+
+static void ClearTransmitGroups()
+{
+	for (auto& [strName, pGroup] : g_pTransmitGroups)
+		delete pGroup;
+
+	g_pTransmitGroups.clear();
+	g_bTransmitGroupsDirty = true;
+}
+
+LUA_FUNCTION_STATIC(pvs_ClearTransmitGroups)
+{
+	ClearTransmitGroups();
+	return 0;
+}
+
+static bool GetTransmitLODKey(GarrysMod::Lua::ILuaInterface* LUA, int iStackPos, std::string& strClassName, int& iEdict)
+{
+	if (LUA->IsType(iStackPos, GarrysMod::Lua::Type::String))
+	{
+		strClassName = LUA->GetString(iStackPos);
+		return true;
 	}
 
+	CBaseEntity* pEnt = Util::Get_Entity(iStackPos, true);
+	edict_t* pEdict = pEnt->edict();
+	if (!pEdict)
+		LUA->ThrowError("Failed to get edict?");
+
+	iEdict = pEdict->m_EdictIndex;
+	return false;
+}
+
+LUA_FUNCTION_STATIC(pvs_SetTransmitLOD)
+{
+	std::string strClassName;
+	int iEdict = -1;
+	bool bClass = GetTransmitLODKey(LUA, 1, strClassName, iEdict);
+
+	TransmitLOD pLOD;
+	float flDistance = LUA->CheckNumber(2);
+	pLOD.flDistanceSqr = flDistance * flDistance;
+	pLOD.iInterval = MAX((int)LUA->CheckNumber(3), 1);
+
+	if (bClass)
+		g_pClassTransmitLODs[strClassName] = pLOD;
+	else
+		g_pEntityTransmitLODs[iEdict] = pLOD;
+
+	ReleaseAllLODEdicts(); // The next tick decides again with the new LODs.
+	g_bTransmitLODsDirty = true;
+	return 0;
+}
+
+LUA_FUNCTION_STATIC(pvs_RemoveTransmitLOD)
+{
+	std::string strClassName;
+	int iEdict = -1;
+	bool bFound;
+	if (GetTransmitLODKey(LUA, 1, strClassName, iEdict))
+		bFound = g_pClassTransmitLODs.erase(strClassName) > 0;
+	else
+		bFound = g_pEntityTransmitLODs.erase(iEdict) > 0;
+
+	ReleaseAllLODEdicts();
+	g_bTransmitLODsDirty = true;
+	LUA->PushBool(bFound);
 	return 1;
 }
 
+static void ClearTransmitLODs()
+{
+	g_pClassTransmitLODs.clear();
+	g_pEntityTransmitLODs.clear();
+	g_pLODEdicts.clear();
+	ReleaseAllLODEdicts();
+	g_bTransmitLODsDirty = true;
+}
+
+LUA_FUNCTION_STATIC(pvs_ClearTransmitLODs)
+{
+	ClearTransmitLODs();
+	return 0;
+}
+
+void CPVSModule::OnEdictFreed(const edict_t* pEdict)
+{
+	int iEdict = pEdict->m_EdictIndex;
+	for (TransmitRule* pRule : g_pTransmitRules)
+		pRule->pEdicts.erase(std::remove(pRule->pEdicts.begin(), pRule->pEdicts.end(), iEdict), pRule->pEdicts.end());
+
+	for (auto& [strName, pGroup] : g_pTransmitGroups)
+	{
+		if (pGroup->pEntities.IsBitSet(iEdict))
+		{
+			pGroup->pEntities.Clear(iEdict);
+			g_bTransmitGroupsDirty = true;
+		}
+
+		if (iEdict > 0 && iEdict <= ABSOLUTE_PLAYER_LIMIT)
+			pGroup->pPlayers.Clear(iEdict);
+	}
+
+	if (g_pEntityTransmitLODs.erase(iEdict) > 0)
+		g_bTransmitLODsDirty = true;
+
+	g_pLODHistory[iEdict].iTick = -1;
+	g_pLODHeldSet.Clear(iEdict); // The next entity in this slot starts with a full update anyway.
+}
+
 void CPVSModule::Init(CreateInterfaceFn* appfn, CreateInterfaceFn* gamefn)
 {
-	IPlayerInfoManager* playerinfomanager = (IPlayerInfoManager*)gamefn[0](INTERFACEVERSION_PLAYERINFOMANAGER, NULL);
+	playerinfomanager = (IPlayerInfoManager*)gamefn[0](INTERFACEVERSION_PLAYERINFOMANAGER, NULL);
 	Detour::CheckValue("get interface", "playerinfomanager", playerinfomanager != NULL);
 
 	if ( playerinfomanager )
@@ -865,6 +2387,20 @@ void CPVSModule::LuaInit(bool bServerInit)
 
 	mapPVSSize = ceil(Util::engineserver->GetClusterCount() / 8.0f);
 
+	TransmitView_TypeID = g_Lua->CreateMetaTable("TransmitView");
+		Util::AddFunc(TransmitView__tostring, "__tostring");
+		Util::AddFunc(TransmitView__index, "__index");
+		Util::AddFunc(TransmitView_IsTransmitting, "IsTransmitting");
+		Util::AddFunc(TransmitView_Count, "Count");
+		Util::AddFunc(TransmitView_Iterator, "Iterator");
+		Util::AddFunc(TransmitView_ToEntityList, "ToEntityList");
+	g_Lua->Pop(1);
+
+	Push_TransmitView(&g_pTransmitView);
+	g_iTransmitViewReference = g_Lua->ReferenceCreate();
+	g_Lua->PushCFunction(TransmitView_Next);
+	g_iTransmitViewNextReference = g_Lua->ReferenceCreate();
+
 	Util::StartTable();
 		Util::AddFunc(pvs_ResetPVS, "ResetPVS");
 		Util::AddFunc(pvs_CheckOriginInPVS, "CheckOriginInPVS");
@@ -873,6 +2409,8 @@ void CPVSModule::LuaInit(bool bServerInit)
 		Util::AddFunc(pvs_GetClusterForOrigin, "GetClusterForOrigin");
 		Util::AddFunc(pvs_CheckAreasConnected, "CheckAreasConnected");
 		Util::AddFunc(pvs_GetArea, "GetArea");
+		Util::AddFunc(pvs_GetAreas, "GetAreas");
+		Util::AddFunc(pvs_FilterConnectedAreas, "FilterConnectedAreas");
 		Util::AddFunc(pvs_GetPVSForCluster, "GetPVSForCluster");
 		Util::AddFunc(pvs_CheckBoxInPVS, "CheckBoxInPVS");
 		Util::AddFunc(pvs_AddEntityToPVS, "AddEntityToPVS");
@@ -882,6 +2420,19 @@ void CPVSModule::LuaInit(bool bServerInit)
 		Util::AddFunc(pvs_SetPreventTransmitBulk, "SetPreventTransmitBulk");
 		Util::AddFunc(pvs_FindInPVS, "FindInPVS");
 		Util::AddFunc(pvs_TestPVS, "TestPVS");
+		Util::AddFunc(pvs_TestPVSBatch, "TestPVSBatch");
+		Util::AddFunc(pvs_AddTransmitRule, "AddTransmitRule");
+		Util::AddFunc(pvs_RemoveTransmitRule, "RemoveTransmitRule");
+		Util::AddFunc(pvs_ClearTransmitRules, "ClearTransmitRules");
+		Util::AddFunc(pvs_AddTransmitGroupEntities, "AddTransmitGroupEntities");
+		Util::AddFunc(pvs_RemoveTransmitGroupEntities, "RemoveTransmitGroupEntities");
+		Util::AddFunc(pvs_AddTransmitGroupPlayers, "AddTransmitGroupPlayers");
+		Util::AddFunc(pvs_RemoveTransmitGroupPlayers, "RemoveTransmitGroupPlayers");
+		Util::AddFunc(pvs_RemoveTransmitGroup, "RemoveTransmitGroup");
+		Util::AddFunc(pvs_ClearTransmitGroups, "ClearTransmitGroups");
+		Util::AddFunc(pvs_SetTransmitLOD, "SetTransmitLOD");
+		Util::AddFunc(pvs_RemoveTransmitLOD, "RemoveTransmitLOD");
+		Util::AddFunc(pvs_ClearTransmitLODs, "ClearTransmitLODs");
 
 		// Use the functions below only inside the HolyLib:PostCheckTransmit hook.  
 		Util::AddFunc(pvs_RemoveEntityFromTransmit, "RemoveEntityFromTransmit");
@@ -892,14 +2443,38 @@ void CPVSModule::LuaInit(bool bServerInit)
 		Util::AddValue(LUA_FL_EDICT_ALWAYS, "FL_EDICT_ALWAYS");
 		Util::AddValue(LUA_FL_EDICT_PVSCHECK, "FL_EDICT_PVSCHECK");
 		Util::AddValue(LUA_FL_EDICT_FULLCHECK, "FL_EDICT_FULLCHECK");
+
+		Util::AddValue(TRANSMITRULE_ALWAYS_TEAM, "TRANSMITRULE_ALWAYS_TEAM");
+		Util::AddValue(TRANSMITRULE_NEVER_CLASS_DISTANCE, "TRANSMITRULE_NEVER_CLASS_DISTANCE");
+		Util::AddValue(TRANSMITRULE_ONLY_LIST, "TRANSMITRULE_ONLY_LIST");
 	Util::FinishTable("pvs");
 }
 
 void CPVSModule::LuaShutdown()
 {
+	ClearTransmitRules();
+	ClearTransmitGroups();
+	ClearTransmitLODs();
+	if (g_iTransmitViewReference != -1)
+	{
+		g_Lua->ReferenceFree(g_iTransmitViewReference);
+		g_iTransmitViewReference = -1;
+	}
+
+	if (g_iTransmitViewNextReference != -1)
+	{
+		g_Lua->ReferenceFree(g_iTransmitViewNextReference);
+		g_iTransmitViewNextReference = -1;
+	}
+
 	Util::NukeTable("pvs");
 }
 
+void CPVSModule::LevelShutdown()
+{
+	g_pLODHeldSet.ClearAll(); // All edicts are freed, the next map starts with full updates.
+}
+
 void CPVSModule::InitDetour(bool bPreServer)
 {
 	if (bPreServer)
@@ -919,4 +2494,13 @@ void CPVSModule::InitDetour(bool bPreServer)
 		(void*)hook_CServerGameEnts_CheckTransmit, m_pID
 	);
 #endif
+}
+
+void CPVSModule::Shutdown()
+{
+	if (pPVSPool)
+	{
+		V_DestroyThreadPool(pPVSPool);
+		pPVSPool = NULL;
+	}
 }
\ No newline at end of file
@@ -263,6 +263,9 @@ void CServerPlugin::GameFrame(bool simulating)
 //---------------------------------------------------------------------------------
 void CServerPlugin::LevelShutdown(void) // !!!!this can get called multiple times per map change
 {
+	VPROF_BUDGET("HolyLib - CServerPlugin::LevelShutdown", VPROF_BUDGETGROUP_HOLYLIB);
+	g_pModuleManager.LevelShutdown();
+	Util::ResetVisCache();
 }
 
 //---------------------------------------------------------------------------------
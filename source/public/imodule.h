@@ -11,6 +11,11 @@ enum Module_Compatibility
 class ConVar;
 class KeyValues;
 struct edict_t;
+
+/*
+ * IModule keeps the layout it had in the first version, so modules built against an older imodule.h still work.
+ * Callbacks added later go into a versioned sub-interface like IModule2 and are only called for modules registered with the matching RegisterModule function.
+ */
 class IModule
 {
 public:
@@ -35,6 +40,12 @@ public:
 	inline int InDebug() { return m_iIsDebug; };
 };
 
+class IModule2 : public IModule // Register it with IModuleManager::RegisterModule2
+{
+public:
+	virtual void LevelShutdown() {};
+};
+
 class IModuleWrapper
 {
 public:
@@ -72,4 +83,8 @@ public:
 	virtual void ServerActivate(edict_t* pEdictList, int edictCount, int clientMax) = 0;
 	virtual void OnEdictAllocated(edict_t* pEdict) = 0;
 	virtual void OnEdictFreed(const edict_t* pEdict) = 0;
+
+	// Added after the first version. Only append new functions so the old ones keep their vtable slot.
+	virtual void LevelShutdown() = 0;
+	virtual void RegisterModule2(IModule2* mdl) = 0;
 };
\ No newline at end of file
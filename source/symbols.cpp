@@ -280,6 +280,38 @@ namespace Symbols
 		Symbol::FromName("_ZNK15CBaseFileSystem11CSearchPath14GetDebugStringEv"),
 	};
 
+	const std::vector<Symbol> CBaseFileSystem_FileExistsSym = {
+		Symbol::FromName("_ZN15CBaseFileSystem10FileExistsEPKcS1_"),
+	};
+
+	const std::vector<Symbol> CBaseFileSystem_RemoveSearchPathSym = {
+		Symbol::FromName("_ZN15CBaseFileSystem16RemoveSearchPathEPKcS1_"),
+	};
+
+	const std::vector<Symbol> CBaseFileSystem_RemoveSearchPathsSym = {
+		Symbol::FromName("_ZN15CBaseFileSystem17RemoveSearchPathsEPKc"),
+	};
+
+	const std::vector<Symbol> CBaseFileSystem_RemoveAllSearchPathsSym = {
+		Symbol::FromName("_ZN15CBaseFileSystem20RemoveAllSearchPathsEv"),
+	};
+
+	const std::vector<Symbol> CBaseFileSystem_RemoveFileSym = {
+		Symbol::FromName("_ZN15CBaseFileSystem10RemoveFileEPKcS1_"),
+	};
+
+	const std::vector<Symbol> CBaseFileSystem_RenameFileSym = {
+		Symbol::FromName("_ZN15CBaseFileSystem10RenameFileEPKcS1_S1_"),
+	};
+
+	const std::vector<Symbol> CBaseFileSystem_OpenForWriteSym = {
+		Symbol::FromName("_ZN15CBaseFileSystem12OpenForWriteEPKcS1_S1_"),
+	};
+
+	const std::vector<Symbol> CBaseFileSystem_CreateDirHierarchySym = {
+		Symbol::FromName("_ZN15CBaseFileSystem18CreateDirHierarchyEPKcS1_"),
+	};
+
 
 	//---------------------------------------------------------------------------------
 	// Purpose: concommand Symbols
@@ -428,6 +460,14 @@ namespace Symbols
 		Symbol::FromSignature("\x48\x8B\x2A\x2A\x2A\x2A\x2A\x48\x8B\x38\x48\x8B\x07*\x50\x10\x48\x8D\x43\x15"), // 48 8B ?? ?? ?? ?? ?? 48 8B 38 48 8B 07 ?? 50 10 48 8D 43 15 || "framesnapshotmanager->LevelChanged()" || "sv.Clear()"
 	};
 
+	const std::vector<Symbol> CFrameSnapshotManager_GetCachedUncompressedEntitySym = {
+		Symbol::FromName("_ZN21CFrameSnapshotManager27GetCachedUncompressedEntityEP12PackedEntity"),
+	};
+
+	const std::vector<Symbol> CFrameSnapshotManager_RemoveEntityReferenceSym = {
+		Symbol::FromName("_ZN21CFrameSnapshotManager21RemoveEntityReferenceEi"),
+	};
+
 	//---------------------------------------------------------------------------------
 	// Purpose: steamworks Symbols
 	//---------------------------------------------------------------------------------
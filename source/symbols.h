@@ -31,6 +31,8 @@ class CFileOpenInfo;
 class CSearchPath;
 class CSteam3Server;
 class IChangeFrameList;
+class CFrameSnapshotManager;
+class PackedEntity;
 class IGameEvent;
 class CBaseHandle;
 
@@ -261,6 +263,30 @@ namespace Symbols
 	typedef const char* (GMCOMMON_CALLING_CONVENTION* CBaseFileSystem_CSearchPath_GetDebugString)(void* searchpath);
 	extern const std::vector<Symbol> CBaseFileSystem_CSearchPath_GetDebugStringSym;
 
+	typedef bool (GMCOMMON_CALLING_CONVENTION* CBaseFileSystem_FileExists)(void* filesystem, const char* pFileName, const char* pPathID);
+	extern const std::vector<Symbol> CBaseFileSystem_FileExistsSym;
+
+	typedef bool (GMCOMMON_CALLING_CONVENTION* CBaseFileSystem_RemoveSearchPath)(void* filesystem, const char* pPath, const char* pathID);
+	extern const std::vector<Symbol> CBaseFileSystem_RemoveSearchPathSym;
+
+	typedef void (GMCOMMON_CALLING_CONVENTION* CBaseFileSystem_RemoveSearchPaths)(void* filesystem, const char* pathID);
+	extern const std::vector<Symbol> CBaseFileSystem_RemoveSearchPathsSym;
+
+	typedef void (GMCOMMON_CALLING_CONVENTION* CBaseFileSystem_RemoveAllSearchPaths)(void* filesystem);
+	extern const std::vector<Symbol> CBaseFileSystem_RemoveAllSearchPathsSym;
+
+	typedef void (GMCOMMON_CALLING_CONVENTION* CBaseFileSystem_RemoveFile)(void* filesystem, const char* pRelativePath, const char* pathID);
+	extern const std::vector<Symbol> CBaseFileSystem_RemoveFileSym;
+
+	typedef bool (GMCOMMON_CALLING_CONVENTION* CBaseFileSystem_RenameFile)(void* filesystem, const char* pOldPath, const char* pNewPath, const char* pathID);
+	extern const std::vector<Symbol> CBaseFileSystem_RenameFileSym;
+
+	typedef FileHandle_t (GMCOMMON_CALLING_CONVENTION* CBaseFileSystem_OpenForWrite)(void* filesystem, const char* pFileName, const char* pOptions, const char* pathID);
+	extern const std::vector<Symbol> CBaseFileSystem_OpenForWriteSym;
+
+	typedef void (GMCOMMON_CALLING_CONVENTION* CBaseFileSystem_CreateDirHierarchy)(void* filesystem, const char* pRelativePath, const char* pathID);
+	extern const std::vector<Symbol> CBaseFileSystem_CreateDirHierarchySym;
+
 
 	//---------------------------------------------------------------------------------
 	// Purpose: concommand Symbols
@@ -329,6 +355,12 @@ namespace Symbols
 
 	extern const std::vector<Symbol> g_FrameSnapshotManagerSym;
 
+	typedef void* (GMCOMMON_CALLING_CONVENTION* CFrameSnapshotManager_GetCachedUncompressedEntity)(CFrameSnapshotManager*, PackedEntity*);
+	extern const std::vector<Symbol> CFrameSnapshotManager_GetCachedUncompressedEntitySym;
+
+	typedef void (GMCOMMON_CALLING_CONVENTION* CFrameSnapshotManager_RemoveEntityReference)(CFrameSnapshotManager*, intptr_t);
+	extern const std::vector<Symbol> CFrameSnapshotManager_RemoveEntityReferenceSym;
+
 	//---------------------------------------------------------------------------------
 	// Purpose: steamworks Symbols
 	//---------------------------------------------------------------------------------
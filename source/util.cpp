@@ -111,19 +111,88 @@ CBasePlayer* Util::GetPlayerByClient(CBaseClient* client)
 	return (CBasePlayer*)servergameents->EdictToBaseEntity(engineserver->PEntityOfEntIndex(client->GetPlayerSlot() + 1));
 }
 
-byte Util::g_pCurrentCluster[MAX_MAP_LEAFS / 8];
-void Util::ResetClusers()
+/*
+ * Vis cache
+ * CM_Vis decompresses the PVS / PAS row of a cluster every time it's called.
+ * The rows only change with the map, so we keep the most recently used ones in a LRU cache keyed by (cluster, type).
+ */
+static ConVar holylib_viscache_size("holylib_viscache_size", "512", 0, "The number of decompressed PVS / PAS rows to cache");
+
+struct VisCacheEntry
 {
-	Q_memset(Util::g_pCurrentCluster, 0, sizeof(Util::g_pCurrentCluster));
+	unsigned int iKey;
+	std::shared_ptr<const std::vector<byte>> pRow;
+};
+
+static std::list<VisCacheEntry> g_pVisCacheLRU; // The front is the most recently used row.
+static std::unordered_map<unsigned int, std::list<VisCacheEntry>::iterator> g_pVisCache;
+static CThreadFastMutex g_pVisCacheMutex;
+static int g_iVisCacheClusters = -1;
+
+void Util::ResetVisCache()
+{
+	g_pVisCacheMutex.Lock();
+	g_pVisCache.clear();
+	g_pVisCacheLRU.clear();
+	g_iVisCacheClusters = -1;
+	g_pVisCacheMutex.Unlock();
 }
 
 Symbols::CM_Vis func_CM_Vis = NULL;
-void Util::CM_Vis(const Vector& orig, int type)
+Util::CVisRow Util::GetVisRow(int iCluster, int iType)
 {
-	Util::ResetClusers();
+	int iClusterCount = Util::engineserver->GetClusterCount();
+	if (iCluster < 0 || iCluster >= iClusterCount)
+		iCluster = -1;
+
+	Util::CVisRow pVisRow;
+	unsigned int iKey = ((unsigned int)(iCluster + 1) << 2) | (iType & 3);
+	g_pVisCacheMutex.Lock();
+	if (g_iVisCacheClusters != iClusterCount) // Fallback if we somehow missed the map change.
+	{
+		g_pVisCache.clear();
+		g_pVisCacheLRU.clear();
+		g_iVisCacheClusters = iClusterCount;
+	}
+
+	auto it = g_pVisCache.find(iKey);
+	if (it != g_pVisCache.end())
+	{
+		g_pVisCacheLRU.splice(g_pVisCacheLRU.begin(), g_pVisCacheLRU, it->second);
+		pVisRow.m_pRow = it->second->pRow;
+		g_pVisCacheMutex.Unlock();
+		return pVisRow;
+	}
+	g_pVisCacheMutex.Unlock();
+
+	// One extra byte since CheckOriginInPVS also reads the byte at checkpvssize.
+	std::shared_ptr<std::vector<byte>> pRow = std::make_shared<std::vector<byte>>((iClusterCount >> 3) + 1, 0);
+	if (func_CM_Vis && iCluster != -1)
+		func_CM_Vis(pRow->data(), pRow->size(), iCluster, iType);
+
+	pVisRow.m_pRow = pRow;
 
-	if (func_CM_Vis)
-		func_CM_Vis(Util::g_pCurrentCluster, sizeof(Util::g_pCurrentCluster), engine->GetClusterForOrigin(orig), type);
+	g_pVisCacheMutex.Lock();
+	if (g_iVisCacheClusters == iClusterCount && g_pVisCache.find(iKey) == g_pVisCache.end()) // Another thread could have been faster.
+	{
+		g_pVisCacheLRU.push_front({iKey, pVisRow.m_pRow});
+		g_pVisCache[iKey] = g_pVisCacheLRU.begin();
+
+		int iMaxRows = MAX(holylib_viscache_size.GetInt(), 1);
+		while ((int)g_pVisCacheLRU.size() > iMaxRows)
+		{
+			g_pVisCache.erase(g_pVisCacheLRU.back().iKey);
+			g_pVisCacheLRU.pop_back();
+		}
+	}
+	g_pVisCacheMutex.Unlock();
+
+	return pVisRow;
+}
+
+Util::CVisRow Util::CM_Vis(const Vector& orig, int iType)
+{
+	return Util::GetVisRow(Util::engineserver->GetClusterForOrigin(orig), iType);
 }
 
 static Symbols::CBaseEntity_CalcAbsolutePosition func_CBaseEntity_CalcAbsolutePosition;
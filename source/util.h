@@ -5,6 +5,8 @@
 #include "vprof.h"
 #include <unordered_map>
 #include <algorithm>
+#include <memory>
+#include <list>
 
 #define DEDICATED
 #include "vstdlib/jobthread.h"
@@ -87,6 +89,12 @@ namespace Util
 		g_Lua->SetField(-2, pName);
 	}
 
+	inline void SetStatsField(GarrysMod::Lua::ILuaInterface* LUA, const char* pName, double flValue) // Sets a number field of the table on top of the stack.
+	{
+		LUA->PushNumber(flValue);
+		LUA->SetField(-2, pName);
+	}
+
 	// Gmod's functions:
 	extern CBasePlayer* Get_Player(int iStackPos, bool unknown);
 	extern CBaseEntity* Get_Entity(int iStackPos, bool unknown);
@@ -111,11 +119,29 @@ namespace Util
 	extern CBaseClient* GetClientByIndex(int index);
 	extern std::vector<CBaseClient*> GetClients();
 	extern CBasePlayer* GetPlayerByClient(CBaseClient* client);
-	extern void CM_Vis(const Vector& orig, int type);
-	extern void ResetClusers();
 	extern bool ShouldLoad();
-	#define MAX_MAP_LEAFS 65536
-	extern byte g_pCurrentCluster[MAX_MAP_LEAFS / 8];
+
+	/*
+	 * A decompressed PVS / PAS row of a cluster.
+	 * The row is shared with the vis cache and stays valid as long as you hold it, even if the cache evicted it.
+	 * This makes it safe to use from worker threads.
+	 */
+	class CVisRow
+	{
+	public:
+		inline const byte* Data() const { return m_pRow ? m_pRow->data() : NULL; };
+		inline int Size() const { return m_pRow ? (int)m_pRow->size() : 0; };
+		inline bool IsClusterVisible(int iCluster) const
+		{
+			return iCluster >= 0 && (iCluster >> 3) < Size() && (Data()[iCluster >> 3] & (1 << (iCluster & 7))) != 0;
+		}
+
+		std::shared_ptr<const std::vector<byte>> m_pRow;
+	};
+
+	extern CVisRow GetVisRow(int iCluster, int iType); // iType = DVIS_PVS / DVIS_PAS
+	extern CVisRow CM_Vis(const Vector& orig, int iType);
+	extern void ResetVisCache(); // Called on map change.
 
 	inline void StartThreadPool(IThreadPool* pool, ThreadPoolStartParams_t& startParams)
 	{
@@ -230,4 +256,5 @@ extern EntityList g_pGlobalEntityList;
 
 extern bool Is_EntityList(int iStackPos);
 extern EntityList* Get_EntityList(int iStackPos, bool bError);
-extern void UpdateGlobalEntityList();
\ No newline at end of file
+extern void UpdateGlobalEntityList();
+extern bool PushEntitiesInClusters(const Util::CVisRow& pVis); // Pushes a table with all entities inside the visible clusters. Returns false if the cluster index is disabled.
\ No newline at end of file